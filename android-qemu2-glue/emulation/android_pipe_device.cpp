@@ -138,6 +138,10 @@ static const GoldfishPipeServiceOps goldfish_pipe_service_ops = {
         [](GoldfishHostPipe* hostPipe, GoldfishPipeWakeFlags wakeFlags) {
             android_pipe_guest_wake_on(hostPipe, static_cast<int>(wakeFlags));
         },
+        // guest_is_thread_safe()
+        [](GoldfishHostPipe* hostPipe) -> bool {
+            return android_pipe_guest_is_thread_safe(hostPipe);
+        },
         // dma_add_buffer()
         [](void* pipe, uint64_t paddr, uint64_t sz) {
             android_goldfish_dma_ops.add_buffer(pipe, paddr, sz);
@@ -183,6 +187,12 @@ static const AndroidPipeHwFuncs android_pipe_hw_funcs = {
                     static_cast<GoldfishHwPipe*>(hwPipe),
                     static_cast<GoldfishPipeWakeFlags>(flags));
         },
+        // queueWake()
+        [](void* hwPipe, unsigned flags) {
+            goldfish_pipe_queue_wake(
+                    static_cast<GoldfishHwPipe*>(hwPipe),
+                    static_cast<GoldfishPipeWakeFlags>(flags));
+        },
 };
 
 bool qemu_android_pipe_init(android::VmLock* vmLock) {
@@ -203,6 +203,16 @@ static std::string getNthParentDir(const char* path, size_t n) {
     return PathUtils::recompose(dir);
 }
 
+// Whether |dir| holds the VM state of snapshot |name|, as saved by
+// save_vmstate_to_dir().
+static bool hasSnapshotFiles(const char* dir, const char* name) {
+    if (!dir) {
+        return false;
+    }
+    return path_is_regular(PathUtils::join(dir, name, "ram.bin").c_str()) &&
+           path_is_regular(PathUtils::join(dir, name, "devices.bin").c_str());
+}
+
 /* generate parameters for each partition by type.
  * Param:
  *  args - array to hold parameters for qemu
@@ -493,6 +503,20 @@ extern "C" int main(int argc, char **argv) {
 
     /** SNAPSHOT STORAGE HANDLING */
 
+    /* QEMU2 snapshots are kept in the AVD directory rather than in a
+     * snapshot storage file, so they can be loaded without one. QEMU does
+     * not start the VM when -loadvm fails, so only ask for a snapshot that
+     * is there, and cold boot otherwise.
+     */
+    if (opts->snapshot && !opts->no_snapshot && !opts->no_snapshot_load &&
+        (hasSnapshotFiles(PathUtils::join(avdInfo_getContentPath(avd),
+                                          "snapshots").c_str(),
+                          opts->snapshot) ||
+         hasSnapshotFiles(opts->snapshot_base, opts->snapshot))) {
+        args[n++] = "-loadvm";
+        args[n++] = ASTRDUP(opts->snapshot);
+    }
+
     /* If we have a valid snapshot storage path */
 
     if (opts->snapstorage) {
@@ -503,11 +527,6 @@ extern "C" int main(int argc, char **argv) {
         * they can change from one invokation to the next and don't really
         * correspond to the hardware configuration itself.
         */
-        if (!opts->no_snapshot_load) {
-            args[n++] = "-loadvm";
-            args[n++] = ASTRDUP(opts->snapshot);
-        }
-
         if (!opts->no_snapshot_save) {
             args[n++] = "-savevm-on-exit";
             args[n++] = ASTRDUP(opts->snapshot);
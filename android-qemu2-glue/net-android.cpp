@@ -63,3 +63,8 @@ void android_qemu_init_slirp_shapers(void)
                                    (void*)data, len, s_opaque);
             });
 }
+
+void android_qemu_start_slirp_threads(void)
+{
+    net_slirp_start_threads();
+}
@@ -17,4 +17,8 @@ ANDROID_BEGIN_HEADER
 
 void android_qemu_init_slirp_shapers(void);
 
+// Run slirp on its own thread, see net_slirp_start_threads(). The shapers
+// stay in the main loop, with the NIC.
+void android_qemu_start_slirp_threads(void);
+
 ANDROID_END_HEADER
@@ -98,6 +98,9 @@ bool qemu_android_emulation_setup() {
         return false;
     }
 
+    // Now that the proxy is known, see if slirp can leave the main loop.
+    android_qemu_start_slirp_threads();
+
     return android_emulation_setup(&consoleAgents);
 }
 
@@ -14,17 +14,20 @@
 
 #include "android-qemu2-glue/qemu-control-impl.h"
 
+#include "android/avd/info.h"
+#include "android/cmdline-option.h"
 #include "android/emulation/control/callbacks.h"
 #include "android/emulation/control/vm_operations.h"
+#include "android/globals.h"
 
 #include "qemu/osdep.h"
+#include "block/snapshot.h"
+#include "qapi/error.h"
 #include "sysemu/sysemu.h"
 
 #include <stdlib.h>
 #include <string.h>
 
-// TODO(zyy@): implement the VM snapshots support
-
 static bool qemu_vm_stop() {
     vm_stop(RUN_STATE_DEBUG);
     return true;
@@ -39,50 +42,140 @@ static bool qemu_vm_is_running() {
     return runstate_is_running() != 0;
 }
 
+// The snapshots are kept with the other files of the AVD, one directory
+// each, see save_vmstate_to_dir(). Their disk state is in the qcow2 images.
+static char* qemu_snapshots_dir() {
+    return g_build_filename(avdInfo_getContentPath(android_avdInfo),
+                            "snapshots", NULL);
+}
+
+// Snapshots may also be loaded from a directory given with -snapshot-base,
+// that many AVDs share. Their RAM files are only mapped copy-on-write (see
+// ram_load_from_file()), so the VMs that load a snapshot from there share,
+// through the page cache, every page they did not write to. Nothing is
+// ever written there: saving a snapshot of the same name puts it in the
+// AVD, where it takes precedence.
+static const char* qemu_snapshots_base_dir() {
+    return android_cmdLineOptions ? android_cmdLineOptions->snapshot_base
+                                  : NULL;
+}
+
+static bool qemu_snapshot_exists_in(const char* dir_path, const char* name) {
+    char* path = g_build_filename(dir_path, name, NULL);
+    const bool res = g_file_test(path, G_FILE_TEST_IS_DIR);
+    g_free(path);
+    return res;
+}
+
+// Return the directory to load snapshot |name| from.
+static char* qemu_snapshot_load_dir(const char* name) {
+    char* dir = qemu_snapshots_dir();
+    const char* base_dir = qemu_snapshots_base_dir();
+    if (base_dir && !qemu_snapshot_exists_in(dir, name) &&
+        qemu_snapshot_exists_in(base_dir, name)) {
+        g_free(dir);
+        dir = g_strdup(base_dir);
+    }
+    return dir;
+}
+
+static void qemu_report_error(Error* err,
+                              void* opaque,
+                              LineConsumerCallback errConsumer) {
+    char* line = g_strdup_printf("%s\n", error_get_pretty(err));
+    errConsumer(opaque, line, strlen(line));
+    g_free(line);
+    error_free(err);
+}
+
+// List the snapshots in |dir_path| that are not in |skip_dir_path| too.
+static void qemu_snapshot_list_dir(const char* dir_path,
+                                   const char* skip_dir_path,
+                                   void* opaque,
+                                   LineConsumerCallback outConsumer) {
+    GDir* dir = g_dir_open(dir_path, 0, NULL);
+    if (!dir) {
+        return;
+    }
+    const char* name;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        BlockDriverState* bs;
+        // Skip what is left of snapshots deleted from the disks.
+        if (qemu_snapshot_exists_in(dir_path, name) &&
+            !(skip_dir_path && qemu_snapshot_exists_in(skip_dir_path, name)) &&
+            bdrv_all_find_snapshot(name, &bs) >= 0) {
+            char* line = g_strdup_printf("%s\n", name);
+            outConsumer(opaque, line, strlen(line));
+            g_free(line);
+        }
+    }
+    g_dir_close(dir);
+}
+
 static bool qemu_snapshot_list(void* opaque,
                                LineConsumerCallback outConsumer,
                                LineConsumerCallback errConsumer) {
-//    Monitor* out = monitor_fake_new(opaque, outConsumer);
-//    Monitor* err = monitor_fake_new(opaque, errConsumer);
-//    do_info_snapshots(out, err);
-//    int ret = monitor_fake_get_bytes(err);
-//    monitor_fake_free(err);
-//    monitor_fake_free(out);
-//    return !ret;
-    return false;
+    char* dir_path = qemu_snapshots_dir();
+    const char* base_dir = qemu_snapshots_base_dir();
+    qemu_snapshot_list_dir(dir_path, NULL, opaque, outConsumer);
+    if (base_dir) {
+        qemu_snapshot_list_dir(base_dir, dir_path, opaque, outConsumer);
+    }
+    g_free(dir_path);
+    return true;
 }
 
 static bool qemu_snapshot_save(const char* name,
                                void* opaque,
                                LineConsumerCallback errConsumer) {
-    //Monitor* err = monitor_fake_new(opaque, errConsumer);
-    //do_savevm(err, name);
-    //int ret = monitor_fake_get_bytes(err);
-    //monitor_fake_free(err);
-    //return !ret;
-    return false;
+    Error* err = NULL;
+    char* dir = qemu_snapshots_dir();
+    int ret = save_vmstate_to_dir(dir, name, &err);
+    g_free(dir);
+    if (ret < 0) {
+        qemu_report_error(err, opaque, errConsumer);
+        return false;
+    }
+    return true;
 }
 
 static bool qemu_snapshot_load(const char* name,
                                void* opaque,
                                LineConsumerCallback errConsumer) {
-    //Monitor* err = monitor_fake_new(opaque, errConsumer);
-    //do_loadvm(err, name);
-    //int ret = monitor_fake_get_bytes(err);
-    //monitor_fake_free(err);
-    //return !ret;
-    return false;
+    Error* err = NULL;
+    char* dir = qemu_snapshot_load_dir(name);
+    // Keep the VM running if the snapshot cannot be loaded at all.
+    if (check_vmstate_in_dir(dir, name, &err) < 0) {
+        g_free(dir);
+        qemu_report_error(err, opaque, errConsumer);
+        return false;
+    }
+    const bool was_running = runstate_is_running();
+    vm_stop(RUN_STATE_RESTORE_VM);
+    int ret = load_vmstate_from_dir(dir, name, &err);
+    g_free(dir);
+    if (ret < 0) {
+        qemu_report_error(err, opaque, errConsumer);
+        return false;
+    }
+    if (was_running) {
+        vm_start();
+    }
+    return true;
 }
 
 static bool qemu_snapshot_delete(const char* name,
                                  void* opaque,
                                  LineConsumerCallback errConsumer) {
-    //Monitor* err = monitor_fake_new(opaque, errConsumer);
-    //do_delvm(err, name);
-    //int ret = monitor_fake_get_bytes(err);
-    //monitor_fake_free(err);
-    //return !ret;
-    return false;
+    Error* err = NULL;
+    char* dir = qemu_snapshots_dir();
+    int ret = delete_vmstate_from_dir(dir, name, &err);
+    g_free(dir);
+    if (ret < 0) {
+        qemu_report_error(err, opaque, errConsumer);
+        return false;
+    }
+    return true;
 }
 
 static const QAndroidVmOperations sQAndroidVmOperations = {
@@ -183,6 +183,8 @@ LOCAL_C_INCLUDES := \
 
 LOCAL_SRC_FILES := \
     android/base/synchronization/Lock_benchmark.cpp \
+    android/camera/camera-format-converters.c \
+    android/camera/camera-format-converters_benchmark.cpp \
 
 LOCAL_STATIC_LIBRARIES := android-emu-base
 
@@ -244,10 +246,12 @@ LOCAL_SRC_FILES := \
     android/base/sockets/SocketDrainer.cpp \
     android/base/threads/internal/ParallelTaskBase.cpp \
     android/boot-properties.c \
+    android/camera/camera-capture-remote.cpp \
     android/camera/camera-common.cpp \
     android/camera/camera-list.cpp \
     android/camera/camera-service.c \
     android/camera/camera-format-converters.c \
+    android/camera/RemoteCameraSource.cpp \
     android/cmdline-option.c \
     android/console.c \
     android/console_auth.cpp \
@@ -319,6 +323,7 @@ LOCAL_SRC_FILES := \
     android/hw-qemud.cpp \
     android/hw-sensors.c \
     android/jpeg-compress.c \
+    android/jpeg-decompress.c \
     android/kernel/kernel_utils.cpp \
     android/loadpng.c \
     android/main-common.c \
@@ -354,11 +359,15 @@ LOCAL_SRC_FILES := \
     android/opengl/gpuinfo.cpp \
     android/opengl/logger.cpp \
     android/opengl/OpenglEsPipe.cpp \
+    android/opengl/transport_stats.cpp \
     android/opengles.cpp \
     android/remote_input_server.cpp \
+    android/remoteinput/InputLatencyTracer.cpp \
     android/remoteinput/RemoteInputListener.cpp \
     android/remoteinput/RemoteInputDataHandler.cpp \
     android/remoteinput/RemoteInputDataConnection.cpp \
+    android/remoteinput/RemoteInputInjector.cpp \
+    android/remoteinput/RemoteInputProtocol.cpp \
     android/openssl-support.cpp \
     android/process_setup.cpp \
     android/protobuf/DelimitedSerialization.cpp \
@@ -540,6 +549,8 @@ LOCAL_SRC_FILES := \
   android/base/Uri_unittest.cpp \
   android/base/Uuid_unittest.cpp \
   android/base/Version_unittest.cpp \
+  android/camera/camera-format-converters_unittest.cpp \
+  android/camera/RemoteCameraSource_unittest.cpp \
   android/cmdline-option_unittest.cpp \
   android/console_auth_unittest.cpp \
   android/emulation/AdbDebugPipe_unittest.cpp \
@@ -586,10 +597,15 @@ LOCAL_SRC_FILES := \
   android/opengl/emugl_config_unittest.cpp \
   android/opengl/GpuFrameBridge_unittest.cpp \
   android/opengl/gpuinfo_unittest.cpp \
+  android/opengl/transport_stats_unittest.cpp \
   android/proxy/proxy_common_unittest.cpp \
   android/proxy/ProxyUtils_unittest.cpp \
   android/qt/qt_path_unittest.cpp \
   android/qt/qt_setup_unittest.cpp \
+  android/remoteinput/InputLatencyTracer_unittest.cpp \
+  android/remoteinput/RemoteInputInjector_unittest.cpp \
+  android/remoteinput/RemoteInputProtocol_unittest.cpp \
+  android/shaper_unittest.cpp \
   android/telephony/gsm_unittest.cpp \
   android/telephony/modem_unittest.cpp \
   android/telephony/sms_unittest.cpp \
@@ -642,6 +658,32 @@ $(call local-link-static-c++lib)
 
 $(call end-emulator-program)
 
+###############################################################################
+#
+#  android-emu benchmarks
+#
+#  For the parts of android-emu above android-emu-base.
+#
+
+$(call start-emulator-benchmark,android_emu_lib$(BUILD_TARGET_SUFFIX)_benchmark)
+
+LOCAL_C_INCLUDES += \
+    $(ANDROID_EMU_INCLUDES) \
+    $(EMULATOR_COMMON_INCLUDES) \
+
+LOCAL_LDLIBS += \
+    $(ANDROID_EMU_LDLIBS) \
+
+LOCAL_SRC_FILES := \
+    android/emulation/AdbGuestPipe_benchmark.cpp \
+    android/emulation/testing/TestAndroidPipeDevice.cpp \
+    android/shaper_benchmark.cpp \
+
+LOCAL_STATIC_LIBRARIES += \
+    $(ANDROID_EMU_STATIC_LIBRARIES) \
+
+$(call end-emulator-benchmark)
+
 ###############################################################################
 #
 #  android-emu-metrics unit tests
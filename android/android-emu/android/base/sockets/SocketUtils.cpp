@@ -21,6 +21,7 @@
 #include "android/base/sockets/Winsock.h"
 #else
 #  include <sys/socket.h>
+#  include <sys/uio.h>
 #  include <unistd.h>
 #  include <fcntl.h>
 #  include <netdb.h>
@@ -30,6 +31,7 @@
 #  include <netinet/tcp.h>
 #endif
 
+#include <algorithm>
 #include <vector>
 
 #include <stdlib.h>
@@ -496,6 +498,69 @@ ssize_t socketSend(int socket, const void* buffer, size_t bufferLen) {
     return ret;
 }
 
+ssize_t socketRecvV(int socket, const SocketBuffer* buffers, int count) {
+    errno = 0;
+    count = std::min(count, kSocketBuffersMax);
+#ifdef _WIN32
+    WSABUF bufs[kSocketBuffersMax];
+    for (int n = 0; n < count; ++n) {
+        bufs[n].buf = static_cast<char*>(buffers[n].data);
+        bufs[n].len = static_cast<ULONG>(buffers[n].size);
+    }
+    DWORD received = 0;
+    DWORD flags = 0;
+    int ret = ::WSARecv(socket, bufs, count, &received, &flags, NULL, NULL);
+    ON_SOCKET_ERROR_RETURN_M1(ret);
+    return static_cast<ssize_t>(received);
+#else
+    struct iovec iov[kSocketBuffersMax];
+    for (int n = 0; n < count; ++n) {
+        iov[n].iov_base = buffers[n].data;
+        iov[n].iov_len = buffers[n].size;
+    }
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    ssize_t ret = HANDLE_EINTR(::recvmsg(socket, &msg, 0));
+    ON_SOCKET_ERROR_RETURN_M1(ret);
+    return ret;
+#endif
+}
+
+ssize_t socketSendV(int socket, const SocketBuffer* buffers, int count) {
+    errno = 0;
+    count = std::min(count, kSocketBuffersMax);
+#ifdef _WIN32
+    WSABUF bufs[kSocketBuffersMax];
+    for (int n = 0; n < count; ++n) {
+        bufs[n].buf = static_cast<char*>(buffers[n].data);
+        bufs[n].len = static_cast<ULONG>(buffers[n].size);
+    }
+    DWORD sent = 0;
+    int ret = ::WSASend(socket, bufs, count, &sent, 0, NULL, NULL);
+    ON_SOCKET_ERROR_RETURN_M1(ret);
+    return static_cast<ssize_t>(sent);
+#else
+    struct iovec iov[kSocketBuffersMax];
+    for (int n = 0; n < count; ++n) {
+        iov[n].iov_base = buffers[n].data;
+        iov[n].iov_len = buffers[n].size;
+    }
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+#ifdef MSG_NOSIGNAL
+    // See socketSend() above.
+    const int sendFlags = MSG_NOSIGNAL;
+#else
+    const int sendFlags = 0;
+#endif
+    ssize_t ret = HANDLE_EINTR(::sendmsg(socket, &msg, sendFlags));
+    ON_SOCKET_ERROR_RETURN_M1(ret);
+    return ret;
+#endif
+}
+
 bool socketSendAll(int socket, const void* buffer, size_t bufferLen) {
     auto buf = static_cast<const char*>(buffer);
     while (bufferLen > 0) {
@@ -33,6 +33,24 @@ ssize_t socketRecv(int socket, void* buffer, size_t bufferLen);
 // writing to a broken pipe (but errno will be set to EPIPE).
 ssize_t socketSend(int socket, const void* buffer, size_t bufferLen);
 
+// A buffer of socketRecvV() or socketSendV().
+struct SocketBuffer {
+    void* data;
+    size_t size;
+};
+
+// Maximum number of buffers used by a single socketRecvV() or socketSendV()
+// call, any buffer past this count is ignored.
+static const int kSocketBuffersMax = 16;
+
+// Same as socketRecv(), but scatter the bytes received into the |count|
+// buffers of |buffers|, in order, with a single system call.
+ssize_t socketRecvV(int socket, const SocketBuffer* buffers, int count);
+
+// Same as socketSend(), but gather the bytes sent from the |count|
+// buffers of |buffers|, in order, with a single system call.
+ssize_t socketSendV(int socket, const SocketBuffer* buffers, int count);
+
 // Same as socketSend() but loop around transient writes.
 // Returns true if all bytes were sent, false otherwise.
 bool socketSendAll(int socket, const void* buffer, size_t bufferLen);
@@ -62,6 +62,31 @@ TEST(SocketUtils, socketRecvAll) {
     socketClose(sock[0]);
 }
 
+TEST(SocketUtils, socketSendVAndRecvV) {
+    char kData[] = "Hello World!";
+    const size_t kDataLen = sizeof(kData) - 1U;
+
+    int sock[2];
+    ASSERT_EQ(0, socketCreatePair(&sock[0], &sock[1]));
+
+    const SocketBuffer out[3] = {
+            {&kData[0], 5}, {&kData[5], 0}, {&kData[5], kDataLen - 5}};
+    EXPECT_EQ(static_cast<ssize_t>(kDataLen), socketSendV(sock[0], out, 3));
+
+    char data[kDataLen] = {};
+    const SocketBuffer in[2] = {{&data[0], 1}, {&data[1], kDataLen - 1}};
+    EXPECT_EQ(static_cast<ssize_t>(kDataLen), socketRecvV(sock[1], in, 2));
+    for (size_t n = 0; n < kDataLen; ++n) {
+        EXPECT_EQ(kData[n], data[n]) << "#" << n;
+    }
+
+    // End of stream.
+    socketClose(sock[0]);
+    EXPECT_EQ(0, socketRecvV(sock[1], in, 2));
+
+    socketClose(sock[1]);
+}
+
 TEST(SocketUtils, socketGetPort) {
     ScopedSocket s0;
     // Find a free TCP IPv4 port and bind to it.
@@ -20,10 +20,13 @@
 #ifdef _WIN32
 #include <windows.h>
 #else
+#include <errno.h>
 #include <pthread.h>
+#include <time.h>
 #endif
 
 #include <assert.h>
+#include <stdint.h>
 
 namespace android {
 namespace base {
@@ -51,6 +54,11 @@ public:
         wait(&userLock->mLock);
     }
 
+    bool timedWait(AutoLock* userLock, uint64_t timeoutUs) {
+        assert(userLock->mLocked);
+        return timedWait(&userLock->mLock, timeoutUs);
+    }
+
 #ifdef _WIN32
 
     ConditionVariable() {
@@ -74,6 +82,16 @@ public:
         ::SleepConditionVariableSRW(&mCond, &userLock->mLock, INFINITE, 0);
     }
 
+    // Like wait(), but give up after |timeoutUs| microseconds. Return false
+    // on timeout. The same loop is needed, with the remaining time.
+    bool timedWait(Lock* userLock, uint64_t timeoutUs) {
+        // Round up, so that the wait is never shorter than asked.
+        const uint64_t timeoutMs = (timeoutUs + 999) / 1000;
+        return ::SleepConditionVariableSRW(
+                &mCond, &userLock->mLock,
+                timeoutMs < INFINITE ? (DWORD)timeoutMs : INFINITE - 1, 0);
+    }
+
     // Signal that a condition was reached. This will wake at least (and
     // preferrably) one waiting thread that is blocked on wait().
     void signal() {
@@ -104,6 +122,17 @@ private:
         pthread_cond_wait(&mCond, &userLock->mLock);
     }
 
+    bool timedWait(Lock* userLock, uint64_t timeoutUs) {
+        // pthread_cond_t uses the realtime clock by default.
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        const uint64_t nsec = deadline.tv_nsec + (timeoutUs % 1000000) * 1000;
+        deadline.tv_sec += timeoutUs / 1000000 + nsec / 1000000000;
+        deadline.tv_nsec = nsec % 1000000000;
+        return pthread_cond_timedwait(&mCond, &userLock->mLock, &deadline) !=
+               ETIMEDOUT;
+    }
+
     void signal() {
         pthread_cond_signal(&mCond);
     }
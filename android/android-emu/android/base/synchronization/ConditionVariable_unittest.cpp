@@ -17,6 +17,8 @@
 #include "android/base/synchronization/Lock.h"
 #include "android/base/testing/TestThread.h"
 
+#include "android/base/system/System.h"
+
 #include <gtest/gtest.h>
 
 #include <vector>
@@ -33,6 +35,15 @@ TEST(ConditionVariable, initAndSignal) {
     cond.signal();
 }
 
+TEST(ConditionVariable, timedWaitTimeout) {
+    ConditionVariable cond;
+    Lock lock;
+    AutoLock autoLock(lock);
+    const auto start = System::get()->getHighResTimeUs();
+    EXPECT_FALSE(cond.timedWait(&autoLock, 10000));
+    EXPECT_LE(start + 10000, System::get()->getHighResTimeUs());
+}
+
 struct TestThreadParams {
     TestThreadParams() : mutex(), cv(), counter(0) { }
     Lock mutex;
@@ -65,6 +76,19 @@ static void* testThreadFunctionAutoLockWait(void* param) {
     return NULL;
 }
 
+static void* testThreadFunctionTimedWait(void* param) {
+    TestThreadParams* p = static_cast<TestThreadParams*>(param);
+
+    AutoLock lock(p->mutex);
+
+    while (p->counter == 0) {
+        // Long enough to never time out.
+        EXPECT_TRUE(p->cv.timedWait(&lock, 60 * 1000 * 1000));
+    }
+
+    return NULL;
+}
+
 
 TEST(ConditionVariable, basicWaitSignal) {
     TestThreadParams p;
@@ -96,6 +120,21 @@ TEST(ConditionVariable, autoLockWaitSignal) {
     EXPECT_EQ(p.counter, 1);
 }
 
+TEST(ConditionVariable, timedWaitSignal) {
+    TestThreadParams p;
+
+    TestThread testThread(testThreadFunctionTimedWait, &p);
+
+    p.mutex.lock();
+    p.counter++;
+    p.cv.signal();
+    p.mutex.unlock();
+
+    testThread.join();
+
+    EXPECT_EQ(p.counter, 1);
+}
+
 TEST(ConditionVariable, basicWaitBroadcast) {
     TestThreadParams p;
 
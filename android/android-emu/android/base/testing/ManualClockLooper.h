@@ -0,0 +1,54 @@
+// Copyright 2017 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#pragma once
+
+#include "android/base/async/DefaultLooper.h"
+
+namespace android {
+namespace base {
+
+// A looper whose clocks only move when told to, so that its timers expire
+// as fast as a test or a benchmark runs them. All the clocks are the same
+// one, as DefaultLooper only has the host clock.
+class ManualClockLooper : public DefaultLooper {
+public:
+    Duration nowMs(ClockType clockType = ClockType::kHost) override {
+        return mNowMs;
+    }
+
+    DurationNs nowNs(ClockType clockType = ClockType::kHost) override {
+        return (DurationNs)mNowMs * 1000000ULL;
+    }
+
+    Looper::Timer* createTimer(Looper::Timer::Callback callback,
+                               void* opaque,
+                               ClockType clock = ClockType::kHost) override {
+        return DefaultLooper::createTimer(callback, opaque, ClockType::kHost);
+    }
+
+    // Moves the clocks forward, and fires the timers that expire, without
+    // waiting for anything like runOneIterationWithDeadlineMs() does.
+    void advanceMs(Duration ms) {
+        mNowMs += ms;
+        Timer* timer;
+        while ((timer = mActiveTimers.front()) && timer->deadline() <= mNowMs) {
+            timer->stop();
+            timer->fire();
+        }
+    }
+
+private:
+    Duration mNowMs = 1;
+};
+
+}  // namespace base
+}  // namespace android
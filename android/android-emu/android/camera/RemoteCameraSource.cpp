@@ -0,0 +1,398 @@
+// Copyright (C) 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "android/camera/RemoteCameraSource.h"
+
+#include "android/base/sockets/SocketUtils.h"
+#include "android/base/sockets/SocketWaiter.h"
+#include "android/camera/camera-format-converters.h"
+#include "android/jpeg-decompress.h"
+#include "android/utils/debug.h"
+#include "android/utils/misc.h"
+
+#include <utility>
+
+#include <errno.h>
+#include <string.h>
+
+#define  W(...)    dwarning(__VA_ARGS__)
+#define  D(...)    VERBOSE_PRINT(camera,__VA_ARGS__)
+
+namespace android {
+namespace camera {
+
+using android::base::AutoLock;
+using android::base::FunctorThread;
+using android::base::SocketWaiter;
+
+namespace {
+
+uint32_t readLe32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+void writeLe32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+// Return the size of a frame in a raw pixel format, or 0 if the format
+// isn't supported.
+size_t rawFrameSize(uint32_t pixelFormat, int width, int height) {
+    const size_t pixels = (size_t)width * height;
+    switch (pixelFormat) {
+        case V4L2_PIX_FMT_RGB32:
+        case V4L2_PIX_FMT_BGR32:
+            return pixels * 4;
+        case V4L2_PIX_FMT_RGB24:
+        case V4L2_PIX_FMT_BGR24:
+            return pixels * 3;
+        case V4L2_PIX_FMT_RGB565:
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY:
+        case V4L2_PIX_FMT_YVYU:
+        case V4L2_PIX_FMT_VYUY:
+            return pixels * 2;
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21:
+            return pixels * 3 / 2;
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_YVU420: {
+            const int yStride = align(width, 16);
+            const int uvStride = align(yStride / 2, 16);
+            return (size_t)(yStride + uvStride) * height;
+        }
+        default:
+            return 0;
+    }
+}
+
+}  // namespace
+
+RemoteCameraSource::RemoteCameraSource() = default;
+
+RemoteCameraSource::~RemoteCameraSource() {
+    stop();
+}
+
+bool RemoteCameraSource::start(int port) {
+    stop();
+    mServer.reset(base::socketTcp4AnyServer(port));
+    if (!mServer.valid()) {
+        W("Cannot listen to the remote camera client on port %d: %s", port,
+          strerror(errno));
+        return false;
+    }
+    base::socketSetNonBlocking(mServer.get());
+
+    int wakeRead, wakeWrite;
+    if (base::socketCreatePair(&wakeRead, &wakeWrite) < 0) {
+        mServer.close();
+        return false;
+    }
+    mWakeRead.reset(wakeRead);
+    mWakeWrite.reset(wakeWrite);
+
+    mThread.reset(new FunctorThread([this]() { threadMain(); }));
+    mThread->start();
+    return true;
+}
+
+void RemoteCameraSource::stop() {
+    if (!mThread) {
+        return;
+    }
+    const char wake = 0;
+    base::socketSend(mWakeWrite.get(), &wake, 1);
+    mThread->wait();
+    mThread.reset();
+
+    mServer.close();
+    mWakeRead.close();
+    mWakeWrite.close();
+    AutoLock lock(mLock);
+    mClient.close();
+    mHasLatest = false;
+}
+
+int RemoteCameraSource::port() const {
+    return mServer.valid() ? base::socketGetPort(mServer.get()) : -1;
+}
+
+void RemoteCameraSource::startCapturing(int width, int height) {
+    AutoLock lock(mLock);
+    mCapturing = true;
+    mWidth = width;
+    mHeight = height;
+    if (mHasLatest) {
+        mHasLatest = false;
+        mStats.dropped++;
+    }
+    sendControlLocked();
+    lock.unlock();
+    mDeliveredSinceStart = false;
+}
+
+void RemoteCameraSource::stopCapturing() {
+    AutoLock lock(mLock);
+    mCapturing = false;
+    if (mHasLatest) {
+        mHasLatest = false;
+        mStats.dropped++;
+    }
+    sendControlLocked();
+}
+
+int RemoteCameraSource::readFrame(ClientFrameBuffer* fbs,
+                                  int fbsNum,
+                                  float rScale,
+                                  float gScale,
+                                  float bScale,
+                                  float expComp) {
+    AutoLock lock(mLock);
+    if (!mCapturing) {
+        errno = EINVAL;
+        return -1;
+    }
+    const bool hasFrame = mHasLatest;
+    if (hasFrame) {
+        // The frame is ours until the next call, and the receiver thread
+        // gets the buffer of the previous one.
+        std::swap(mReading, mLatest);
+        mHasLatest = false;
+        mStats.delivered++;
+    }
+    const int width = mWidth;
+    const int height = mHeight;
+    lock.unlock();
+
+    if (!hasFrame) {
+        if (mDeliveredSinceStart) {
+            return 1;
+        }
+        // Nothing received yet, start with a black frame.
+        const int ySize = align(width, 16) * height;
+        mReading.pixelFormat = V4L2_PIX_FMT_YUV420;
+        mReading.width = width;
+        mReading.height = height;
+        mReading.pixels.assign(rawFrameSize(V4L2_PIX_FMT_YUV420, width, height),
+                               128);
+        memset(mReading.pixels.data(), 16, ySize);
+    }
+    mDeliveredSinceStart = true;
+    return convert_frame(mReading.pixels.data(), mReading.pixelFormat,
+                         mReading.pixels.size(), mReading.width,
+                         mReading.height, fbs, fbsNum, rScale, gScale, bScale,
+                         expComp) ? -1 : 0;
+}
+
+RemoteCameraSource::Stats RemoteCameraSource::stats() const {
+    AutoLock lock(mLock);
+    return mStats;
+}
+
+void RemoteCameraSource::threadMain() {
+    std::unique_ptr<SocketWaiter> waiter(SocketWaiter::create());
+    for (;;) {
+        // |mClient| only changes on this thread while it runs.
+        const int client = mClient.get();
+        waiter->reset();
+        waiter->update(mWakeRead.get(), SocketWaiter::kEventRead);
+        waiter->update(mServer.get(), SocketWaiter::kEventRead);
+        if (client >= 0) {
+            waiter->update(client, SocketWaiter::kEventRead);
+        }
+        if (waiter->wait(INT64_MAX) < 0) {
+            W("Remote camera: %s", strerror(errno));
+            break;
+        }
+        if (waiter->pendingEventsFor(mWakeRead.get())) {
+            break;
+        }
+        if (client >= 0 && waiter->pendingEventsFor(client) && !receive()) {
+            D("Remote camera client disconnected");
+            AutoLock lock(mLock);
+            mClient.close();
+        }
+        if (waiter->pendingEventsFor(mServer.get())) {
+            acceptClient();
+        }
+    }
+}
+
+void RemoteCameraSource::acceptClient() {
+    const int socket = base::socketAcceptAny(mServer.get());
+    if (socket < 0) {
+        return;
+    }
+    base::socketSetNonBlocking(socket);
+    base::socketSetNoDelay(socket);
+
+    AutoLock lock(mLock);
+    if (mClient.valid()) {
+        D("Remote camera client replaced by a new connection");
+    } else {
+        D("Remote camera client connected");
+    }
+    mClient.reset(socket);
+    mHeaderReceived = 0;
+    mPixelsReceived = 0;
+    // Tell it what to send right away.
+    sendControlLocked();
+}
+
+bool RemoteCameraSource::receive() {
+    const int client = mClient.get();
+    for (;;) {
+        ssize_t size;
+        if (mHeaderReceived < kFrameHeaderSize) {
+            size = base::socketRecv(client, mHeader + mHeaderReceived,
+                                    kFrameHeaderSize - mHeaderReceived);
+            if (size > 0) {
+                mHeaderReceived += size;
+                if (mHeaderReceived == kFrameHeaderSize && !startFrame()) {
+                    return false;
+                }
+            }
+        } else {
+            std::vector<uint8_t>& pixels = mReceiving.pixels;
+            size = base::socketRecv(client, pixels.data() + mPixelsReceived,
+                                    pixels.size() - mPixelsReceived);
+            if (size > 0) {
+                mPixelsReceived += size;
+            }
+        }
+        if (size == 0) {
+            return false;
+        }
+        if (size < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (mHeaderReceived == kFrameHeaderSize &&
+            mPixelsReceived == mReceiving.pixels.size()) {
+            mHeaderReceived = 0;
+            mPixelsReceived = 0;
+            onFrameReceived();
+            // Check stop() before the next frame.
+            return true;
+        }
+    }
+}
+
+bool RemoteCameraSource::startFrame() {
+    const uint32_t magic = readLe32(mHeader);
+    const uint32_t pixelFormat = readLe32(mHeader + 4);
+    const uint32_t width = readLe32(mHeader + 8);
+    const uint32_t height = readLe32(mHeader + 12);
+    const uint32_t size = readLe32(mHeader + 16);
+
+    if (magic != kRemoteCameraFrameMagic || width == 0 || height == 0 ||
+        width > (uint32_t)kRemoteCameraMaxDim ||
+        height > (uint32_t)kRemoteCameraMaxDim) {
+        W("Invalid remote camera frame header");
+        return false;
+    }
+    size_t expectedSize;
+    if (pixelFormat == V4L2_PIX_FMT_MJPEG) {
+        // An image larger than RGB32 pixels makes no sense.
+        expectedSize = size;
+        if (size == 0 || size > (size_t)width * height * 4) {
+            expectedSize = 0;
+        }
+    } else {
+        expectedSize = rawFrameSize(pixelFormat, width, height);
+    }
+    if (expectedSize == 0 || size != expectedSize) {
+        W("Invalid remote camera frame: %.4s %ux%u, %u bytes",
+          (const char*)&pixelFormat, width, height, size);
+        return false;
+    }
+
+    mReceiving.pixelFormat = pixelFormat;
+    mReceiving.width = width;
+    mReceiving.height = height;
+    mReceiving.pixels.resize(size);
+    return true;
+}
+
+void RemoteCameraSource::onFrameReceived() {
+    AutoLock lock(mLock);
+    mStats.received++;
+    if (!mCapturing || mReceiving.width != mWidth ||
+        mReceiving.height != mHeight) {
+        mStats.dropped++;
+        return;
+    }
+    lock.unlock();
+
+    Frame* frame = &mReceiving;
+    if (mReceiving.pixelFormat == V4L2_PIX_FMT_MJPEG) {
+        // Decode to YU12, the converters' native format.
+        const int width = mReceiving.width;
+        const int height = mReceiving.height;
+        const int yStride = align(width, 16);
+        const int uvStride = align(yStride / 2, 16);
+        mDecoded.pixelFormat = V4L2_PIX_FMT_YUV420;
+        mDecoded.width = width;
+        mDecoded.height = height;
+        mDecoded.pixels.resize(
+                rawFrameSize(V4L2_PIX_FMT_YUV420, width, height));
+        uint8_t* const y = mDecoded.pixels.data();
+        uint8_t* const u = y + yStride * height;
+        uint8_t* const v = u + uvStride * (height / 2);
+        if (jpeg_decompress_yuv420(mReceiving.pixels.data(),
+                                   mReceiving.pixels.size(), width, height, y,
+                                   yStride, u, v, uvStride)) {
+            D("Cannot decode a %dx%d remote camera frame", width, height);
+            lock.lock();
+            mStats.dropped++;
+            return;
+        }
+        frame = &mDecoded;
+    }
+
+    lock.lock();
+    // The capture may have changed while decoding.
+    if (!mCapturing || frame->width != mWidth || frame->height != mHeight) {
+        mStats.dropped++;
+        return;
+    }
+    if (mHasLatest) {
+        // The guest didn't read the previous one, it is stale now.
+        mStats.dropped++;
+    }
+    std::swap(*frame, mLatest);
+    mHasLatest = true;
+}
+
+void RemoteCameraSource::sendControlLocked() {
+    if (!mClient.valid()) {
+        return;
+    }
+    uint8_t control[kControlSize];
+    writeLe32(control, kRemoteCameraControlMagic);
+    writeLe32(control + 4, mCapturing ? 1 : 0);
+    writeLe32(control + 8, mCapturing ? mWidth : 0);
+    writeLe32(control + 12, mCapturing ? mHeight : 0);
+    if (base::socketSend(mClient.get(), control, sizeof(control)) !=
+        (ssize_t)sizeof(control)) {
+        W("Cannot send the capture command to the remote camera client");
+    }
+}
+
+}  // namespace camera
+}  // namespace android
@@ -0,0 +1,186 @@
+// Copyright (C) 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "android/base/Compiler.h"
+#include "android/base/sockets/ScopedSocket.h"
+#include "android/base/synchronization/Lock.h"
+#include "android/base/threads/FunctorThread.h"
+#include "android/camera/camera-common.h"
+
+#include <memory>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+namespace camera {
+
+// The format of the messages between a remote camera client and the
+// emulator, over a TCP connection.
+//
+// The client sends frames, each one as a header followed by its pixels:
+//
+//     u32 magic         kRemoteCameraFrameMagic
+//     u32 pixel format  One of the V4L2_PIX_FMT_ values below.
+//     u32 width
+//     u32 height
+//     u32 size          Number of bytes of pixels after the header.
+//
+// The pixels of the raw formats have the same layout as for the camera
+// format converters: RGB32, BGR32, RGB24, BGR24, RGB565, YUYV, UYVY, YVYU,
+// VYUY, NV12, NV21, and YU12 / YV12 with lines aligned to 16 bytes. A
+// V4L2_PIX_FMT_MJPEG frame is a YUV 4:2:0 JPEG image, as encoded by most
+// cameras and hardware encoders.
+//
+// The emulator tells the client what the guest captures with:
+//
+//     u32 magic         kRemoteCameraControlMagic
+//     u32 command       1 to start capturing, or 0 to stop.
+//     u32 width         Frame dimensions, when starting.
+//     u32 height
+//
+// Frames of other dimensions than the ones being captured are dropped, as
+// there is no scaling. All values are little-endian.
+static const uint32_t kRemoteCameraFrameMagic = 0x4d414352;    // 'RCAM'
+static const uint32_t kRemoteCameraControlMagic = 0x4c544352;  // 'RCTL'
+
+// Largest frame dimension accepted from a client.
+static const int kRemoteCameraMaxDim = 4096;
+
+// RemoteCameraSource receives the frames of a camera on a remote client,
+// e.g. the user of a cloud session, and hands them to the camera service
+// the same way a local capture device does.
+//
+// A thread receives the frames as soon as they arrive, and keeps only the
+// latest complete one: when the guest reads slower than the client sends,
+// the frames it didn't read are dropped rather than queued, so that it
+// always gets the freshest one. MJPEG frames are decoded by that thread
+// too. readFrame() then converts the latest frame straight to the guest's
+// video and preview frames, with one conversion each, and no copy.
+//
+// Only one client is served at a time, a new connection replaces the
+// previous one. Until the first frame arrives after startCapturing(),
+// readFrame() returns black frames, so that the guest's camera opens even
+// when the client doesn't send anything yet.
+//
+// start(), stop() and the destructor must be called from the same thread,
+// as well as the capture methods, which are called by the camera service
+// from the main loop.
+class RemoteCameraSource {
+public:
+    struct Stats {
+        // Frames received completely.
+        uint64_t received = 0;
+        // Frames converted for the guest.
+        uint64_t delivered = 0;
+        // Frames replaced by a newer one before the guest read them,
+        // received when not capturing, or with the wrong dimensions.
+        uint64_t dropped = 0;
+    };
+
+    RemoteCameraSource();
+    ~RemoteCameraSource();
+
+    // Listen to the clients on TCP |port| of all interfaces, 0 meaning any
+    // free port. Return false on error.
+    bool start(int port);
+
+    // Stop listening, and close the client connection.
+    void stop();
+
+    // Return the port listened to, or -1 if not started.
+    int port() const;
+
+    // Start capturing frames of |width| x |height| pixels, and tell the
+    // client. Frames received before are dropped.
+    void startCapturing(int width, int height);
+
+    // Stop capturing, and tell the client.
+    void stopCapturing();
+
+    // Convert the latest frame to the |fbsNum| framebuffers |fbs|, with the
+    // given white balance and exposure compensation. Return 0 on success, 1
+    // if there's no new frame since the last call, in which case the caller
+    // uses the frames it already has, or -1 on error.
+    int readFrame(ClientFrameBuffer* fbs,
+                  int fbsNum,
+                  float rScale,
+                  float gScale,
+                  float bScale,
+                  float expComp);
+
+    Stats stats() const;
+
+private:
+    struct Frame {
+        uint32_t pixelFormat = 0;
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> pixels;
+    };
+
+    static const size_t kFrameHeaderSize = 20;
+    static const size_t kControlSize = 16;
+
+    // The receiver thread.
+    void threadMain();
+    // Replace the client connection with a new one from the listen socket.
+    void acceptClient();
+    // Receive what the client sent so far. Return false to close the
+    // connection.
+    bool receive();
+    // Parse the frame header in |mHeader|, return false if invalid.
+    bool startFrame();
+    // Keep the frame just received in |mReceiving| as the latest one if the
+    // guest wants it.
+    void onFrameReceived();
+    // Send the current capture command to the client. Must be called with
+    // |mLock| held.
+    void sendControlLocked();
+
+    android::base::ScopedSocket mServer;
+    // Written to by stop() to wake the receiver thread.
+    android::base::ScopedSocket mWakeRead;
+    android::base::ScopedSocket mWakeWrite;
+    std::unique_ptr<android::base::FunctorThread> mThread;
+
+    // Only used by the receiver thread.
+    uint8_t mHeader[kFrameHeaderSize];
+    size_t mHeaderReceived = 0;
+    size_t mPixelsReceived = 0;
+    Frame mReceiving;
+    Frame mDecoded;
+
+    mutable android::base::Lock mLock;
+    // Protected by |mLock|.
+    android::base::ScopedSocket mClient;
+    Frame mLatest;
+    bool mHasLatest = false;
+    bool mCapturing = false;
+    int mWidth = 0;
+    int mHeight = 0;
+    Stats mStats;
+
+    // Only used by readFrame().
+    Frame mReading;
+    bool mDeliveredSinceStart = false;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(RemoteCameraSource);
+};
+
+}  // namespace camera
+}  // namespace android
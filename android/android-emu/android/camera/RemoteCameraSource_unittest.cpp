@@ -0,0 +1,240 @@
+// Copyright (C) 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "android/camera/RemoteCameraSource.h"
+
+#include "android/base/sockets/ScopedSocket.h"
+#include "android/base/sockets/SocketUtils.h"
+#include "android/base/system/System.h"
+#include "android/jpeg-compress.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+using android::base::ScopedSocket;
+using android::base::System;
+using android::camera::RemoteCameraSource;
+using android::camera::kRemoteCameraControlMagic;
+using android::camera::kRemoteCameraFrameMagic;
+
+namespace {
+
+const int kWidth = 32;
+const int kHeight = 16;
+
+void appendLe32(std::vector<uint8_t>* data, uint32_t value) {
+    for (int n = 0; n < 4; n++) {
+        data->push_back((uint8_t)(value >> (n * 8)));
+    }
+}
+
+// An NV21 frame where all the pixels have the same Y, U and V values.
+std::vector<uint8_t> flatNV21(uint8_t y, uint8_t u, uint8_t v) {
+    std::vector<uint8_t> pixels(kWidth * kHeight, y);
+    for (int n = 0; n < kWidth * kHeight / 4; n++) {
+        pixels.push_back(v);
+        pixels.push_back(u);
+    }
+    return pixels;
+}
+
+// A stand-in for the remote client.
+class RemoteCameraSourceTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_TRUE(mSource.start(0));
+        mClient.reset(android::base::socketTcp4LoopbackClient(mSource.port()));
+        ASSERT_TRUE(mClient.valid());
+        // Once the connection is accepted, the source tells what to capture,
+        // nothing yet.
+        EXPECT_EQ(0, recvCommand());
+    }
+
+    // Receives the next capture command, return its width, or 0 to stop.
+    int recvCommand() {
+        uint8_t control[16];
+        EXPECT_TRUE(android::base::socketRecvAll(mClient.get(), control,
+                                                 sizeof(control)));
+        uint32_t values[4];
+        memcpy(values, control, sizeof(values));
+        EXPECT_EQ(kRemoteCameraControlMagic, values[0]);
+        return values[1] ? (int)values[2] : 0;
+    }
+
+    void startCapturing() {
+        mSource.startCapturing(kWidth, kHeight);
+        EXPECT_EQ(kWidth, recvCommand());
+    }
+
+    void sendFrame(uint32_t pixelFormat,
+                   int width,
+                   int height,
+                   const std::vector<uint8_t>& pixels) {
+        std::vector<uint8_t> data;
+        appendLe32(&data, kRemoteCameraFrameMagic);
+        appendLe32(&data, pixelFormat);
+        appendLe32(&data, width);
+        appendLe32(&data, height);
+        appendLe32(&data, pixels.size());
+        data.insert(data.end(), pixels.begin(), pixels.end());
+        EXPECT_TRUE(android::base::socketSendAll(mClient.get(), data.data(),
+                                                 data.size()));
+    }
+
+    // Waits until the source has received |count| frames in total.
+    void waitForFrames(uint64_t count) {
+        for (int n = 0; n < 500 && mSource.stats().received < count; n++) {
+            System::get()->sleepMs(10);
+        }
+        ASSERT_EQ(count, mSource.stats().received);
+    }
+
+    // Reads a frame in RGB32, return the result of readFrame().
+    int readFrame(std::vector<uint32_t>* rgb) {
+        rgb->assign(kWidth * kHeight, 0);
+        ClientFrameBuffer fb = {V4L2_PIX_FMT_RGB32, rgb->data()};
+        return mSource.readFrame(&fb, 1, 1.0f, 1.0f, 1.0f, 1.0f);
+    }
+
+    RemoteCameraSource mSource;
+    ScopedSocket mClient;
+};
+
+}  // namespace
+
+TEST_F(RemoteCameraSourceTest, blackUntilFirstFrame) {
+    startCapturing();
+    std::vector<uint32_t> rgb;
+    EXPECT_EQ(0, readFrame(&rgb));
+    EXPECT_EQ(std::vector<uint32_t>(kWidth * kHeight, 0xff000000U), rgb);
+    // Nothing new.
+    EXPECT_EQ(1, readFrame(&rgb));
+    EXPECT_EQ(0U, mSource.stats().delivered);
+}
+
+TEST_F(RemoteCameraSourceTest, latestFrameWins) {
+    startCapturing();
+    sendFrame(V4L2_PIX_FMT_NV21, kWidth, kHeight, flatNV21(16, 128, 128));
+    sendFrame(V4L2_PIX_FMT_NV21, kWidth, kHeight, flatNV21(100, 128, 128));
+    sendFrame(V4L2_PIX_FMT_NV21, kWidth, kHeight, flatNV21(235, 128, 128));
+    waitForFrames(3);
+
+    std::vector<uint32_t> rgb;
+    EXPECT_EQ(0, readFrame(&rgb));
+    EXPECT_EQ(std::vector<uint32_t>(kWidth * kHeight, 0xffffffffU), rgb);
+    EXPECT_EQ(1, readFrame(&rgb));
+
+    const RemoteCameraSource::Stats stats = mSource.stats();
+    EXPECT_EQ(1U, stats.delivered);
+    EXPECT_EQ(2U, stats.dropped);
+}
+
+TEST_F(RemoteCameraSourceTest, dropsFramesNotCaptured) {
+    // Before capturing.
+    sendFrame(V4L2_PIX_FMT_NV21, kWidth, kHeight, flatNV21(235, 128, 128));
+    waitForFrames(1);
+    startCapturing();
+    // With other dimensions.
+    sendFrame(V4L2_PIX_FMT_NV21, kWidth / 2, kHeight / 2,
+              std::vector<uint8_t>(kWidth * kHeight * 3 / 8, 235));
+    waitForFrames(2);
+
+    std::vector<uint32_t> rgb;
+    EXPECT_EQ(0, readFrame(&rgb));
+    EXPECT_EQ(std::vector<uint32_t>(kWidth * kHeight, 0xff000000U), rgb);
+    EXPECT_EQ(2U, mSource.stats().dropped);
+    EXPECT_EQ(0U, mSource.stats().delivered);
+}
+
+TEST_F(RemoteCameraSourceTest, convertsToAllFramebuffers) {
+    startCapturing();
+    std::vector<uint8_t> rgb32(kWidth * kHeight * 4);
+    for (size_t n = 0; n < rgb32.size(); n += 4) {
+        rgb32[n] = 0xff;
+        rgb32[n + 3] = 0xff;
+    }
+    sendFrame(V4L2_PIX_FMT_RGB32, kWidth, kHeight, rgb32);
+    waitForFrames(1);
+
+    std::vector<uint8_t> preview(rgb32.size());
+    std::vector<uint8_t> video(kWidth * kHeight * 3 / 2);
+    ClientFrameBuffer fbs[2] = {{V4L2_PIX_FMT_NV21, video.data()},
+                                {V4L2_PIX_FMT_RGB32, preview.data()}};
+    EXPECT_EQ(0, mSource.readFrame(fbs, 2, 1.0f, 1.0f, 1.0f, 1.0f));
+    // Pure red, as Y'CrCb, or close.
+    EXPECT_NEAR(82, video[0], 2);
+    EXPECT_NEAR(240, video[kWidth * kHeight], 2);
+    EXPECT_NEAR(90, video[kWidth * kHeight + 1], 2);
+    EXPECT_NEAR(0xff, preview[0], 2);
+    EXPECT_NEAR(0, preview[1], 2);
+}
+
+TEST_F(RemoteCameraSourceTest, decodesMjpeg) {
+    startCapturing();
+    // A JPEG image with YUV 4:2:0 sampling, the default.
+    std::vector<uint32_t> image(kWidth * kHeight, 0xff808080U);
+    AJPEGDesc* jpeg = jpeg_compressor_create(0, 4096);
+    jpeg_compressor_compress_fb(jpeg, 0, 0, kWidth, kHeight, kHeight, 4,
+                                kWidth * 4, (const uint8_t*)image.data(), 90,
+                                1);
+    const uint8_t* data = (const uint8_t*)jpeg_compressor_get_buffer(jpeg);
+    // A truncated image first, which is dropped as invalid.
+    sendFrame(V4L2_PIX_FMT_MJPEG, kWidth, kHeight,
+              std::vector<uint8_t>(data, data + 200));
+    sendFrame(V4L2_PIX_FMT_MJPEG, kWidth, kHeight,
+              std::vector<uint8_t>(
+                      data, data + jpeg_compressor_get_jpeg_size(jpeg)));
+    jpeg_compressor_destroy(jpeg);
+    waitForFrames(2);
+
+    std::vector<uint32_t> rgb;
+    EXPECT_EQ(0, readFrame(&rgb));
+    EXPECT_EQ(1U, mSource.stats().dropped);
+    EXPECT_EQ(1U, mSource.stats().delivered);
+    // The gray of the image, or close.
+    EXPECT_NEAR(0x80, rgb[0] & 0xff, 2);
+    EXPECT_NEAR(0x80, (rgb[0] >> 8) & 0xff, 2);
+    EXPECT_NEAR(0x80, (rgb[0] >> 16) & 0xff, 2);
+}
+
+TEST_F(RemoteCameraSourceTest, invalidFrameClosesConnection) {
+    startCapturing();
+    sendFrame(V4L2_PIX_FMT_NV21, kWidth, kHeight, std::vector<uint8_t>(10));
+    // Closed, or reset as the pixels were not read.
+    char byte;
+    EXPECT_GE(0, android::base::socketRecv(mClient.get(), &byte, 1));
+    EXPECT_EQ(0U, mSource.stats().received);
+}
+
+TEST_F(RemoteCameraSourceTest, newClientReplacesOld) {
+    startCapturing();
+    ScopedSocket client(
+            android::base::socketTcp4LoopbackClient(mSource.port()));
+    ASSERT_TRUE(client.valid());
+    // The old one is closed, the new one is told to capture.
+    char byte;
+    EXPECT_EQ(0, android::base::socketRecv(mClient.get(), &byte, 1));
+    mClient.swap(&client);
+    EXPECT_EQ(kWidth, recvCommand());
+
+    sendFrame(V4L2_PIX_FMT_NV21, kWidth, kHeight, flatNV21(235, 128, 128));
+    waitForFrames(1);
+    std::vector<uint32_t> rgb;
+    EXPECT_EQ(0, readFrame(&rgb));
+    EXPECT_EQ(0xffffffffU, rgb[0]);
+}
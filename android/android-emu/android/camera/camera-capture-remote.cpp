@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains the capturing API of the remote camera, on top of
+ * android::camera::RemoteCameraSource.
+ */
+
+#include "android/camera/camera-capture-remote.h"
+
+#include "android/base/memory/LazyInstance.h"
+#include "android/camera/RemoteCameraSource.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define  E(...)    derror(__VA_ARGS__)
+#define  D(...)    VERBOSE_PRINT(camera,__VA_ARGS__)
+
+using android::camera::RemoteCameraSource;
+
+namespace {
+
+struct Globals {
+    RemoteCameraSource source;
+    CameraDevice device = {};
+    bool opened = false;
+};
+
+android::base::LazyInstance<Globals> sGlobals = LAZY_INSTANCE_INIT;
+
+/* Frame dimensions offered to the guest, the same as for the webcams on
+ * Windows. */
+const CameraFrameDim kFrameDims[] = {
+        {640, 480}, {352, 288}, {320, 240}, {176, 144},
+};
+
+}  // namespace
+
+int remote_camera_init(void) {
+    const char* port = getenv("remote_camera_server_port");
+    if (!port) {
+        port = "30050";
+    }
+    if (!sGlobals->source.start(atoi(port))) {
+        return -1;
+    }
+    D("Remote camera client is expected on port %d", sGlobals->source.port());
+    return 0;
+}
+
+void remote_camera_get_info(CameraInfo* ci, const char* dir) {
+    camera_info_done(ci);
+    ci->display_name = strdup(REMOTE_CAMERA_DEVICE_NAME);
+    ci->device_name = strdup(REMOTE_CAMERA_DEVICE_NAME);
+    ci->inp_channel = 0;
+    /* What MJPEG frames are decoded to. */
+    ci->pixel_format = V4L2_PIX_FMT_YUV420;
+    ci->direction = strdup(dir);
+    ci->frame_sizes = (CameraFrameDim*)malloc(sizeof(kFrameDims));
+    memcpy(ci->frame_sizes, kFrameDims, sizeof(kFrameDims));
+    ci->frame_sizes_num = sizeof(kFrameDims) / sizeof(kFrameDims[0]);
+    ci->in_use = 0;
+}
+
+CameraDevice* remote_camera_device_open(const char* name, int inp_channel) {
+    Globals* const globals = sGlobals.ptr();
+    if (name == NULL || strcmp(name, REMOTE_CAMERA_DEVICE_NAME)) {
+        E("%s: Unknown remote camera device '%s'", __FUNCTION__, name);
+        return NULL;
+    }
+    if (globals->opened) {
+        E("%s: Remote camera is already opened", __FUNCTION__);
+        return NULL;
+    }
+    globals->opened = true;
+    globals->device.opaque = &globals->source;
+    return &globals->device;
+}
+
+int remote_camera_device_start_capturing(CameraDevice* cd,
+                                         uint32_t pixel_format,
+                                         int frame_width,
+                                         int frame_height) {
+    RemoteCameraSource* const source = (RemoteCameraSource*)cd->opaque;
+    source->startCapturing(frame_width, frame_height);
+    return 0;
+}
+
+int remote_camera_device_stop_capturing(CameraDevice* cd) {
+    RemoteCameraSource* const source = (RemoteCameraSource*)cd->opaque;
+    source->stopCapturing();
+    return 0;
+}
+
+int remote_camera_device_read_frame(CameraDevice* cd,
+                                    ClientFrameBuffer* framebuffers,
+                                    int fbs_num,
+                                    float r_scale,
+                                    float g_scale,
+                                    float b_scale,
+                                    float exp_comp) {
+    RemoteCameraSource* const source = (RemoteCameraSource*)cd->opaque;
+    return source->readFrame(framebuffers, fbs_num, r_scale, g_scale, b_scale,
+                             exp_comp);
+}
+
+void remote_camera_device_close(CameraDevice* cd) {
+    Globals* const globals = sGlobals.ptr();
+    if (cd != &globals->device || !globals->opened) {
+        E("%s: Invalid remote camera device", __FUNCTION__);
+        return;
+    }
+    const RemoteCameraSource::Stats stats = globals->source.stats();
+    D("Remote camera frames: %llu received, %llu delivered, %llu dropped",
+      (unsigned long long)stats.received, (unsigned long long)stats.delivered,
+      (unsigned long long)stats.dropped);
+    globals->source.stopCapturing();
+    globals->opened = false;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Contains declarations for the capturing API of the remote camera, i.e. the
+ * camera of the client of a cloud session, which sends its frames over the
+ * network. See android/camera/RemoteCameraSource.h for the protocol.
+ *
+ * The routines are the same as the ones of the camera capture API in
+ * camera-capture.h, for the single device named REMOTE_CAMERA_DEVICE_NAME.
+ */
+
+#include "android/camera/camera-common.h"
+
+#include "android/utils/compiler.h"
+
+ANDROID_BEGIN_HEADER
+
+/* Device name of the remote camera, as reported to the guest. */
+#define REMOTE_CAMERA_DEVICE_NAME   "remote"
+
+/* Starts listening to the remote camera client on the TCP port in the
+ * 'remote_camera_server_port' environment variable, 30050 by default.
+ * Return:
+ *  0 on success, or -1 on failure.
+ */
+extern int remote_camera_init(void);
+
+/* Fills in the information for the remote camera.
+ * Param:
+ *  ci - Camera information to fill in. Must be freed with camera_info_done.
+ *  dir - Direction ('back', or 'front') that the camera is facing.
+ */
+extern void remote_camera_get_info(CameraInfo* ci, const char* dir);
+
+/* See camera_device_open. Only REMOTE_CAMERA_DEVICE_NAME can be opened, and
+ * only once at a time. */
+extern CameraDevice* remote_camera_device_open(const char* name,
+                                               int inp_channel);
+
+/* See camera_device_start_capturing. Frames of any supported pixel format can
+ * come from the client, so 'pixel_format' is ignored. */
+extern int remote_camera_device_start_capturing(CameraDevice* cd,
+                                                uint32_t pixel_format,
+                                                int frame_width,
+                                                int frame_height);
+
+/* See camera_device_stop_capturing. */
+extern int remote_camera_device_stop_capturing(CameraDevice* cd);
+
+/* See camera_device_read_frame. Returns 1 when no new frame has been received
+ * since the last call, so that the camera service reuses the previous one. */
+extern int remote_camera_device_read_frame(CameraDevice* cd,
+                                           ClientFrameBuffer* framebuffers,
+                                           int fbs_num,
+                                           float r_scale,
+                                           float g_scale,
+                                           float b_scale,
+                                           float exp_comp);
+
+/* See camera_device_close. */
+extern void remote_camera_device_close(CameraDevice* cd);
+
+ANDROID_END_HEADER
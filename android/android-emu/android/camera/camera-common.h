@@ -66,6 +66,9 @@ ANDROID_BEGIN_HEADER
 #ifndef V4L2_PIX_FMT_YYVU
 #define V4L2_PIX_FMT_YYVU    v4l2_fourcc('Y', 'Y', 'V', 'U')
 #endif /* V4L2_PIX_FMT_YYVU */
+#ifndef V4L2_PIX_FMT_MJPEG
+#define V4L2_PIX_FMT_MJPEG   v4l2_fourcc('M', 'J', 'P', 'G')
+#endif /* V4L2_PIX_FMT_MJPEG */
 #ifndef V4L2_PIX_FMT_SGBRG8
 #define V4L2_PIX_FMT_SGBRG8  v4l2_fourcc('G', 'B', 'R', 'G')
 #endif  /* V4L2_PIX_FMT_SGBRG8 */
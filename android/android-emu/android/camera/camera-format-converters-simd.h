@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Vectorized row converters between RGB32 and the YUV 4:2:0 formats.
+ *
+ * NOTE: This file is a template included by camera-format-converters.c once
+ * per instruction set, hence no include guard. Before including it, the
+ * following must be defined:
+ *
+ *  simd_t              - Vector type of SIMD_N 32-bit lanes.
+ *  SIMD_N              - Number of pixels converted per iteration.
+ *  SIMD_TARGET         - Function attribute enabling the instruction set.
+ *  SIMD_FUNC(name)     - Name of the instruction set's version of 'name'.
+ *  SIMD_OP(op)         - Intrinsic for the 32-bit lanes operation 'op'.
+ *  SIMD_AND, SIMD_OR   - Bitwise intrinsics.
+ *  SIMD_LOADU, SIMD_STOREU - Unaligned load / store of a whole vector.
+ *  SIMD_BLEND_ODD(a, b)    - 'a' with its odd lanes replaced by the ones of 'b'.
+ *
+ * as well as the SIMD_FUNC(_load_bytes), SIMD_FUNC(_load_uv),
+ * SIMD_FUNC(_uv_mask) and SIMD_FUNC(_store_bytes) helpers.
+ *
+ * Each pixel goes through the exact same integer math as in the generic
+ * converters with no white balance or exposure compensation, so that the
+ * results are identical. The row converters only handle the beginning of a
+ * row that doesn't make them read past its end, and return the number of
+ * pixels they converted. The rest is left to the scalar row converters.
+ */
+
+/* Same as YUVToRGBPix(). */
+static __inline__ SIMD_TARGET void
+SIMD_FUNC(_yuv_to_rgb)(simd_t y, simd_t u, simd_t v,
+                       simd_t* r, simd_t* g, simd_t* b)
+{
+    const simd_t zero = SIMD_OP(set1_epi32)(0);
+    const simd_t max = SIMD_OP(set1_epi32)(255);
+    const simd_t c = SIMD_OP(add_epi32)(
+            SIMD_OP(mullo_epi32)(SIMD_OP(sub_epi32)(y, SIMD_OP(set1_epi32)(16)),
+                                 SIMD_OP(set1_epi32)(298)),
+            SIMD_OP(set1_epi32)(128));
+    const simd_t d = SIMD_OP(sub_epi32)(u, SIMD_OP(set1_epi32)(128));
+    const simd_t e = SIMD_OP(sub_epi32)(v, SIMD_OP(set1_epi32)(128));
+    simd_t x;
+
+    x = SIMD_OP(add_epi32)(c, SIMD_OP(mullo_epi32)(e, SIMD_OP(set1_epi32)(409)));
+    *r = SIMD_OP(min_epi32)(SIMD_OP(max_epi32)(SIMD_OP(srai_epi32)(x, 8), zero),
+                            max);
+    x = SIMD_OP(sub_epi32)(
+            SIMD_OP(sub_epi32)(
+                    c, SIMD_OP(mullo_epi32)(d, SIMD_OP(set1_epi32)(100))),
+            SIMD_OP(mullo_epi32)(e, SIMD_OP(set1_epi32)(208)));
+    *g = SIMD_OP(min_epi32)(SIMD_OP(max_epi32)(SIMD_OP(srai_epi32)(x, 8), zero),
+                            max);
+    x = SIMD_OP(add_epi32)(c, SIMD_OP(mullo_epi32)(d, SIMD_OP(set1_epi32)(516)));
+    *b = SIMD_OP(min_epi32)(SIMD_OP(max_epi32)(SIMD_OP(srai_epi32)(x, 8), zero),
+                            max);
+}
+
+/* Same as the RGB2Y, RGB2U and RGB2V macros. */
+static __inline__ SIMD_TARGET simd_t
+SIMD_FUNC(_rgb_to_yuv)(simd_t r, simd_t g, simd_t b,
+                       int kr, int kg, int kb, int offset)
+{
+    simd_t x = SIMD_OP(add_epi32)(
+            SIMD_OP(mullo_epi32)(r, SIMD_OP(set1_epi32)(kr)),
+            SIMD_OP(mullo_epi32)(g, SIMD_OP(set1_epi32)(kg)));
+    x = SIMD_OP(add_epi32)(x, SIMD_OP(mullo_epi32)(b, SIMD_OP(set1_epi32)(kb)));
+    x = SIMD_OP(add_epi32)(x, SIMD_OP(set1_epi32)(128));
+    return SIMD_OP(add_epi32)(SIMD_OP(srai_epi32)(x, 8),
+                              SIMD_OP(set1_epi32)(offset));
+}
+
+#define SIMD_RGB2Y(r, g, b) SIMD_FUNC(_rgb_to_yuv)(r, g, b,  66, 129,  25,  16)
+#define SIMD_RGB2U(r, g, b) SIMD_FUNC(_rgb_to_yuv)(r, g, b, -38, -74, 112, 128)
+#define SIMD_RGB2V(r, g, b) SIMD_FUNC(_rgb_to_yuv)(r, g, b, 112, -94, -18, 128)
+
+/* Same as _change_exposure_RGB() with no exposure compensation. */
+static __inline__ SIMD_TARGET void
+SIMD_FUNC(_to_yuv_and_back)(simd_t* r, simd_t* g, simd_t* b)
+{
+    const simd_t y = SIMD_RGB2Y(*r, *g, *b);
+    const simd_t u = SIMD_RGB2U(*r, *g, *b);
+    const simd_t v = SIMD_RGB2V(*r, *g, *b);
+    SIMD_FUNC(_yuv_to_rgb)(y, u, v, r, g, b);
+}
+
+/* Saves the even lanes of 'x' as the U or V values of a YUV 4:2:0 row. */
+static __inline__ SIMD_TARGET void
+SIMD_FUNC(_store_chroma)(uint8_t* p, int uv_inc, simd_t x)
+{
+    int32_t lanes[SIMD_N];
+    int n;
+    SIMD_STOREU(lanes, x);
+    for (n = 0; n < SIMD_N / 2; n++) {
+        p[n * uv_inc] = (uint8_t)lanes[n * 2];
+    }
+}
+
+static SIMD_TARGET int
+SIMD_FUNC(_YUV420ToRGB32Row)(const uint8_t* pY,
+                             const uint8_t* pU,
+                             const uint8_t* pV,
+                             int uv_inc,
+                             uint8_t* rgb,
+                             int width)
+{
+    const simd_t uv_mask = SIMD_FUNC(_uv_mask)(uv_inc);
+    const simd_t alpha = SIMD_OP(set1_epi32)((int)0xff000000);
+    int x;
+    for (x = 0; x + 2 * SIMD_N <= width; x += SIMD_N) {
+        const int uv = (x / 2) * uv_inc;
+        simd_t r, g, b;
+        SIMD_FUNC(_yuv_to_rgb)(SIMD_FUNC(_load_bytes)(pY + x),
+                               SIMD_FUNC(_load_uv)(pU + uv, uv_mask),
+                               SIMD_FUNC(_load_uv)(pV + uv, uv_mask),
+                               &r, &g, &b);
+        SIMD_FUNC(_to_yuv_and_back)(&r, &g, &b);
+        SIMD_STOREU(rgb + x * 4,
+                    SIMD_OR(SIMD_OR(r, SIMD_OP(slli_epi32)(g, 8)),
+                            SIMD_OR(SIMD_OP(slli_epi32)(b, 16), alpha)));
+    }
+    return x;
+}
+
+static SIMD_TARGET int
+SIMD_FUNC(_RGB32ToYUV420Row)(const uint8_t* rgb,
+                             uint8_t* pY,
+                             uint8_t* pU,
+                             uint8_t* pV,
+                             int uv_inc,
+                             int width)
+{
+    const simd_t mask = SIMD_OP(set1_epi32)(0xff);
+    int x;
+    for (x = 0; x + 2 * SIMD_N <= width; x += SIMD_N) {
+        const simd_t pix = SIMD_LOADU(rgb + x * 4);
+        simd_t r = SIMD_AND(pix, mask);
+        simd_t g = SIMD_AND(SIMD_OP(srli_epi32)(pix, 8), mask);
+        simd_t b = SIMD_AND(SIMD_OP(srli_epi32)(pix, 16), mask);
+        SIMD_FUNC(_to_yuv_and_back)(&r, &g, &b);
+        SIMD_FUNC(_store_bytes)(pY + x, SIMD_RGB2Y(r, g, b));
+        if (pU != NULL) {
+            const int uv = (x / 2) * uv_inc;
+            SIMD_FUNC(_store_chroma)(pU + uv, uv_inc, SIMD_RGB2U(r, g, b));
+            SIMD_FUNC(_store_chroma)(pV + uv, uv_inc, SIMD_RGB2V(r, g, b));
+        }
+    }
+    return x;
+}
+
+static SIMD_TARGET int
+SIMD_FUNC(_YUV420ToYUV420Row)(const uint8_t* pYsrc,
+                              const uint8_t* pUsrc,
+                              const uint8_t* pVsrc,
+                              int uv_inc_src,
+                              uint8_t* pYdst,
+                              uint8_t* pUdst,
+                              uint8_t* pVdst,
+                              int uv_inc_dst,
+                              int width)
+{
+    const simd_t uv_mask = SIMD_FUNC(_uv_mask)(uv_inc_src);
+    int x;
+    for (x = 0; x + 2 * SIMD_N <= width; x += SIMD_N) {
+        const int uv_src = (x / 2) * uv_inc_src;
+        const simd_t y = SIMD_FUNC(_load_bytes)(pYsrc + x);
+        simd_t r, g, b;
+        SIMD_FUNC(_yuv_to_rgb)(y,
+                               SIMD_FUNC(_load_uv)(pUsrc + uv_src, uv_mask),
+                               SIMD_FUNC(_load_uv)(pVsrc + uv_src, uv_mask),
+                               &r, &g, &b);
+        /* Only the first pixel of each pair goes through RGB. */
+        SIMD_FUNC(_store_bytes)(pYdst + x,
+                                SIMD_BLEND_ODD(SIMD_RGB2Y(r, g, b), y));
+        if (pUdst != NULL) {
+            const int uv_dst = (x / 2) * uv_inc_dst;
+            SIMD_FUNC(_store_chroma)(pUdst + uv_dst, uv_inc_dst,
+                                     SIMD_RGB2U(r, g, b));
+            SIMD_FUNC(_store_chroma)(pVdst + uv_dst, uv_inc_dst,
+                                     SIMD_RGB2V(r, g, b));
+        }
+    }
+    return x;
+}
+
+#undef SIMD_RGB2Y
+#undef SIMD_RGB2U
+#undef SIMD_RGB2V
@@ -16,14 +16,21 @@
 
 #include "android/camera/camera-format-converters.h"
 #include "android/utils/misc.h"
+#include "android/utils/x86_cpuid.h"
 
 #ifdef __linux__
 #include <linux/videodev2.h>
 #endif
 
+#if defined(__i386__) || defined(__x86_64__)
+#define CONVERTERS_HAVE_SIMD 1
+#include <immintrin.h>
+#endif
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define  E(...)    derror(__VA_ARGS__)
 #define  W(...)    dwarning(__VA_ARGS__)
@@ -1632,6 +1639,446 @@ _get_pixel_format_descriptor(uint32_t pixel_format)
     return NULL;
 }
 
+/********************************************************************************
+ * Fast RGB32 / YUV 4:2:0 converters
+ *
+ * Frames are converted between the preview format (RGB32) and the video
+ * formats (YV12, YU12, NV12 and NV21) at every frame, which makes the generic
+ * per-pixel converters above show up in the profiles. When there is no white
+ * balance or exposure compensation to apply, which is the default, these
+ * conversions are done row by row instead, with SSE4.1 or AVX2 when the host
+ * CPU supports them.
+ *
+ * The results are the same as the ones of the generic converters, quirks
+ * included: each pixel still goes through _change_exposure_RGB(), and the
+ * U/V values of a 4:2:0 frame come from the second line of each pair.
+ *******************************************************************************/
+
+/* Converts a pixel to RGB and back, as _change_exposure_RGB() does with no
+ * exposure compensation. */
+static __inline__ void
+_to_yuv_and_back(uint8_t* r, uint8_t* g, uint8_t* b)
+{
+    uint8_t y, u, v;
+    R8G8B8ToYUV(*r, *g, *b, &y, &u, &v);
+    YUVToRGBPix(y, u, v, r, g, b);
+}
+
+/* Converts pixels [x, width) of a YUV 4:2:0 row to RGB32. */
+static void
+_YUV420ToRGB32Row(const uint8_t* pY,
+                  const uint8_t* pU,
+                  const uint8_t* pV,
+                  int uv_inc,
+                  uint8_t* rgb,
+                  int x,
+                  int width)
+{
+    for (; x < width; x += 2) {
+        const uint8_t U = pU[(x / 2) * uv_inc];
+        const uint8_t V = pV[(x / 2) * uv_inc];
+        int n;
+        for (n = x; n < x + 2; n++) {
+            uint8_t r, g, b;
+            YUVToRGBPix(pY[n], U, V, &r, &g, &b);
+            _to_yuv_and_back(&r, &g, &b);
+            _save_RGB32(rgb + n * 4, r, g, b);
+        }
+    }
+}
+
+/* Converts pixels [x, width) of an RGB32 row to YUV 4:2:0. The U/V values are
+ * only saved if 'pU' and 'pV' are not NULL. */
+static void
+_RGB32ToYUV420Row(const uint8_t* rgb,
+                  uint8_t* pY,
+                  uint8_t* pU,
+                  uint8_t* pV,
+                  int uv_inc,
+                  int x,
+                  int width)
+{
+    for (; x < width; x += 2) {
+        uint8_t r, g, b;
+        _load_RGB32(rgb + x * 4, &r, &g, &b);
+        _to_yuv_and_back(&r, &g, &b);
+        pY[x] = RGB2Y((int)r, (int)g, (int)b);
+        if (pU != NULL) {
+            pU[(x / 2) * uv_inc] = RGB2U((int)r, (int)g, (int)b);
+            pV[(x / 2) * uv_inc] = RGB2V((int)r, (int)g, (int)b);
+        }
+        _load_RGB32(rgb + x * 4 + 4, &r, &g, &b);
+        _to_yuv_and_back(&r, &g, &b);
+        pY[x + 1] = RGB2Y((int)r, (int)g, (int)b);
+    }
+}
+
+/* Converts pixels [x, width) of a YUV 4:2:0 row to another YUV 4:2:0 format.
+ * The U/V values are only saved if 'pUdst' and 'pVdst' are not NULL. */
+static void
+_YUV420ToYUV420Row(const uint8_t* pYsrc,
+                   const uint8_t* pUsrc,
+                   const uint8_t* pVsrc,
+                   int uv_inc_src,
+                   uint8_t* pYdst,
+                   uint8_t* pUdst,
+                   uint8_t* pVdst,
+                   int uv_inc_dst,
+                   int x,
+                   int width)
+{
+    for (; x < width; x += 2) {
+        const int Y = pYsrc[x];
+        const int U = pUsrc[(x / 2) * uv_inc_src];
+        const int V = pVsrc[(x / 2) * uv_inc_src];
+        const int r = YUV2R(Y, U, V);
+        const int g = YUV2G(Y, U, V);
+        const int b = YUV2B(Y, U, V);
+        pYdst[x] = RGB2Y(r, g, b);
+        if (pUdst != NULL) {
+            pUdst[(x / 2) * uv_inc_dst] = RGB2U(r, g, b);
+            pVdst[(x / 2) * uv_inc_dst] = RGB2V(r, g, b);
+        }
+        pYdst[x + 1] = pYsrc[x + 1];
+    }
+}
+
+#ifdef CONVERTERS_HAVE_SIMD
+
+/* SSE4.1 helpers for the row converters template. */
+
+#define SSE41_TARGET __attribute__((target("sse4.1")))
+
+/* Loads 4 bytes into 32-bit lanes. */
+static __inline__ SSE41_TARGET __m128i
+_load_bytes_sse41(const uint8_t* p)
+{
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(v));
+}
+
+/* Returns the shuffle mask used by _load_uv_sse41() for 'uv_inc'. */
+static __inline__ SSE41_TARGET __m128i
+_uv_mask_sse41(int uv_inc)
+{
+    const char i = (char)uv_inc;
+    return _mm_setr_epi8(0, -1, -1, -1, 0, -1, -1, -1,
+                         i, -1, -1, -1, i, -1, -1, -1);
+}
+
+/* Loads the U or V values of 4 pixels, each one in two 32-bit lanes. */
+static __inline__ SSE41_TARGET __m128i
+_load_uv_sse41(const uint8_t* p, __m128i mask)
+{
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return _mm_shuffle_epi8(_mm_cvtsi32_si128(v), mask);
+}
+
+/* Saves 4 32-bit lanes in the 0-255 range as bytes. */
+static __inline__ SSE41_TARGET void
+_store_bytes_sse41(uint8_t* p, __m128i x)
+{
+    x = _mm_packus_epi32(x, x);
+    const int32_t v = _mm_cvtsi128_si32(_mm_packus_epi16(x, x));
+    memcpy(p, &v, sizeof(v));
+}
+
+#define simd_t                  __m128i
+#define SIMD_N                  4
+#define SIMD_TARGET             SSE41_TARGET
+#define SIMD_FUNC(name)         name##_sse41
+#define SIMD_OP(op)             _mm_##op
+#define SIMD_AND                _mm_and_si128
+#define SIMD_OR                 _mm_or_si128
+#define SIMD_LOADU(p)           _mm_loadu_si128((const __m128i*)(p))
+#define SIMD_STOREU(p, x)       _mm_storeu_si128((__m128i*)(p), (x))
+#define SIMD_BLEND_ODD(a, b)    _mm_blend_epi16((a), (b), 0xcc)
+#include "android/camera/camera-format-converters-simd.h"
+#undef simd_t
+#undef SIMD_N
+#undef SIMD_TARGET
+#undef SIMD_FUNC
+#undef SIMD_OP
+#undef SIMD_AND
+#undef SIMD_OR
+#undef SIMD_LOADU
+#undef SIMD_STOREU
+#undef SIMD_BLEND_ODD
+
+/* AVX2 helpers for the row converters template. */
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+/* Loads 8 bytes into 32-bit lanes. */
+static __inline__ AVX2_TARGET __m256i
+_load_bytes_avx2(const uint8_t* p)
+{
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p));
+}
+
+/* Returns the shuffle mask used by _load_uv_avx2() for 'uv_inc'. Shuffles
+ * don't cross 128-bit lanes, so each half of the mask picks its values from
+ * its own copy of the loaded bytes. */
+static __inline__ AVX2_TARGET __m256i
+_uv_mask_avx2(int uv_inc)
+{
+    const char i = (char)uv_inc;
+    return _mm256_setr_epi8(0, -1, -1, -1, 0, -1, -1, -1,
+                            i, -1, -1, -1, i, -1, -1, -1,
+                            2 * i, -1, -1, -1, 2 * i, -1, -1, -1,
+                            3 * i, -1, -1, -1, 3 * i, -1, -1, -1);
+}
+
+/* Loads the U or V values of 8 pixels, each one in two 32-bit lanes. */
+static __inline__ AVX2_TARGET __m256i
+_load_uv_avx2(const uint8_t* p, __m256i mask)
+{
+    const __m128i v = _mm_loadl_epi64((const __m128i*)p);
+    return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(v), mask);
+}
+
+/* Saves 8 32-bit lanes in the 0-255 range as bytes. */
+static __inline__ AVX2_TARGET void
+_store_bytes_avx2(uint8_t* p, __m256i x)
+{
+    __m128i v = _mm_packus_epi32(_mm256_castsi256_si128(x),
+                                 _mm256_extracti128_si256(x, 1));
+    _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(v, v));
+}
+
+#define simd_t                  __m256i
+#define SIMD_N                  8
+#define SIMD_TARGET             AVX2_TARGET
+#define SIMD_FUNC(name)         name##_avx2
+#define SIMD_OP(op)             _mm256_##op
+#define SIMD_AND                _mm256_and_si256
+#define SIMD_OR                 _mm256_or_si256
+#define SIMD_LOADU(p)           _mm256_loadu_si256((const __m256i*)(p))
+#define SIMD_STOREU(p, x)       _mm256_storeu_si256((__m256i*)(p), (x))
+#define SIMD_BLEND_ODD(a, b)    _mm256_blend_epi32((a), (b), 0xaa)
+#include "android/camera/camera-format-converters-simd.h"
+#undef simd_t
+#undef SIMD_N
+#undef SIMD_TARGET
+#undef SIMD_FUNC
+#undef SIMD_OP
+#undef SIMD_AND
+#undef SIMD_OR
+#undef SIMD_LOADU
+#undef SIMD_STOREU
+#undef SIMD_BLEND_ODD
+
+#endif  /* CONVERTERS_HAVE_SIMD */
+
+/* Vectorized row converters, which return the number of pixels they
+ * converted at the beginning of the row. */
+typedef struct SimdRowConverters {
+    int (*yuv420_to_rgb32)(const uint8_t* pY,
+                           const uint8_t* pU,
+                           const uint8_t* pV,
+                           int uv_inc,
+                           uint8_t* rgb,
+                           int width);
+    int (*rgb32_to_yuv420)(const uint8_t* rgb,
+                           uint8_t* pY,
+                           uint8_t* pU,
+                           uint8_t* pV,
+                           int uv_inc,
+                           int width);
+    int (*yuv420_to_yuv420)(const uint8_t* pYsrc,
+                            const uint8_t* pUsrc,
+                            const uint8_t* pVsrc,
+                            int uv_inc_src,
+                            uint8_t* pYdst,
+                            uint8_t* pUdst,
+                            uint8_t* pVdst,
+                            int uv_inc_dst,
+                            int width);
+} SimdRowConverters;
+
+#ifdef CONVERTERS_HAVE_SIMD
+static const SimdRowConverters _simd_sse41 = {
+    .yuv420_to_rgb32    = &_YUV420ToRGB32Row_sse41,
+    .rgb32_to_yuv420    = &_RGB32ToYUV420Row_sse41,
+    .yuv420_to_yuv420   = &_YUV420ToYUV420Row_sse41,
+};
+
+static const SimdRowConverters _simd_avx2 = {
+    .yuv420_to_rgb32    = &_YUV420ToRGB32Row_avx2,
+    .rgb32_to_yuv420    = &_RGB32ToYUV420Row_avx2,
+    .yuv420_to_yuv420   = &_YUV420ToYUV420Row_avx2,
+};
+#endif  /* CONVERTERS_HAVE_SIMD */
+
+/* Implementation used by convert_frame(), and its SIMD row converters, if
+ * any. Set by set_converter_impl(), on the first conversion by default. */
+static int _converter_impl = -1;
+static const SimdRowConverters* _simd = NULL;
+
+ConverterImpl
+set_converter_impl(ConverterImpl impl)
+{
+    _simd = NULL;
+#ifdef CONVERTERS_HAVE_SIMD
+    if (impl >= CONVERTER_IMPL_AVX2 && android_get_x86_cpuid_avx2_support()) {
+        _simd = &_simd_avx2;
+        impl = CONVERTER_IMPL_AVX2;
+    } else if (impl >= CONVERTER_IMPL_SSE41 &&
+               android_get_x86_cpuid_sse41_support()) {
+        _simd = &_simd_sse41;
+        impl = CONVERTER_IMPL_SSE41;
+    } else if (impl > CONVERTER_IMPL_FAST) {
+        impl = CONVERTER_IMPL_FAST;
+    }
+#else   // !CONVERTERS_HAVE_SIMD
+    if (impl > CONVERTER_IMPL_FAST) {
+        impl = CONVERTER_IMPL_FAST;
+    }
+#endif  // !CONVERTERS_HAVE_SIMD
+    _converter_impl = impl;
+    D("%s: Using converter implementation %d", __FUNCTION__, impl);
+    return impl;
+}
+
+/* Checks if a YUV format descriptor is one of the 4:2:0 ones. */
+static int
+_is_yuv420(const YUVDesc* desc)
+{
+    return desc == &_YV12 || desc == &_YU12 ||
+           desc == &_NV12 || desc == &_NV21;
+}
+
+/* Fast converter from a YUV 4:2:0 format to RGB32. */
+static void
+_YUV420ToRGB32(const YUVDesc* yuv_fmt, const void* yuv, void* rgb,
+               int width, int height)
+{
+    int y;
+    for (y = 0; y < height; y++) {
+        const uint8_t* pY =
+            (const uint8_t*)yuv + yuv_fmt->y_offset(yuv_fmt, y, width, height);
+        const uint8_t* pU =
+            (const uint8_t*)yuv + yuv_fmt->u_offset(yuv_fmt, y, width, height);
+        const uint8_t* pV =
+            (const uint8_t*)yuv + yuv_fmt->v_offset(yuv_fmt, y, width, height);
+        uint8_t* row = (uint8_t*)rgb + y * width * 4;
+        int x = 0;
+        if (_simd != NULL) {
+            x = _simd->yuv420_to_rgb32(pY, pU, pV, yuv_fmt->UV_inc, row, width);
+        }
+        _YUV420ToRGB32Row(pY, pU, pV, yuv_fmt->UV_inc, row, x, width);
+    }
+}
+
+/* Fast converter from RGB32 to a YUV 4:2:0 format. */
+static void
+_RGB32ToYUV420(const YUVDesc* yuv_fmt, const void* rgb, void* yuv,
+               int width, int height)
+{
+    int y;
+    for (y = 0; y < height; y++) {
+        const uint8_t* row = (const uint8_t*)rgb + y * width * 4;
+        uint8_t* pY =
+            (uint8_t*)yuv + yuv_fmt->y_offset(yuv_fmt, y, width, height);
+        uint8_t* pU = NULL;
+        uint8_t* pV = NULL;
+        int x = 0;
+        /* The generic converter saves the U/V values of both lines of a pair,
+         * and the second one wins. */
+        if ((y & 1) != 0 || y == height - 1) {
+            pU = (uint8_t*)yuv + yuv_fmt->u_offset(yuv_fmt, y, width, height);
+            pV = (uint8_t*)yuv + yuv_fmt->v_offset(yuv_fmt, y, width, height);
+        }
+        if (_simd != NULL) {
+            x = _simd->rgb32_to_yuv420(row, pY, pU, pV, yuv_fmt->UV_inc, width);
+        }
+        _RGB32ToYUV420Row(row, pY, pU, pV, yuv_fmt->UV_inc, x, width);
+    }
+}
+
+/* Fast converter between two YUV 4:2:0 formats. */
+static void
+_YUV420ToYUV420(const YUVDesc* src_fmt, const YUVDesc* dst_fmt,
+                const void* src, void* dst, int width, int height)
+{
+    int y;
+    for (y = 0; y < height; y++) {
+        const uint8_t* pYsrc =
+            (const uint8_t*)src + src_fmt->y_offset(src_fmt, y, width, height);
+        const uint8_t* pUsrc =
+            (const uint8_t*)src + src_fmt->u_offset(src_fmt, y, width, height);
+        const uint8_t* pVsrc =
+            (const uint8_t*)src + src_fmt->v_offset(src_fmt, y, width, height);
+        uint8_t* pYdst =
+            (uint8_t*)dst + dst_fmt->y_offset(dst_fmt, y, width, height);
+        uint8_t* pUdst = NULL;
+        uint8_t* pVdst = NULL;
+        int x = 0;
+        /* See _RGB32ToYUV420(). */
+        if ((y & 1) != 0 || y == height - 1) {
+            pUdst = (uint8_t*)dst + dst_fmt->u_offset(dst_fmt, y, width, height);
+            pVdst = (uint8_t*)dst + dst_fmt->v_offset(dst_fmt, y, width, height);
+        }
+        if (_simd != NULL) {
+            x = _simd->yuv420_to_yuv420(pYsrc, pUsrc, pVsrc, src_fmt->UV_inc,
+                                        pYdst, pUdst, pVdst, dst_fmt->UV_inc,
+                                        width);
+        }
+        _YUV420ToYUV420Row(pYsrc, pUsrc, pVsrc, src_fmt->UV_inc,
+                           pYdst, pUdst, pVdst, dst_fmt->UV_inc, x, width);
+    }
+}
+
+/* Converts a frame with one of the fast converters, if there is one for the
+ * given formats and settings.
+ * Return:
+ *  boolean: 1 if the frame was converted, or 0 if the generic converters must
+ *  be used.
+ */
+static int
+_convert_frame_fast(const PIXFormat* src_desc,
+                    const PIXFormat* dst_desc,
+                    const void* src,
+                    void* dst,
+                    int width,
+                    int height,
+                    float r_scale,
+                    float g_scale,
+                    float b_scale,
+                    float exp_comp)
+{
+    if (_converter_impl < 0) {
+        set_converter_impl(CONVERTER_IMPL_AVX2);
+    }
+    if (_converter_impl == CONVERTER_IMPL_GENERIC ||
+        r_scale != 1.0f || g_scale != 1.0f || b_scale != 1.0f ||
+        exp_comp != 1.0f || (width & 1) != 0) {
+        return 0;
+    }
+
+    const int src_rgb32 = src_desc->format_sel == PIX_FMT_RGB &&
+                          src_desc->desc.rgb_desc == &_RGB32;
+    const int src_yuv420 = src_desc->format_sel == PIX_FMT_YUV &&
+                           _is_yuv420(src_desc->desc.yuv_desc);
+    const int dst_rgb32 = dst_desc->format_sel == PIX_FMT_RGB &&
+                          dst_desc->desc.rgb_desc == &_RGB32;
+    const int dst_yuv420 = dst_desc->format_sel == PIX_FMT_YUV &&
+                           _is_yuv420(dst_desc->desc.yuv_desc);
+    if (src_yuv420 && dst_rgb32) {
+        _YUV420ToRGB32(src_desc->desc.yuv_desc, src, dst, width, height);
+    } else if (src_rgb32 && dst_yuv420) {
+        _RGB32ToYUV420(dst_desc->desc.yuv_desc, src, dst, width, height);
+    } else if (src_yuv420 && dst_yuv420) {
+        _YUV420ToYUV420(src_desc->desc.yuv_desc, dst_desc->desc.yuv_desc,
+                        src, dst, width, height);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
 /********************************************************************************
  * Public API
  *******************************************************************************/
@@ -1680,6 +2127,12 @@ convert_frame(const void* frame,
               __FUNCTION__, (const char*)&framebuffers[n].pixel_format);
             return -1;
         }
+        if (_convert_frame_fast(src_desc, dst_desc,
+                                frame, framebuffers[n].framebuffer,
+                                width, height,
+                                r_scale, g_scale, b_scale, exp_comp)) {
+            continue;
+        }
         switch (src_desc->format_sel) {
             case PIX_FMT_RGB:
                 if (dst_desc->format_sel == PIX_FMT_RGB) {
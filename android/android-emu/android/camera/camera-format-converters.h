@@ -73,4 +73,31 @@ extern int convert_frame(const void* frame,
                          float b_scale,
                          float exp_comp);
 
+/* Implementations of the converters used by convert_frame(), from the slowest
+ * to the fastest one. */
+typedef enum ConverterImpl {
+    /* Per-pixel converters, for all formats and settings. */
+    CONVERTER_IMPL_GENERIC,
+    /* Row converters between RGB32 and the YUV 4:2:0 formats, used when there
+     * is no white balance or exposure compensation to apply. The generic
+     * converters are used otherwise. */
+    CONVERTER_IMPL_FAST,
+    /* Same as CONVERTER_IMPL_FAST, vectorized with SSE4.1. */
+    CONVERTER_IMPL_SSE41,
+    /* Same as CONVERTER_IMPL_FAST, vectorized with AVX2. */
+    CONVERTER_IMPL_AVX2,
+} ConverterImpl;
+
+/* Selects the converters implementation used by convert_frame(). By default,
+ * the fastest one that the host CPU supports is used, which produces the same
+ * frames as the others. This is meant for tests and benchmarks, and must not
+ * be called while frames are being converted.
+ * Param:
+ *  impl - The fastest implementation to use.
+ * Return:
+ *  The implementation that is actually used, which is slower than 'impl' if
+ *  the host CPU doesn't support it.
+ */
+extern ConverterImpl set_converter_impl(ConverterImpl impl);
+
 ANDROID_END_HEADER
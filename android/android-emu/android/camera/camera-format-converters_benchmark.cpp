@@ -0,0 +1,77 @@
+// Copyright (C) 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A small benchmark used to compare the implementations of the camera
+// frame converters, for the conversions done at every frame.
+
+#include "android/camera/camera-format-converters.h"
+
+#include <vector>
+
+#include <stdint.h>
+
+#include "benchmark/benchmark_api.h"
+
+static const int kWidth = 640;
+static const int kHeight = 480;
+
+static const char* const kImplNames[] = {"generic", "fast", "sse4.1", "avx2"};
+
+// Run a benchmark once per implementation supported by the host CPU.
+static void AllImpls(benchmark::internal::Benchmark* b) {
+    const int best = set_converter_impl(CONVERTER_IMPL_AVX2);
+    for (int impl = CONVERTER_IMPL_GENERIC; impl <= best; impl++) {
+        b->Arg(impl);
+    }
+}
+
+static void convertFrames(benchmark::State& state, uint32_t from, uint32_t to) {
+    const ConverterImpl impl = (ConverterImpl)state.range_x();
+    set_converter_impl(impl);
+    state.SetLabel(kImplNames[impl]);
+
+    std::vector<uint8_t> src((kWidth + 32) * kHeight * 4, 0x80);
+    for (size_t n = 0; n < src.size(); n++) {
+        src[n] = (uint8_t)(n * 7);
+    }
+    std::vector<uint8_t> dst((kWidth + 32) * kHeight * 4);
+    ClientFrameBuffer fb = {to, dst.data()};
+    while (state.KeepRunning()) {
+        convert_frame(src.data(), from, src.size(), kWidth, kHeight, &fb, 1,
+                      1.0f, 1.0f, 1.0f, 1.0f);
+    }
+    state.SetItemsProcessed(state.iterations() * kWidth * kHeight);
+}
+
+// The preview frames.
+void BM_Converters_NV21ToRGB32(benchmark::State& state) {
+    convertFrames(state, V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_RGB32);
+}
+
+BENCHMARK(BM_Converters_NV21ToRGB32)->Apply(AllImpls);
+
+// The video frames, from a webcam providing YUV or RGB.
+void BM_Converters_NV21ToYV12(benchmark::State& state) {
+    convertFrames(state, V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_YVU420);
+}
+
+BENCHMARK(BM_Converters_NV21ToYV12)->Apply(AllImpls);
+
+void BM_Converters_RGB32ToYV12(benchmark::State& state) {
+    convertFrames(state, V4L2_PIX_FMT_RGB32, V4L2_PIX_FMT_YVU420);
+}
+
+BENCHMARK(BM_Converters_RGB32ToYV12)->Apply(AllImpls);
+
+BENCHMARK_MAIN()
@@ -0,0 +1,189 @@
+// Copyright (C) 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "android/camera/camera-format-converters.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+namespace {
+
+const uint32_t kFormats[] = {
+        V4L2_PIX_FMT_RGB32, V4L2_PIX_FMT_YVU420, V4L2_PIX_FMT_YUV420,
+        V4L2_PIX_FMT_NV12,  V4L2_PIX_FMT_NV21,
+};
+
+// Large enough for a frame in any of the formats above, including the
+// alignment of the YV12 / YU12 lines to 16 bytes.
+size_t frameSize(int width, int height) {
+    return (width + 32) * (height + 1) * 4;
+}
+
+std::vector<uint8_t> randomFrame(int width, int height, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::vector<uint8_t> frame(frameSize(width, height));
+    for (auto& byte : frame) {
+        byte = (uint8_t)gen();
+    }
+    return frame;
+}
+
+// Converts |src| from |from| to |to| with the given implementation.
+std::vector<uint8_t> convert(ConverterImpl impl,
+                             const std::vector<uint8_t>& src,
+                             uint32_t from,
+                             uint32_t to,
+                             int width,
+                             int height,
+                             float scale = 1.0f) {
+    set_converter_impl(impl);
+    // Bytes that are not part of the frame must stay the same too.
+    std::vector<uint8_t> dst(frameSize(width, height), 0xcd);
+    ClientFrameBuffer fb = {to, dst.data()};
+    EXPECT_EQ(0, convert_frame(src.data(), from, src.size(), width, height,
+                               &fb, 1, scale, scale, scale, 1.0f));
+    return dst;
+}
+
+// FNV-1a hash of a frame.
+uint32_t hashFrame(const std::vector<uint8_t>& frame) {
+    uint32_t hash = 2166136261U;
+    for (uint8_t byte : frame) {
+        hash = (hash ^ byte) * 16777619U;
+    }
+    return hash;
+}
+
+class CameraFormatConvertersTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mBestImpl = set_converter_impl(CONVERTER_IMPL_AVX2);
+    }
+
+    void TearDown() override { set_converter_impl(CONVERTER_IMPL_AVX2); }
+
+    // Checks that all the implementations produce the same frames as the
+    // generic one.
+    void checkAllImpls(int width, int height) {
+        for (uint32_t from : kFormats) {
+            const auto src = randomFrame(width, height, from);
+            for (uint32_t to : kFormats) {
+                const auto expected = convert(CONVERTER_IMPL_GENERIC, src,
+                                              from, to, width, height);
+                for (int impl = CONVERTER_IMPL_FAST; impl <= mBestImpl;
+                     impl++) {
+                    const auto actual = convert((ConverterImpl)impl, src,
+                                                from, to, width, height);
+                    EXPECT_TRUE(expected == actual)
+                            << "impl " << impl << " " << width << "x"
+                            << height << " from "
+                            << std::string((const char*)&from, 4) << " to "
+                            << std::string((const char*)&to, 4);
+                }
+            }
+        }
+    }
+
+    ConverterImpl mBestImpl = CONVERTER_IMPL_GENERIC;
+};
+
+}  // namespace
+
+TEST_F(CameraFormatConvertersTest, sameAsGeneric) {
+    checkAllImpls(640, 480);
+}
+
+TEST_F(CameraFormatConvertersTest, sameAsGenericOddSizes) {
+    // Rows with a scalar tail after the vectorized part, an odd number of
+    // rows, and rows too short to be vectorized at all.
+    checkAllImpls(38, 22);
+    checkAllImpls(30, 7);
+    checkAllImpls(2, 2);
+}
+
+TEST_F(CameraFormatConvertersTest, whiteBalanceUsesGeneric) {
+    const auto src = randomFrame(64, 48, 1);
+    const auto expected = convert(CONVERTER_IMPL_GENERIC, src,
+                                  V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_RGB32, 64,
+                                  48, 1.5f);
+    EXPECT_TRUE(expected == convert(mBestImpl, src, V4L2_PIX_FMT_NV21,
+                                    V4L2_PIX_FMT_RGB32, 64, 48, 1.5f));
+    EXPECT_FALSE(expected == convert(mBestImpl, src, V4L2_PIX_FMT_NV21,
+                                     V4L2_PIX_FMT_RGB32, 64, 48));
+}
+
+TEST_F(CameraFormatConvertersTest, blackAndWhite) {
+    const int kWidth = 16;
+    const int kHeight = 2;
+    // NV21 frame with black pixels on the left and white ones on the right.
+    std::vector<uint8_t> src(kWidth * kHeight * 3 / 2, 128);
+    for (int y = 0; y < kHeight; y++) {
+        memset(&src[y * kWidth], 16, kWidth / 2);
+        memset(&src[y * kWidth + kWidth / 2], 235, kWidth / 2);
+    }
+
+    const auto rgb = convert(mBestImpl, src, V4L2_PIX_FMT_NV21,
+                             V4L2_PIX_FMT_RGB32, kWidth, kHeight);
+    for (int n = 0; n < kWidth * kHeight; n++) {
+        const uint32_t expected =
+                (n % kWidth) < kWidth / 2 ? 0xff000000U : 0xffffffffU;
+        uint32_t pixel;
+        memcpy(&pixel, &rgb[n * 4], 4);
+        EXPECT_EQ(expected, pixel) << "pixel " << n;
+    }
+
+    // And back.
+    const auto yuv = convert(mBestImpl, rgb, V4L2_PIX_FMT_RGB32,
+                             V4L2_PIX_FMT_NV21, kWidth, kHeight);
+    EXPECT_EQ(0, memcmp(src.data(), yuv.data(), src.size()));
+}
+
+TEST_F(CameraFormatConvertersTest, golden) {
+    // Gradients in all directions, converted to the preview and video
+    // formats. The hashes were computed with the generic converters, and catch
+    // any change in the output of all the implementations.
+    const int kWidth = 64;
+    const int kHeight = 48;
+    std::vector<uint8_t> rgb(frameSize(kWidth, kHeight));
+    for (int y = 0; y < kHeight; y++) {
+        for (int x = 0; x < kWidth; x++) {
+            uint8_t* pixel = &rgb[(y * kWidth + x) * 4];
+            pixel[0] = x * 4;
+            pixel[1] = y * 5;
+            pixel[2] = 255 - (x + y) * 2;
+            pixel[3] = 0xff;
+        }
+    }
+    for (int impl = CONVERTER_IMPL_GENERIC; impl <= mBestImpl; impl++) {
+        SCOPED_TRACE(testing::Message() << "impl " << impl);
+        const auto yv12 = convert((ConverterImpl)impl, rgb, V4L2_PIX_FMT_RGB32,
+                                  V4L2_PIX_FMT_YVU420, kWidth, kHeight);
+        const auto nv21 = convert((ConverterImpl)impl, yv12,
+                                  V4L2_PIX_FMT_YVU420, V4L2_PIX_FMT_NV21,
+                                  kWidth, kHeight);
+        const auto preview = convert((ConverterImpl)impl, nv21,
+                                     V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_RGB32,
+                                     kWidth, kHeight);
+
+        EXPECT_EQ(0xd73dad80U, hashFrame(yv12));
+        EXPECT_EQ(0x4ab3d93dU, hashFrame(nv21));
+        EXPECT_EQ(0x9403a8bcU, hashFrame(preview));
+    }
+}
@@ -21,6 +21,7 @@
 #include "android/camera/camera-service.h"
 
 #include "android/camera/camera-capture.h"
+#include "android/camera/camera-capture-remote.h"
 #include "android/camera/camera-format-converters.h"
 #include "android/emulation/android_qemud.h"
 #include "android/globals.h"  /* for android_hw */
@@ -320,6 +321,35 @@ _wecam_setup(CameraServiceDesc* csd,
     csd->camera_count++;
 }
 
+/* Initialized remote camera emulation record in camera service descriptor.
+ * Param:
+ *  csd - Camera service descriptor to initialize a record in.
+ *  dir - Direction ('back', or 'front') that emulated camera is facing.
+ */
+static void
+_remote_camera_setup(CameraServiceDesc* csd, const char* dir)
+{
+    /* There is only one remote camera. */
+    if (_camera_info_get_by_device_name(REMOTE_CAMERA_DEVICE_NAME,
+                                        csd->camera_info,
+                                        csd->camera_count) != NULL) {
+        W("The remote camera can only be used for one camera, not the %s one",
+          dir);
+        return;
+    }
+    if (remote_camera_init()) {
+        W("Unable to listen to the remote camera client");
+        return;
+    }
+
+    remote_camera_get_info(&csd->camera_info[csd->camera_count], dir);
+    D("Camera %d '%s' facing %s is fed by the remote client",
+      csd->camera_count, csd->camera_info[csd->camera_count].display_name,
+      csd->camera_info[csd->camera_count].direction);
+
+    csd->camera_count++;
+}
+
 /* Initializes camera service descriptor.
  */
 static void
@@ -332,6 +362,14 @@ _camera_service_init(CameraServiceDesc* csd)
     memset(csd->camera_info, 0, sizeof(CameraInfo) * MAX_CAMERA);
     csd->camera_count = 0;
 
+    /* Set up the cameras fed by the remote client. */
+    if (!strcmp(android_hw->hw_camera_back, "remote")) {
+        _remote_camera_setup(csd, "back");
+    }
+    if (!strcmp(android_hw->hw_camera_front, "remote")) {
+        _remote_camera_setup(csd, "front");
+    }
+
     /* Lets see if HW config uses web cameras. */
     if (strncmp(android_hw->hw_camera_back, "webcam", 6) &&
         strncmp(android_hw->hw_camera_front, "webcam", 6)) {
@@ -590,6 +628,35 @@ _factory_client_close(void*  opaque)
  * Camera client API
  *******************************************************************************/
 
+/* Capture API used by a camera client, for the web cameras connected to the
+ * host, or for the remote camera. See camera-capture.h. */
+typedef struct CameraCaptureOps {
+    CameraDevice* (*open)(const char* name, int inp_channel);
+    int (*start_capturing)(CameraDevice* cd, uint32_t pixel_format,
+                           int frame_width, int frame_height);
+    int (*stop_capturing)(CameraDevice* cd);
+    int (*read_frame)(CameraDevice* cd, ClientFrameBuffer* framebuffers,
+                      int fbs_num, float r_scale, float g_scale,
+                      float b_scale, float exp_comp);
+    void (*close)(CameraDevice* cd);
+} CameraCaptureOps;
+
+static const CameraCaptureOps _webcam_ops = {
+    camera_device_open,
+    camera_device_start_capturing,
+    camera_device_stop_capturing,
+    camera_device_read_frame,
+    camera_device_close,
+};
+
+static const CameraCaptureOps _remote_camera_ops = {
+    remote_camera_device_open,
+    remote_camera_device_start_capturing,
+    remote_camera_device_stop_capturing,
+    remote_camera_device_read_frame,
+    remote_camera_device_close,
+};
+
 /* Describes an emulated camera client.
  */
 typedef struct CameraClient CameraClient;
@@ -604,6 +671,8 @@ struct CameraClient
     int                 inp_channel;
     /* Camera information. */
     const CameraInfo*   camera_info;
+    /* Capture API for the camera device. */
+    const CameraCaptureOps* ops;
     /* Emulated camera device descriptor. */
     CameraDevice*       camera;
     /* Buffer allocated for video frames.
@@ -647,7 +716,7 @@ _camera_client_free(CameraClient* cc)
         ((CameraInfo*)cc->camera_info)->in_use = 0;
     }
     if (cc->camera != NULL) {
-        camera_device_close(cc->camera);
+        cc->ops->close(cc->camera);
     }
     if (cc->video_frame != NULL) {
         free(cc->video_frame);
@@ -730,6 +799,8 @@ _camera_client_create(CameraServiceDesc* csd, const char* param)
     /* We're done. Set camera in use, and succeed the connection. */
     ci->in_use = 1;
     cc->camera_info = ci;
+    cc->ops = strcmp(cc->device_name, REMOTE_CAMERA_DEVICE_NAME)
+                  ? &_webcam_ops : &_remote_camera_ops;
 
     D("%s: Camera service is created for device '%s' using input channel %d",
       __FUNCTION__, cc->device_name, cc->inp_channel);
@@ -758,7 +829,7 @@ _camera_client_query_connect(CameraClient* cc, QemudClient* qc, const char* para
     }
 
     /* Open camera device. */
-    cc->camera = camera_device_open(cc->device_name, cc->inp_channel);
+    cc->camera = cc->ops->open(cc->device_name, cc->inp_channel);
     if (cc->camera == NULL) {
         E("%s: Unable to open camera device '%s'", __FUNCTION__, cc->device_name);
         _qemu_client_reply_ko(qc, "Unable to open camera device.");
@@ -798,7 +869,7 @@ _camera_client_query_disconnect(CameraClient* cc,
     }
 
     /* Close camera device. */
-    camera_device_close(cc->camera);
+    cc->ops->close(cc->camera);
     cc->camera = NULL;
 
     D("Camera device '%s' is now disconnected", cc->device_name);
@@ -969,8 +1040,8 @@ _camera_client_query_start(CameraClient* cc, QemudClient* qc, const char* param)
     cc->preview_frame = (uint16_t*)(cc->video_frame + cc->video_frame_size);
 
     /* Start the camera. */
-    if (camera_device_start_capturing(cc->camera, cc->camera_info->pixel_format,
-                                      cc->width, cc->height)) {
+    if (cc->ops->start_capturing(cc->camera, cc->camera_info->pixel_format,
+                                 cc->width, cc->height)) {
         E("%s: Cannot start camera '%s' for %.4s[%dx%d]: %s",
           __FUNCTION__, cc->device_name, (const char*)&cc->pixel_format,
           cc->width, cc->height, strerror(errno));
@@ -1004,7 +1075,7 @@ _camera_client_query_stop(CameraClient* cc, QemudClient* qc, const char* param)
     }
 
     /* Stop the camera. */
-    if (camera_device_stop_capturing(cc->camera)) {
+    if (cc->ops->stop_capturing(cc->camera)) {
         E("%s: Cannot stop camera device '%s': %s",
           __FUNCTION__, cc->device_name, strerror(errno));
         _qemu_client_reply_ko(qc, "Cannot stop camera device");
@@ -1109,8 +1180,8 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
 
     /* Capture new frame. */
     tick = _get_timestamp();
-    repeat = camera_device_read_frame(cc->camera, fbs, fbs_num,
-                                      r_scale, g_scale, b_scale, exp_comp);
+    repeat = cc->ops->read_frame(cc->camera, fbs, fbs_num,
+                                 r_scale, g_scale, b_scale, exp_comp);
 
     /* Note that there is no (known) way how to wait on next frame being
      * available, so we could dequeue frame buffer from the device only when we
@@ -1127,8 +1198,8 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
            (_get_timestamp() - tick) < 2000000LL) {
         /* Sleep for 10 millisec before repeating the attempt. */
         _camera_sleep(10);
-        repeat = camera_device_read_frame(cc->camera, fbs, fbs_num,
-                                          r_scale, g_scale, b_scale, exp_comp);
+        repeat = cc->ops->read_frame(cc->camera, fbs, fbs_num,
+                                     r_scale, g_scale, b_scale, exp_comp);
     }
     if (repeat == 1 && !cc->frames_cached) {
         /* Waited too long for the first frame. */
@@ -85,6 +85,7 @@ OPT_FLAG ( no_snapshot,    "perform a full boot and do not do not auto-save, but
 OPT_FLAG ( no_snapshot_save, "do not auto-save to snapshot on exit: abandon changed state" )
 OPT_FLAG ( no_snapshot_load, "do not auto-start from snapshot: perform a full boot" )
 OPT_FLAG ( snapshot_list,  "show a list of available snapshots" )
+OPT_PARAM( snapshot_base,  "<dir>", "also look for snapshots in <dir>, shared read-only by AVDs whose disk images are copies of the one that saved them" )
 OPT_FLAG ( no_snapshot_update_time, "do not do try to correct snapshot time on restore" )
 OPT_FLAG ( wipe_data, "reset the user data image (copy it from initdata)" )
 CFG_PARAM( avd, "<name>", "use a specific android virtual device" )
@@ -32,6 +32,8 @@
 #include "android/network/control.h"
 #include "android/network/constants.h"
 #include "android/network/globals.h"
+#include "android/opengl/transport_stats.h"
+#include "android/remote_input_server.h"
 #include "android/shaper.h"
 #include "android/tcpdump.h"
 #include "android/telephony/modem_driver.h"
@@ -2643,6 +2645,148 @@ static const CommandDefRec fingerprint_commands[] =
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
+/********************************************************************************************/
+/********************************************************************************************/
+/*****                                                                                 ******/
+/*****                         R E N D E R   C O M M A N D S                           ******/
+/*****                                                                                 ******/
+/********************************************************************************************/
+/********************************************************************************************/
+
+/* Period of 'render dump start' when none is given, in milliseconds */
+#define RENDER_DUMP_DEFAULT_PERIOD_MS 1000
+
+static int
+do_render_stats( ControlClient  client, char*  args )
+{
+    if (android_opengl_print_transport_stats(client, control_write_out_cb) == 0) {
+        control_write( client, "no render session is forwarded to a render server\r\n" );
+    }
+    return 0;
+}
+
+static int
+do_render_dump_start( ControlClient  client, char*  args )
+{
+    int period_ms = RENDER_DUMP_DEFAULT_PERIOD_MS;
+
+    if ( !args ) {
+        control_write( client, "KO: missing <file> argument, see 'help render dump start'\r\n" );
+        return -1;
+    }
+
+    /* an optional period follows the file name */
+    char* last = strrchr(args, ' ');
+    if (last && last[1] && strspn(last + 1, "0123456789") == strlen(last + 1)) {
+        period_ms = atoi(last + 1);
+        *last = 0;
+        if (period_ms <= 0) {
+            control_write( client, "KO: invalid <period> argument\r\n" );
+            return -1;
+        }
+    }
+
+    if (!android_opengl_start_transport_stats_dump(args, period_ms)) {
+        control_write( client, "KO: could not open %s: %s\r\n", args, strerror(errno) );
+        return -1;
+    }
+    return 0;
+}
+
+static int
+do_render_dump_stop( ControlClient  client, char*  args )
+{
+    /* no need to return an error here */
+    android_opengl_stop_transport_stats_dump();
+    return 0;
+}
+
+static const CommandDefRec  render_dump_commands[] =
+{
+    { "start", "start dumping render transport statistics",
+      "'render dump start <file> [<period>]' appends the output of 'render stats' to\r\n"
+      "<file> every <period> milliseconds, 1000 by default, each line starting with\r\n"
+      "the time in milliseconds since the epoch. This stops any dump already in progress.\r\n\r\n"
+      "you can stop the dump anytime with 'render dump stop'\r\n", NULL,
+      do_render_dump_start, NULL },
+
+    { "stop", "stop dumping render transport statistics",
+      "'render dump stop' stops a dump started with 'render dump start', if any.\r\n", NULL,
+      do_render_dump_stop, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+static int
+do_render_latency_stats( ControlClient  client, char*  args )
+{
+    android_remote_input_print_latency(client, control_write_out_cb);
+    return 0;
+}
+
+static int
+do_render_latency_trace( ControlClient  client, char*  args )
+{
+    if ( !args ) {
+        control_write( client, "KO: missing <file> argument, see 'help render latency trace'\r\n" );
+        return -1;
+    }
+    if (!android_remote_input_write_latency_trace(args)) {
+        control_write( client, "KO: could not write %s: %s\r\n", args, strerror(errno) );
+        return -1;
+    }
+    return 0;
+}
+
+static int
+do_render_latency_reset( ControlClient  client, char*  args )
+{
+    android_remote_input_reset_latency();
+    return 0;
+}
+
+static const CommandDefRec  render_latency_commands[] =
+{
+    { "stats", "display input to frame latency statistics",
+      "'render latency stats' displays how many remote input events were injected in\r\n"
+      "the guest, then matched with the first frame sent to the remote render server\r\n"
+      "after them or dropped, and two histograms of their latencies: from their\r\n"
+      "reception to their injection, and from their reception to that frame.\r\n", NULL,
+      do_render_latency_stats, NULL },
+
+    { "trace", "write the last input events and frames as a Chrome trace",
+      "'render latency trace <file>' writes the last remote input events matched with\r\n"
+      "a frame, and the frames, to <file> in the Chrome trace format. Each event is\r\n"
+      "tagged with the timestamp of the client that sent it.\r\n", NULL,
+      do_render_latency_trace, NULL },
+
+    { "reset", "forget the input to frame latency statistics",
+      "'render latency reset' clears the counts and the events traced so far.\r\n", NULL,
+      do_render_latency_reset, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+static const CommandDefRec  render_commands[] =
+{
+    { "stats", "display render transport statistics",
+      "'render stats' displays one line for each render session forwarded to the\r\n"
+      "remote render server: the bytes per second and in total received from the\r\n"
+      "guest and replied to it, the pages waiting to be sent and the most there\r\n"
+      "were, and a histogram of the round trip times of the commands that expect\r\n"
+      "a reply. The rates are averaged since they were last updated, at most once\r\n"
+      "per second.\r\n", NULL,
+      do_render_stats, NULL },
+
+    { "dump", "dump render transport statistics to a file",
+      NULL, NULL, NULL, render_dump_commands },
+
+    { "latency", "trace the latency from remote input events to frames",
+      NULL, NULL, NULL, render_latency_commands },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
 /********************************************************************************************/
 /********************************************************************************************/
 /*****                                                                                 ******/
@@ -2799,6 +2943,11 @@ static const CommandDefRec main_commands[] = {
         {"rotate", "rotate the screen clockwise by 90 degrees", NULL, NULL,
          do_rotate_90_clockwise, NULL},
 
+        {"render", "remote render transport commands",
+         "allows you to monitor how the render sessions are forwarded to the "
+         "remote render server\r\n",
+         NULL, NULL, render_commands},
+
         {NULL, NULL, NULL, NULL, NULL, NULL}};
 
 /********************************************************************************************/
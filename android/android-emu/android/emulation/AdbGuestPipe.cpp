@@ -11,14 +11,10 @@
 
 #include "android/emulation/AdbGuestPipe.h"
 
-#include "android/base/async/AsyncSocketServer.h"
-#include "android/base/async/Looper.h"
-#include "android/base/async/ScopedSocketWatch.h"
-#include "android/base/async/ThreadLooper.h"
 #include "android/base/Log.h"
 #include "android/base/sockets/SocketUtils.h"
+#include "android/base/sockets/SocketWaiter.h"
 #include "android/base/StringView.h"
-#include "android/emulation/VmLock.h"
 #include "android/globals.h"
 #include "android/utils/debug.h"
 
@@ -26,6 +22,9 @@
 #include <string>
 
 #include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
 
 #define DEBUG 0
 
@@ -73,7 +72,8 @@ namespace emulation {
 //
 // State::ProxyingData:
 //   onGuestClose -> State::ClosedByGuest
-//   on host disconnect -> State::ClosedByHost
+//   on host disconnect, once the guest received all data before it
+//                     -> State::ClosedByHost
 //   data in or out -> State;:ProxyingData (self)
 //
 // State::ClosedByHost:
@@ -83,10 +83,21 @@ namespace emulation {
 //   close host socket ->  State::ClosedByGuest
 //
 
-using FdWatch = android::base::Looper::FdWatch;
-using android::base::ScopedSocketWatch;
+using android::base::AutoLock;
+using android::base::FunctorThread;
+using android::base::SocketBuffer;
+using android::base::SocketWaiter;
 using android::base::StringView;
 
+// Size of each ring between the guest and the host socket. This is enough
+// for a few of the largest ADB packets, whose payload is at most 256 KiB.
+static const size_t kRingSize = 1024 * 1024;
+
+// Only receive from the host socket again once the guest read the bytes
+// above this, so that the guest wakes up the i/o thread once every so
+// many bytes read, rather than on every read.
+static const size_t kRingLowWater = kRingSize / 2;
+
 #if DEBUG >= 2
 static int bufferBytes(const AndroidPipeBuffer* buffers, int count) {
     int result = 0;
@@ -97,6 +108,55 @@ static int bufferBytes(const AndroidPipeBuffer* buffers, int count) {
 }
 #endif
 
+// Set |segments| to the buffers of the |size| bytes at |offset| in the ring
+// |data|, which wrap around its end at most once. Return their number.
+static int ringSegments(std::vector<uint8_t>& data,
+                        size_t offset,
+                        size_t size,
+                        SocketBuffer* segments) {
+    offset %= data.size();
+    const size_t first = std::min(size, data.size() - offset);
+    int count = 0;
+    if (first > 0) {
+        segments[count++] = {&data[offset], first};
+    }
+    if (size > first) {
+        segments[count++] = {&data[0], size - first};
+    }
+    return count;
+}
+
+// Copy as many bytes as possible from the |srcCount| buffers of |src| to the
+// |dstCount| buffers of |dst|, in order. Return the number of bytes copied.
+template <class Dst, class Src>
+static size_t copyBuffers(const Dst* dst,
+                          int dstCount,
+                          const Src* src,
+                          int srcCount) {
+    size_t result = 0;
+    size_t dstPos = 0;
+    size_t srcPos = 0;
+    while (dstCount > 0 && srcCount > 0) {
+        const size_t len = std::min(dst->size - dstPos, src->size - srcPos);
+        memcpy(static_cast<uint8_t*>(dst->data) + dstPos,
+               static_cast<const uint8_t*>(src->data) + srcPos, len);
+        result += len;
+        dstPos += len;
+        srcPos += len;
+        if (dstPos == dst->size) {
+            dst++;
+            dstCount--;
+            dstPos = 0;
+        }
+        if (srcPos == src->size) {
+            src++;
+            srcCount--;
+            srcPos = 0;
+        }
+    }
+    return result;
+}
+
 AndroidPipe* AdbGuestPipe::Service::create(void* mHwPipe, const char* args) {
     auto pipe = new AdbGuestPipe(mHwPipe, this, mHostAgent);
     onPipeOpen(pipe);
@@ -155,7 +215,10 @@ void AdbGuestPipe::onGuestClose() {
     DD("%s: [%p]", __func__, this);
     mState = State::ClosedByGuest;
     DINIT("%s: [%p] Adb closed by guest",__func__, this);
-    mHostSocket.reset();
+    stopHostIo();
+    // Make sure there's no wake up scheduled by the i/o thread for this
+    // pipe instance to run on the main thread.
+    abortPendingOperation();
     service()->onPipeClose(this);  // This deletes the instance.
 }
 
@@ -173,11 +236,13 @@ unsigned AdbGuestPipe::onGuestPoll() const {
             break;
 
         case State::ProxyingData: {
-            unsigned flags = mHostSocket->poll();
-            if (flags & FdWatch::kEventRead) {
+            // Once the host socket is closed, let the guest find out with
+            // an i/o error.
+            AutoLock lock(mIoLock);
+            if (mToGuest.count > 0 || mHostClosed) {
                 result |= PIPE_POLL_IN;
             }
-            if (flags & FdWatch::kEventWrite) {
+            if (mToHost.count < mToHost.data.size() || mHostClosed) {
                 result |= PIPE_POLL_OUT;
             }
             break;
@@ -237,16 +302,23 @@ int AdbGuestPipe::onGuestSend(const AndroidPipeBuffer* buffers,
 }
 
 void AdbGuestPipe::onGuestWantWakeOn(int flags) {
-    if (flags & PIPE_WAKE_READ) {
-        if (mHostSocket.get()) {
-            mHostSocket->wantRead();
-        }
+    if (mState != State::ProxyingData) {
+        return;
     }
-    if (flags & PIPE_WAKE_WRITE) {
-        if (mHostSocket.get()) {
-            mHostSocket->wantWrite();
-        }
+    bool wakeIo = false;
+    {
+        AutoLock lock(mIoLock);
+        // The i/o thread only receives into an empty ring for a waiting
+        // guest.
+        wakeIo = (flags & PIPE_WAKE_READ) != 0 &&
+                 (mGuestWakes & PIPE_WAKE_READ) == 0 && mToGuest.count == 0;
+        mGuestWakes |= flags & (PIPE_WAKE_READ | PIPE_WAKE_WRITE);
     }
+    if (wakeIo) {
+        wakeHostIo();
+    }
+    // The rings may have changed since the guest polled them.
+    signalGuestWakes();
 }
 
 void AdbGuestPipe::onHostConnection(ScopedSocket&& socket) {
@@ -260,12 +332,7 @@ void AdbGuestPipe::onHostConnection(ScopedSocket&& socket) {
     // noticeable.
     android::base::socketSetNoDelay(socket.get());
 
-    mHostSocket.reset(android::base::ThreadLooper::get()->createFdWatch(
-            socket.release(),
-            [](void* opaque, int fd, unsigned events) {
-                static_cast<AdbGuestPipe*>(opaque)->onHostSocketEvent(events);
-            },
-            this));
+    mHostSocket.reset(socket.release());
 
     waitForHostConnection();
 }
@@ -292,71 +359,268 @@ const char* AdbGuestPipe::toString(AdbGuestPipe::State state) {
     }
 }
 
-// Called whenever an i/o event occurs on the host socket.
-void AdbGuestPipe::onHostSocketEvent(unsigned events) {
-    int wakeFlags = 0;
-    if ((events & FdWatch::kEventRead) != 0) {
-        wakeFlags |= PIPE_WAKE_READ;
-        mHostSocket->dontWantRead();
-    }
-    if ((events & FdWatch::kEventWrite) != 0) {
-        wakeFlags |= PIPE_WAKE_WRITE;
-        mHostSocket->dontWantWrite();
+void AdbGuestPipe::startHostIo() {
+    int wakeRead, wakeWrite;
+    if (android::base::socketCreatePair(&wakeRead, &wakeWrite) < 0) {
+        PLOG(ERROR) << "Could not create ADB pipe i/o thread socket pair";
+        mHostClosed = true;
+        return;
     }
-    if (wakeFlags) {
-        signalWake(wakeFlags);
+    mIoWakeRead.reset(wakeRead);
+    mIoWakeWrite.reset(wakeWrite);
+    mToGuest.data.resize(kRingSize);
+    mToHost.data.resize(kRingSize);
+
+    mIoThread.reset(new FunctorThread([this]() { hostIoMain(); }));
+    mIoThread->start();
+}
+
+void AdbGuestPipe::stopHostIo() {
+    if (mIoThread) {
+        {
+            AutoLock lock(mIoLock);
+            mIoStopping = true;
+        }
+        wakeHostIo();
+        mIoThread->wait();
+        mIoThread.reset();
     }
+    mIoWakeRead.close();
+    mIoWakeWrite.close();
+    mHostSocket.close();
 }
 
-int AdbGuestPipe::onGuestRecvData(AndroidPipeBuffer* buffers, int numBuffers) {
-    DD("%s: [%p] numBuffers=%d bytes=%d", __func__, this, numBuffers,
-        bufferBytes(buffers, numBuffers));
-    CHECK(mState == State::ProxyingData);
-    int result = 0;
-    while (numBuffers > 0) {
-        uint8_t* data = buffers[0].data;
-        size_t dataSize = buffers[0].size;
-        DD("%s: [%p] dataSize=%d", __func__, this, (int)dataSize);
-        while (dataSize > 0) {
-            ssize_t len;
-            {
-                ScopedVmUnlock unlockBql;
-                len = android::base::socketRecv(mHostSocket->fd(),
-                                                data, dataSize);
+void AdbGuestPipe::wakeHostIo() {
+    const char wake = 0;
+    android::base::socketSend(mIoWakeWrite.get(), &wake, 1);
+}
+
+void AdbGuestPipe::hostIoMain() {
+    std::unique_ptr<SocketWaiter> waiter(SocketWaiter::create());
+    const int socket = mHostSocket.get();
+    for (;;) {
+        // Only wait for the socket events the rings can take.
+        unsigned events = 0;
+        {
+            AutoLock lock(mIoLock);
+            if (mIoStopping) {
+                // Pass on what the guest sent before closing the pipe, as
+                // far as the host socket takes it without blocking.
+                const bool flush = mToHost.count > 0 && !mHostClosed;
+                lock.unlock();
+                if (flush) {
+                    sendToHost();
+                }
+                break;
             }
-            if (len > 0) {
-                data += len;
-                dataSize -= len;
-                result += static_cast<int>(len);
-                if (dataSize != 0) {
-                    return result; // got less than requested -> no more data.
+            // While the ring is empty and the guest keeps reading, it
+            // receives straight from the host socket, see
+            // recvFromHostDirect(). Only fill the ring when the guest is
+            // behind, or waits to be woken up.
+            const bool fillRing = mToGuest.count > 0 ||
+                                  (mGuestWakes & PIPE_WAKE_READ) != 0;
+            if (fillRing && mToGuest.count <= kRingLowWater) {
+                if (mHostRecvBusy) {
+                    // The guest receives by itself, it wakes us once done.
+                    mIoRecvDeferred = true;
                 } else {
-                    break;
+                    events |= SocketWaiter::kEventRead;
                 }
             }
-            if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                if (result == 0) {
-                    mHostSocket->dontWantRead();
-                    return PIPE_ERROR_AGAIN;
-                }
-            } else {
-                // End of stream or i/o error means the guest has closed
-                // the connection.
-                if (result == 0) {
-                    mHostSocket.reset();
-                    mState = State::ClosedByHost;
-                    DINIT("%s: [%p] Adb closed by host",__func__, this);
-                    return PIPE_ERROR_IO;
-                }
+            if (mToHost.count > 0) {
+                events |= SocketWaiter::kEventWrite;
             }
-            // Some data was received so report it, the guest will have
-            // to try again to get an error.
+        }
+        waiter->reset();
+        waiter->update(mIoWakeRead.get(), SocketWaiter::kEventRead);
+        if (events) {
+            waiter->update(socket, events);
+        }
+        bool connected = waiter->wait(INT64_MAX) >= 0;
+        if (!connected) {
+            PLOG(ERROR) << "Could not wait for ADB host socket";
+        }
+        if (waiter->pendingEventsFor(mIoWakeRead.get())) {
+            char buf[16];
+            while (android::base::socketRecv(mIoWakeRead.get(), buf,
+                                             sizeof(buf)) > 0) {
+            }
+        }
+        const unsigned pending = waiter->pendingEventsFor(socket);
+        if (connected && (pending & SocketWaiter::kEventRead)) {
+            connected = recvFromHost();
+        }
+        if (connected && (pending & SocketWaiter::kEventWrite)) {
+            connected = sendToHost();
+        }
+        if (!connected) {
+            // End of stream or i/o error means the host has closed
+            // the connection, the guest will find out once it received
+            // the data before it.
+            AutoLock lock(mIoLock);
+            mHostClosed = true;
+        }
+        signalGuestWakes();
+        if (!connected) {
+            break;
+        }
+    }
+}
+
+bool AdbGuestPipe::recvFromHost() {
+    AutoLock lock(mIoLock);
+    const size_t offset = mToGuest.head + mToGuest.count;
+    const size_t room = mToGuest.data.size() - mToGuest.count;
+    if (room == 0 || mHostRecvBusy) {
+        return true;
+    }
+    mHostRecvBusy = true;
+    lock.unlock();
+
+    SocketBuffer segments[2];
+    const int count = ringSegments(mToGuest.data, offset, room, segments);
+    const ssize_t len =
+            android::base::socketRecvV(mHostSocket.get(), segments, count);
+    const int recvErrno = errno;
+
+    lock.lock();
+    mHostRecvBusy = false;
+    if (len < 0) {
+        return recvErrno == EAGAIN || recvErrno == EWOULDBLOCK;
+    }
+    if (len == 0) {
+        return false;
+    }
+    DD("%s: [%p] received %d bytes", __func__, this, (int)len);
+    mToGuest.count += len;
+    return true;
+}
+
+bool AdbGuestPipe::sendToHost() {
+    AutoLock lock(mIoLock);
+    const size_t head = mToHost.head;
+    const size_t avail = mToHost.count;
+    lock.unlock();
+    if (avail == 0) {
+        return true;
+    }
+
+    SocketBuffer segments[2];
+    const int count = ringSegments(mToHost.data, head, avail, segments);
+    const ssize_t len =
+            android::base::socketSendV(mHostSocket.get(), segments, count);
+    if (len < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    if (len == 0) {
+        return false;
+    }
+    DD("%s: [%p] sent %d bytes", __func__, this, (int)len);
+
+    lock.lock();
+    mToHost.head = (mToHost.head + len) % mToHost.data.size();
+    mToHost.count -= len;
+    return true;
+}
+
+void AdbGuestPipe::signalGuestWakes() {
+    AutoLock lock(mIoLock);
+    int wakes = 0;
+    if (mToGuest.count > 0 || mHostClosed) {
+        wakes |= PIPE_WAKE_READ;
+    }
+    if (mToHost.count < mToHost.data.size() || mHostClosed) {
+        wakes |= PIPE_WAKE_WRITE;
+    }
+    wakes &= mGuestWakes;
+    mGuestWakes &= ~wakes;
+    lock.unlock();
+    if (wakes) {
+        signalWake(wakes);
+    }
+}
+
+int AdbGuestPipe::onGuestRecvData(AndroidPipeBuffer* buffers, int numBuffers) {
+    DD("%s: [%p] numBuffers=%d bytes=%d", __func__, this, numBuffers,
+        bufferBytes(buffers, numBuffers));
+    CHECK(mState == State::ProxyingData);
+    AutoLock lock(mIoLock);
+    const size_t head = mToGuest.head;
+    const size_t avail = mToGuest.count;
+    bool hostClosed = mHostClosed;
+    // With nothing in the ring, receive straight into the guest buffers,
+    // which saves a copy when the guest keeps up with the host.
+    const bool recvDirect = avail == 0 && !hostClosed && !mHostRecvBusy;
+    if (recvDirect) {
+        mHostRecvBusy = true;
+    }
+    lock.unlock();
+    if (recvDirect) {
+        const int result = recvFromHostDirect(buffers, numBuffers);
+        if (result != PIPE_ERROR_IO) {
             return result;
         }
-        buffers++;
-        numBuffers--;
+        hostClosed = true;
     }
-    return result;
+    if (avail == 0) {
+        if (!hostClosed) {
+            return PIPE_ERROR_AGAIN;
+        }
+        stopHostIo();
+        mState = State::ClosedByHost;
+        DINIT("%s: [%p] Adb closed by host",__func__, this);
+        return PIPE_ERROR_IO;
+    }
+
+    // Only copy the bytes here, mIoThread receives them from the host.
+    SocketBuffer segments[2];
+    const int count = ringSegments(mToGuest.data, head, avail, segments);
+    const size_t result = copyBuffers(buffers, numBuffers, segments, count);
+
+    lock.lock();
+    const bool wasAboveLowWater = mToGuest.count > kRingLowWater;
+    mToGuest.head = (mToGuest.head + result) % mToGuest.data.size();
+    mToGuest.count -= result;
+    const bool isAboveLowWater = mToGuest.count > kRingLowWater;
+    lock.unlock();
+    if (wasAboveLowWater && !isAboveLowWater) {
+        wakeHostIo();
+    }
+    return static_cast<int>(result);
+}
+
+int AdbGuestPipe::recvFromHostDirect(AndroidPipeBuffer* buffers,
+                                     int numBuffers) {
+    SocketBuffer segments[android::base::kSocketBuffersMax];
+    const int count = std::min(numBuffers, android::base::kSocketBuffersMax);
+    for (int n = 0; n < count; ++n) {
+        segments[n] = {buffers[n].data, buffers[n].size};
+    }
+    const ssize_t len =
+            android::base::socketRecvV(mHostSocket.get(), segments, count);
+    const bool closed = len == 0 || (len < 0 && errno != EAGAIN &&
+                                     errno != EWOULDBLOCK);
+
+    AutoLock lock(mIoLock);
+    mHostRecvBusy = false;
+    if (closed) {
+        mHostClosed = true;
+    }
+    const bool wakeIo = mIoRecvDeferred;
+    mIoRecvDeferred = false;
+    lock.unlock();
+    if (wakeIo) {
+        wakeHostIo();
+    }
+
+    if (closed) {
+        return PIPE_ERROR_IO;
+    }
+    if (len < 0) {
+        return PIPE_ERROR_AGAIN;
+    }
+    DD("%s: [%p] received %d bytes", __func__, this, (int)len);
+    return static_cast<int>(len);
 }
 
 int AdbGuestPipe::onGuestSendData(const AndroidPipeBuffer* buffers,
@@ -364,50 +628,34 @@ int AdbGuestPipe::onGuestSendData(const AndroidPipeBuffer* buffers,
     DD("%s: [%p] numBuffers=%d bytes=%d", __func__, this, numBuffers,
         bufferBytes(buffers, numBuffers));
     CHECK(mState == State::ProxyingData);
-    int result = 0;
-    while (numBuffers > 0) {
-        const uint8_t* data = buffers[0].data;
-        size_t dataSize = buffers[0].size;
-        while (dataSize > 0) {
-            ssize_t len;
-            {
-                ScopedVmUnlock unlockBql;
-                len = android::base::socketSend(mHostSocket->fd(),
-                                                data, dataSize);
-            }
-            if (len > 0) {
-                data += len;
-                dataSize -= len;
-                result += static_cast<int>(len);
-                if (dataSize != 0) {
-                    return result; // sent less than requested -> no more room.
-                } else {
-                    break;
-                }
-            }
-            if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                if (result == 0) {
-                    mHostSocket->dontWantWrite();
-                    return PIPE_ERROR_AGAIN;
-                }
-            } else {
-                // End of stream or i/o error means the guest has closed
-                // the connection.
-                if (result == 0) {
-                    mHostSocket.reset();
-                    mState = State::ClosedByHost;
-                    DINIT("%s: [%p] Adb closed by host",__func__, this);
-                    return PIPE_ERROR_IO;
-                }
-            }
-            // Some data was received so report it, the guest will have
-            // to try again to get an error.
-            return result;
-        }
-        buffers++;
-        numBuffers--;
+    AutoLock lock(mIoLock);
+    const size_t offset = mToHost.head + mToHost.count;
+    const size_t room = mToHost.data.size() - mToHost.count;
+    const bool hostClosed = mHostClosed;
+    lock.unlock();
+    if (hostClosed) {
+        stopHostIo();
+        mState = State::ClosedByHost;
+        DINIT("%s: [%p] Adb closed by host",__func__, this);
+        return PIPE_ERROR_IO;
     }
-    return result;
+    if (room == 0) {
+        return PIPE_ERROR_AGAIN;
+    }
+
+    // Only copy the bytes here, mIoThread sends them to the host.
+    SocketBuffer segments[2];
+    const int count = ringSegments(mToHost.data, offset, room, segments);
+    const size_t result = copyBuffers(segments, count, buffers, numBuffers);
+
+    lock.lock();
+    const bool wasEmpty = mToHost.count == 0;
+    mToHost.count += result;
+    lock.unlock();
+    if (wasEmpty && result > 0) {
+        wakeHostIo();
+    }
+    return static_cast<int>(result);
 }
 
 int AdbGuestPipe::onGuestRecvReply(AndroidPipeBuffer* buffers, int numBuffers) {
@@ -456,7 +704,7 @@ int AdbGuestPipe::onGuestSendCommand(const AndroidPipeBuffer* buffers,
                 // Mismatched, this is not what the pipe is expecting.
                 // Closing the connection now is easier than sending 'ko'.
                 DD("%s: [%p] mismatched command", __func__, this);
-                mHostSocket.reset();
+                mHostSocket.close();
                 return PIPE_ERROR_IO;
             }
             data += avail;
@@ -471,6 +719,7 @@ int AdbGuestPipe::onGuestSendCommand(const AndroidPipeBuffer* buffers,
                 } else if (mState == State::WaitingForGuestStartCommand) {
                     // Proxying data can start right now.
                     mState = State::ProxyingData;
+                    startHostIo();
                     // when -verbose, print a message indicating adb is connected
                     DINIT("%s: [%p] Adb connected, start proxing data",__func__, this);
                 }
@@ -503,7 +752,7 @@ void AdbGuestPipe::setExpectedGuestCommand(StringView command, State newState) {
 }
 
 void AdbGuestPipe::waitForHostConnection() {
-    if (mHostSocket.get()) {
+    if (mHostSocket.valid()) {
         // A host connection already exists! Send the 'ok' reply back to
         // the guest.
         DD("%s: [%p] sending reply", __func__, this);
@@ -11,16 +11,20 @@
 
 #pragma once
 
-#include "android/base/async/Looper.h"
-#include "android/base/async/ScopedSocketWatch.h"
+#include "android/base/sockets/ScopedSocket.h"
 #include "android/base/StringView.h"
+#include "android/base/synchronization/Lock.h"
+#include "android/base/threads/FunctorThread.h"
 #include "android/emulation/AndroidPipe.h"
 #include "android/emulation/AdbTypes.h"
 #include "android/featurecontrol/feature_control.h"
 #include "android/featurecontrol/FeatureControl.h"
 
+#include <memory>
 #include <vector>
 
+#include <stdint.h>
+
 namespace android {
 namespace emulation {
 
@@ -57,6 +61,14 @@ namespace emulation {
 //      data with the host ADB server (all data on the pipe should be
 //      proxied between the two at this point).
 //
+//      -> The data goes through two rings of host memory, one per
+//         direction. The guest commands only copy bytes to or from them,
+//         while a thread dedicated to the pipe does the host socket i/o,
+//         so that a slow ADB server never blocks a vCPU. While the ring
+//         to the guest is empty and the guest keeps reading, it receives
+//         from the non-blocking host socket by itself instead, which
+//         saves a copy.
+//
 // IMPORTANT NOTE: The adbd daemon will typically create a new AdbGuestPipe
 //                 instance just after that, but it will only 'accept'
 //                 one at a time. For more details see qemu_socket_thread()
@@ -152,9 +164,42 @@ private:
     // Used for debugging.
     static const char* toString(State);
 
-    // Called when an i/o event occurs on the host socket.
-    // |events| is a mask of FdWatch::kEventXXX flags.
-    void onHostSocketEvent(unsigned events);
+    // A fixed-size ring of bytes between the guest and the host socket.
+    // Each one has a single writer and a single reader, which copy the
+    // bytes without holding mIoLock, only its fields are protected by it.
+    struct Ring {
+        std::vector<uint8_t> data;
+        size_t head = 0;   // offset of the first byte to read in |data|.
+        size_t count = 0;  // number of bytes to read.
+    };
+
+    // Start or stop mIoThread, which proxies the data between the
+    // rings and the host socket.
+    void startHostIo();
+    void stopHostIo();
+
+    // Wake up mIoThread after the guest made room in, or added bytes to,
+    // a ring it may be waiting for.
+    void wakeHostIo();
+
+    // Main function of mIoThread.
+    void hostIoMain();
+
+    // Called from mIoThread to move bytes between the rings and the host
+    // socket, with a single vectored call each. Return false once the
+    // host socket is closed, or on i/o error.
+    bool recvFromHost();
+    bool sendToHost();
+
+    // Called from the device thread to receive from the host socket into
+    // the guest |buffers| when mToGuest is empty. Return the number of
+    // bytes received, PIPE_ERROR_AGAIN, or PIPE_ERROR_IO once the host
+    // socket is closed.
+    int recvFromHostDirect(AndroidPipeBuffer* buffers, int numBuffers);
+
+    // Wake the guest for the events it waits for and which occured.
+    // Called from mIoThread, or the device thread.
+    void signalGuestWakes();
 
     // Implement onGuestRecv() and onGuestSend() while proxying the data
     // between the guest and the host.
@@ -185,10 +230,25 @@ private:
     size_t mBufferPos = 0;   // number of matched command bytes on input/output.
 
     State mState = State::WaitingForGuestAcceptCommand;  // current pipe state.
-    android::base::ScopedSocketWatch
-            mHostSocket;  // current host socket, if connected.
+    ScopedSocket mHostSocket;  // current host socket, if connected.
     AdbHostAgent* mHostAgent = nullptr;
     bool mPlayStoreImage = false;
+
+    // Host i/o thread, and the socket pair used to wake it up.
+    std::unique_ptr<android::base::FunctorThread> mIoThread;
+    ScopedSocket mIoWakeRead;
+    ScopedSocket mIoWakeWrite;
+
+    // Protects the fields below, shared with mIoThread.
+    mutable android::base::Lock mIoLock;
+    Ring mToGuest;             // bytes received from the host socket.
+    Ring mToHost;              // bytes to send to the host socket.
+    bool mHostClosed = false;  // true once the host socket is closed.
+    bool mIoStopping = false;  // true to make mIoThread exit.
+    bool mHostRecvBusy = false;    // true while receiving from the host.
+    bool mIoRecvDeferred = false;  // true if mIoThread waits for the guest
+                                   // to be done receiving.
+    int mGuestWakes = 0;       // PIPE_WAKE_XXX flags the guest waits for.
 };
 
 }  // namespace emulation
@@ -0,0 +1,75 @@
+// Copyright 2017 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// A benchmark of the data transfers from the host ADB server to the guest
+// adbd, as done by 'adb push' or 'adb install'.
+
+#include "android/emulation/AdbGuestPipe.h"
+
+#include "android/base/Log.h"
+#include "android/emulation/testing/MockAdbHostAgent.h"
+#include "android/emulation/testing/TestAndroidPipeDevice.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark_api.h"
+
+using android::emulation::MockAdbHostAgent;
+using android::TestAndroidPipeDevice;
+
+using TestGuest = TestAndroidPipeDevice::Guest;
+
+namespace {
+
+const size_t kTransferSize = 64 * 1024 * 1024;
+
+}  // namespace
+
+// Sends kTransferSize bytes from the host to the guest through a new ADB
+// pipe, which the guest reads state.range_x() bytes at a time. Like a vCPU,
+// the guest tries again as soon as there is no data to read.
+void BM_AdbGuestPipe_HostToGuest(benchmark::State& state) {
+    TestAndroidPipeDevice testDevice;
+    MockAdbHostAgent adbHost;
+
+    const std::string data(kTransferSize, 'x');
+    std::vector<char> buffer(state.range_x());
+    while (state.KeepRunning()) {
+        std::unique_ptr<TestGuest> guest(TestGuest::create());
+        guest->connect("qemud:adb");
+        guest->write("accept", 6);
+        adbHost.createFakeConnection(data);
+
+        char reply[2];
+        guest->read(reply, sizeof(reply));
+        guest->write("start", 5);
+
+        size_t received = 0;
+        while (received < kTransferSize) {
+            const ssize_t ret = guest->read(buffer.data(), buffer.size());
+            if (ret > 0) {
+                received += ret;
+            } else if (ret != PIPE_ERROR_AGAIN) {
+                LOG(FATAL) << "ADB pipe closed after " << received << " bytes";
+            }
+        }
+        // Let the host close the connection.
+        guest->write("x", 1);
+        guest->close();
+    }
+    state.SetBytesProcessed(state.iterations() * kTransferSize);
+}
+
+// A page, and the largest payloads of ADB packets before and after
+// Android N.
+BENCHMARK(BM_AdbGuestPipe_HostToGuest)->Arg(4096)->Arg(65536)->Arg(262144);
@@ -11,12 +11,10 @@
 
 #include "android/emulation/AdbGuestPipe.h"
 
-#include "android/base/async/ThreadLooper.h"
 #include "android/base/Log.h"
-#include "android/base/sockets/ScopedSocket.h"
-#include "android/base/sockets/SocketUtils.h"
 #include "android/base/StringFormat.h"
-#include "android/base/threads/Thread.h"
+#include "android/base/system/System.h"
+#include "android/emulation/testing/MockAdbHostAgent.h"
 #include "android/emulation/testing/TestAndroidPipeDevice.h"
 
 #include <gtest/gtest.h>
@@ -27,13 +25,14 @@
 #undef ERROR
 #endif
 
+#include <algorithm>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace android {
 namespace emulation {
 
-using android::base::ScopedSocket;
 using android::base::StringFormat;
 using android::base::StringView;
 
@@ -41,118 +40,17 @@ using TestGuest = TestAndroidPipeDevice::Guest;
 
 namespace {
 
-// A Mock AdbHostAgent that will be used during testing. It doesn't depend
-// on any TCP ports.
-class MockAdbHostAgent : public AdbHostAgent {
-public:
-    MockAdbHostAgent() {
-        auto service = new AdbGuestPipe::Service(this);
-        mGuestAgent = service;
-        AndroidPipe::Service::add(service);
-    }
-
-    ~MockAdbHostAgent() {
-        if (mThread.get()) {
-            mThread->wait(nullptr);
-        }
-        AndroidPipe::Service::resetAll();
-    }
-
-    // AdbHostAgent overrides.
-    void setAgent(AdbGuestAgent* guestAgent) { mGuestAgent = guestAgent; }
-
-    virtual void startListening() override { mListening = true; }
-    virtual void stopListening() override { mListening = false; }
-    virtual void notifyServer() override { mServerNotificationCount++; }
-
-    // Accessors.
-    virtual bool isListening() const { return mListening; }
-
-    virtual int serverNotificationCount() const {
-        return mServerNotificationCount;
-    }
-
-    // Create a socket pair and a thread that will push |data| into it
-    // before trying to read a single byte from one end of the pair.
-    // The other end is passed to a new active guest.
-    void createFakeConnection(StringView data) {
-        CHECK(mListening);
-        if (mThread.get()) {
-            mThread->wait(nullptr);
-        }
-        mThread.reset(new ConnectorThread(data));
-        mListening = false;
-        mGuestAgent->onHostConnection(mThread->releaseOutSocket());
-        mThread->start();
-    }
-
-private:
-    // A small thread that will connect to a given port and send some
-    // data through the socket. It will then try to read a single byte
-    // before exiting.
-    class ConnectorThread : public android::base::Thread {
-    public:
-        ConnectorThread(StringView data) : Thread(), mData(data) {
-            int inSocket, outSocket;
-            if (android::base::socketCreatePair(&inSocket, &outSocket) < 0) {
-                PLOG(ERROR) << "Could not create socket pair";
-                return;
-            }
-            // Make the sockets blocking for this test to work.
-            android::base::socketSetBlocking(inSocket);
-            android::base::socketSetBlocking(outSocket);
-
-            mInSocket.reset(inSocket);
-            mOutSocket.reset(outSocket);
-        }
-
-        bool valid() const { return mInSocket.valid() && mOutSocket.valid(); }
-
-        int releaseOutSocket() { return mOutSocket.release(); }
-
-        virtual intptr_t main() override {
-            if (mData.size() > 0) {
-                if (!android::base::socketSendAll(
-                            mInSocket.get(), mData.c_str(), mData.size())) {
-                    DPLOG(ERROR) << "I/O error when sending data";
-                    return -1;
-                }
-            }
-            char buf[1] = {};
-            ssize_t len = android::base::socketRecv(mInSocket.get(), buf,
-                                                    sizeof(buf));
-            if (len < 0) {
-                DPLOG(ERROR) << "I/O error when receiving data";
-            } else if (len == 0) {
-                DLOG(ERROR) << "Disconnected";
-            }
-            mInSocket.close();
-            return 0;
-        }
-
-    private:
-        ScopedSocket mInSocket;
-        ScopedSocket mOutSocket;
-        std::string mData;
-    };
-
-    AdbGuestAgent* mGuestAgent = nullptr;
-    bool mListening = false;
-    int mServerNotificationCount = 0;
-    std::unique_ptr<ConnectorThread> mThread;
-};
-
-// The socket associated with |guest| is in non-blocking mode, which
-// means that read() attempts will sometimes return PIPE_ERROR_AGAIN.
+// The data sent to |guest| is received by the i/o thread of its pipe,
+// which means that read() attempts will sometimes return PIPE_ERROR_AGAIN.
 // This function handles these by waiting a little, giving some time
-// slices for the ConnectorThread to write properly.
+// slices for the ConnectorThread and the i/o thread to write properly.
 int blockingRead(TestGuest* guest, void* buffer, size_t size) {
     int ret = guest->read(buffer, size);
-    if (ret != PIPE_ERROR_AGAIN) {
-        return ret;
+    for (int n = 0; n < 500 && ret == PIPE_ERROR_AGAIN; n++) {
+        android::base::System::get()->sleepMs(2);
+        ret = guest->read(buffer, size);
     }
-    android::base::ThreadLooper::get()->runWithTimeoutMs(2);
-    return guest->read(buffer, size);
+    return ret;
 }
 
 }  // namespace
@@ -335,6 +233,48 @@ TEST(AdbGuestPipe, createGuestWhichClosesTheConnection) {
     guest->close();
 }
 
+TEST(AdbGuestPipe, receiveDataLargerThanRing) {
+    TestAndroidPipeDevice testDevice;
+
+    MockAdbHostAgent adbHost;
+
+    auto guest = TestGuest::create();
+    EXPECT_TRUE(guest);
+    EXPECT_EQ(0, guest->connect("qemud:adb"));
+    EXPECT_EQ(6, guest->write("accept", 6));
+
+    // Enough data to wrap around the ring of the pipe a few times.
+    std::string message(3 * 1024 * 1024 + 7, '\0');
+    for (size_t n = 0; n < message.size(); ++n) {
+        message[n] = static_cast<char>(n * 7 + n / 4096);
+    }
+    adbHost.createFakeConnection(message);
+
+    char reply[3] = {};
+    EXPECT_EQ(2, guest->read(reply, 2));
+    EXPECT_STREQ("ok", reply);
+    EXPECT_EQ(5, guest->write("start", 5));
+
+    std::string buffer(message.size(), '\0');
+    size_t received = 0;
+    while (received < buffer.size()) {
+        const int ret = blockingRead(guest, &buffer[received],
+                                     std::min<size_t>(100000,
+                                                      buffer.size() - received));
+        ASSERT_LT(0, ret) << received;
+        received += ret;
+    }
+    EXPECT_TRUE(message == buffer);
+
+    // The host closes the connection after this, which the guest gets as
+    // an i/o error once there is no more data.
+    EXPECT_EQ(1, guest->write("x", 1));
+    EXPECT_EQ(PIPE_ERROR_IO, blockingRead(guest, &buffer[0], 1));
+    EXPECT_EQ(PIPE_POLL_HUP, guest->poll());
+
+    guest->close();
+}
+
 TEST(AdbGuestPipe, createMultipleGuestConnections) {
     TestAndroidPipeDevice testDevice;
 
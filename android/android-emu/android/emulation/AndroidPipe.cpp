@@ -70,8 +70,11 @@ static BaseStream* asBaseStream(CStream* stream) {
 // doesn't hold the VM state lock.
 #if (DEBUG > 0) || !defined(NDEBUG)
 #define CHECK_VM_STATE_LOCK()  CHECK(VmLock::get()->isLockedBySelf())
+#define CHECK_VM_STATE_LOCK_UNLESS_THREAD_SAFE(pipe) \
+    CHECK((pipe)->canRunWithoutVmLock() || VmLock::get()->isLockedBySelf())
 #else
 #define CHECK_VM_STATE_LOCK() (void)0
+#define CHECK_VM_STATE_LOCK_UNLESS_THREAD_SAFE(pipe) (void)0
 #endif
 
 namespace android {
@@ -315,7 +318,8 @@ public:
 
 // A helper class used to send signalWake() and closeFromHost() commands to
 // the device thread, depending on the threading mode setup by the emulation
-// engine.
+// engine. Devices implementing AndroidPipeHwFuncs::queueWake() get the
+// commands directly, as they are sent by the render threads on every reply.
 struct PipeWakeCommand {
     void* hwPipe;
     int wakeFlags;
@@ -324,6 +328,10 @@ struct PipeWakeCommand {
 class PipeWaker final : public DeviceContextRunner<PipeWakeCommand> {
 public:
     void signalWake(void* hwPipe, int wakeFlags) {
+        if (sPipeHwFuncs->queueWake) {
+            sPipeHwFuncs->queueWake(hwPipe, wakeFlags);
+            return;
+        }
         queueDeviceOperation({ hwPipe, wakeFlags });
     }
     void closeFromHost(void* hwPipe) {
@@ -563,9 +571,14 @@ void* android_pipe_guest_load_legacy(CStream* stream,
                                                       pClosed, pForceClose);
 }
 
+bool android_pipe_guest_is_thread_safe(void* internalPipe) {
+    auto pipe = static_cast<AndroidPipe*>(internalPipe);
+    return pipe && pipe->canRunWithoutVmLock();
+}
+
 unsigned android_pipe_guest_poll(void* internalPipe) {
-    CHECK_VM_STATE_LOCK();
     auto pipe = static_cast<AndroidPipe*>(internalPipe);
+    CHECK_VM_STATE_LOCK_UNLESS_THREAD_SAFE(pipe);
     DD("%s: host=%p [%s]", __FUNCTION__, pipe, pipe->name());
     return pipe->onGuestPoll();
 }
@@ -573,22 +586,22 @@ unsigned android_pipe_guest_poll(void* internalPipe) {
 int android_pipe_guest_recv(void* internalPipe,
                             AndroidPipeBuffer* buffers,
                             int numBuffers) {
-    CHECK_VM_STATE_LOCK();
     auto pipe = static_cast<AndroidPipe*>(internalPipe);
+    CHECK_VM_STATE_LOCK_UNLESS_THREAD_SAFE(pipe);
     return pipe->onGuestRecv(buffers, numBuffers);
 }
 
 int android_pipe_guest_send(void* internalPipe,
                             const AndroidPipeBuffer* buffers,
                             int numBuffers) {
-    CHECK_VM_STATE_LOCK();
     auto pipe = static_cast<AndroidPipe*>(internalPipe);
+    CHECK_VM_STATE_LOCK_UNLESS_THREAD_SAFE(pipe);
     return pipe->onGuestSend(buffers, numBuffers);
 }
 
 void android_pipe_guest_wake_on(void* internalPipe, unsigned wakes) {
-    CHECK_VM_STATE_LOCK();
     auto pipe = static_cast<AndroidPipe*>(internalPipe);
+    CHECK_VM_STATE_LOCK_UNLESS_THREAD_SAFE(pipe);
     pipe->onGuestWantWakeOn(wakes);
 }
 
@@ -54,7 +54,9 @@ namespace android {
 //    method will be called iff 'canLoad()' is overloaded to return true.
 //
 // 4) During pipe operations, onGuestXXX() methods will be called from the
-//    device thread to operate on the pipe.
+//    device thread to operate on the pipe. Services that can do without the
+//    global VM lock may have their pipes' reads and writes called from any
+//    thread instead, see Service::canRunWithoutVmLock().
 //
 // 5) The signalWake() and closeFromHost() pipe methods can be called from
 //    any thread to signal i/o events, or ask for the pipe closure.
@@ -96,6 +98,14 @@ public:
         // false.
         virtual bool canLoad() const { return false; }
 
+        // Returns true if the onGuestPoll(), onGuestRecv(), onGuestSend()
+        // and onGuestWantWakeOn() methods of the service's pipes can be
+        // called from any thread, without the global VM lock. The virtual
+        // device still never calls two of them at the same time on the same
+        // pipe, and all other methods keep being called from the device
+        // thread. The default implementation returns false.
+        virtual bool canRunWithoutVmLock() const { return false; }
+
         // Load a pipe instance from input |stream|. Only called if
         // canLoad() returns true. Default implementation returns nullptr
         // to indicate an error loading the instance.
@@ -179,6 +189,12 @@ public:
         return mService ? mService->name().c_str() : "<null>";
     }
 
+    // Return true if the guest operations on this pipe can be performed
+    // without the global VM lock, see Service::canRunWithoutVmLock().
+    bool canRunWithoutVmLock() const {
+        return mService && mService->canRunWithoutVmLock();
+    }
+
     // The following functions are implementation details. They are in the
     // public scope to make the implementation of android_pipe_guest_save()
     // and android_pipe_guest_load() easier. DO NOT CALL THEM DIRECTLY.
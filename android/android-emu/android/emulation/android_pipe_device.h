@@ -148,6 +148,12 @@ extern void* android_pipe_guest_load_legacy(Stream* file,
                                             unsigned char* closed,
                                             char* force_close);
 
+// Return true if the poll(), recvBuffers(), sendBuffers() and wakeOn()
+// callbacks of the client associated with |pipe| can be called without the
+// global VM lock, from any thread, as long as they are not called
+// concurrently for the same |pipe|.
+extern bool android_pipe_guest_is_thread_safe(void* internal_pipe);
+
 // Call the poll() callback of the client associated with |pipe|.
 extern unsigned android_pipe_guest_poll(void* internal_pipe);
 
@@ -171,6 +177,12 @@ typedef struct AndroidPipeHwFuncs {
     void (*resetPipe)(void* hwpipe, void* internal_pipe);
     void (*closeFromHost)(void* hwpipe);
     void (*signalWake)(void* hwpipe, unsigned flags);
+    // Optional. Same as signalWake(), or closeFromHost() if |flags| has
+    // PIPE_WAKE_CLOSED, but can be called from any thread, without the VM
+    // lock. The device coalesces the wakes of each pipe until it can apply
+    // them. If NULL, these wakes are queued and applied from a main loop
+    // timer instead.
+    void (*queueWake)(void* hwpipe, unsigned flags);
 } AndroidPipeHwFuncs;
 
 // Change the set of AndroidPipeHwFuncs corresponding to the hardware virtual
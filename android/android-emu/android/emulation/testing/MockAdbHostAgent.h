@@ -0,0 +1,132 @@
+// Copyright 2017 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#pragma once
+
+#include "android/base/Log.h"
+#include "android/base/sockets/ScopedSocket.h"
+#include "android/base/sockets/SocketUtils.h"
+#include "android/base/StringView.h"
+#include "android/base/threads/Thread.h"
+#include "android/emulation/AdbGuestPipe.h"
+
+#include <memory>
+#include <string>
+
+namespace android {
+namespace emulation {
+
+// A Mock AdbHostAgent that will be used during testing. It doesn't depend
+// on any TCP ports.
+class MockAdbHostAgent : public AdbHostAgent {
+public:
+    using ScopedSocket = android::base::ScopedSocket;
+    using StringView = android::base::StringView;
+
+    MockAdbHostAgent() {
+        auto service = new AdbGuestPipe::Service(this);
+        mGuestAgent = service;
+        AndroidPipe::Service::add(service);
+    }
+
+    ~MockAdbHostAgent() {
+        if (mThread.get()) {
+            mThread->wait(nullptr);
+        }
+        AndroidPipe::Service::resetAll();
+    }
+
+    // AdbHostAgent overrides.
+    void setAgent(AdbGuestAgent* guestAgent) { mGuestAgent = guestAgent; }
+
+    virtual void startListening() override { mListening = true; }
+    virtual void stopListening() override { mListening = false; }
+    virtual void notifyServer() override { mServerNotificationCount++; }
+
+    // Accessors.
+    virtual bool isListening() const { return mListening; }
+
+    virtual int serverNotificationCount() const {
+        return mServerNotificationCount;
+    }
+
+    // Create a socket pair and a thread that will push |data| into it
+    // before trying to read a single byte from one end of the pair.
+    // The other end is passed to a new active guest.
+    void createFakeConnection(StringView data) {
+        CHECK(mListening);
+        if (mThread.get()) {
+            mThread->wait(nullptr);
+        }
+        mThread.reset(new ConnectorThread(data));
+        mListening = false;
+        mGuestAgent->onHostConnection(mThread->releaseOutSocket());
+        mThread->start();
+    }
+
+private:
+    // A small thread that will connect to a given port and send some
+    // data through the socket. It will then try to read a single byte
+    // before exiting.
+    class ConnectorThread : public android::base::Thread {
+    public:
+        ConnectorThread(StringView data) : Thread(), mData(data) {
+            int inSocket, outSocket;
+            if (android::base::socketCreatePair(&inSocket, &outSocket) < 0) {
+                PLOG(ERROR) << "Could not create socket pair";
+                return;
+            }
+            // Make the sockets blocking for this test to work.
+            android::base::socketSetBlocking(inSocket);
+            android::base::socketSetBlocking(outSocket);
+
+            mInSocket.reset(inSocket);
+            mOutSocket.reset(outSocket);
+        }
+
+        bool valid() const { return mInSocket.valid() && mOutSocket.valid(); }
+
+        int releaseOutSocket() { return mOutSocket.release(); }
+
+        virtual intptr_t main() override {
+            if (mData.size() > 0) {
+                if (!android::base::socketSendAll(
+                            mInSocket.get(), mData.c_str(), mData.size())) {
+                    DPLOG(ERROR) << "I/O error when sending data";
+                    return -1;
+                }
+            }
+            char buf[1] = {};
+            ssize_t len = android::base::socketRecv(mInSocket.get(), buf,
+                                                    sizeof(buf));
+            if (len < 0) {
+                DPLOG(ERROR) << "I/O error when receiving data";
+            } else if (len == 0) {
+                DLOG(ERROR) << "Disconnected";
+            }
+            mInSocket.close();
+            return 0;
+        }
+
+    private:
+        ScopedSocket mInSocket;
+        ScopedSocket mOutSocket;
+        std::string mData;
+    };
+
+    AdbGuestAgent* mGuestAgent = nullptr;
+    bool mListening = false;
+    int mServerNotificationCount = 0;
+    std::unique_ptr<ConnectorThread> mThread;
+};
+
+}  // namespace emulation
+}  // namespace android
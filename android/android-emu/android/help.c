@@ -1293,6 +1293,7 @@ help_camera_back(stralloc_t* out)
 
     "     emulated  -> camera will be emulated using software ('fake') camera emulation\n"
     "     webcam<N> -> camera will be emulated using a webcamera connected to the host\n"
+    "     remote    -> camera will be emulated using the frames sent by a remote client\n"
     "     none      -> camera emulation will be disabled\n\n"
     );
 }
@@ -1306,6 +1307,7 @@ help_camera_front(stralloc_t* out)
 
     "     emulated  -> camera will be emulated using software ('fake') camera emulation\n"
     "     webcam<N> -> camera will be emulated using a webcamera connected to the host\n"
+    "     remote    -> camera will be emulated using the frames sent by a remote client\n"
     "     none      -> camera emulation will be disabled\n\n"
     );
 }
@@ -0,0 +1,235 @@
+/* Copyright (C) 2017 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+#include "android/jpeg-decompress.h"
+#include "android/utils/debug.h"
+
+#include "jinclude.h"
+#include "jpeglib.h"
+
+#include <setjmp.h>
+#include <string.h>
+
+#define  D(...)    VERBOSE_PRINT(camera,__VA_ARGS__)
+
+/* Error manager that returns to jpeg_decompress_yuv420 instead of exiting
+ * the process, like the default one does. */
+typedef struct AJPEGErrorMgr {
+    /* Common JPEG error manager header. */
+    struct jpeg_error_mgr   common;
+    /* Where to jump on errors. */
+    jmp_buf                 on_error;
+} AJPEGErrorMgr;
+
+/********************************************************************************
+ *                      jpeglib callbacks.
+ *******************************************************************************/
+
+/* Implements JPEG error manager's error_exit routine. */
+static void
+_on_error_exit(j_common_ptr cinfo)
+{
+    AJPEGErrorMgr* const err = (AJPEGErrorMgr*)cinfo->err;
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->on_error, 1);
+}
+
+/* Implements JPEG error manager's output_message routine. */
+static void
+_on_output_message(j_common_ptr cinfo)
+{
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, msg);
+    D("%s: %s", __FUNCTION__, msg);
+}
+
+/* Implements JPEG source manager's init_source and term_source routines.
+ * The whole image is already in memory, so there is nothing to do. */
+static void
+_on_init_source(j_decompress_ptr cinfo)
+{
+}
+
+static void
+_on_term_source(j_decompress_ptr cinfo)
+{
+}
+
+/* Implements JPEG source manager's fill_input_buffer routine. This is only
+ * called past the end of the image, when it is truncated: same as the stdio
+ * source manager does at the end of a file, insert a fake EOI marker, so that
+ * the decoder stops with a warning rather than an error. */
+static boolean
+_on_fill_input_buffer(j_decompress_ptr cinfo)
+{
+    static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = sizeof(eoi);
+    return TRUE;
+}
+
+/* Implements JPEG source manager's skip_input_data routine. */
+static void
+_on_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+    struct jpeg_source_mgr* const src = cinfo->src;
+    if (num_bytes <= 0) {
+        return;
+    }
+    if ((size_t)num_bytes > src->bytes_in_buffer) {
+        _on_fill_input_buffer(cinfo);
+    } else {
+        src->next_input_byte += num_bytes;
+        src->bytes_in_buffer -= num_bytes;
+    }
+}
+
+/********************************************************************************
+ *                      JPEG decompressor API.
+ *******************************************************************************/
+
+/* Checks that the image is YUV 4:2:0 with the expected dimensions. */
+static int
+_is_yuv420(const struct jpeg_decompress_struct* cinfo, int width, int height)
+{
+    const jpeg_component_info* const comp = cinfo->comp_info;
+    return cinfo->jpeg_color_space == JCS_YCbCr &&
+           cinfo->num_components == 3 &&
+           (int)cinfo->image_width == width &&
+           (int)cinfo->image_height == height &&
+           comp[0].h_samp_factor == 2 && comp[0].v_samp_factor == 2 &&
+           comp[1].h_samp_factor == 1 && comp[1].v_samp_factor == 1 &&
+           comp[2].h_samp_factor == 1 && comp[2].v_samp_factor == 1;
+}
+
+/* Sets the rows where the decoder outputs 'count' lines of a pane, starting
+ * at 'line'. The decoder writes whole blocks, so the lines that are past the
+ * end of the pane, or too short for the blocks, go to the scratch rows. */
+static void
+_set_pane_rows(JSAMPARRAY rows, JSAMPARRAY scratch, int count,
+               uint8_t* pane, int stride, int line, int lines, int direct)
+{
+    int n;
+    for (n = 0; n < count; n++) {
+        rows[n] = (direct && line + n < lines) ? pane + (line + n) * stride
+                                               : scratch[n];
+    }
+}
+
+/* Copies the lines of a pane that the decoder wrote to the scratch rows. */
+static void
+_copy_scratch_rows(JSAMPARRAY rows, int count, uint8_t* pane, int stride,
+                   int line, int lines, int width)
+{
+    int n;
+    for (n = 0; n < count && line + n < lines; n++) {
+        uint8_t* const dst = pane + (line + n) * stride;
+        if (rows[n] != dst) {
+            memcpy(dst, rows[n], width);
+        }
+    }
+}
+
+int
+jpeg_decompress_yuv420(const void* jpeg, size_t jpeg_size,
+                       int width, int height,
+                       uint8_t* y, int y_stride,
+                       uint8_t* u, uint8_t* v, int uv_stride)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_source_mgr src;
+    AJPEGErrorMgr err;
+    JSAMPROW y_rows[2 * DCTSIZE];
+    JSAMPROW u_rows[DCTSIZE];
+    JSAMPROW v_rows[DCTSIZE];
+    JSAMPARRAY panes[3] = { y_rows, u_rows, v_rows };
+    JSAMPARRAY scratch;
+    int y_direct, uv_direct;
+
+    if (width <= 0 || height <= 0 || (width & 1) || (height & 1)) {
+        return -1;
+    }
+
+    memset(&cinfo, 0, sizeof(cinfo));
+    cinfo.err = jpeg_std_error(&err.common);
+    err.common.error_exit = _on_error_exit;
+    err.common.output_message = _on_output_message;
+    if (setjmp(err.on_error)) {
+        jpeg_destroy_decompress(&cinfo);
+        return -1;
+    }
+    jpeg_create_decompress(&cinfo);
+
+    memset(&src, 0, sizeof(src));
+    src.next_input_byte     = (const JOCTET*)jpeg;
+    src.start_input_byte    = (const JOCTET*)jpeg;
+    src.bytes_in_buffer     = jpeg_size;
+    src.current_offset      = jpeg_size;
+    src.init_source         = _on_init_source;
+    src.fill_input_buffer   = _on_fill_input_buffer;
+    src.skip_input_data     = _on_skip_input_data;
+    src.resync_to_restart   = jpeg_resync_to_restart;
+    src.term_source         = _on_term_source;
+    cinfo.src = &src;
+
+    jpeg_read_header(&cinfo, TRUE);
+    if (!_is_yuv420(&cinfo, width, height)) {
+        D("%s: Expected a %dx%d YUV 4:2:0 image", __FUNCTION__, width, height);
+        jpeg_destroy_decompress(&cinfo);
+        return -1;
+    }
+
+    /* Get the downsampled planes as they are in the image. */
+    cinfo.raw_data_out = TRUE;
+    cinfo.out_color_space = JCS_YCbCr;
+    cinfo.dct_method = JDCT_IFAST;
+    jpeg_start_decompress(&cinfo);
+
+    /* 16 scratch rows for Y, then 8 for U and 8 for V. */
+    scratch = (*cinfo.mem->alloc_sarray)(
+            (j_common_ptr)&cinfo, JPOOL_IMAGE,
+            cinfo.comp_info[0].width_in_blocks * DCTSIZE, 4 * DCTSIZE);
+    y_direct = y_stride >= (int)(cinfo.comp_info[0].width_in_blocks * DCTSIZE);
+    uv_direct = uv_stride >= (int)(cinfo.comp_info[1].width_in_blocks * DCTSIZE) &&
+                uv_stride >= (int)(cinfo.comp_info[2].width_in_blocks * DCTSIZE);
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        const int line = cinfo.output_scanline;
+        _set_pane_rows(y_rows, scratch, 2 * DCTSIZE,
+                       y, y_stride, line, height, y_direct);
+        _set_pane_rows(u_rows, scratch + 2 * DCTSIZE, DCTSIZE,
+                       u, uv_stride, line / 2, height / 2, uv_direct);
+        _set_pane_rows(v_rows, scratch + 3 * DCTSIZE, DCTSIZE,
+                       v, uv_stride, line / 2, height / 2, uv_direct);
+        if (jpeg_read_raw_data(&cinfo, panes, 2 * DCTSIZE) == 0) {
+            /* Can't happen, the source never suspends. */
+            jpeg_destroy_decompress(&cinfo);
+            return -1;
+        }
+        _copy_scratch_rows(y_rows, 2 * DCTSIZE, y, y_stride,
+                           line, height, width);
+        _copy_scratch_rows(u_rows, DCTSIZE, u, uv_stride,
+                           line / 2, height / 2, width / 2);
+        _copy_scratch_rows(v_rows, DCTSIZE, v, uv_stride,
+                           line / 2, height / 2, width / 2);
+    }
+
+    /* No need to read the end of the image. A truncated, or corrupted image
+     * is only decoded partially, with warnings: reject it too. */
+    if (err.common.num_warnings) {
+        D("%s: Corrupted image", __FUNCTION__);
+        jpeg_destroy_decompress(&cinfo);
+        return -1;
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return 0;
+}
@@ -0,0 +1,55 @@
+/* Copyright (C) 2017 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+#pragma once
+
+#include "android/utils/compiler.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+/*
+ * Contains declaration of utility routines that decompress a JPEG image into
+ * a YUV frame.
+ *
+ * NOTE: Same as android/jpeg-compress.h, this code uses the jpeglib library
+ * located in android/third_party/jpeg-6b, and is compiled separately.
+ */
+
+/* Decompresses a JPEG image with YUV 4:2:0 sampling (the usual output of the
+ * MJPEG cameras and encoders) into the three panes of a YUV 4:2:0 frame.
+ * The decoder outputs the downsampled Y, Cb and Cr samples as they are, so
+ * no color conversion or upsampling happens here.
+ * Param:
+ *  jpeg, jpeg_size - The JPEG image.
+ *  width, height - Expected dimensions of the image, both even.
+ *  y, y_stride - Y pane, and the distance in bytes between its lines.
+ *  u, v, uv_stride - U (Cb) and V (Cr) panes, and the distance in bytes
+ *      between their lines.
+ * Return:
+ *  0 on success, or -1 if the image is corrupted, doesn't have the expected
+ *  dimensions, or isn't YUV 4:2:0. Errors are never fatal, so that the
+ *  images can come from an untrusted source.
+ */
+extern int jpeg_decompress_yuv420(const void* jpeg,
+                                  size_t jpeg_size,
+                                  int width,
+                                  int height,
+                                  uint8_t* y,
+                                  int y_stride,
+                                  uint8_t* u,
+                                  uint8_t* v,
+                                  int uv_stride);
+
+ANDROID_END_HEADER
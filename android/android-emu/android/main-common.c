@@ -1624,9 +1624,10 @@ bool emulator_parseCommonCommandLineOptions(int* p_argc,
         /* Validate parameter. */
         if (memcmp(opts->camera_back, "webcam", 6) &&
             strcmp(opts->camera_back, "emulated") &&
+            strcmp(opts->camera_back, "remote") &&
             strcmp(opts->camera_back, "none")) {
             derror("Invalid value for -camera-back <mode> parameter: %s\n"
-                   "Valid values are: 'emulated', 'webcam<N>', or 'none'\n",
+                   "Valid values are: 'emulated', 'webcam<N>', 'remote', or 'none'\n",
                    opts->camera_back);
             return false;
         }
@@ -1637,9 +1638,10 @@ bool emulator_parseCommonCommandLineOptions(int* p_argc,
         /* Validate parameter. */
         if (memcmp(opts->camera_front, "webcam", 6) &&
             strcmp(opts->camera_front, "emulated") &&
+            strcmp(opts->camera_front, "remote") &&
             strcmp(opts->camera_front, "none")) {
             derror("Invalid value for -camera-front <mode> parameter: %s\n"
-                   "Valid values are: 'emulated', 'webcam<N>', or 'none'\n",
+                   "Valid values are: 'emulated', 'webcam<N>', 'remote', or 'none'\n",
                    opts->camera_front);
             return false;
         }
@@ -540,6 +540,10 @@ void multitouch_update_pointer(MTESource source,
     }
 }
 
+void multitouch_sync(void) {
+    _push_event(EV_SYN, LINUX_SYN_REPORT, 0);
+}
+
 int
 multitouch_get_max_slot()
 {
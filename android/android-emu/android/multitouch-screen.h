@@ -77,6 +77,10 @@ extern void multitouch_update_pointer(MTESource source,
                                       int pressure,
                                       bool skip_sync);
 
+/* Reports the pointer updates made with |skip_sync| so far as one event,
+ * i.e. sends the EV_SYN they skipped. */
+extern void multitouch_sync(void);
+
 /* Gets maximum slot index available for the multi-touch emulation. */
 extern int multitouch_get_max_slot();
 
@@ -75,6 +75,10 @@ public:
 
         // Really cannot save/load these pipes' state.
         virtual bool canLoad() const override { return false; }
+
+        // The render channel has its own lock, so the guest's GL commands
+        // don't have to wait for the global VM lock on their way to it.
+        virtual bool canRunWithoutVmLock() const override { return true; }
     };
 
     /////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,144 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/opengl/transport_stats.h"
+
+#include "android/base/async/ThreadLooper.h"
+#include "android/base/memory/LazyInstance.h"
+#include "android/base/StringFormat.h"
+#include "android/base/system/System.h"
+
+#include <memory>
+#include <vector>
+
+#include <inttypes.h>
+#include <stdio.h>
+
+using android::base::LazyInstance;
+using android::base::Looper;
+using android::base::StringAppendFormat;
+using android::base::StringFormat;
+using android::base::System;
+using android::base::ThreadLooper;
+
+namespace android {
+namespace opengl {
+
+std::string formatTransportStats(const AndroidOpenglesTransportStats& stats) {
+    std::string line = StringFormat(
+            "session %d: in %" PRIu64 " B/s (%" PRIu64 " B), out %" PRIu64
+            " B/s (%" PRIu64 " B), queue %u/%u pages (max %u), "
+            "round trips %" PRIu64 ", latency",
+            stats.session, stats.bytesInPerSec, stats.bytesIn,
+            stats.bytesOutPerSec, stats.bytesOut, stats.queuedPages,
+            stats.queueSize, stats.maxQueuedPages, stats.roundTrips);
+    for (int i = 0; i < ANDROID_OPENGLES_LATENCY_BUCKETS; i++) {
+        const bool last = i == ANDROID_OPENGLES_LATENCY_BUCKETS - 1;
+        // The last bucket has the same bound as the one before, from above.
+        const int limitUs = 250 << (last ? i - 1 : i);
+        StringAppendFormat(&line, " %s%d%s:%" PRIu64, last ? ">=" : "<",
+                           limitUs < 1000 ? limitUs : limitUs / 1000,
+                           limitUs < 1000 ? "us" : "ms",
+                           stats.latencyHistogram[i]);
+    }
+    return line;
+}
+
+}  // namespace opengl
+}  // namespace android
+
+using android::opengl::formatTransportStats;
+
+static std::vector<AndroidOpenglesTransportStats> getTransportStats() {
+    std::vector<AndroidOpenglesTransportStats> stats(16);
+    while (true) {
+        const int count =
+                android_getOpenglesTransportStats(stats.data(), stats.size());
+        if (count <= (int)stats.size()) {
+            stats.resize(count);
+            return stats;
+        }
+        // More sessions were started meanwhile.
+        stats.resize(count);
+    }
+}
+
+int android_opengl_print_transport_stats(void* opaque,
+                                         LineConsumerCallback callback) {
+    const auto stats = getTransportStats();
+    for (const auto& session : stats) {
+        const std::string line = formatTransportStats(session) + "\n";
+        callback(opaque, line.c_str(), line.size());
+    }
+    return stats.size();
+}
+
+namespace {
+
+class TransportStatsDump {
+public:
+    ~TransportStatsDump() { stop(); }
+
+    bool start(const char* path, int periodMs) {
+        stop();
+        mFile = fopen(path, "a");
+        if (!mFile) {
+            return false;
+        }
+        mPeriodMs = periodMs;
+        mTimer.reset(ThreadLooper::get()->createTimer(
+                [](void* opaque, Looper::Timer* timer) {
+                    static_cast<TransportStatsDump*>(opaque)->onTimer();
+                },
+                this));
+        mTimer->startRelative(mPeriodMs);
+        return true;
+    }
+
+    void stop() {
+        if (mTimer) {
+            mTimer->stop();
+            mTimer.reset();
+        }
+        if (mFile) {
+            fclose(mFile);
+            mFile = nullptr;
+        }
+    }
+
+private:
+    void onTimer() {
+        const uint64_t nowMs = System::get()->getUnixTimeUs() / 1000;
+        for (const auto& session : getTransportStats()) {
+            fprintf(mFile, "%" PRIu64 " %s\n", nowMs,
+                    formatTransportStats(session).c_str());
+        }
+        fflush(mFile);
+        mTimer->startRelative(mPeriodMs);
+    }
+
+    FILE* mFile = nullptr;
+    int mPeriodMs = 0;
+    std::unique_ptr<Looper::Timer> mTimer;
+};
+
+LazyInstance<TransportStatsDump> sDump = LAZY_INSTANCE_INIT;
+
+}  // namespace
+
+bool android_opengl_start_transport_stats_dump(const char* path,
+                                               int periodMs) {
+    return sDump->start(path, periodMs);
+}
+
+void android_opengl_stop_transport_stats_dump(void) {
+    sDump->stop();
+}
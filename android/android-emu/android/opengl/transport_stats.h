@@ -0,0 +1,55 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+#pragma once
+
+#include "android/emulation/control/callbacks.h"
+#include "android/opengles.h"
+#include "android/utils/compiler.h"
+
+#include <stdbool.h>
+
+ANDROID_BEGIN_HEADER
+
+// Report the transport statistics of the render sessions forwarded to the
+// remote render server (see android_getOpenglesTransportStats()), to tell
+// whether a stutter comes from the guest, the transport or the server.
+
+// Print one line per live render session with |callback|. Return the
+// number of sessions.
+int android_opengl_print_transport_stats(void* opaque,
+                                         LineConsumerCallback callback);
+
+// Append the lines printed above to the file at |path| every |periodMs|
+// milliseconds, each prefixed with the time, from the thread of the current
+// looper. Replaces any dump started before. Return false if the file cannot
+// be opened.
+bool android_opengl_start_transport_stats_dump(const char* path,
+                                               int periodMs);
+
+// Stop the dump started above, if any, and close its file.
+void android_opengl_stop_transport_stats_dump(void);
+
+ANDROID_END_HEADER
+
+#ifdef __cplusplus
+
+#include <string>
+
+namespace android {
+namespace opengl {
+
+// Format |stats| as one line, without the line end.
+std::string formatTransportStats(const AndroidOpenglesTransportStats& stats);
+
+}  // namespace opengl
+}  // namespace android
+
+#endif
@@ -0,0 +1,39 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/opengl/transport_stats.h"
+
+#include <gtest/gtest.h>
+
+using android::opengl::formatTransportStats;
+
+TEST(TransportStats, format) {
+    AndroidOpenglesTransportStats stats = {};
+    stats.session = 3;
+    stats.bytesIn = 1000000;
+    stats.bytesOut = 2000;
+    stats.bytesInPerSec = 50000;
+    stats.bytesOutPerSec = 100;
+    stats.queuedPages = 2;
+    stats.maxQueuedPages = 64;
+    stats.queueSize = 64;
+    stats.roundTrips = 12;
+    stats.latencyHistogram[0] = 7;
+    stats.latencyHistogram[3] = 4;
+    stats.latencyHistogram[ANDROID_OPENGLES_LATENCY_BUCKETS - 1] = 1;
+
+    EXPECT_EQ(
+            "session 3: in 50000 B/s (1000000 B), out 100 B/s (2000 B), "
+            "queue 2/64 pages (max 64), round trips 12, latency <250us:7 "
+            "<500us:0 <1ms:0 <2ms:4 <4ms:0 <8ms:0 <16ms:0 <32ms:0 <64ms:0 "
+            "<128ms:0 >=128ms:1",
+            formatTransportStats(stats));
+}
@@ -25,9 +25,12 @@
 
 #include "OpenglRender/render_api_functions.h"
 
+#include <algorithm>
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define D(...)  VERBOSE_PRINT(init,__VA_ARGS__)
 #define DD(...) VERBOSE_PRINT(gles,__VA_ARGS__)
@@ -76,6 +79,10 @@ static bool sRendererUsesSubWindow;
 static emugl::RenderLibPtr sRenderLib = nullptr;
 static emugl::RendererPtr sRenderer = nullptr;
 
+// Set before the renderer is started, if any.
+static OnFrameSentFunc sOnFrameSent = nullptr;
+static void* sOnFrameSentContext = nullptr;
+
 int android_initOpenglesEmulation() {
     char* error = NULL;
 
@@ -160,6 +167,9 @@ android_startOpenglesRenderer(int width, int height, bool guestPhoneApi, int gue
         D("Can't start OpenGLES renderer?");
         return -1;
     }
+    if (sOnFrameSent) {
+        sRenderer->setFrameSentCallback(sOnFrameSent, sOnFrameSentContext);
+    }
     return 0;
 }
 
@@ -171,6 +181,17 @@ android_setPostCallback(OnPostFunc onPost, void* onPostContext)
     }
 }
 
+void
+android_setOpenglesFrameSentCallback(OnFrameSentFunc onFrameSent,
+                                     void* context)
+{
+    sOnFrameSent = onFrameSent;
+    sOnFrameSentContext = context;
+    if (sRenderer) {
+        sRenderer->setFrameSentCallback(onFrameSent, context);
+    }
+}
+
 static char* strdupBaseString(const char* src) {
     const char* begin = strchr(src, '(');
     if (!begin) {
@@ -287,3 +308,32 @@ void android_cleanupProcGLObjects(uint64_t puid) {
         sRenderer->cleanupProcGLObjects(puid);
     }
 }
+
+static_assert(ANDROID_OPENGLES_LATENCY_BUCKETS ==
+                      emugl::Renderer::TransportStats::kLatencyBucketCount,
+              "Latency histograms must have the same buckets");
+
+int android_getOpenglesTransportStats(AndroidOpenglesTransportStats* stats,
+                                      int maxCount) {
+    if (!sRenderer) {
+        return 0;
+    }
+    const auto sessions = sRenderer->getTransportStats();
+    const int count = std::min<int>(sessions.size(), maxCount);
+    for (int i = 0; i < count; i++) {
+        const auto& from = sessions[i];
+        AndroidOpenglesTransportStats* to = &stats[i];
+        to->session = from.session;
+        to->bytesIn = from.bytesIn;
+        to->bytesOut = from.bytesOut;
+        to->bytesInPerSec = from.bytesInPerSec;
+        to->bytesOutPerSec = from.bytesOutPerSec;
+        to->queuedPages = from.queuedPages;
+        to->maxQueuedPages = from.maxQueuedPages;
+        to->queueSize = from.queueSize;
+        to->roundTrips = from.roundTrips;
+        memcpy(to->latencyHistogram, from.latencyHistogram,
+               sizeof(to->latencyHistogram));
+    }
+    return (int)sessions.size();
+}
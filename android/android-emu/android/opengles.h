@@ -13,6 +13,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "android/utils/compiler.h"
 
@@ -76,6 +77,39 @@ extern int  android_gles_fast_pipes;
 
 void android_cleanupProcGLObjects(uint64_t puid);
 
+/* Statistics of a render session forwarded to the remote render server.
+ * Bucket i of |latencyHistogram| counts the round trips of the commands
+ * that expect a reply shorter than 250 << i microseconds, the last bucket
+ * all the longer ones. See emugl::Renderer::TransportStats for details. */
+#define ANDROID_OPENGLES_LATENCY_BUCKETS 11
+
+typedef struct {
+    int session;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t bytesInPerSec;
+    uint64_t bytesOutPerSec;
+    uint32_t queuedPages;
+    uint32_t maxQueuedPages;
+    uint32_t queueSize;
+    uint64_t roundTrips;
+    uint64_t latencyHistogram[ANDROID_OPENGLES_LATENCY_BUCKETS];
+} AndroidOpenglesTransportStats;
+
+/* Fill |stats| with the statistics of up to |maxCount| live render sessions,
+ * and return how many there are, which can be more than |maxCount|. Returns
+ * 0 when the renderer is not started. */
+int android_getOpenglesTransportStats(AndroidOpenglesTransportStats* stats,
+                                      int maxCount);
+
+/* Call |onFrameSent| from a render thread each time the end of a guest frame
+ * is sent to the remote render server, or stop with a NULL callback. This
+ * can be called before the renderer is started. See
+ * emugl::Renderer::setFrameSentCallback() for details. */
+typedef void (*OnFrameSentFunc)(void* context);
+void android_setOpenglesFrameSentCallback(OnFrameSentFunc onFrameSent,
+                                          void* context);
+
 #ifdef __cplusplus
 const emugl::RendererPtr& android_getOpenglesRenderer();
 #endif
@@ -14,20 +14,28 @@
 #include "android/base/files/StdioStream.h"
 #include "android/base/files/Stream.h"
 #include "android/base/memory/LazyInstance.h"
+#include "android/base/StringFormat.h"
 #include "android/base/system/System.h"
 
 
+#include "android/opengles.h"
+#include "android/remoteinput/InputLatencyTracer.h"
 #include "android/remoteinput/RemoteInputListener.h"
 #include "android/utils/debug.h"
 
 #include <memory>
 #include <string>
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 namespace {
 
+using android::base::StringAppendFormat;
+using android::base::StringFormat;
+using android::base::System;
+using android::remoteinput::InputLatencyTracer;
 using android::remoteinput::RemoteInputListener;
 
 // Global variables used here.
@@ -43,6 +51,23 @@ struct Globals {
 
 android::base::LazyInstance<Globals> sGlobals = LAZY_INSTANCE_INIT;
 
+void onFrameSent(void*) {
+    InputLatencyTracer::get()->onFrameSent(
+            System::get()->getHighResTimeUs());
+}
+
+std::string formatLatencyHistogram(const char* name,
+                                   const uint64_t* histogram) {
+    std::string line = StringFormat("%s latency", name);
+    for (int i = 0; i < InputLatencyTracer::kBucketCount; i++) {
+        const bool last = i == InputLatencyTracer::kBucketCount - 1;
+        // The last bucket has the same bound as the one before, from above.
+        StringAppendFormat(&line, " %s%dms:%" PRIu64, last ? ">=" : "<",
+                           1 << (last ? i - 1 : i), histogram[i]);
+    }
+    return line + "\n";
+}
+
 }  // namespace
 
 int android_remote_input_server_init(const AndroidConsoleAgents* agents) {
@@ -65,10 +90,14 @@ int android_remote_input_server_init(const AndroidConsoleAgents* agents) {
     }
 
     globals->hostListener.startListening();
+
+    // Trace the frames that follow the input events.
+    android_setOpenglesFrameSentCallback(&onFrameSent, nullptr);
     return 0;
 }
 
 void android_remote_input_server_undo_init(void) {
+    android_setOpenglesFrameSentCallback(nullptr, nullptr);
     sGlobals->hostListener.reset(-1, NULL);
 }
 
@@ -77,3 +106,33 @@ void android_remote_input_service_init(void) {
     //sGlobals->registerServices();
 }
 
+
+void android_remote_input_print_latency(void* opaque,
+                                        LineConsumerCallback callback) {
+    InputLatencyTracer::Stats stats;
+    InputLatencyTracer::get()->snapshot(&stats);
+    const std::string text =
+            StringFormat("events %" PRIu64 " injected, %" PRIu64
+                         " completed, %" PRIu64 " dropped, frames %" PRIu64
+                         "\n",
+                         stats.injected, stats.completed, stats.dropped,
+                         stats.frames) +
+            formatLatencyHistogram("inject", stats.injectHistogram) +
+            formatLatencyHistogram("frame", stats.frameHistogram);
+    callback(opaque, text.c_str(), text.size());
+}
+
+bool android_remote_input_write_latency_trace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    const std::string trace = InputLatencyTracer::get()->chromeTrace();
+    const bool ok = fwrite(trace.data(), 1, trace.size(), file) ==
+                    trace.size();
+    return fclose(file) == 0 && ok;
+}
+
+void android_remote_input_reset_latency(void) {
+    InputLatencyTracer::get()->reset();
+}
@@ -19,6 +19,9 @@
 #include "android/utils/compiler.h"
 #include "android/utils/looper.h"
 #include "android/console.h"
+#include "android/emulation/control/callbacks.h"
+
+#include <stdbool.h>
 
 
 ANDROID_BEGIN_HEADER
@@ -27,5 +30,20 @@ int android_remote_input_server_init(const AndroidConsoleAgents* agents);
 void android_remote_input_server_undo_init(void);
 void android_remote_input_service_init(void);
 
+/* Report the latency from the reception of the remote input events to the
+ * first frame sent to the remote render server after their injection, see
+ * android::remoteinput::InputLatencyTracer. */
+
+/* Print the counts and latency histograms with |callback|. */
+void android_remote_input_print_latency(void* opaque,
+                                        LineConsumerCallback callback);
+
+/* Write the last traced events to the file at |path|, in the Chrome trace
+ * format. Return false if it cannot be written. */
+bool android_remote_input_write_latency_trace(const char* path);
+
+/* Forget the traced events and counts. */
+void android_remote_input_reset_latency(void);
+
 ANDROID_END_HEADER
 
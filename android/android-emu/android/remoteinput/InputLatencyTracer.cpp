@@ -0,0 +1,133 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/remoteinput/InputLatencyTracer.h"
+
+#include "android/base/memory/LazyInstance.h"
+#include "android/base/StringFormat.h"
+
+#include <inttypes.h>
+
+using android::base::AutoLock;
+using android::base::LazyInstance;
+using android::base::StringAppendFormat;
+
+namespace android {
+namespace remoteinput {
+
+static LazyInstance<InputLatencyTracer> sTracer = LAZY_INSTANCE_INIT;
+
+// static
+InputLatencyTracer* InputLatencyTracer::get() {
+    return sTracer.ptr();
+}
+
+// static
+void InputLatencyTracer::addToHistogram(uint64_t* histogram,
+                                        uint64_t latencyUs) {
+    int bucket = 0;
+    while (bucket < kBucketCount - 1 && latencyUs >= (1000ULL << bucket)) {
+        ++bucket;
+    }
+    ++histogram[bucket];
+}
+
+void InputLatencyTracer::onInputInjected(uint64_t clientTimestampUs,
+                                         uint64_t receivedUs,
+                                         uint64_t injectedUs) {
+    AutoLock lock(mLock);
+    ++mStats.injected;
+    addToHistogram(mStats.injectHistogram,
+                   injectedUs > receivedUs ? injectedUs - receivedUs : 0);
+    if (mPending.size() == kMaxPendingEvents) {
+        mPending.pop_front();
+        ++mStats.dropped;
+    }
+    mPending.push_back({clientTimestampUs, receivedUs, injectedUs, 0});
+}
+
+void InputLatencyTracer::onFrameSent(uint64_t nowUs) {
+    AutoLock lock(mLock);
+    ++mStats.frames;
+    if (mPending.empty()) {
+        return;
+    }
+    if (mFrames.size() == kMaxTracedEvents) {
+        mFrames.pop_front();
+    }
+    mFrames.push_back(nowUs);
+
+    for (TracedEvent& event : mPending) {
+        if (nowUs > event.injectedUs + kMaxFrameDelayUs) {
+            ++mStats.dropped;
+            continue;
+        }
+        event.frameUs = nowUs;
+        ++mStats.completed;
+        addToHistogram(mStats.frameHistogram,
+                       nowUs > event.receivedUs ? nowUs - event.receivedUs
+                                                : 0);
+        if (mTraced.size() == kMaxTracedEvents) {
+            mTraced.pop_front();
+        }
+        mTraced.push_back(event);
+    }
+    mPending.clear();
+}
+
+void InputLatencyTracer::snapshot(Stats* out) {
+    AutoLock lock(mLock);
+    *out = mStats;
+}
+
+std::string InputLatencyTracer::chromeTrace() {
+    AutoLock lock(mLock);
+    std::string res = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    const char* separator = "\n";
+    uint64_t id = 0;
+    for (const TracedEvent& event : mTraced) {
+        ++id;
+        StringAppendFormat(
+                &res,
+                "%s{\"name\":\"input\",\"cat\":\"input\",\"ph\":\"b\","
+                "\"id\":%" PRIu64 ",\"pid\":1,\"tid\":1,\"ts\":%" PRIu64
+                ",\"args\":{\"client_ts\":%" PRIu64 "}},\n"
+                "{\"name\":\"injected\",\"cat\":\"input\",\"ph\":\"n\","
+                "\"id\":%" PRIu64 ",\"pid\":1,\"tid\":1,\"ts\":%" PRIu64
+                "},\n"
+                "{\"name\":\"input\",\"cat\":\"input\",\"ph\":\"e\","
+                "\"id\":%" PRIu64 ",\"pid\":1,\"tid\":1,\"ts\":%" PRIu64 "}",
+                separator, id, event.receivedUs, event.clientTimestampUs, id,
+                event.injectedUs, id, event.frameUs);
+        separator = ",\n";
+    }
+    for (uint64_t frameUs : mFrames) {
+        StringAppendFormat(&res,
+                           "%s{\"name\":\"frame\",\"cat\":\"render\","
+                           "\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":2,"
+                           "\"ts\":%" PRIu64 "}",
+                           separator, frameUs);
+        separator = ",\n";
+    }
+    res += "\n]}\n";
+    return res;
+}
+
+void InputLatencyTracer::reset() {
+    AutoLock lock(mLock);
+    mPending.clear();
+    mTraced.clear();
+    mFrames.clear();
+    mStats = {};
+}
+
+}  // namespace remoteinput
+}  // namespace android
@@ -0,0 +1,115 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#pragma once
+
+#include "android/base/Compiler.h"
+#include "android/base/synchronization/Lock.h"
+
+#include <deque>
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+namespace remoteinput {
+
+// InputLatencyTracer follows the input events of the remote clients from
+// the time they are received to the first frame sent to the remote render
+// server after they reached the guest, to tell where the latency between a
+// touch and its effect on the screen comes from:
+//
+//     received ---------> injected -----------> frame sent
+//              (pacing,             (guest app,
+//               main loop)           eglSwapBuffers)
+//
+// Each event is tagged with the timestamp of the client, so that the traces
+// can be matched with the ones of the client. The latencies are counted in
+// histograms, and the last traced events can be exported in the Chrome trace
+// format, to be loaded in chrome://tracing.
+//
+// All times are in microseconds of the host monotonic clock, and passed by
+// the caller. The methods can be called from any thread.
+class InputLatencyTracer {
+public:
+    // Bucket i of the histograms counts the latencies shorter than 1 << i
+    // milliseconds, the last bucket all the longer ones.
+    static constexpr int kBucketCount = 11;
+
+    // The most events waiting for a frame, and kept for the trace.
+    static constexpr size_t kMaxPendingEvents = 1024;
+    static constexpr size_t kMaxTracedEvents = 4096;
+
+    // An event is not matched with a frame sent later than this after its
+    // injection: the guest likely had nothing to draw for it.
+    static constexpr uint64_t kMaxFrameDelayUs = 1000 * 1000;
+
+    struct Stats {
+        // Events injected, and matched with a frame or dropped.
+        uint64_t injected;
+        uint64_t completed;
+        uint64_t dropped;
+        uint64_t frames;
+        // From the reception to the injection of the events.
+        uint64_t injectHistogram[kBucketCount];
+        // From the reception to the first frame sent after the injection.
+        uint64_t frameHistogram[kBucketCount];
+    };
+
+    // The instance used by the remote input and render code.
+    static InputLatencyTracer* get();
+
+    InputLatencyTracer() = default;
+
+    // An event sent by the client at |clientTimestampUs| of its own clock,
+    // received at |receivedUs|, was just delivered to the guest at
+    // |injectedUs|.
+    void onInputInjected(uint64_t clientTimestampUs,
+                         uint64_t receivedUs,
+                         uint64_t injectedUs);
+
+    // The end of a frame was sent to the render server at |nowUs|. It
+    // completes all the events injected before.
+    void onFrameSent(uint64_t nowUs);
+
+    void snapshot(Stats* out);
+
+    // Return the completed events still kept as a Chrome trace, a JSON
+    // object. Each event is an async slice from its reception to its frame,
+    // with an instant at its injection; the frames are global instants.
+    std::string chromeTrace();
+
+    // Forget all the events and counts.
+    void reset();
+
+private:
+    struct TracedEvent {
+        uint64_t clientTimestampUs;
+        uint64_t receivedUs;
+        uint64_t injectedUs;
+        uint64_t frameUs;
+    };
+
+    static void addToHistogram(uint64_t* histogram, uint64_t latencyUs);
+
+    android::base::Lock mLock;
+    // Injected, waiting for a frame. |frameUs| is unset.
+    std::deque<TracedEvent> mPending;
+    std::deque<TracedEvent> mTraced;
+    std::deque<uint64_t> mFrames;
+    Stats mStats = {};
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(InputLatencyTracer);
+};
+
+}  // namespace remoteinput
+}  // namespace android
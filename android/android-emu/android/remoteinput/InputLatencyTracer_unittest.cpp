@@ -0,0 +1,106 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/remoteinput/InputLatencyTracer.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace android {
+namespace remoteinput {
+
+using Stats = InputLatencyTracer::Stats;
+
+TEST(InputLatencyTracer, matchesEventsWithNextFrame) {
+    InputLatencyTracer tracer;
+    // A frame before any input is counted, but completes nothing.
+    tracer.onFrameSent(500);
+    tracer.onInputInjected(7, 1000, 1500);
+    tracer.onInputInjected(8, 1000, 3000);
+    tracer.onFrameSent(6000);
+    // Nothing left for the next one.
+    tracer.onFrameSent(7000);
+
+    Stats stats;
+    tracer.snapshot(&stats);
+    EXPECT_EQ(2U, stats.injected);
+    EXPECT_EQ(2U, stats.completed);
+    EXPECT_EQ(0U, stats.dropped);
+    EXPECT_EQ(3U, stats.frames);
+    // 500us and 2ms.
+    EXPECT_EQ(1U, stats.injectHistogram[0]);
+    EXPECT_EQ(1U, stats.injectHistogram[2]);
+    // 5ms, twice.
+    EXPECT_EQ(2U, stats.frameHistogram[3]);
+}
+
+TEST(InputLatencyTracer, histogramBounds) {
+    InputLatencyTracer tracer;
+    tracer.onInputInjected(1, 0, 999);
+    tracer.onInputInjected(2, 0, 1000);
+    tracer.onInputInjected(3, 0, 3600000000ULL);
+    // Injected before it was received, which the clocks should not allow.
+    tracer.onInputInjected(4, 10, 0);
+
+    Stats stats;
+    tracer.snapshot(&stats);
+    EXPECT_EQ(2U, stats.injectHistogram[0]);
+    EXPECT_EQ(1U, stats.injectHistogram[1]);
+    EXPECT_EQ(1U, stats.injectHistogram[InputLatencyTracer::kBucketCount - 1]);
+}
+
+TEST(InputLatencyTracer, dropsEventsWithoutFrame) {
+    InputLatencyTracer tracer;
+    tracer.onInputInjected(1, 0, 0);
+    tracer.onInputInjected(2, 0, 500000);
+    tracer.onFrameSent(InputLatencyTracer::kMaxFrameDelayUs + 1);
+
+    for (size_t i = 0; i < InputLatencyTracer::kMaxPendingEvents + 1; i++) {
+        tracer.onInputInjected(i, 0, 0);
+    }
+
+    Stats stats;
+    tracer.snapshot(&stats);
+    EXPECT_EQ(2U, stats.dropped);
+    EXPECT_EQ(1U, stats.completed);
+}
+
+TEST(InputLatencyTracer, chromeTrace) {
+    InputLatencyTracer tracer;
+    EXPECT_EQ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n]}\n",
+              tracer.chromeTrace());
+
+    tracer.onInputInjected(123, 1000, 2000);
+    tracer.onFrameSent(5000);
+    EXPECT_EQ(
+            "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+            "{\"name\":\"input\",\"cat\":\"input\",\"ph\":\"b\",\"id\":1,"
+            "\"pid\":1,\"tid\":1,\"ts\":1000,\"args\":{\"client_ts\":123}},\n"
+            "{\"name\":\"injected\",\"cat\":\"input\",\"ph\":\"n\",\"id\":1,"
+            "\"pid\":1,\"tid\":1,\"ts\":2000},\n"
+            "{\"name\":\"input\",\"cat\":\"input\",\"ph\":\"e\",\"id\":1,"
+            "\"pid\":1,\"tid\":1,\"ts\":5000},\n"
+            "{\"name\":\"frame\",\"cat\":\"render\",\"ph\":\"i\",\"s\":\"g\","
+            "\"pid\":1,\"tid\":2,\"ts\":5000}\n"
+            "]}\n",
+            tracer.chromeTrace());
+
+    tracer.reset();
+    Stats stats;
+    tracer.snapshot(&stats);
+    EXPECT_EQ(0U, stats.injected);
+    EXPECT_EQ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n]}\n",
+              tracer.chromeTrace());
+}
+
+}  // namespace remoteinput
+}  // namespace android
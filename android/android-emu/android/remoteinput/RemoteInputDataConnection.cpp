@@ -13,8 +13,6 @@
 
 #include "android/base/sockets/SocketUtils.h"
 
-#include "android/emulation/VmLock.h"
-
 
 #include "android/utils/debug.h"
 #include "RemoteInputDataConnection.h"
@@ -32,8 +30,9 @@
 namespace android {
 namespace remoteinput {
 
-RemoteInputDataConnection::RemoteInputDataConnection(int socket) :
-        mFd(socket) {
+RemoteInputDataConnection::RemoteInputDataConnection(
+        int socket, RemoteInputDecoder::Sink* sink) :
+        mFd(socket), mDecoder(sink) {
     
     printf("%s: create\n", __func__);
 
@@ -46,27 +45,31 @@ RemoteInputDataConnection::RemoteInputDataConnection(int socket) :
     android::base::socketSetNoDelay(socket);
 };
 
-ssize_t RemoteInputDataConnection::receiveDataFromSocketNonBlocking(char * buf, ssize_t buf_size) {
-    ssize_t readLen;
-    {
-        ScopedVmUnlock unlockBql;
-        readLen = android::base::socketRecv(
-            mFd,
-            buf,
-            buf_size);
-    }
-
-    if (readLen < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return 0;
-        } else {
-            //mSocket.reset();
-            assert(0);
-            return -1;
+bool RemoteInputDataConnection::receivePackets() {
+    // The socket is edge-triggered, read until it is drained.
+    while (true) {
+        size_t size;
+        char* buffer = mDecoder.receiveBuffer(&size);
+        const ssize_t readLen = android::base::socketRecv(mFd, buffer, size);
+        if (readLen < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (readLen == 0) {
+            // Closed by the client.
+            return false;
+        }
+        if (!mDecoder.decode(readLen)) {
+            LOG(WARNING) << "Invalid remote input stream, closing the "
+                            "connection";
+            return false;
+        }
+        if ((size_t)readLen < size) {
+            return true;
         }
     }
-
-    return readLen;
 }
 
 void RemoteInputDataConnection::CloseConnection() {
@@ -20,6 +20,7 @@
 //#include "android/emulation/AndroidPipe.h"
 
 //#include "android/utils/gl_cmd_net_format.h"
+#include "android/remoteinput/RemoteInputProtocol.h"
 #include "android/utils/debug.h"
 
 #include <atomic>
@@ -38,7 +39,8 @@ namespace remoteinput {
 class RemoteInputDataConnection {
 public:
     
-    RemoteInputDataConnection(int socket);
+    // The events received on |socket| are passed to |sink|.
+    RemoteInputDataConnection(int socket, RemoteInputDecoder::Sink* sink);
     ~RemoteInputDataConnection() {
         CloseConnection();
     };
@@ -49,13 +51,18 @@ public:
 
     void CloseConnection();
     
-    ssize_t receiveDataFromSocketNonBlocking(char * buf, ssize_t buf_size);
+    // Receive and decode all the packets available on the socket, with as
+    // few reads as its buffer allows. Return false if the connection must
+    // be closed.
+    bool receivePackets();
 private:
     
     int mSessionId;
 
     int mFd;
 
+    RemoteInputDecoder mDecoder;
+
 };
 
 }  // namespace emulation
@@ -1,75 +1,35 @@
 
 #include "RemoteInputDataHandler.h"
 
+#include "android/avd/hw-config.h"
+#include "android/base/async/ThreadLooper.h"
+#include "android/base/system/System.h"
+#include "android/emulation/VmLock.h"
+#include "android/globals.h"
+#include "android/hw-sensors.h"
+#include "android/multitouch-screen.h"
+#include "android/remoteinput/InputLatencyTracer.h"
+#include "android/skin/linux_keycodes.h"
+
 
 namespace android {
 namespace remoteinput {
 
-
-
-
-/* Describes state of a multi-touch pointer  */
-typedef struct MTSPointerState {
-    /* Tracking ID assigned to the pointer by an app emulating multi-touch. */
-    int tracking_id;
-    /* X - coordinate of the tracked pointer. */
-    int x;
-    /* Y - coordinate of the tracked pointer. */
-    int y;
-    /* Current pressure value. */
-    int pressure;
-} MTSPointerState;
-
-/* Maximum number of pointers, supported by multi-touch emulation. */
-#define MTS_POINTERS_NUM    10
-/* Signals that pointer is not tracked (or is "up"). */
-#define MTS_POINTER_UP      -1
-/* Special tracking ID for a mouse pointer. */
-#define MTS_POINTER_MOUSE   -2
-
-MTSPointerState tracked_pointers[MTS_POINTERS_NUM];
-int tracked_pointer_num = 0;
-
-/* Gets an index in the MTS's tracking pointers array MTS for the given
- * tracking id.
- * Return:
- *  Index of a matching entry in the MTS's tracking pointers array, or -1 if
- *  matching entry was not found.
- */
-static int
-_mtsstate_get_pointer_index(const MTSPointerState* pointerStates, int tracking_id)
-{
-    int index;
-    for (index = 0; index < MTS_POINTERS_NUM; index++) {
-        if (pointerStates[index].tracking_id == tracking_id) {
-            return index;
-        }
-    }
-    return -1;
-}
-
-/* Gets an index of the first untracking pointer in the MTS's tracking pointers
- * array.
- * Return:
- *  An index of the first untracking pointer, or -1 if all pointers are tracked.
- */
-static int
-_mtsstate_get_available_pointer_index(const MTSPointerState* pointerStates)
-{
-    return _mtsstate_get_pointer_index(pointerStates, MTS_POINTER_UP);
-}
-
-static void
-_mtsstate_init_pointer()
-{
-    int index;
-    for (index = 0; index < MTS_POINTERS_NUM; index++) {
-        tracked_pointers[index].tracking_id = MTS_POINTER_UP;
-    }
-
-    tracked_pointer_num = 0;
-}
-
+// The gamepad buttons that have a key equivalent. The guest keyboard
+// doesn't report the BTN_ codes of gamepads, the others are dropped.
+static const struct {
+    uint32_t button;
+    int key;
+} kGamepadKeys[] = {
+    {kGamepadA, LINUX_KEY_ENTER},
+    {kGamepadB, LINUX_KEY_BACK},
+    {kGamepadStart, LINUX_KEY_MENU},
+    {kGamepadMode, LINUX_KEY_HOME},
+    {kGamepadUp, LINUX_KEY_UP},
+    {kGamepadDown, LINUX_KEY_DOWN},
+    {kGamepadLeft, LINUX_KEY_LEFT},
+    {kGamepadRight, LINUX_KEY_RIGHT},
+};
 
 void RemoteInputDataHandler::StartHandler() {
         mIsWorking = true;
@@ -92,6 +52,13 @@ void RemoteInputDataHandler::StartHandler() {
         
         AutoLock lock(mListLock);
         mConnectionList.erase(fd);
+        lock.unlock();
+
+        // Don't leave the fingers or buttons of the client down.
+        if (mInjector) {
+            mInjector->releaseAll();
+        }
+        onGamepad(0);
     }
 
     bool RemoteInputDataHandler::addConnection(int socket) {
@@ -99,10 +66,8 @@ void RemoteInputDataHandler::StartHandler() {
         if (mConnectionList.size() > 0)
             return false;
 
-        _mtsstate_init_pointer();
-        
         std::shared_ptr<RemoteInputDataConnection> connection = 
-                std::make_shared<RemoteInputDataConnection>(socket);
+                std::make_shared<RemoteInputDataConnection>(socket, this);
         
         AutoLock lock(mListLock);
         mConnectionList.insert(std::make_pair(socket, connection));
@@ -131,116 +96,102 @@ void RemoteInputDataHandler::StartHandler() {
     }
 
     void RemoteInputDataHandler::setUserEventAgent(const AndroidConsoleAgents* agents) {
+        if (!agents) {
+            return;
+        }
         mUserEventAgent = (QAndroidUserEventAgent*)agents->user_event;
+        if (!mInjector) {
+            mDeviceEventRunner.init(android::VmLock::get());
+            mInjector.reset(new RemoteInputInjector(
+                    android::base::ThreadLooper::get(),
+                    [this](const RemoteTouchEvent* events, int count) {
+                        injectTouchEvents(events, count);
+                    }));
+        }
     }
 
-    void RemoteInputDataHandler::consumeInputPacket(RemoteInputPacket * inputPacket) {
-        const int slot_index = _mtsstate_get_pointer_index(tracked_pointers, inputPacket->tracking_id);
-        if (slot_index < 0) {
-            //state idle or state in_action
-            if (inputPacket->event == MOUSE_EVENT_DOWN) {
-                //state in_action
-
-                mLastTimestamp = inputPacket->timestamp;
-
-                struct timeval curtimeval;
-                gettimeofday(&curtimeval, NULL);
-                uint64_t curtiming = curtimeval.tv_sec * 1000 * 1000 + curtimeval.tv_usec;
-                mLastSentTiming = curtiming;
-
-                int slot_avail_index = _mtsstate_get_available_pointer_index(tracked_pointers);
- 
-                tracked_pointers[slot_avail_index].tracking_id = inputPacket->tracking_id;
-                tracked_pointers[slot_avail_index].x = inputPacket->x;
-                tracked_pointers[slot_avail_index].y = inputPacket->y;
-                tracked_pointers[slot_avail_index].pressure = 1;
-
-                tracked_pointer_num ++;
-
-                if (tracked_pointer_num == 1) {
-                    //first finger
-                    mUserEventAgent->sendMouseEvent(inputPacket->x, inputPacket->y, 0, 1);
-	            } else if (tracked_pointer_num == 2) {
-	                //secondary finger
-	                mUserEventAgent->sendMouseEvent(inputPacket->x, inputPacket->y, 0, 5);
-	            } else {
-	                assert(0);
-	            }
-            } else {
-                //error state
-                assert(0);
-                return;
+    void RemoteInputDataHandler::onTouch(const RemoteTouchEvent& event) {
+        mTouches.push_back(event);
+        mTouches.back().receivedUs =
+                android::base::System::get()->getHighResTimeUs();
+    }
+
+    void RemoteInputDataHandler::onKey(int code, bool down) {
+        if (!mInjector) {
+            return;
+        }
+        RemoteDeviceEvent event = {RemoteDeviceEvent::Type::Key, code, down};
+        mDeviceEventRunner.send(event);
+    }
+
+    void RemoteInputDataHandler::onSensor(int sensorId, float a, float b, float c) {
+        if (!mInjector) {
+            return;
+        }
+        RemoteDeviceEvent event = {RemoteDeviceEvent::Type::Sensor, sensorId,
+                                   false, {a, b, c}};
+        mDeviceEventRunner.send(event);
+    }
+
+    void RemoteInputDataHandler::onGamepad(uint32_t buttons) {
+        const uint32_t changed = buttons ^ mGamepadButtons;
+        mGamepadButtons = buttons;
+        for (const auto& mapping : kGamepadKeys) {
+            if (changed & mapping.button) {
+                onKey(mapping.key, (buttons & mapping.button) != 0);
             }
+        }
+    }
 
-            //printf("mLastTimestamp = %lld, mLastSentTiming = %lld\n", (long long int)mLastTimestamp, (long long int)mLastSentTiming);
-        } else {
-            //state in_action
-            uint64_t needsleeptime = 0;
-            struct timeval curtimeval;
-            gettimeofday(&curtimeval, NULL);
-            uint64_t curtiming = curtimeval.tv_sec * 1000 * 1000 + curtimeval.tv_usec;
-            
-            if (mLastSentTiming != 0 && mLastTimestamp != 0) {
-                
-                uint64_t senttiming_offset = 0;
-                if (curtiming > mLastSentTiming) {
-                    senttiming_offset = curtiming - mLastSentTiming;
-                }
-                uint64_t timestamp_offset = 0;
-                if (inputPacket->timestamp > mLastTimestamp){
-                    timestamp_offset = inputPacket->timestamp - mLastTimestamp;
-                }
+    void RemoteInputDataHandler::DeviceEventRunner::performDeviceOperation(
+            const RemoteDeviceEvent& event) {
+        switch (event.type) {
+            case RemoteDeviceEvent::Type::Key:
+                mHandler->mUserEventAgent->sendKey(event.id, event.down);
+                break;
+            case RemoteDeviceEvent::Type::Sensor:
+                android_sensors_set(event.id, event.values[0],
+                                    event.values[1], event.values[2]);
+                break;
+        }
+    }
 
-                if (timestamp_offset > senttiming_offset) {
-                    needsleeptime = timestamp_offset - senttiming_offset;
-                    usleep(needsleeptime);
-                }
+    void RemoteInputDataHandler::injectTouchEvents(const RemoteTouchEvent* events, int count) {
+        const uint64_t nowUs = android::base::System::get()->getHighResTimeUs();
+        for (int i = 0; i < count; i++) {
+            if (events[i].receivedUs) {
+                InputLatencyTracer::get()->onInputInjected(
+                        events[i].timestampUs, events[i].receivedUs, nowUs);
             }
+        }
 
-            if (inputPacket->event == MOUSE_EVENT_UP) {
-                tracked_pointer_num --;
-                tracked_pointers[slot_index].tracking_id = MTS_POINTER_UP;
-                tracked_pointers[slot_index].x = 0;
-                tracked_pointers[slot_index].y = 0;
-                tracked_pointers[slot_index].pressure = 0;
-
-                if (tracked_pointer_num == 0) {
-                    // will became state idle
-
-                    mLastTimestamp = 0;
-                    mLastSentTiming = 0;
-                    //first finger
-                    mUserEventAgent->sendMouseEvent(inputPacket->x, inputPacket->y, 0, 0);
-                } else if (tracked_pointer_num == 1) {
-                    // still be state in_action
-                    //secondary finger
-                    mLastTimestamp = inputPacket->timestamp;
-		            mLastSentTiming = curtiming + needsleeptime;
-                    
-                    mUserEventAgent->sendMouseEvent(inputPacket->x, inputPacket->y, 0, 4);
-                } else {
-                    assert(0);
+        if (!androidHwConfig_isScreenMultiTouch(android_hw)) {
+            // The mouse emulates the first finger down, the others are
+            // ignored until it is lifted.
+            for (int i = 0; i < count; i++) {
+                const RemoteTouchEvent& event = events[i];
+                if (mSingleTouchId < 0 && event.pressure) {
+                    mSingleTouchId = event.trackingId;
+                }
+                if (event.trackingId != mSingleTouchId) {
+                    continue;
+                }
+                mUserEventAgent->sendMouseEvent(event.x, event.y, 0,
+                                                event.pressure ? 1 : 0);
+                if (!event.pressure) {
+                    mSingleTouchId = -1;
                 }
-            } else if (inputPacket->event == MOUSE_EVENT_MOVE) {
-                //state in_action
-                tracked_pointers[slot_index].x = inputPacket->x;
-                tracked_pointers[slot_index].y = inputPacket->y;
-
-                mLastTimestamp = inputPacket->timestamp;
-	            mLastSentTiming = curtiming + needsleeptime;
-                
-                mUserEventAgent->sendMouseEvent(inputPacket->x, inputPacket->y, 0, 1);
-            } else if (inputPacket->event == MOUSE_EVENT_DOWN) {
-                // got event down of same finger, ignore it
-                assert(0);
             }
+            return;
+        }
 
-            //printf("mLastTimestamp = %lld, mLastSentTiming = %lld\n", (long long int)mLastTimestamp, (long long int)mLastSentTiming);
+        // One slot per finger, and a single EV_SYN for all of them.
+        for (int i = 0; i < count; i++) {
+            multitouch_update_pointer(MTES_DEVICE, events[i].trackingId,
+                                      events[i].x, events[i].y,
+                                      events[i].pressure, true);
         }
+        multitouch_sync();
     }
 }
 }
-
-
-
-
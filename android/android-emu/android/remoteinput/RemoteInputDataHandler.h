@@ -1,6 +1,10 @@
 #pragma once
 
 #include "RemoteInputDataConnection.h"
+#include "RemoteInputInjector.h"
+#include "RemoteInputProtocol.h"
+
+#include "android/emulation/DeviceContextRunner.h"
 
 #include "android/base/threads/Thread.h"
 
@@ -13,6 +17,7 @@
 
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include <list>
 #include <sys/epoll.h>
@@ -28,54 +33,32 @@ namespace android {
 namespace remoteinput {
 
 
-typedef enum _MOUSE_EVENT_TYPE {
-    MOUSE_EVENT_DOWN = 0,
-    MOUSE_EVENT_UP,
-    MOUSE_EVENT_MOVE
-} MOUSE_EVENT_TYPE;
-
-typedef struct _RemoteInputPacket  {
-    int x : 16;
-    int y : 16;
-    MOUSE_EVENT_TYPE event : 8;
-    int tracking_id : 32;
-    uint64_t timestamp : 64;
-} __attribute__ ((packed)) RemoteInputPacket;
-
-#define REMOTE_INPUT_PACKET_LEN       (sizeof(RemoteInputPacket))
-
+// A key or sensor event to send to the devices from the main loop.
+struct RemoteDeviceEvent {
+    enum class Type { Key, Sensor } type;
+    int id;
+    bool down;
+    float values[3];
+};
 
-class RemoteInputDataHandler : public android::base::Thread {
+class RemoteInputDataHandler : public android::base::Thread,
+                               public RemoteInputDecoder::Sink {
 public:
     RemoteInputDataHandler() :
         mUserEventAgent(NULL),
         mEpollFD(-1),
-        mIsWorking(false),
-        mLastTimestamp(0),
-        mLastSentTiming(0)
+        mIsWorking(false)
          {};
 
     virtual intptr_t main() override {
-        RemoteInputPacket curInputPacket;
-        ssize_t packetStartPos = 0;
-
         struct epoll_event events[MAX_HANDLE_FD_SIZE];
         
         printf("remote input datahandler thread begins\n");
         while (mIsWorking) {
-            //printf("connection count = %d-------------------\n", (int)mConnectionList.size());
             int ret = ::epoll_wait(mEpollFD, events, MAX_HANDLE_FD_SIZE, 100);
 
             for (int i = 0; i < ret; i ++) {
-                if ((events[i].events & EPOLLERR) ||  
-                      (events[i].events & EPOLLHUP) ||
-                      (events[i].events & EPOLLRDHUP)) {
-                      printf("found a connection exited\n");
-                      mLastSentTiming = 0;
-                      mLastTimestamp = 0;
-                      removeConnection(events[i].data.fd);
-                      continue;  
-                } else if (events[i].events & EPOLLIN) {
+                if (events[i].events & EPOLLIN) {
                     AutoLock lock(mListLock);
                     auto it =
                         mConnectionList.find(events[i].data.fd);
@@ -87,35 +70,28 @@ public:
                     
                     lock.unlock();
 
-                    //mUserEventAgent->sendMouseEvent(483, 656, 0, 1);
-                    //usleep(1000 * 20);
-                    //mUserEventAgent->sendMouseEvent(472, 656, 0, 1);
-                    //usleep(1000 * 20);
-                    //mUserEventAgent->sendMouseEvent(450, 656, 0, 1);
-                    //usleep(1000 * 20);
-                    //mUserEventAgent->sendMouseEvent(450, 656, 0, 0);
-
-                    //the loop will read off socket receive buffer because epollet is set.
-                    while (1) {
-                        ssize_t readSize = connection->receiveDataFromSocketNonBlocking(
-                            (char*)(&curInputPacket) + packetStartPos, (ssize_t)REMOTE_INPUT_PACKET_LEN - packetStartPos);
-
-                        if (readSize < 0)
-                            break;
-                        else if (readSize == (ssize_t)REMOTE_INPUT_PACKET_LEN - packetStartPos) {
-                            
-                            consumeInputPacket(&curInputPacket);
-                            
-                            packetStartPos = 0;
-                            continue; // perhaps still data exist in receive buffer, try next packet
-                        } else {
-                            //printf("not a complete packet, keep receiving\n");
-                            // no data in receive buffer, exit the loop, wait for next epoll event
-                            packetStartPos += readSize;
-                            break;
+                    // Decode all the packets received so far, then queue
+                    // their touches at once, the last ones from a closing
+                    // client included.
+                    const bool open = connection->receivePackets();
+                    if (!mTouches.empty()) {
+                        if (mInjector) {
+                            mInjector->queue(mTouches.data(), mTouches.size());
                         }
+                        mTouches.clear();
+                    }
+                    if (!open) {
+                        printf("found a connection exited\n");
+                        removeConnection(events[i].data.fd);
+                        continue;
                     }
                 }
+                if ((events[i].events & EPOLLERR) ||  
+                      (events[i].events & EPOLLHUP) ||
+                      (events[i].events & EPOLLRDHUP)) {
+                      printf("found a connection exited\n");
+                      removeConnection(events[i].data.fd);
+                }
             }
 
             
@@ -137,17 +113,51 @@ public:
 
     void setUserEventAgent(const AndroidConsoleAgents* agents);
 
-    void consumeInputPacket(RemoteInputPacket * inputPacket);
+    // RemoteInputDecoder::Sink implementation, called from the handler
+    // thread.
+    void onTouch(const RemoteTouchEvent& event) override;
+    void onKey(int code, bool down) override;
+    void onSensor(int sensorId, float a, float b, float c) override;
+    void onGamepad(uint32_t buttons) override;
     
 private:
+    class DeviceEventRunner
+        : public android::DeviceContextRunner<RemoteDeviceEvent> {
+    public:
+        explicit DeviceEventRunner(RemoteInputDataHandler* handler)
+            : mHandler(handler) {}
+
+        void send(const RemoteDeviceEvent& event) {
+            queueDeviceOperation(event);
+        }
+
+    protected:
+        void performDeviceOperation(const RemoteDeviceEvent& event) override;
+
+    private:
+        RemoteInputDataHandler* const mHandler;
+    };
+
+    // Called from the main loop with touch events due at the same time.
+    void injectTouchEvents(const RemoteTouchEvent* events, int count);
+
     QAndroidUserEventAgent * mUserEventAgent;
         
     int mEpollFD;
     
     bool mIsWorking;
 
-    uint64_t mLastTimestamp;
-    uint64_t mLastSentTiming;
+    // Paces the touch events and injects them from the main loop.
+    std::unique_ptr<RemoteInputInjector> mInjector;
+    // Without a multi-touch screen, the finger that the mouse emulates.
+    int mSingleTouchId = -1;
+    // The touches decoded from the last read.
+    std::vector<RemoteTouchEvent> mTouches;
+
+    // Sends the other events from the main loop, ready with |mInjector|.
+    DeviceEventRunner mDeviceEventRunner{this};
+    // The gamepad buttons currently pressed.
+    uint32_t mGamepadButtons = 0;
 
     std::unordered_map<int, std::shared_ptr<RemoteInputDataConnection> > mConnectionList;
     
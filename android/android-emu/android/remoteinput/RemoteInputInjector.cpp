@@ -0,0 +1,138 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/remoteinput/RemoteInputInjector.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace android {
+namespace remoteinput {
+
+using android::base::AutoLock;
+using android::base::Looper;
+
+RemoteInputInjector::RemoteInputInjector(Looper* looper,
+                                         BatchCallback callback)
+    : mLooper(looper), mCallback(std::move(callback)) {
+    mTimer.reset(mLooper->createTimer(
+            [](void* opaque, Looper::Timer*) {
+                static_cast<RemoteInputInjector*>(opaque)->onTimer();
+            },
+            this));
+}
+
+RemoteInputInjector::~RemoteInputInjector() {
+    mTimer->stop();
+}
+
+void RemoteInputInjector::queue(const RemoteTouchEvent& event) {
+    AutoLock lock(mLock);
+    queueLocked(event);
+}
+
+void RemoteInputInjector::queue(const RemoteTouchEvent* events,
+                                size_t count) {
+    AutoLock lock(mLock);
+    for (size_t i = 0; i < count; ++i) {
+        queueLocked(events[i]);
+    }
+}
+
+void RemoteInputInjector::releaseAll() {
+    AutoLock lock(mLock);
+    const auto down = mDown;
+    for (RemoteTouchEvent event : down) {
+        event.pressure = 0;
+        event.timestampUs = mLastTimestampUs;
+        // Not received from the client.
+        event.receivedUs = 0;
+        queueLocked(event);
+    }
+}
+
+void RemoteInputInjector::queueLocked(const RemoteTouchEvent& event) {
+    const uint64_t now = nowUs();
+
+    // Keep the interval the client had since the previous event of the
+    // gesture, but don't hold events before the first or forever.
+    uint64_t delayUs = 0;
+    if (!mDown.empty() && event.timestampUs > mLastTimestampUs) {
+        delayUs = event.timestampUs - mLastTimestampUs;
+    }
+    const uint64_t dueUs = std::min(std::max(now, mLastDueUs + delayUs),
+                                    now + kMaxPacingDelayUs);
+
+    const auto it = std::find_if(mDown.begin(), mDown.end(),
+                                 [&event](const RemoteTouchEvent& down) {
+                                     return down.trackingId ==
+                                            event.trackingId;
+                                 });
+    if (event.pressure == 0) {
+        if (it != mDown.end()) {
+            mDown.erase(it);
+        }
+    } else if (it == mDown.end()) {
+        mDown.push_back(event);
+    } else {
+        *it = event;
+    }
+    mLastTimestampUs = event.timestampUs;
+    mLastDueUs = dueUs;
+
+    // Due times never decrease, so the timer only needs to be armed for
+    // the first pending event.
+    mPending.push_back({event, dueUs});
+    if (mPending.size() == 1) {
+        armTimerLocked();
+    }
+}
+
+void RemoteInputInjector::armTimerLocked() {
+    // Round up, the events must not be found early when it fires.
+    mTimer->startAbsolute((mPending.front().dueUs + 999) / 1000);
+}
+
+void RemoteInputInjector::onTimer() {
+    std::vector<RemoteTouchEvent> events;
+    AutoLock lock(mLock);
+    const uint64_t now = nowUs();
+    while (!mPending.empty() && mPending.front().dueUs <= now) {
+        events.push_back(mPending.front().event);
+        mPending.pop_front();
+    }
+    if (!mPending.empty()) {
+        armTimerLocked();
+    }
+    lock.unlock();
+
+    // Start a new batch at each finger seen twice.
+    size_t start = 0;
+    for (size_t i = 1; i < events.size(); ++i) {
+        for (size_t j = start; j < i; ++j) {
+            if (events[j].trackingId == events[i].trackingId) {
+                mCallback(&events[start], i - start);
+                start = i;
+                break;
+            }
+        }
+    }
+    if (start < events.size()) {
+        mCallback(&events[start], events.size() - start);
+    }
+}
+
+uint64_t RemoteInputInjector::nowUs() const {
+    return mLooper->nowNs() / 1000;
+}
+
+}  // namespace remoteinput
+}  // namespace android
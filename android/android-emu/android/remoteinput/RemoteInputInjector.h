@@ -0,0 +1,109 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#pragma once
+
+#include "android/base/Compiler.h"
+#include "android/base/async/Looper.h"
+#include "android/base/synchronization/Lock.h"
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <stdint.h>
+
+namespace android {
+namespace remoteinput {
+
+// A touch event of one of the fingers of a remote client.
+struct RemoteTouchEvent {
+    int trackingId;
+    int x;
+    int y;
+    // 0 when the finger is lifted.
+    int pressure;
+    // When the client sent the event, in microseconds of its own clock.
+    uint64_t timestampUs;
+    // When the event was received, in microseconds of the host monotonic
+    // clock, to trace its latency, or 0 if it was not.
+    uint64_t receivedUs;
+};
+
+// RemoteInputInjector replays the touch events received from a remote
+// client into the guest, from the thread of a looper that can touch the
+// virtual devices (i.e. the main loop). More specifically:
+//
+// - Events are paced by their client timestamps: during a gesture, an
+//   event is not injected sooner after the previous one than the client
+//   sent it, so bursts caused by the network don't speed gestures up.
+//   The wait is done with a looper timer, the thread queueing the events
+//   never blocks.
+//
+// - All the events that are due at once are injected as one batch, which
+//   the callback ends with a single EV_SYN, like a real multi-touch
+//   screen reports simultaneous touches. A batch never has two events of
+//   the same finger, so none is lost.
+//
+// NOTE: queue() and releaseAll() are called from the thread that receives
+// the events; this relies on Looper::Timer::startAbsolute() being
+// thread-safe, see DeviceContextRunner.
+class RemoteInputInjector {
+public:
+    // Called from the looper thread to inject |count| events as one batch.
+    using BatchCallback =
+            std::function<void(const RemoteTouchEvent* events, int count)>;
+
+    // An event is never held for longer than this, whatever its timestamp.
+    static constexpr uint64_t kMaxPacingDelayUs = 100 * 1000;
+
+    // Must be called from the thread of |looper|.
+    RemoteInputInjector(android::base::Looper* looper, BatchCallback callback);
+    ~RemoteInputInjector();
+
+    // Queue |event| for injection, from any thread.
+    void queue(const RemoteTouchEvent& event);
+    // Same as above for |count| events in a row.
+    void queue(const RemoteTouchEvent* events, size_t count);
+
+    // Queue the lifting of the fingers still down, e.g. when the client
+    // disconnects in the middle of a gesture.
+    void releaseAll();
+
+private:
+    struct PendingEvent {
+        RemoteTouchEvent event;
+        uint64_t dueUs;
+    };
+
+    void queueLocked(const RemoteTouchEvent& event);
+    void armTimerLocked();
+    void onTimer();
+    uint64_t nowUs() const;
+
+    android::base::Looper* const mLooper;
+    const BatchCallback mCallback;
+    std::unique_ptr<android::base::Looper::Timer> mTimer;
+
+    android::base::Lock mLock;
+    std::deque<PendingEvent> mPending;
+    // The fingers down after the queued events, and the client and host
+    // times of the last one, to pace the next.
+    std::vector<RemoteTouchEvent> mDown;
+    uint64_t mLastTimestampUs = 0;
+    uint64_t mLastDueUs = 0;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(RemoteInputInjector);
+};
+
+}  // namespace remoteinput
+}  // namespace android
@@ -0,0 +1,140 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/remoteinput/RemoteInputInjector.h"
+
+#include "android/base/testing/TestLooper.h"
+#include "android/base/testing/TestSystem.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using android::base::System;
+using android::base::TestLooper;
+using android::base::TestSystem;
+
+namespace android {
+namespace remoteinput {
+
+namespace {
+
+// The tracking ids of the events of each injected batch.
+using Batches = std::vector<std::vector<int>>;
+
+class RemoteInputInjectorTest : public ::testing::Test {
+public:
+    TestSystem mSystem{"/", System::kProgramBitness, "/"};
+    TestLooper mLooper;
+    Batches mBatches;
+    RemoteInputInjector mInjector{
+            &mLooper, [this](const RemoteTouchEvent* events, int count) {
+                mBatches.emplace_back();
+                for (int i = 0; i < count; ++i) {
+                    mBatches.back().push_back(
+                            events[i].pressure ? events[i].trackingId
+                                               : -events[i].trackingId);
+                }
+            }};
+
+    void SetUp() override { mSystem.setUnixTimeUs(1000000); }
+
+    // Move the time forward by |us| and run the timers due.
+    void advanceUs(uint64_t us) {
+        mSystem.setUnixTimeUs(mSystem.getUnixTimeUs() + us);
+        mLooper.runOneIterationWithDeadlineMs(mLooper.nowMs());
+    }
+
+    void down(int id, uint64_t timestampUs) {
+        mInjector.queue({id, 10, 10, 1, timestampUs});
+    }
+
+    void up(int id, uint64_t timestampUs) {
+        mInjector.queue({id, 10, 10, 0, timestampUs});
+    }
+};
+
+}  // namespace
+
+TEST_F(RemoteInputInjectorTest, batchesEventsDueTogether) {
+    // Two fingers touching at once, from the same packet burst.
+    down(1, 500);
+    down(2, 500);
+    advanceUs(0);
+    EXPECT_EQ(Batches({{1, 2}}), mBatches);
+}
+
+TEST_F(RemoteInputInjectorTest, splitsBatchesOnRepeatedFinger) {
+    // The main loop was late, but the tap must not be lost.
+    down(1, 500);
+    up(1, 500);
+    down(2, 500);
+    advanceUs(0);
+    EXPECT_EQ(Batches({{1}, {-1, 2}}), mBatches);
+}
+
+TEST_F(RemoteInputInjectorTest, pacesGesture) {
+    // A move sent 16 ms after the touch but received right after it waits
+    // for the same interval.
+    down(1, 1000);
+    mInjector.queue({1, 20, 20, 1, 17000});
+    advanceUs(0);
+    EXPECT_EQ(Batches({{1}}), mBatches);
+
+    advanceUs(15000);
+    EXPECT_EQ(1U, mBatches.size());
+    advanceUs(1000);
+    EXPECT_EQ(Batches({{1}, {1}}), mBatches);
+}
+
+TEST_F(RemoteInputInjectorTest, doesNotPaceFirstTouch) {
+    // The client timestamps are only compared within a gesture.
+    down(1, 1000);
+    up(1, 2000);
+    advanceUs(0);
+    advanceUs(1000);
+    EXPECT_EQ(2U, mBatches.size());
+
+    down(1, 900000);
+    advanceUs(0);
+    EXPECT_EQ(3U, mBatches.size());
+}
+
+TEST_F(RemoteInputInjectorTest, capsPacingDelay) {
+    down(1, 0);
+    // The client clock jumped.
+    mInjector.queue({1, 20, 20, 1, 3600000000ULL});
+    advanceUs(0);
+    EXPECT_EQ(1U, mBatches.size());
+
+    advanceUs(RemoteInputInjector::kMaxPacingDelayUs);
+    EXPECT_EQ(2U, mBatches.size());
+}
+
+TEST_F(RemoteInputInjectorTest, releaseAll) {
+    down(1, 0);
+    down(2, 0);
+    up(1, 0);
+    advanceUs(0);
+    mBatches.clear();
+
+    mInjector.releaseAll();
+    advanceUs(0);
+    EXPECT_EQ(Batches({{-2}}), mBatches);
+
+    // Nothing left to release.
+    mInjector.releaseAll();
+    advanceUs(0);
+    EXPECT_EQ(1U, mBatches.size());
+}
+
+}  // namespace remoteinput
+}  // namespace android
@@ -0,0 +1,201 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/remoteinput/RemoteInputProtocol.h"
+
+#include <string.h>
+
+namespace android {
+namespace remoteinput {
+
+// Size of the header of the version 2 stream, and of each of its packets.
+static const size_t kStreamHeaderSize = sizeof(kRemoteInputMagic) + 1;
+static const size_t kPacketHeaderSize = 3;
+
+static uint16_t readLe16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t readLe32(const uint8_t* p) {
+    return readLe16(p) | ((uint32_t)readLe16(p + 2) << 16);
+}
+
+static uint64_t readLe64(const uint8_t* p) {
+    return readLe32(p) | ((uint64_t)readLe32(p + 4) << 32);
+}
+
+static float readFloat(const uint8_t* p) {
+    const uint32_t bits = readLe32(p);
+    float res;
+    memcpy(&res, &bits, sizeof(res));
+    return res;
+}
+
+RemoteInputDecoder::RemoteInputDecoder(Sink* sink)
+    : mSink(sink), mBuffer(kBufferSize) {}
+
+char* RemoteInputDecoder::receiveBuffer(size_t* size) {
+    // Only the start of a packet can be left, move it to the front.
+    if (mStart > 0) {
+        memmove(mBuffer.data(), mBuffer.data() + mStart, mEnd - mStart);
+        mEnd -= mStart;
+        mStart = 0;
+    }
+    *size = mBuffer.size() - mEnd;
+    return mBuffer.data() + mEnd;
+}
+
+bool RemoteInputDecoder::decode(size_t size) {
+    mEnd += size;
+    const uint8_t* const data =
+            reinterpret_cast<const uint8_t*>(mBuffer.data());
+
+    if (mVersion == 0) {
+        if (mEnd - mStart < sizeof(kRemoteInputMagic)) {
+            return true;
+        }
+        if (memcmp(data + mStart, kRemoteInputMagic,
+                   sizeof(kRemoteInputMagic)) != 0) {
+            mVersion = 1;
+        } else if (mEnd - mStart < kStreamHeaderSize) {
+            return true;
+        } else {
+            // The packets of any later version can still be framed.
+            mVersion = data[mStart + sizeof(kRemoteInputMagic)];
+            if (mVersion < kRemoteInputVersion) {
+                return false;
+            }
+            mStart += kStreamHeaderSize;
+        }
+    }
+
+    if (mVersion == 1) {
+        for (; mEnd - mStart >= REMOTE_INPUT_PACKET_LEN;
+             mStart += REMOTE_INPUT_PACKET_LEN) {
+            if (!decodeV1(data + mStart)) {
+                return false;
+            }
+        }
+    } else {
+        while (mEnd - mStart >= kPacketHeaderSize) {
+            const size_t payloadSize = readLe16(data + mStart);
+            if (mEnd - mStart < kPacketHeaderSize + payloadSize) {
+                break;
+            }
+            if (!decodeV2(static_cast<RemoteInputPacketType>(
+                                  data[mStart + 2]),
+                          data + mStart + kPacketHeaderSize, payloadSize)) {
+                return false;
+            }
+            mStart += kPacketHeaderSize + payloadSize;
+        }
+    }
+
+    if (mStart == mEnd) {
+        mStart = mEnd = 0;
+    }
+    return true;
+}
+
+bool RemoteInputDecoder::decodeV1(const uint8_t* data) {
+    RemoteInputPacket packet;
+    memcpy(&packet, data, sizeof(packet));
+
+    // Negative tracking ids are reserved by the multi-touch screen.
+    if (packet.tracking_id < 0) {
+        return true;
+    }
+    RemoteTouchEvent event = {};
+    event.trackingId = packet.tracking_id;
+    event.x = packet.x;
+    event.y = packet.y;
+    event.timestampUs = packet.timestamp;
+    switch (packet.event) {
+        case MOUSE_EVENT_DOWN:
+        case MOUSE_EVENT_MOVE:
+            event.pressure = kRemoteTouchPressure;
+            break;
+        case MOUSE_EVENT_UP:
+            event.pressure = 0;
+            break;
+        default:
+            return true;
+    }
+    mSink->onTouch(event);
+    return true;
+}
+
+bool RemoteInputDecoder::decodeV2(RemoteInputPacketType type,
+                                  const uint8_t* payload,
+                                  size_t size) {
+    switch (type) {
+        case RemoteInputPacketType::kTouch: {
+            if (size < 21) {
+                return false;
+            }
+            RemoteTouchEvent event = {};
+            event.trackingId = (int32_t)readLe32(payload + 1);
+            event.x = (int32_t)readLe32(payload + 5);
+            event.y = (int32_t)readLe32(payload + 9);
+            event.timestampUs = readLe64(payload + 13);
+            event.pressure =
+                    size >= 23 ? readLe16(payload + 21) : kRemoteTouchPressure;
+            if (event.trackingId < 0) {
+                return true;
+            }
+            switch (static_cast<RemoteInputTouchAction>(payload[0])) {
+                case RemoteInputTouchAction::kUp:
+                    event.pressure = 0;
+                    break;
+                case RemoteInputTouchAction::kDown:
+                case RemoteInputTouchAction::kMove:
+                    // A zero pressure would lift the finger.
+                    if (event.pressure == 0) {
+                        event.pressure = 1;
+                    }
+                    break;
+                default:
+                    return true;
+            }
+            mSink->onTouch(event);
+            return true;
+        }
+
+        case RemoteInputPacketType::kKey:
+            if (size < 3) {
+                return false;
+            }
+            mSink->onKey(readLe16(payload), payload[2] != 0);
+            return true;
+
+        case RemoteInputPacketType::kSensor:
+            if (size < 13) {
+                return false;
+            }
+            mSink->onSensor(payload[0], readFloat(payload + 1),
+                            readFloat(payload + 5), readFloat(payload + 9));
+            return true;
+
+        case RemoteInputPacketType::kGamepad:
+            if (size < 4) {
+                return false;
+            }
+            mSink->onGamepad(readLe32(payload));
+            return true;
+
+        default:
+            // From a newer client.
+            return true;
+    }
+}
+
+}  // namespace remoteinput
+}  // namespace android
@@ -0,0 +1,164 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#pragma once
+
+#include "android/base/Compiler.h"
+#include "android/remoteinput/RemoteInputInjector.h"
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+namespace remoteinput {
+
+// The formats of the packets sent by remote input clients.
+//
+// Version 1 (legacy): a stream of fixed-size RemoteInputPacket structures,
+// touch events only.
+//
+// Version 2: the stream starts with the 4 bytes of kRemoteInputMagic and
+// a version byte, then each packet is:
+//
+//     u16 size     Number of bytes after the type.
+//     u8  type     One of RemoteInputPacketType.
+//     ...          |size| bytes of payload.
+//
+// All values are little-endian. Receivers skip the packets of unknown
+// types, and the payload bytes after the fields they know, so new types
+// and fields can be added without breaking older emulators. The payloads
+// are:
+//
+//     kTouch    u8 action (RemoteInputTouchAction), i32 tracking id,
+//               i32 x, i32 y, u64 client timestamp (us),
+//               [u16 pressure, kRemoteTouchPressure by default]
+//     kKey      u16 Linux key code, u8 1 if down or 0 if up
+//     kSensor   u8 sensor id (AndroidSensor), f32 a, f32 b, f32 c
+//     kGamepad  u32 pressed buttons (RemoteGamepadButton bits)
+//
+// A version 1 stream never starts with the magic: as coordinates, it would
+// be far out of any screen.
+
+typedef enum _MOUSE_EVENT_TYPE {
+    MOUSE_EVENT_DOWN = 0,
+    MOUSE_EVENT_UP,
+    MOUSE_EVENT_MOVE
+} MOUSE_EVENT_TYPE;
+
+typedef struct _RemoteInputPacket  {
+    int x : 16;
+    int y : 16;
+    MOUSE_EVENT_TYPE event : 8;
+    int tracking_id : 32;
+    uint64_t timestamp : 64;
+} __attribute__ ((packed)) RemoteInputPacket;
+
+#define REMOTE_INPUT_PACKET_LEN       (sizeof(RemoteInputPacket))
+
+static const char kRemoteInputMagic[4] = {'R', 'I', 'N', 'P'};
+static const uint8_t kRemoteInputVersion = 2;
+
+enum class RemoteInputPacketType : uint8_t {
+    kTouch = 1,
+    kKey = 2,
+    kSensor = 3,
+    kGamepad = 4,
+};
+
+enum class RemoteInputTouchAction : uint8_t {
+    kDown = MOUSE_EVENT_DOWN,
+    kUp = MOUSE_EVENT_UP,
+    kMove = MOUSE_EVENT_MOVE,
+};
+
+enum RemoteGamepadButton : uint32_t {
+    kGamepadA = 1 << 0,
+    kGamepadB = 1 << 1,
+    kGamepadX = 1 << 2,
+    kGamepadY = 1 << 3,
+    kGamepadL1 = 1 << 4,
+    kGamepadR1 = 1 << 5,
+    kGamepadSelect = 1 << 6,
+    kGamepadStart = 1 << 7,
+    kGamepadMode = 1 << 8,
+    kGamepadThumbL = 1 << 9,
+    kGamepadThumbR = 1 << 10,
+    kGamepadUp = 1 << 11,
+    kGamepadDown = 1 << 12,
+    kGamepadLeft = 1 << 13,
+    kGamepadRight = 1 << 14,
+};
+
+// The pressure of the touches that don't report one.
+static const int kRemoteTouchPressure = 0x81;
+
+// RemoteInputDecoder decodes the packets of one client connection, in
+// either format. The bytes are received directly in its buffer, so that
+// one read can get many packets, which are then decoded together:
+//
+//     size_t size;
+//     char* buffer = decoder.receiveBuffer(&size);
+//     ssize_t received = recv(fd, buffer, size, 0);
+//     if (received > 0 && !decoder.decode(received)) {
+//         // Close the connection.
+//     }
+class RemoteInputDecoder {
+public:
+    // Receives the decoded events, in order.
+    class Sink {
+    public:
+        virtual void onTouch(const RemoteTouchEvent& event) = 0;
+        virtual void onKey(int code, bool down) = 0;
+        virtual void onSensor(int sensorId, float a, float b, float c) = 0;
+        virtual void onGamepad(uint32_t buttons) = 0;
+
+    protected:
+        ~Sink() = default;
+    };
+
+    // Holds the largest packet, or thousands of touch packets.
+    static const size_t kBufferSize = 128 * 1024;
+
+    explicit RemoteInputDecoder(Sink* sink);
+
+    // Return where to receive the next bytes, and at most how many in
+    // |*size|, which is never 0.
+    char* receiveBuffer(size_t* size);
+
+    // Decode the packets completed by the |size| bytes just received in
+    // the buffer. Return false if the stream is invalid and the connection
+    // should be closed.
+    bool decode(size_t size);
+
+    // The version of the format of the stream, 0 until known.
+    int version() const { return mVersion; }
+
+private:
+    // Decode one packet, return false if the stream is invalid.
+    bool decodeV1(const uint8_t* data);
+    bool decodeV2(RemoteInputPacketType type,
+                  const uint8_t* payload,
+                  size_t size);
+
+    Sink* const mSink;
+    int mVersion = 0;
+    std::vector<char> mBuffer;
+    // The undecoded bytes are in [mStart, mEnd) of |mBuffer|.
+    size_t mStart = 0;
+    size_t mEnd = 0;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(RemoteInputDecoder);
+};
+
+}  // namespace remoteinput
+}  // namespace android
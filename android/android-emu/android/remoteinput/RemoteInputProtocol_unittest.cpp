@@ -0,0 +1,222 @@
+// Copyright 2016 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/remoteinput/RemoteInputProtocol.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <string.h>
+
+namespace android {
+namespace remoteinput {
+
+namespace {
+
+// Records the decoded events as strings.
+class TestSink : public RemoteInputDecoder::Sink {
+public:
+    void onTouch(const RemoteTouchEvent& event) override {
+        events.push_back("touch " + std::to_string(event.trackingId) + " " +
+                         std::to_string(event.x) + "," +
+                         std::to_string(event.y) + " " +
+                         std::to_string(event.pressure) + " @" +
+                         std::to_string(event.timestampUs));
+    }
+    void onKey(int code, bool down) override {
+        events.push_back("key " + std::to_string(code) +
+                         (down ? " down" : " up"));
+    }
+    void onSensor(int sensorId, float a, float b, float c) override {
+        events.push_back("sensor " + std::to_string(sensorId) + " " +
+                         std::to_string((int)a) + " " +
+                         std::to_string((int)b) + " " +
+                         std::to_string((int)c));
+    }
+    void onGamepad(uint32_t buttons) override {
+        events.push_back("gamepad " + std::to_string(buttons));
+    }
+
+    std::vector<std::string> events;
+};
+
+// Builds streams of version 2 packets.
+class StreamBuilder {
+public:
+    StreamBuilder& header(uint8_t version = kRemoteInputVersion) {
+        data.append(kRemoteInputMagic, sizeof(kRemoteInputMagic));
+        data.push_back(version);
+        return *this;
+    }
+    StreamBuilder& packet(RemoteInputPacketType type,
+                          const std::string& payload) {
+        le(payload.size(), 2);
+        data.push_back(static_cast<char>(type));
+        data += payload;
+        return *this;
+    }
+    StreamBuilder& le(uint64_t value, int size) {
+        for (int i = 0; i < size; ++i) {
+            data.push_back((char)(value >> (8 * i)));
+        }
+        return *this;
+    }
+
+    std::string data;
+};
+
+std::string touchPayload(RemoteInputTouchAction action,
+                         int id,
+                         int x,
+                         int y,
+                         uint64_t timestampUs) {
+    StreamBuilder b;
+    b.data.push_back(static_cast<char>(action));
+    b.le(id, 4).le(x, 4).le(y, 4).le(timestampUs, 8);
+    return b.data;
+}
+
+std::string floatBytes(float value) {
+    std::string res(sizeof(value), 0);
+    memcpy(&res[0], &value, sizeof(value));
+    return res;
+}
+
+// Receive |data| in |decoder|, |chunk| bytes at a time.
+bool receive(RemoteInputDecoder* decoder,
+             const std::string& data,
+             size_t chunk = SIZE_MAX) {
+    for (size_t pos = 0; pos < data.size();) {
+        size_t size;
+        char* buffer = decoder->receiveBuffer(&size);
+        size = std::min(std::min(size, chunk), data.size() - pos);
+        memcpy(buffer, data.data() + pos, size);
+        pos += size;
+        if (!decoder->decode(size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+TEST(RemoteInputDecoder, legacy) {
+    TestSink sink;
+    RemoteInputDecoder decoder(&sink);
+
+    RemoteInputPacket packets[3] = {};
+    packets[0] = {100, 200, MOUSE_EVENT_DOWN, 7, 1000};
+    packets[1] = {110, 210, MOUSE_EVENT_MOVE, 7, 2000};
+    packets[2] = {110, 210, MOUSE_EVENT_UP, 7, 3000};
+    const std::string data((const char*)packets, sizeof(packets));
+
+    // Packets split across reads.
+    EXPECT_TRUE(receive(&decoder, data, 5));
+    EXPECT_EQ(1, decoder.version());
+    EXPECT_EQ(std::vector<std::string>({"touch 7 100,200 129 @1000",
+                                        "touch 7 110,210 129 @2000",
+                                        "touch 7 110,210 0 @3000"}),
+              sink.events);
+}
+
+TEST(RemoteInputDecoder, allTypes) {
+    TestSink sink;
+    RemoteInputDecoder decoder(&sink);
+
+    StreamBuilder stream;
+    stream.header()
+            .packet(RemoteInputPacketType::kTouch,
+                    touchPayload(RemoteInputTouchAction::kDown, 3, 1080,
+                                 1920, 5))
+            .packet(RemoteInputPacketType::kKey,
+                    StreamBuilder().le(158, 2).le(1, 1).data)
+            .packet(RemoteInputPacketType::kSensor,
+                    std::string(1, 0) + floatBytes(1) + floatBytes(-2) +
+                            floatBytes(9))
+            .packet(RemoteInputPacketType::kGamepad,
+                    StreamBuilder().le(kGamepadA | kGamepadUp, 4).data);
+
+    // All the packets decoded from a single read.
+    EXPECT_TRUE(receive(&decoder, stream.data));
+    EXPECT_EQ(kRemoteInputVersion, decoder.version());
+    EXPECT_EQ(std::vector<std::string>({"touch 3 1080,1920 129 @5",
+                                        "key 158 down", "sensor 0 1 -2 9",
+                                        "gamepad 2049"}),
+              sink.events);
+}
+
+TEST(RemoteInputDecoder, extensions) {
+    TestSink sink;
+    RemoteInputDecoder decoder(&sink);
+
+    StreamBuilder stream;
+    stream.header(kRemoteInputVersion + 1)
+            // An unknown packet type.
+            .packet(static_cast<RemoteInputPacketType>(200), "whatever")
+            // The optional pressure, and an unknown field after it.
+            .packet(RemoteInputPacketType::kTouch,
+                    touchPayload(RemoteInputTouchAction::kMove, 1, 2, 3, 4) +
+                            StreamBuilder().le(50, 2).le(0xffff, 2).data)
+            .packet(RemoteInputPacketType::kTouch,
+                    touchPayload(RemoteInputTouchAction::kUp, 1, 2, 3, 5));
+
+    EXPECT_TRUE(receive(&decoder, stream.data, 1));
+    EXPECT_EQ(std::vector<std::string>(
+                      {"touch 1 2,3 50 @4", "touch 1 2,3 0 @5"}),
+              sink.events);
+}
+
+TEST(RemoteInputDecoder, invalid) {
+    {
+        TestSink sink;
+        RemoteInputDecoder decoder(&sink);
+        EXPECT_FALSE(receive(&decoder, StreamBuilder().header(1).data));
+    }
+    {
+        // A known packet missing fields.
+        TestSink sink;
+        RemoteInputDecoder decoder(&sink);
+        EXPECT_FALSE(
+                receive(&decoder, StreamBuilder()
+                                          .header()
+                                          .packet(RemoteInputPacketType::kKey,
+                                                  "x")
+                                          .data));
+    }
+}
+
+TEST(RemoteInputDecoder, largestPacket) {
+    TestSink sink;
+    RemoteInputDecoder decoder(&sink);
+
+    StreamBuilder stream;
+    stream.header()
+            .packet(RemoteInputPacketType::kGamepad,
+                    StreamBuilder().le(1, 4).data)
+            .packet(RemoteInputPacketType::kGamepad,
+                    StreamBuilder().le(2, 4).data + std::string(65531, 0))
+            .packet(RemoteInputPacketType::kGamepad,
+                    StreamBuilder().le(3, 4).data);
+
+    // Read more than a packet at a time, so that it is never at the start
+    // of the buffer.
+    EXPECT_TRUE(receive(&decoder, stream.data, 1000));
+    EXPECT_EQ(std::vector<std::string>(
+                      {"gamepad 1", "gamepad 2", "gamepad 3"}),
+              sink.events);
+}
+
+}  // namespace remoteinput
+}  // namespace android
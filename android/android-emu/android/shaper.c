@@ -51,38 +51,78 @@ _packet_is_internal( const uint8_t*  data, size_t  size )
  * that it takes 1/MAX_RATE seconds to send a single bit, and count*8/MAX_RATE
  * seconds to send 'count' bytes.
  *
- * we're going to implement a scheme where, when we send a packet of
- * 'count' bytes, no other packet will go through in the same direction for
- * at least 'count*8/MAX_RATE' seconds. any successive packet that is "sent"
- * in this interval is placed in a queue, associated to a timer
+ * we use a token bucket for this: it is filled with MAX_RATE/8 bytes per
+ * second, up to SHAPER_BURST_MS worth of them, and a packet can go through
+ * as long as the bucket isn't empty. the packet's size is then taken from
+ * the bucket, which can go below zero for a big packet: no other packet will
+ * go through in the same direction until it has been filled again. any
+ * packet that is "sent" in the meantime is placed at the end of a queue, and
+ * a single timer is programmed for the time at which the first one can go.
  *
  * there are different (queue/timer/rate) values for the input and output
  * direction of the user vlan.
  */
+#define  SHAPER_BURST_MS   10
+
 typedef struct QueuedPacketRec_ {
-    Duration                   expiration;
     struct QueuedPacketRec_*   next;
     size_t                     size;
     void*                      opaque;
     void*                      data;
+    int                        pooled;  /* is this packet from a pool ? */
 } QueuedPacketRec, *QueuedPacket;
 
+/* queued packets are recycled through a pool instead of being allocated
+ * and freed for each packet. a pooled packet has room for the copy of any
+ * Ethernet frame, bigger ones are allocated on their own.
+ */
+#define  PACKET_POOL_DATA_SIZE   2048
+#define  PACKET_POOL_MAX_FREE    256
+
+typedef struct PacketPoolRec_ {
+    QueuedPacket   free_packets;
+    int            num_free;
+} PacketPoolRec, *PacketPool;
+
+static void
+packet_pool_init( PacketPool  pool )
+{
+    pool->free_packets = NULL;
+    pool->num_free     = 0;
+}
+
+static void
+packet_pool_done( PacketPool  pool )
+{
+    while (pool->free_packets) {
+        QueuedPacket  packet = pool->free_packets;
+        pool->free_packets = packet->next;
+        free(packet);
+    }
+    pool->num_free = 0;
+}
 
 static QueuedPacket
-queued_packet_create( const void*   data,
+queued_packet_create( PacketPool    pool,
+                      const void*   data,
                       size_t        size,
                       void*         opaque,
                       int           do_copy )
 {
     QueuedPacket   packet;
-    size_t         packet_size = sizeof(*packet);
 
-    if (do_copy)
-        packet_size += size;
-
-    packet = malloc(packet_size);
+    if (do_copy && size > PACKET_POOL_DATA_SIZE) {
+        packet = malloc(sizeof(*packet) + size);
+        packet->pooled = 0;
+    } else if (pool->free_packets) {
+        packet = pool->free_packets;
+        pool->free_packets = packet->next;
+        pool->num_free--;
+    } else {
+        packet = malloc(sizeof(*packet) + PACKET_POOL_DATA_SIZE);
+        packet->pooled = 1;
+    }
     packet->next       = NULL;
-    packet->expiration = 0;
     packet->size       = (size_t)size;
     packet->opaque     = opaque;
 
@@ -96,21 +136,32 @@ queued_packet_create( const void*   data,
 }
 
 static void
-queued_packet_free( QueuedPacket  packet )
+queued_packet_free( PacketPool  pool, QueuedPacket  packet )
 {
     if (packet) {
-        free( packet );
+        if (packet->pooled && pool->num_free < PACKET_POOL_MAX_FREE) {
+            packet->next = pool->free_packets;
+            pool->free_packets = packet;
+            pool->num_free++;
+        } else {
+            free( packet );
+        }
     }
 }
 
 typedef struct NetShaperRec_ {
-    QueuedPacket   packets;   /* list of queued packets, ordered by expiration date */
+    QueuedPacket   packets;   /* list of queued packets, in sending order */
+    QueuedPacket   last;      /* last queued packet */
     int            num_packets;
     int            active;    /* is this shaper active ? */
-    Duration       block_until;
-    double         max_rate;  /* max rate expressed in bytes/second */
-    double         inv_rate;  /* inverse of max rate                */
+    double         max_rate;  /* max rate expressed in bits/second */
+    double         inv_rate;  /* milliseconds to send a byte */
+    double         tokens;    /* bytes that can be sent, < 0 when blocked */
+    double         burst;     /* max number of tokens */
+    Duration       refilled;  /* when the tokens were last updated */
+    Looper*        looper;
     LoopTimer*     timer;     /* timer */
+    PacketPoolRec  pool;
 
     int                do_copy;
     NetShaperSendFunc  send_func;
@@ -128,8 +179,10 @@ netshaper_destroy( NetShaper  shaper )
             QueuedPacket  packet = shaper->packets;
             shaper->packets = packet->next;
             packet->next    = NULL;
-            queued_packet_free(packet);
+            queued_packet_free(&shaper->pool, packet);
         }
+        shaper->last = NULL;
+        packet_pool_done(&shaper->pool);
 
         loopTimer_stop(shaper->timer);
         loopTimer_free(shaper->timer);
@@ -138,36 +191,58 @@ netshaper_destroy( NetShaper  shaper )
     }
 }
 
+/* fill the bucket with the tokens accumulated since the last time */
+static void
+netshaper_refill( NetShaper  shaper, Duration  now )
+{
+    if (now > shaper->refilled) {
+        shaper->tokens += (now - shaper->refilled) / shaper->inv_rate;
+        if (shaper->tokens > shaper->burst)
+            shaper->tokens = shaper->burst;
+        shaper->refilled = now;
+    }
+}
+
+/* program the timer for when the first queued packet can be sent */
+static void
+netshaper_rearm( NetShaper  shaper, Duration  now )
+{
+    double    wait_ms = -shaper->tokens * shaper->inv_rate;
+    Duration  wait    = (Duration)wait_ms;
+
+    if (wait < wait_ms || wait == 0)
+        wait++;
+    loopTimer_startAbsolute(shaper->timer, now + wait);
+}
+
 /* this function is called when the shaper's timer expires */
 static void
 netshaper_expires(void* opaque, LoopTimer* unused)
 {
     NetShaper shaper = (NetShaper)opaque;
     QueuedPacket  packet;
+    Duration      now;
 
     if (opaque == NULL) {
         crashhandler_die("netshaper_expires() with opaque==NULL");
     }
 
-    while ((packet = shaper->packets) != NULL) {
-       Duration now = looper_nowWithClock(looper_getForThread(), SHAPER_CLOCK);
+    now = looper_nowWithClock(shaper->looper, SHAPER_CLOCK);
+    netshaper_refill(shaper, now);
 
-       if (packet->expiration > now)
-           break;
-
-       shaper->packets = packet->next;
-       shaper->send_func( packet->data, packet->size, packet->opaque );
-       queued_packet_free(packet);
-       shaper->num_packets--;
-   }
+    while ((packet = shaper->packets) != NULL && shaper->tokens >= 0) {
+        shaper->packets = packet->next;
+        if (!shaper->packets)
+            shaper->last = NULL;
+        shaper->num_packets--;
+        shaper->tokens -= packet->size;
+        shaper->send_func( packet->data, packet->size, packet->opaque );
+        queued_packet_free(&shaper->pool, packet);
+    }
 
-   /* reprogram timer if needed */
-   if (shaper->packets) {
-       shaper->block_until = shaper->packets->expiration;
-       loopTimer_startAbsolute(shaper->timer, shaper->block_until);
-   } else {
-       shaper->block_until = -1;
-   }
+    /* reprogram timer if needed */
+    if (shaper->packets)
+        netshaper_rearm(shaper, now);
 }
 
 
@@ -179,14 +254,19 @@ netshaper_create( int                do_copy,
 
     shaper->active = 0;
     shaper->packets = NULL;
+    shaper->last = NULL;
     shaper->num_packets = 0;
+    shaper->looper = looper_getForThread();
     shaper->timer = loopTimer_newWithClock(
-            looper_getForThread(), netshaper_expires, shaper, SHAPER_CLOCK);
+            shaper->looper, netshaper_expires, shaper, SHAPER_CLOCK);
+    shaper->do_copy   = do_copy;
     shaper->send_func = send_func;
     shaper->max_rate  = 1e6;
     shaper->inv_rate  = 0.;
-
-    shaper->block_until = -1; /* magic value, means to not block */
+    shaper->tokens    = 0.;
+    shaper->burst     = 0.;
+    shaper->refilled  = 0;
+    packet_pool_init(&shaper->pool);
 
     return shaper;
 }
@@ -202,19 +282,22 @@ netshaper_set_rate( NetShaper  shaper,
         QueuedPacket  packet = shaper->packets;
         shaper->packets = packet->next;
         shaper->send_func(packet->data, packet->size, packet->opaque);
-        free(packet);
-        shaper->num_packets = 0;
+        queued_packet_free(&shaper->pool, packet);
     }
+    shaper->last = NULL;
+    shaper->num_packets = 0;
+    loopTimer_stop(shaper->timer);
 
     shaper->max_rate = rate;
     if (rate > 1.) {
         shaper->inv_rate = (8.*SHAPER_CLOCK_UNIT)/rate;  /* our clock time is in ms */
+        shaper->burst    = SHAPER_BURST_MS / shaper->inv_rate;
+        shaper->tokens   = shaper->burst;
+        shaper->refilled = looper_nowWithClock(shaper->looper, SHAPER_CLOCK);
         shaper->active   = 1;                            /* for the real-time clock */
     } else {
         shaper->active = 0;
     }
-
-    shaper->block_until = -1;
 }
 
 void
@@ -223,50 +306,34 @@ netshaper_send_aux( NetShaper  shaper,
                     size_t     size,
                     void*      opaque )
 {
-    Duration now;
+    QueuedPacket  packet;
 
     if (!shaper->active || _packet_is_internal(data, size)) {
         shaper->send_func( data, size, opaque );
         return;
     }
 
-    now = looper_nowWithClock(looper_getForThread(), SHAPER_CLOCK);
-    if (now >= shaper->block_until) {
-        shaper->send_func( data, size, opaque );
-        shaper->block_until = now + size*shaper->inv_rate;
-        //fprintf(stderr, "NETSHAPER: block for %.2fms\n", (shaper->block_until - now)*1.0 );
-        return;
-    }
-
-    /* create new packet, add it to the queue */
-    {
-        QueuedPacket   packet;
-
-        packet = queued_packet_create( data, size, opaque, shaper->do_copy );
-
-        packet->expiration = shaper->block_until;
-
-        {
-            QueuedPacket  *pnode, node;
-
-            pnode = &shaper->packets;
-            for (;;) {
-                node = *pnode;
-                if (node == NULL || node->expiration > packet->expiration )
-                    break;
-                pnode = &node->next;
-            }
-            packet->next = *pnode;
-            *pnode       = packet;
+    if (!shaper->packets) {
+        Duration  now = looper_nowWithClock(shaper->looper, SHAPER_CLOCK);
 
-            if (packet == shaper->packets) {
-                loopTimer_startAbsolute(shaper->timer, packet->expiration);
-            }
+        netshaper_refill(shaper, now);
+        if (shaper->tokens >= 0) {
+            shaper->tokens -= size;
+            shaper->send_func( data, size, opaque );
+            return;
         }
-        shaper->num_packets += 1;
+        netshaper_rearm(shaper, now);
     }
-    shaper->block_until += size*shaper->inv_rate;
-    //fprintf(stderr, "NETSHAPER: block2 for %.2fms\n", (shaper->block_until - now)*1.0 );
+
+    /* add a new packet to the end of the queue */
+    packet = queued_packet_create( &shaper->pool, data, size, opaque,
+                                   shaper->do_copy );
+    if (shaper->last)
+        shaper->last->next = packet;
+    else
+        shaper->packets = packet;
+    shaper->last = packet;
+    shaper->num_packets += 1;
 }
 
 void
@@ -279,30 +346,231 @@ netshaper_send( NetShaper  shaper,
 
 
 int
-netshaper_can_send( NetShaper  shaper )
+netshaper_num_pooled_for_testing( NetShaper  shaper )
 {
-    Duration now;
+    return shaper->pool.num_free;
+}
+
 
-    if (!shaper->active || shaper->block_until < 0)
+int
+netshaper_can_send( NetShaper  shaper )
+{
+    if (!shaper->active)
         return 1;
 
     if (shaper->packets)
         return 0;
 
-    now = looper_nowWithClock(looper_getForThread(), SHAPER_CLOCK);
-    return (now >= shaper->block_until);
+    netshaper_refill(shaper,
+            looper_nowWithClock(shaper->looper, SHAPER_CLOCK));
+    return (shaper->tokens >= 0);
+}
+
+
+
+
+
+
+/* the delayed packets are kept in a hierarchical timer wheel: level 0 has
+ * a slot per millisecond for the next TIMER_WHEEL_SLOTS milliseconds, and
+ * each level above a slot for as many milliseconds as the whole level below.
+ * the entries of a slot of an upper level are moved down when the time
+ * reaches it. adding or removing an entry doesn't depend on the number of
+ * entries, and finding the next one to expire only looks at a bitmap.
+ */
+#define  TIMER_WHEEL_BITS     6
+#define  TIMER_WHEEL_SLOTS    (1 << TIMER_WHEEL_BITS)
+#define  TIMER_WHEEL_MASK     (TIMER_WHEEL_SLOTS - 1)
+#define  TIMER_WHEEL_LEVELS   4
+
+/* the longest delay, about 4.6 hours */
+#define  TIMER_WHEEL_MAX_DELAY  \
+    (((Duration)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+typedef struct TimerWheelEntryRec_ {
+    struct TimerWheelEntryRec_*   next;
+    struct TimerWheelEntryRec_**  pnext;  /* NULL if not in the wheel */
+    Duration                      expiration;
+    int                           level;
+    int                           slot;
+} TimerWheelEntryRec, *TimerWheelEntry;
+
+typedef void (*TimerWheelFunc)( TimerWheelEntry  entry, void*  opaque );
+
+typedef struct TimerWheelRec_ {
+    Duration         now;     /* next millisecond to expire */
+    int              count;
+    uint64_t         bitmaps[TIMER_WHEEL_LEVELS];  /* non-empty slots */
+    TimerWheelEntry  slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} TimerWheelRec, *TimerWheel;
+
+static void
+timer_wheel_init( TimerWheel  wheel, Duration  now )
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+static void
+timer_wheel_insert( TimerWheel  wheel, TimerWheelEntry  entry )
+{
+    Duration  expiration = entry->expiration;
+    Duration  delta;
+    int       level = 0;
+
+    if (expiration < wheel->now)
+        expiration = wheel->now;
+    delta = expiration - wheel->now;
+    if (delta > TIMER_WHEEL_MAX_DELAY)
+        expiration = wheel->now + TIMER_WHEEL_MAX_DELAY;
+
+    while (delta >= ((Duration)1 << (TIMER_WHEEL_BITS * (level + 1))) &&
+           level < TIMER_WHEEL_LEVELS - 1)
+        level++;
+
+    entry->level = level;
+    entry->slot  = (int)(expiration >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    entry->next  = wheel->slots[level][entry->slot];
+    if (entry->next)
+        entry->next->pnext = &entry->next;
+    entry->pnext = &wheel->slots[level][entry->slot];
+    *entry->pnext = entry;
+    wheel->bitmaps[level] |= (uint64_t)1 << entry->slot;
+}
+
+static void
+timer_wheel_add( TimerWheel  wheel, TimerWheelEntry  entry, Duration  expiration )
+{
+    entry->expiration = expiration;
+    timer_wheel_insert(wheel, entry);
+    wheel->count++;
+}
+
+static void
+timer_wheel_unlink( TimerWheel  wheel, TimerWheelEntry  entry )
+{
+    *entry->pnext = entry->next;
+    if (entry->next)
+        entry->next->pnext = entry->pnext;
+    if (!wheel->slots[entry->level][entry->slot])
+        wheel->bitmaps[entry->level] &= ~((uint64_t)1 << entry->slot);
+    entry->next  = NULL;
+    entry->pnext = NULL;
 }
 
+static void
+timer_wheel_remove( TimerWheel  wheel, TimerWheelEntry  entry )
+{
+    if (entry->pnext) {
+        timer_wheel_unlink(wheel, entry);
+        wheel->count--;
+    }
+}
 
+/* move the entries of the upper levels that are due within the next
+ * TIMER_WHEEL_SLOTS milliseconds down to the lower levels */
+static void
+timer_wheel_cascade( TimerWheel  wheel )
+{
+    int  level;
+
+    for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        int              slot = (int)(wheel->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+        TimerWheelEntry  entry = wheel->slots[level][slot];
+
+        wheel->slots[level][slot] = NULL;
+        wheel->bitmaps[level] &= ~((uint64_t)1 << slot);
+        while (entry) {
+            TimerWheelEntry  next = entry->next;
+            timer_wheel_insert(wheel, entry);
+            entry = next;
+        }
+        if (slot != 0)
+            break;
+    }
+}
 
+/* index of the first non-empty slot of level 0 from 'slot', or -1 */
+static int
+timer_wheel_next_slot( TimerWheel  wheel, int  slot )
+{
+    uint64_t  bits = wheel->bitmaps[0] >> slot;
+    int       n;
+
+    if (!bits)
+        return -1;
+    for (n = slot; !(bits & 1); n++)
+        bits >>= 1;
+    return n;
+}
 
+/* expire all the entries due until 'now' included, calling 'func' for each
+ * of them once it has been removed from the wheel */
+static void
+timer_wheel_advance( TimerWheel      wheel,
+                     Duration        now,
+                     TimerWheelFunc  func,
+                     void*           opaque )
+{
+    if (!wheel->count) {
+        if (now >= wheel->now)
+            wheel->now = now + 1;
+        return;
+    }
+
+    while (wheel->now <= now) {
+        int  slot = (int)wheel->now & TIMER_WHEEL_MASK;
+        int  next;
+
+        if (slot == 0)
+            timer_wheel_cascade(wheel);
+
+        while (wheel->slots[0][slot]) {
+            TimerWheelEntry  entry = wheel->slots[0][slot];
+            timer_wheel_unlink(wheel, entry);
+            wheel->count--;
+            func(entry, opaque);
+        }
+
+        /* skip to the next non-empty slot, or the next cascade */
+        next = timer_wheel_next_slot(wheel, slot);
+        if (next < 0)
+            next = TIMER_WHEEL_SLOTS;
+        else if (next == slot)
+            next++;
+        wheel->now += next - slot;
+        if (wheel->now > now + 1)
+            wheel->now = now + 1;
+    }
+}
+
+/* return the time at which timer_wheel_advance() must be called next */
+static Duration
+timer_wheel_next_expiration( TimerWheel  wheel )
+{
+    int  slot, next;
+
+    if (!wheel->count)
+        return DURATION_INFINITE;
+
+    slot = (int)wheel->now & TIMER_WHEEL_MASK;
+    next = timer_wheel_next_slot(wheel, slot);
+    if (next < 0 || (slot == 0 && wheel->bitmaps[1] | wheel->bitmaps[2] |
+                                  wheel->bitmaps[3])) {
+        /* nothing in level 0, or the upper levels must be cascaded first */
+        if (slot == 0)
+            return wheel->now;
+        return wheel->now + TIMER_WHEEL_SLOTS - slot;
+    }
+    return wheel->now + next - slot;
+}
 
 
 /* this type is used to model a session connection/state
  * if session->packet is != NULL, then the connection is delayed
  */
 typedef struct SessionRec_ {
-    Duration              expiration;
+    TimerWheelEntryRec    entry;  /* in the wheel while the packet is delayed */
     struct SessionRec_*   next;
     unsigned              src_ip;
     unsigned              dst_ip;
@@ -316,19 +584,8 @@ typedef struct SessionRec_ {
 #define  _PROTOCOL_TCP   6
 #define  _PROTOCOL_UDP   17
 
-
-
-static void
-session_free( Session  session )
-{
-    if (session) {
-        if (session->packet) {
-            queued_packet_free(session->packet);
-            session->packet = NULL;
-        }
-        free( session );
-    }
-}
+/* number of buckets of the table of sessions, a power of 2 */
+#define  NETDELAY_HASH_SIZE   1024
 
 
 #if 0  /* useful for debugging */
@@ -397,22 +654,49 @@ _packet_SYN_flags( const void*  _data, size_t   size, Session  info )
 
 typedef struct NetDelayRec_
 {
-    Session     sessions;
-    int         num_sessions;
-    LoopTimer*  timer;
-    int         active;
-    int         min_ms;
-    int         max_ms;
+    Session        sessions[NETDELAY_HASH_SIZE];  /* hash table of sessions */
+    int            num_sessions;
+    TimerWheelRec  wheel;     /* sessions with a delayed packet */
+    Looper*        looper;
+    LoopTimer*     timer;
+    int            active;
+    int            min_ms;
+    int            max_ms;
+    PacketPoolRec  pool;
 
     NetShaperSendFunc  send_func;
 
 } NetDelayRec;
 
 
+static void
+session_free( NetDelay  delay, Session  session )
+{
+    if (session) {
+        timer_wheel_remove(&delay->wheel, &session->entry);
+        if (session->packet) {
+            queued_packet_free(&delay->pool, session->packet);
+            session->packet = NULL;
+        }
+        free( session );
+    }
+}
+
+static unsigned
+session_hash( Session  info )
+{
+    unsigned  hash = info->src_ip * 0x9e3779b1U;
+
+    hash = (hash ^ info->dst_ip) * 0x9e3779b1U;
+    hash = (hash ^ ((info->src_port << 16) | info->dst_port)) * 0x9e3779b1U;
+    hash ^= info->protocol;
+    return (hash ^ (hash >> 16)) & (NETDELAY_HASH_SIZE - 1);
+}
+
 static Session*
 netdelay_lookup_session( NetDelay  delay, Session  info )
 {
-    Session*  pnode = &delay->sessions;
+    Session*  pnode = &delay->sessions[session_hash(info)];
     Session   node;
 
     for (;;) {
@@ -433,42 +717,34 @@ netdelay_lookup_session( NetDelay  delay, Session  info )
 }
 
 
+/* called by the wheel when the delay of a session is over */
+static void
+netdelay_session_expires( TimerWheelEntry  entry, void*  opaque )
+{
+    NetDelay      delay   = (NetDelay)opaque;
+    Session       session = (Session)entry;
+    QueuedPacket  packet  = session->packet;
+
+    /* send the SYN packet now */
+            //fprintf(stderr, "NetDelay:RST: sending creation for %s\n", session_to_string(session) );
+    session->packet = NULL;
+    delay->send_func( packet->data, packet->size, packet->opaque );
+    queued_packet_free( &delay->pool, packet );
+}
 
 /* called by the delay's timer on expiration */
 static void
 netdelay_expires(void* opaque, LoopTimer* unused)
 {
     NetDelay delay = (NetDelay)opaque;
-    Session  session;
-    Duration now = looper_nowWithClock(looper_getForThread(), SHAPER_CLOCK);
-    int      rearm = 0;
-    Duration rearm_time = 0;
-
-    for (session = delay->sessions; session != NULL; session = session->next)
-    {
-        QueuedPacket  packet = session->packet;
-
-        if (packet == NULL)
-            continue;
-
-        if (session->expiration <= now) {
-            /* send the SYN packet now */
-                    //fprintf(stderr, "NetDelay:RST: sending creation for %s\n", session_to_string(session) );
-            delay->send_func( packet->data, packet->size, packet->opaque );
-            session->packet = NULL;
-            queued_packet_free( packet );
-        } else {
-            if (!rearm) {
-                rearm      = 1;
-                rearm_time = session->expiration;
-            }
-            else if ( session->expiration < rearm_time )
-                rearm_time = session->expiration;
-        }
-    }
+    Duration now = looper_nowWithClock(delay->looper, SHAPER_CLOCK);
+    Duration next;
+
+    timer_wheel_advance(&delay->wheel, now, netdelay_session_expires, delay);
 
-    if (rearm) {
-        loopTimer_startAbsolute(delay->timer, rearm_time);
+    next = timer_wheel_next_expiration(&delay->wheel);
+    if (next != DURATION_INFINITE) {
+        loopTimer_startAbsolute(delay->timer, next);
     }
 }
 
@@ -478,13 +754,17 @@ netdelay_create( NetShaperSendFunc  send_func )
 {
     NetDelay  delay = malloc(sizeof(*delay));
 
-    delay->sessions     = NULL;
+    memset(delay->sessions, 0, sizeof(delay->sessions));
     delay->num_sessions = 0;
+    delay->looper = looper_getForThread();
     delay->timer = loopTimer_newWithClock(
-            looper_getForThread(), netdelay_expires, delay, SHAPER_CLOCK);
+            delay->looper, netdelay_expires, delay, SHAPER_CLOCK);
+    timer_wheel_init(&delay->wheel,
+            looper_nowWithClock(delay->looper, SHAPER_CLOCK));
     delay->active = 0;
     delay->min_ms = 0;
     delay->max_ms = 0;
+    packet_pool_init(&delay->pool);
 
     delay->send_func = send_func;
 
@@ -495,18 +775,23 @@ netdelay_create( NetShaperSendFunc  send_func )
 void
 netdelay_set_latency( NetDelay  delay, int  min_ms, int  max_ms )
 {
+    int  n;
+
     /* when changing the latency, accept all sessions */
-    while (delay->sessions) {
-        Session  session = delay->sessions;
-        delay->sessions = session->next;
-        session->next = NULL;
-        if (session->packet) {
-            QueuedPacket  packet = session->packet;
-            delay->send_func( packet->data, packet->size, packet->opaque );
+    for (n = 0; n < NETDELAY_HASH_SIZE; n++) {
+        while (delay->sessions[n]) {
+            Session  session = delay->sessions[n];
+            delay->sessions[n] = session->next;
+            session->next = NULL;
+            if (session->packet) {
+                QueuedPacket  packet = session->packet;
+                delay->send_func( packet->data, packet->size, packet->opaque );
+            }
+            session_free(delay, session);
+            delay->num_sessions--;
         }
-        session_free(session);
-        delay->num_sessions--;
     }
+    loopTimer_stop(delay->timer);
 
     delay->min_ms = min_ms;
     delay->max_ms = max_ms;
@@ -536,7 +821,7 @@ netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void* opaqu
                 //fprintf(stderr, "NetDelay:RST: dropping %s\n", session_to_string(info) );
 
                 *lookup = session->next;
-                session_free( session );
+                session_free( delay, session );
                 delay->num_sessions -= 1;
             }
         }
@@ -556,8 +841,9 @@ netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void* opaqu
                 }
             } else {
                 /* establish a new session slightly in the future */
-                int   latency = delay->min_ms;
-                int   range   = delay->max_ms - delay->min_ms;
+                int       latency = delay->min_ms;
+                int       range   = delay->max_ms - delay->min_ms;
+                Duration  now;
 
                  if (range > 0)
                     latency += rand() % range;
@@ -565,21 +851,26 @@ netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void* opaqu
                     //fprintf(stderr, "NetDelay:RST: delay creation for %s\n", session_to_string(info) );
                 session = malloc( sizeof(*session) );
 
-                session->next        = delay->sessions;
-                delay->sessions      = session;
+                session->next        = NULL;
+                *lookup              = session;
                 delay->num_sessions += 1;
 
-                session->expiration = looper_nowWithClock(looper_getForThread(), SHAPER_CLOCK) + latency;
-
                 session->src_ip   = info->src_ip;
                 session->dst_ip   = info->dst_ip;
                 session->src_port = info->src_port;
                 session->dst_port = info->dst_port;
                 session->protocol = info->protocol;
 
-                session->packet = queued_packet_create( data, size, opaque, 1 );
+                session->packet = queued_packet_create( &delay->pool, data,
+                                                        size, opaque, 1 );
 
-                netdelay_expires(delay, delay->timer);
+                /* send what is due first, the new packet isn't */
+                now = looper_nowWithClock(delay->looper, SHAPER_CLOCK);
+                timer_wheel_advance(&delay->wheel, now - 1,
+                                    netdelay_session_expires, delay);
+                timer_wheel_add(&delay->wheel, &session->entry, now + latency);
+                loopTimer_startAbsolute(delay->timer,
+                        timer_wheel_next_expiration(&delay->wheel));
                 return;
             }
         }
@@ -593,12 +884,17 @@ void
 netdelay_destroy( NetDelay  delay )
 {
     if (delay) {
-        while (delay->sessions) {
-            Session  session = delay->sessions;
-            delay->sessions = session->next;
-            session_free(session);
-            delay->num_sessions -= 1;
+        int  n;
+
+        for (n = 0; n < NETDELAY_HASH_SIZE; n++) {
+            while (delay->sessions[n]) {
+                Session  session = delay->sessions[n];
+                delay->sessions[n] = session->next;
+                session_free(delay, session);
+                delay->num_sessions -= 1;
+            }
         }
+        packet_pool_done(&delay->pool);
         loopTimer_stop(delay->timer);
         loopTimer_free(delay->timer);
         delay->timer = NULL;
@@ -37,6 +37,9 @@ int         netshaper_can_send( NetShaper  shaper );
 
 void        netshaper_destroy (NetShaper   shaper);
 
+/* number of packets kept for reuse by the shaper, for unit tests only */
+int         netshaper_num_pooled_for_testing( NetShaper  shaper );
+
 /* a NetDelay object is used to simulate network connection latencies */
 typedef struct NetDelayRec_*  NetDelay;
 
@@ -0,0 +1,159 @@
+// Copyright (C) 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A benchmark of the network shaper and delay, which emulate the bandwidth
+// and latency of a mobile network for every packet.
+
+#include "android/shaper.h"
+
+#include "android/base/async/ThreadLooper.h"
+#include "android/base/testing/ManualClockLooper.h"
+
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "benchmark/benchmark_api.h"
+
+using android::base::ManualClockLooper;
+using android::base::ThreadLooper;
+
+namespace {
+
+ManualClockLooper* looper() {
+    static ManualClockLooper* const sLooper = [] {
+        ManualClockLooper* looper = new ManualClockLooper();
+        ThreadLooper::setLooper(looper, true);
+        return looper;
+    }();
+    return sLooper;
+}
+
+const size_t kPacketSize = 1514;
+const int kPacketsPerConnection = 64;
+const uint8_t kTcpSyn = 0x02;
+const uint8_t kTcpAck = 0x10;
+const uint8_t kTcpFin = 0x11;
+
+// An Ethernet frame of a TCP packet from the guest to a remote server.
+class TcpFrame {
+public:
+    TcpFrame() : mData(kPacketSize) {
+        uint8_t* ip = &mData[14];
+        mData[12] = 0x08;
+        ip[0] = 0x45;
+        ip[8] = 64;
+        ip[9] = 6;
+        const uint8_t src[4] = {10, 0, 2, 15};
+        const uint8_t dst[4] = {93, 184, 216, 34};
+        memcpy(&ip[12], src, sizeof(src));
+        memcpy(&ip[16], dst, sizeof(dst));
+        ip[22] = 443 >> 8;
+        ip[23] = 443 & 0xff;
+    }
+
+    uint8_t* set(int port, uint8_t flags) {
+        uint8_t* tcp = &mData[34];
+        tcp[0] = (uint8_t)(port >> 8);
+        tcp[1] = (uint8_t)port;
+        tcp[13] = flags;
+        return mData.data();
+    }
+
+private:
+    std::vector<uint8_t> mData;
+};
+
+NetDelay sDelay;
+uint64_t sDelivered;
+
+// The packets of |count| connections, each closed and replaced by a new one
+// every kPacketsPerConnection packets.
+class Connections {
+public:
+    Connections(int count) : mPorts(count), mSent(count) {
+        for (int n = 0; n < count; n++) {
+            mPorts[n] = 1024 + n;
+        }
+    }
+
+    void sendNext(NetShaper shaper) {
+        const int n = mNext;
+        mNext = (mNext + 1) % (int)mPorts.size();
+        if (mSent[n] == kPacketsPerConnection) {
+            netshaper_send(shaper, mFrame.set(mPorts[n], kTcpFin), kPacketSize);
+            mPorts[n] = 1024 + (mPorts[n] - 1024 + mPorts.size()) % 60000;
+            mSent[n] = 0;
+        }
+        netshaper_send(shaper,
+                       mFrame.set(mPorts[n], mSent[n] ? kTcpAck : kTcpSyn),
+                       kPacketSize);
+        mSent[n]++;
+    }
+
+private:
+    TcpFrame mFrame;
+    std::vector<int> mPorts;
+    std::vector<int> mSent;
+    int mNext = 0;
+};
+
+}  // namespace
+
+// Sends the packets of state.range_y() connections through the upload
+// shaper, at state.range_x() kbit/s, and the delay, with the latency of
+// UMTS. The connections are always opened with the same latency, and a
+// backlog of packets keeps the shaper busy as long as the benchmark runs.
+void BM_Shaper_SendThroughDelay(benchmark::State& state) {
+    ManualClockLooper* const clock = looper();
+    const double packetsPerMs = state.range_x() / (8. * kPacketSize);
+
+    sDelivered = 0;
+    sDelay = netdelay_create([](void* data, size_t size, void* opaque) {
+        sDelivered++;
+    });
+    NetShaper shaper = netshaper_create(
+            1, [](void* data, size_t size, void* opaque) {
+                netdelay_send_aux(sDelay, data, size, opaque);
+            });
+    netdelay_set_latency(sDelay, 35, 200);
+    netshaper_set_rate(shaper, state.range_x() * 1000.);
+
+    Connections connections(state.range_y());
+    for (int n = 0; n < packetsPerMs * 50 + 1; n++) {
+        connections.sendNext(shaper);
+    }
+
+    double credit = 0.;
+    while (state.KeepRunning()) {
+        for (credit += packetsPerMs; credit >= 1.; credit -= 1.) {
+            connections.sendNext(shaper);
+        }
+        clock->advanceMs(1);
+    }
+    state.SetItemsProcessed(sDelivered);
+
+    netshaper_destroy(shaper);
+    netdelay_destroy(sDelay);
+}
+
+// UMTS, HSDPA and LTE download speeds.
+BENCHMARK(BM_Shaper_SendThroughDelay)
+        ->ArgPair(384, 16)
+        ->ArgPair(13980, 16)
+        ->ArgPair(173000, 16)
+        ->ArgPair(173000, 1024);
+
+BENCHMARK_MAIN()
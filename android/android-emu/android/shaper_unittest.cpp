@@ -0,0 +1,287 @@
+// Copyright 2017 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/shaper.h"
+
+#include "android/base/async/ThreadLooper.h"
+#include "android/base/testing/ManualClockLooper.h"
+#include "android/base/threads/FunctorThread.h"
+
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+using android::base::FunctorThread;
+using android::base::ManualClockLooper;
+using android::base::ThreadLooper;
+
+namespace {
+
+const size_t kFrameSize = 1514;
+const uint8_t kTcpSyn = 0x02;
+const uint8_t kTcpFin = 0x11;
+
+// The shaper and the delay take the looper of the thread that creates them,
+// which can only be set before anything else uses it: run |func| in a new
+// thread with a ManualClockLooper.
+void runWithManualClock(const std::function<void(ManualClockLooper*)>& func) {
+    FunctorThread thread([&func] {
+        ManualClockLooper looper;
+        ThreadLooper::setLooper(&looper);
+        func(&looper);
+    });
+    thread.start();
+    thread.wait();
+}
+
+// An Ethernet frame of a TCP packet from the guest to a remote server.
+class TcpFrame {
+public:
+    explicit TcpFrame(size_t size = 64) : mData(size) {
+        uint8_t* ip = &mData[14];
+        mData[12] = 0x08;
+        ip[0] = 0x45;
+        ip[8] = 64;
+        ip[9] = 6;
+        const uint8_t src[4] = {10, 0, 2, 15};
+        const uint8_t dst[4] = {93, 184, 216, 34};
+        memcpy(&ip[12], src, sizeof(src));
+        memcpy(&ip[16], dst, sizeof(dst));
+        ip[22] = 443 >> 8;
+        ip[23] = 443 & 0xff;
+    }
+
+    uint8_t* set(int port, uint8_t flags) {
+        uint8_t* tcp = &mData[34];
+        tcp[0] = (uint8_t)(port >> 8);
+        tcp[1] = (uint8_t)port;
+        tcp[13] = flags;
+        return mData.data();
+    }
+
+    size_t size() const { return mData.size(); }
+
+    static int port(const void* data) {
+        const uint8_t* tcp = (const uint8_t*)data + 34;
+        return (tcp[0] << 8) | tcp[1];
+    }
+
+    static uint8_t flags(const void* data) {
+        return ((const uint8_t*)data)[34 + 13];
+    }
+
+private:
+    std::vector<uint8_t> mData;
+};
+
+struct Delivery {
+    int port;
+    uint8_t flags;
+    android::base::Looper::Duration atMs;
+};
+
+ManualClockLooper* sLooper;
+NetDelay sDelay;
+std::vector<Delivery> sDeliveries;
+// Called with each SYN that the delay lets through, if set.
+std::function<void(int port)> sOnSyn;
+
+void recordDelivery(void* data, size_t size, void* opaque) {
+    const Delivery delivery = {TcpFrame::port(data), TcpFrame::flags(data),
+                               sLooper->nowMs()};
+    sDeliveries.push_back(delivery);
+    if (sOnSyn && delivery.flags == kTcpSyn) {
+        sOnSyn(delivery.port);
+    }
+}
+
+void startDelay(ManualClockLooper* looper, int latencyMs) {
+    sLooper = looper;
+    sDeliveries.clear();
+    sDelay = netdelay_create(recordDelivery);
+    netdelay_set_latency(sDelay, latencyMs, latencyMs);
+}
+
+void stopDelay() {
+    netdelay_destroy(sDelay);
+    sDelay = nullptr;
+    sOnSyn = nullptr;
+}
+
+}  // namespace
+
+// The connections are opened one millisecond apart, so that they expire
+// across the slots of level 0 and the cascades from the upper levels.
+TEST(NetDelay, ExpiresInOrderAcrossCascades) {
+    const int kConnections = 80;
+    for (int latency : {1, 63, 64, 100, 4095, 4096, 4100, 300000}) {
+        SCOPED_TRACE(latency);
+        runWithManualClock([latency](ManualClockLooper* looper) {
+            // Right before the first cascade from level 2.
+            looper->advanceMs(4096 - 40);
+            startDelay(looper, latency);
+
+            TcpFrame frame;
+            const auto startMs = looper->nowMs();
+            for (int n = 0; n < kConnections; n++) {
+                netdelay_send(sDelay, frame.set(1024 + n, kTcpSyn),
+                              frame.size());
+                looper->advanceMs(1);
+            }
+            while (looper->nowMs() < startMs + kConnections + latency) {
+                looper->advanceMs(1);
+            }
+
+            ASSERT_EQ((size_t)kConnections, sDeliveries.size());
+            for (int n = 0; n < kConnections; n++) {
+                EXPECT_EQ(1024 + n, sDeliveries[n].port);
+                EXPECT_EQ(startMs + n + latency, sDeliveries[n].atMs);
+            }
+            stopDelay();
+        });
+    }
+}
+
+// Each connection is opened when the previous one is let through, while the
+// wheel is advancing. The first two expire together, and the first of them
+// to be let through closes the other one.
+TEST(NetDelay, RearmsWhileAdvancing) {
+    const int kConnections = 20;
+    const int kClosedPort = 2048;
+    for (int latency : {1, 10, 64, 100}) {
+        SCOPED_TRACE(latency);
+        runWithManualClock([latency](ManualClockLooper* looper) {
+            looper->advanceMs(64 - 3);
+            startDelay(looper, latency);
+
+            TcpFrame frame;
+            sOnSyn = [&frame](int port) {
+                if (port == 1024 || port == kClosedPort) {
+                    const int other = port == 1024 ? kClosedPort : 1024;
+                    netdelay_send(sDelay, frame.set(other, kTcpFin),
+                                  frame.size());
+                    port = 1024;
+                }
+                if (port < 1024 + kConnections - 1) {
+                    netdelay_send(sDelay, frame.set(port + 1, kTcpSyn),
+                                  frame.size());
+                }
+            };
+
+            const auto startMs = looper->nowMs();
+            netdelay_send(sDelay, frame.set(1024, kTcpSyn), frame.size());
+            netdelay_send(sDelay, frame.set(kClosedPort, kTcpSyn),
+                          frame.size());
+            while (looper->nowMs() < startMs + kConnections * latency + 1) {
+                looper->advanceMs(1);
+            }
+
+            std::vector<Delivery> syns;
+            for (const Delivery& delivery : sDeliveries) {
+                if (delivery.flags == kTcpSyn) {
+                    syns.push_back(delivery);
+                }
+            }
+            ASSERT_EQ((size_t)kConnections, syns.size());
+            EXPECT_TRUE(syns[0].port == 1024 || syns[0].port == kClosedPort);
+            EXPECT_EQ(startMs + latency, syns[0].atMs);
+            for (int n = 1; n < kConnections; n++) {
+                EXPECT_EQ(1024 + n, syns[n].port);
+                EXPECT_EQ(startMs + (n + 1) * latency, syns[n].atMs);
+            }
+            stopDelay();
+        });
+    }
+}
+
+// Keeps the shaper busy for two seconds, and checks that what went through
+// is what the bucket allows: it starts full, with 10 ms worth of tokens, and
+// is filled at the rate. Within a packet, and the millisecond the last timer
+// may still be waiting for.
+TEST(NetShaper, LongRunRate) {
+    const int kDurationMs = 2000;
+    const size_t kBacklog = 256;
+    // A frame takes longer than the burst to send at 1 Mbit/s, about as
+    // long at 1.2 Mbit/s. Millisecond rounding used to leave anything above
+    // 12 Mbit/s unshaped.
+    for (double rate : {1e6, 1.2e6, 12e6, 13.98e6, 100e6, 173e6, 1e9}) {
+        SCOPED_TRACE(rate);
+        runWithManualClock([rate](ManualClockLooper* looper) {
+            static size_t sDeliveredBytes;
+            static size_t sDeliveredPackets;
+            sDeliveredBytes = 0;
+            sDeliveredPackets = 0;
+            NetShaper shaper = netshaper_create(
+                    1, [](void* data, size_t size, void* opaque) {
+                        sDeliveredBytes += size;
+                        sDeliveredPackets++;
+                    });
+            netshaper_set_rate(shaper, rate);
+
+            TcpFrame frame(kFrameSize);
+            size_t sent = 0;
+            for (int ms = 0; ms < kDurationMs; ms++) {
+                while (sent - sDeliveredPackets < kBacklog) {
+                    netshaper_send(shaper, frame.set(1024, 0x10),
+                                   frame.size());
+                    sent++;
+                }
+                looper->advanceMs(1);
+            }
+
+            const double bytesPerMs = rate / 8000.;
+            const double expected = (10 + kDurationMs) * bytesPerMs;
+            EXPECT_NEAR(expected, (double)sDeliveredBytes,
+                        kFrameSize + bytesPerMs);
+            netshaper_destroy(shaper);
+        });
+    }
+}
+
+TEST(NetShaper, PoolKeepsAtMost256FreePackets) {
+    runWithManualClock([](ManualClockLooper* looper) {
+        NetShaper shaper = netshaper_create(
+                1, [](void* data, size_t size, void* opaque) {});
+        TcpFrame frame;
+        TcpFrame bigFrame(4000);
+
+        // Changing the rate sends everything that was queued. The first
+        // packet goes through as the bucket starts full, the next ones wait.
+        netshaper_set_rate(shaper, 1000.);
+        for (int n = 0; n < 1001; n++) {
+            netshaper_send(shaper, frame.set(1024, 0x10), frame.size());
+        }
+        EXPECT_EQ(0, netshaper_num_pooled_for_testing(shaper));
+        netshaper_set_rate(shaper, 1000.);
+        EXPECT_EQ(256, netshaper_num_pooled_for_testing(shaper));
+
+        // Frames too big for the pool are allocated on their own.
+        for (int n = 0; n < 11; n++) {
+            netshaper_send(shaper, bigFrame.set(1024, 0x10), bigFrame.size());
+        }
+        EXPECT_EQ(256, netshaper_num_pooled_for_testing(shaper));
+        netshaper_set_rate(shaper, 1000.);
+        EXPECT_EQ(256, netshaper_num_pooled_for_testing(shaper));
+
+        for (int n = 0; n < 201; n++) {
+            netshaper_send(shaper, frame.set(1024, 0x10), frame.size());
+        }
+        EXPECT_EQ(56, netshaper_num_pooled_for_testing(shaper));
+        netshaper_set_rate(shaper, 0.);
+        EXPECT_EQ(256, netshaper_num_pooled_for_testing(shaper));
+
+        netshaper_destroy(shaper);
+    });
+}
@@ -1,13 +1,17 @@
 
+#include "android/base/synchronization/ConditionVariable.h"
 #include "android/base/synchronization/Lock.h"
 #include "streaming.h"
 #include "CTransCoder.h"
+#include <deque>
+#include <string>
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
 
 ANDROID_BEGIN_HEADER
 #include "libavutil/samplefmt.h"
 #include "libavutil/time.h"
-#include "libavutil/fifo.h"
 ANDROID_END_HEADER
 
 enum {
@@ -19,37 +23,58 @@ enum {
     AUD_FMT_S32
 };
 
+/* The packets captured ahead of the encoder are dropped beyond this, in
+ * frames, so that the stream never lags behind the guest. */
+#define MAX_QUEUED_FRAMES           8
+#define MAX_QUEUED_FRAMES_LOW_DELAY 2
+
+/*
+ * IRRAudioDemuxer feeds the PCM written by the audio capture to the
+ * transcoder. The captured data is copied once, straight into the packets
+ * handed to the encoder, and readPacket() sleeps until a packet is
+ * complete. When the guest plays nothing, silence is sent at the pace of
+ * the wall clock to keep the stream going.
+ */
 class IRRAudioDemuxer : public CDemux {
 public:
-    IRRAudioDemuxer(int channels, int freq, int fmt) {
+    IRRAudioDemuxer(const RRndrAudioConfig *config) {
         m_Info.m_rTimeBase  = AV_TIME_BASE_Q;
-        m_Info.m_rFrameRate = (AVRational){freq, 1};
-        m_Info.m_pCodecPars->sample_rate = freq;
-        m_Info.m_pCodecPars->channels    = channels;
-        m_Info.m_pCodecPars->format      = mapFormat(fmt);
-        m_Info.m_pCodecPars->codec_id    = findCodec(fmt);
+        m_Info.m_rFrameRate = (AVRational){config->freq, 1};
+        m_Info.m_pCodecPars->sample_rate = config->freq;
+        m_Info.m_pCodecPars->channels    = config->channels;
+        m_Info.m_pCodecPars->format      = mapFormat(config->fmt);
+        m_Info.m_pCodecPars->codec_id    = findCodec(config->fmt);
         m_Info.m_pCodecPars->codec_type  = AVMEDIA_TYPE_AUDIO;
-        m_Info.m_pCodecPars->bit_rate    = 256*1000;
+        m_Info.m_pCodecPars->bit_rate    = config->bitrate > 0 ? config->bitrate : 256*1000;
 
+        m_bLowDelay  = config->lowDelay != 0;
         /* The number of samples in one single audio packet */
-        m_nSamples   = 1024;
+        m_nSamples   = config->frameSamples;
+        if (m_nSamples <= 0)
+            m_nSamples = m_bLowDelay ? FFMAX(config->freq / 100, 1) : 1024;
         /* The number of bytes 1 sample needed */
         m_nBps       = av_get_bytes_per_sample((AVSampleFormat)m_Info.m_pCodecPars->format);
-        m_nBps      *= channels;
+        m_nBps      *= config->channels;
         m_nMaxSize   = av_samples_get_buffer_size(nullptr,
                                                   m_Info.m_pCodecPars->channels, m_nSamples,
                                                  (AVSampleFormat)m_Info.m_pCodecPars->format, 1);
-        /* Cycle FIFO to store the incoming PCM data */
-        m_pFifo      = av_fifo_alloc(m_nMaxSize * 10);
+        m_nMaxQueued = m_bLowDelay ? MAX_QUEUED_FRAMES_LOW_DELAY : MAX_QUEUED_FRAMES;
         m_nStartTime = av_gettime_relative();
         m_nCurPts    = 0;
 
+        av_init_packet(&m_Filling);
+        m_Filling.data = nullptr;
+        m_Filling.size = 0;
+        m_nFilled      = 0;
+
         createMutePkt();
     }
 
     ~IRRAudioDemuxer() {
+        for (AVPacket &pkt : m_Ready)
+            av_packet_unref(&pkt);
+        av_packet_unref(&m_Filling);
         av_packet_unref(&m_MutePkt);
-        av_fifo_free(m_pFifo);
     }
 
     int getNumStreams() {
@@ -61,40 +86,121 @@ public:
     }
 
     int readPacket(AVPacket *avpkt) {
-        int  ret = 0;
-        int size = FFMIN(av_fifo_size(m_pFifo), m_nMaxSize);
-
-        while (av_gettime_relative() - m_nStartTime <= m_nCurPts)
-            av_usleep(100);
-
-        android::base::AutoLock mutex(mLock);
+        int ret = 0;
+        android::base::AutoLock lock(mLock);
+
+        /* The end of the next packet, were it captured in real time. In
+         * low-delay mode, what was captured is sent by then; otherwise a
+         * late capture is given one more frame to complete the packet. */
+        const int64_t frameDuration = getDuration(m_nSamples);
+        const int64_t deadline = m_nStartTime + m_nCurPts + frameDuration +
+                                 (m_bLowDelay ? 0 : frameDuration);
+        while (m_Ready.empty()) {
+            const int64_t now = av_gettime_relative();
+            if (now >= deadline)
+                break;
+            mCond.timedWait(&lock, deadline - now);
+        }
 
-        if (size > 0) {
-            avpkt->data     = m_pFifo->rptr;
-            avpkt->size     = FFMIN(size, m_pFifo->end - m_pFifo->rptr);
-            avpkt->duration = getDuration(avpkt->size/m_nBps);
-            av_fifo_drain(m_pFifo, avpkt->size);
-        } else
+        if (!m_Ready.empty()) {
+            av_packet_move_ref(avpkt, &m_Ready.front());
+            m_Ready.pop_front();
+        } else if (m_bLowDelay && m_nFilled >= m_nBps) {
+            ret = flushPartial(avpkt);
+        } else {
             ret = av_packet_ref(avpkt, &m_MutePkt);
+        }
 
+        /* Captured packets are stamped with the time they are played at,
+         * never going back over what was already sent. */
+        if (avpkt->pts != AV_NOPTS_VALUE)
+            m_nCurPts = FFMAX(m_nCurPts, avpkt->pts - m_nStartTime);
         avpkt->pts = avpkt->dts = m_nCurPts;
         m_nCurPts += avpkt->duration;
 
         return ret;
     }
 
-    int write(void *buf, int size) {
-        android::base::AutoLock mutex(mLock);
-        return av_fifo_generic_write(m_pFifo, buf, size, nullptr);
+    /* |timeUs| is when the first sample is played, on the clock of
+     * av_gettime_relative(), or AV_NOPTS_VALUE to play the data after what
+     * was sent already. */
+    int write(const void *buf, int size, int64_t timeUs) {
+        const uint8_t *data = (const uint8_t *)buf;
+        int left = size;
+        bool completed = false;
+
+        android::base::AutoLock lock(mLock);
+        while (left > 0) {
+            if (!m_Filling.data && av_new_packet(&m_Filling, m_nMaxSize) < 0)
+                return -1;
+            if (m_nFilled == 0 && timeUs != AV_NOPTS_VALUE)
+                m_Filling.pts = timeUs + getDuration((size - left) / m_nBps);
+
+            const int len = FFMIN(left, m_nMaxSize - m_nFilled);
+            memcpy(m_Filling.data + m_nFilled, data, len);
+            m_nFilled += len;
+            data      += len;
+            left      -= len;
+
+            if (m_nFilled == m_nMaxSize) {
+                m_Filling.duration = getDuration(m_nSamples);
+                queuePacket(&m_Filling);
+                m_nFilled = 0;
+                completed = true;
+            }
+        }
+
+        if (completed)
+            mCond.signalAndUnlock(&lock);
+        return size;
     }
 
 private:
-    mutable android::base::Lock mLock;
+    android::base::Lock mLock;
+    android::base::ConditionVariable mCond;
     CStreamInfo  m_Info;
     AVPacket     m_MutePkt;
-    int          m_nSamples, m_nBps, m_nMaxSize;
+    /* The packet being written, with m_nFilled bytes, and the complete
+     * ones waiting for the encoder. */
+    AVPacket     m_Filling;
+    int          m_nFilled;
+    std::deque<AVPacket> m_Ready;
+    bool         m_bLowDelay;
+    int          m_nSamples, m_nBps, m_nMaxSize, m_nMaxQueued;
     int64_t      m_nStartTime, m_nCurPts;
-    AVFifoBuffer *m_pFifo;
+
+    /* Move |pkt| to the ready queue, dropping the oldest packets if the
+     * encoder is too far behind. */
+    void queuePacket(AVPacket *pkt) {
+        while ((int)m_Ready.size() >= m_nMaxQueued) {
+            av_packet_unref(&m_Ready.front());
+            m_Ready.pop_front();
+        }
+        m_Ready.emplace_back();
+        av_packet_move_ref(&m_Ready.back(), pkt);
+    }
+
+    /* Return the whole samples of the packet being written, keeping the
+     * rest in a new one. */
+    int flushPartial(AVPacket *avpkt) {
+        const int size = m_nFilled - m_nFilled % m_nBps;
+        const int rest = m_nFilled - size;
+        AVPacket next;
+
+        av_init_packet(&next);
+        if (av_new_packet(&next, m_nMaxSize) < 0)
+            return av_packet_ref(avpkt, &m_MutePkt);
+        memcpy(next.data, m_Filling.data + size, rest);
+        if (m_Filling.pts != AV_NOPTS_VALUE)
+            next.pts = m_Filling.pts + getDuration(size / m_nBps);
+
+        av_shrink_packet(&m_Filling, size);
+        m_Filling.duration = getDuration(size / m_nBps);
+        av_packet_move_ref(avpkt, &m_Filling);
+        av_packet_move_ref(&m_Filling, &next);
+        m_nFilled = rest;
+        return 0;
+    }
 
     void createMutePkt() {
         int ret;
@@ -156,12 +262,35 @@ struct RRndrStream {
     CTransCoder *pTrans;
 };
 
+static int getEnvInt(const char *name, int defaultValue) {
+    const char *value = getenv(name);
+    return value && *value ? atoi(value) : defaultValue;
+}
 
-RRndrStream *RRndr_create_audio(int channels, int freq, int fmt, const char *path) {
+void RRndr_audio_config_from_env(RRndrAudioConfig *config) {
+    config->channels     = getEnvInt("AUDIO_CHANNELS", 2);
+    config->freq         = getEnvInt("AUDIO_SAMPLE_RATE", 44100);
+    config->fmt          = AUD_FMT_S16;
+    config->frameSamples = getEnvInt("AUDIO_FRAME_SIZE", 0);
+    config->codec        = getenv("AUDIO_CODEC");
+    config->bitrate      = getEnvInt("AUDIO_BITRATE", 0);
+    config->lowDelay     = getEnvInt("AUDIO_LOW_DELAY", 0);
+}
+
+RRndrStream *RRndr_create_audio(const RRndrAudioConfig *config, const char *path) {
     RRndrStream *st = new RRndrStream();
 
-    st->pDemux = new IRRAudioDemuxer(channels, freq, fmt);
+    st->pDemux = new IRRAudioDemuxer(config);
     st->pTrans = new CTransCoder(st->pDemux, path);
+    if (config->codec && *config->codec)
+        st->pTrans->setOutputProp("c", config->codec);
+    if (config->bitrate > 0)
+        st->pTrans->setOutputProp("b", std::to_string(config->bitrate).c_str());
+    if (config->lowDelay) {
+        /* Don't let the muxer hold packets back. */
+        st->pTrans->setOutputProp("flush_packets", "1");
+        st->pTrans->setOutputProp("max_delay", "0");
+    }
     st->pTrans->start();
 
     return st;
@@ -176,6 +305,11 @@ void RRndr_delete(RRndrStream *stream) {
     delete stream;
 }
 
-int RRndr_write(struct RRndrStream *stream, void *buf, int size) {
-    return stream->pDemux->write(buf, size);
+int RRndr_write(struct RRndrStream *stream, const void *buf, int size) {
+    return stream->pDemux->write(buf, size, AV_NOPTS_VALUE);
+}
+
+int RRndr_write_at(struct RRndrStream *stream, const void *buf, int size,
+                   int64_t timestampUs) {
+    return stream->pDemux->write(buf, size, timestampUs);
 }
@@ -1,18 +1,44 @@
-
 #ifndef STREAMING_H
 #define STREAMING_H
 
 #include "android/utils/compiler.h"
 
+#include <stdint.h>
+
 ANDROID_BEGIN_HEADER
 
 struct RRndrStream;
 
-struct RRndrStream *RRndr_create_audio(int channels, int freq, int fmt, const char *path);
+/* How the captured audio is encoded and streamed. */
+typedef struct RRndrAudioConfig {
+    int channels;
+    int freq;
+    int fmt;            /* AUD_FMT_XXX */
+    /* Samples per packet read by the encoder, 0 for the default: 1024, or
+     * 10 ms of audio in low-delay mode. */
+    int frameSamples;
+    /* Name of the encoder, NULL to use the default of the output format. */
+    const char *codec;
+    /* Encoded bits per second, 0 for the default. */
+    int bitrate;
+    /* Send each packet as soon as it is encoded, with the shortest buffering
+     * everywhere, at the cost of more packets. */
+    int lowDelay;
+} RRndrAudioConfig;
+
+/* Fill |config| with the defaults (2 channels, 44.1 kHz, S16), overridden by
+ * the AUDIO_CHANNELS, AUDIO_SAMPLE_RATE, AUDIO_FRAME_SIZE, AUDIO_CODEC,
+ * AUDIO_BITRATE and AUDIO_LOW_DELAY environment variables. */
+void RRndr_audio_config_from_env(RRndrAudioConfig *config);
+
+struct RRndrStream *RRndr_create_audio(const RRndrAudioConfig *config, const char *path);
 void RRndr_delete(struct RRndrStream *stream);
-int RRndr_write(struct RRndrStream *stream, void *buf, int size);
+int RRndr_write(struct RRndrStream *stream, const void *buf, int size);
+/* Same as RRndr_write(), for samples played at |timestampUs| of the
+ * monotonic clock rather than right after the previous ones. */
+int RRndr_write_at(struct RRndrStream *stream, const void *buf, int size,
+                   int64_t timestampUs);
 
 ANDROID_END_HEADER
 
 #endif /* STREAMING_H */
-
@@ -239,3 +239,39 @@ bool android_get_x86_cpuid_is_64bit_capable()
     return false;
 #endif
 }
+
+bool android_get_x86_cpuid_sse41_support()
+{
+    uint32_t ecx = 0;
+    android_get_x86_cpuid(1, 0, nullptr, nullptr, &ecx, nullptr);
+    return (ecx & CPUID_ECX_SSE41) != 0;
+}
+
+bool android_get_x86_cpuid_avx2_support()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (android_get_x86_cpuid_function_max() < 7) {
+        return false;
+    }
+
+    uint32_t ecx = 0;
+    android_get_x86_cpuid(1, 0, nullptr, nullptr, &ecx, nullptr);
+    const uint32_t kAvxOs = CPUID_ECX_OSXSAVE | CPUID_ECX_AVX;
+    if ((ecx & kAvxOs) != kAvxOs) {
+        return false;
+    }
+
+    // XCR0 bits 1 and 2: the OS saves the XMM and YMM registers.
+    uint32_t xcr0_lo, xcr0_hi;
+    asm volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) != 0x6) {
+        return false;
+    }
+
+    uint32_t ebx = 0;
+    android_get_x86_cpuid(7, 0, nullptr, &ebx, nullptr, nullptr);
+    return (ebx & CPUID_EBX_AVX2) != 0;
+#else
+    return false;
+#endif
+}
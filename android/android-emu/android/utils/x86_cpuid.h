@@ -46,6 +46,10 @@ uint32_t android_get_x86_cpuid_extended_function_max();
 #define CPUID_ECX_SSE41    (1 << 19)
 #define CPUID_ECX_SSE42    (1 << 20)
 #define CPUID_ECX_POPCNT   (1 << 23)
+#define CPUID_ECX_OSXSAVE  (1 << 27)
+#define CPUID_ECX_AVX      (1 << 28)
+/* Applicable when calling CPUID with EAX=7 and ECX=0 */
+#define CPUID_EBX_AVX2     (1 << 5)
 
 /*
  * android_get_x86_cpuid: retrieve x86 CPUID for host CPU.
@@ -152,4 +156,11 @@ bool android_get_x86_cpuid_is_vcpu();
 // Returns true if the CPU supports AMD64 instruction set.
 bool android_get_x86_cpuid_is_64bit_capable();
 
+// Returns true if the CPU supports the SSE4.1 instruction set.
+bool android_get_x86_cpuid_sse41_support();
+
+// Returns true if the CPU supports the AVX2 instruction set, and the OS saves
+// the YMM registers on context switches so that it can actually be used.
+bool android_get_x86_cpuid_avx2_support();
+
 ANDROID_END_HEADER
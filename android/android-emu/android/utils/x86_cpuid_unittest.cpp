@@ -68,6 +68,14 @@ TEST(x86_cpuid, Default) {
             PrintCpuFeatureTestResult("SSE4.2", ecx & CPUID_ECX_SSE42);
             PrintCpuFeatureTestResult("POPCNT", ecx & CPUID_ECX_POPCNT);
         }
+        PrintCpuFeatureTestResult("AVX2", android_get_x86_cpuid_avx2_support());
+
+        EXPECT_EQ(android_get_x86_cpuid_sse41_support(),
+                  (ecx & CPUID_ECX_SSE41) != 0);
+        // Every CPU with AVX2 has SSE4.1 too.
+        if (android_get_x86_cpuid_avx2_support()) {
+            EXPECT_TRUE(android_get_x86_cpuid_sse41_support());
+        }
     }
 }
 
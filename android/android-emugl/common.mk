@@ -223,7 +223,9 @@ GEN := $$(_emugl_dec)_dec.cpp \
        $$(_emugl_dec)_dec.h \
        $$(_emugl_dec)_opcodes.h \
        $$(_emugl_dec)_server_context.h \
-       $$(_emugl_dec)_server_context.cpp
+       $$(_emugl_dec)_server_context.cpp \
+       $$(_emugl_dec)_reply_size.h \
+       $$(_emugl_dec)_reply_size.cpp
 
 $$(GEN): PRIVATE_PATH := $$(LOCAL_PATH)
 $$(GEN): PRIVATE_CUSTOM_TOOL := $$(EMUGL_EMUGEN) -D $$1 -i $$2 $$3
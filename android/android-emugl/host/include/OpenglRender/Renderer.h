@@ -19,6 +19,9 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
+
+#include <stdint.h>
 
 namespace emugl {
 
@@ -135,6 +138,45 @@ public:
     // killed). Such resources include color buffer handles and EglImage handles.
     virtual void cleanupProcGLObjects(uint64_t puid) = 0;
 
+    // getTransportStats - describe how the render sessions are forwarded
+    // to the remote render server, one entry per live session. The stream
+    // going in is the one written by the guest, the one going out the
+    // replies sent back to it.
+    struct TransportStats {
+        // Bucket i of |latencyHistogram| counts the round trips shorter than
+        // 250 << i microseconds, the last bucket all the longer ones.
+        static constexpr int kLatencyBucketCount = 11;
+
+        int session;
+        uint64_t bytesIn;
+        uint64_t bytesOut;
+        // Averaged since the rates were last updated, which calls do at
+        // most once per second.
+        uint64_t bytesInPerSec;
+        uint64_t bytesOutPerSec;
+        // Pages waiting to be sent to the server, out of |queueSize|, and
+        // the most there ever were.
+        uint32_t queuedPages;
+        uint32_t maxQueuedPages;
+        uint32_t queueSize;
+        // Round trips of the commands that expect a reply, from the time
+        // they are read from the guest to the time all of it is received.
+        uint64_t roundTrips;
+        uint64_t latencyHistogram[kLatencyBucketCount];
+    };
+    virtual std::vector<TransportStats> getTransportStats() = 0;
+
+    // A frame callback can be registered with setFrameSentCallback(); to
+    // remove it pass a null callback. While a callback is registered, the
+    // renderer calls it each time it has sent the remote render server a
+    // stream that ends a frame of the guest, i.e. after an eglSwapBuffers()
+    // call. This tells when the effect of an input shows up at the earliest.
+    //
+    // The callback is called from the render threads, possibly at once.
+    using OnFrameSentCallback = void (*)(void* context);
+    virtual void setFrameSentCallback(OnFrameSentCallback onFrameSent,
+                                      void* context) = 0;
+
     // Stops all channels and render threads.
     virtual void stop() = 0;
 protected:
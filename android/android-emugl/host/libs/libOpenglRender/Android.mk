@@ -34,9 +34,14 @@ host_common_SRC_FILES := \
     RenderLibImpl.cpp \
     RenderThread.cpp \
     RemoteRenderChannel.cpp \
+    RemoteRenderCompression.cpp \
+    RemoteRenderConnection.cpp \
+    RemoteRenderReactor.cpp \
+    RemoteRenderStats.cpp \
     RenderThreadInfo.cpp \
     render_api.cpp \
     RenderWindow.cpp \
+    ReplySizeScanner.cpp \
     SyncThread.cpp \
     TextureDraw.cpp \
     TextureResize.cpp \
@@ -69,7 +74,7 @@ $(call emugl-end-module)
 
 ### OpenglRender unittests
 $(call emugl-begin-executable,lib$(BUILD_TARGET_SUFFIX)OpenglRender_unittests)
-$(call emugl-import,libOpenglCodecCommon)
+$(call emugl-import,libGLESv1_dec libGLESv2_dec lib_renderControl_dec libOpenglCodecCommon)
 
 $(call emugl-export,C_INCLUDES,$(EMUGL_PATH)/host/include)
 $(call emugl-export,C_INCLUDES,$(LOCAL_PATH))
@@ -93,6 +98,61 @@ LOCAL_SRC_FILES := \
     ../Translator/GLES_V2/ANGLEShaderParser.cpp \
     OpenGLTestContext.cpp \
     OpenGL_unittest.cpp \
+    PageQueue_unittest.cpp \
+    RemoteRenderChannel.cpp \
+    RemoteRenderCompression.cpp \
+    RemoteRenderCompression_unittest.cpp \
+    RemoteRenderConnection.cpp \
+    RemoteRenderConnection_unittest.cpp \
+    RemoteRenderReactor.cpp \
+    RemoteRenderStats.cpp \
+    RemoteRenderStats_unittest.cpp \
+    ReplySizeScanner.cpp \
+    ReplySizeScanner_unittest.cpp \
+    SpscBufferQueue_unittest.cpp \
 
 $(call emugl-import,lib$(BUILD_TARGET_SUFFIX)OpenglRender libemugl_gtest)
 $(call emugl-end-module)
+
+### OpenglRender benchmark
+# Only built with android/configure.sh --benchmarks.
+ifeq (true,$(BUILD_BENCHMARKS))
+$(call emugl-begin-executable,lib$(BUILD_TARGET_SUFFIX)OpenglRender_benchmark)
+
+LOCAL_C_INCLUDES += $(EMUGL_PATH)/host/include
+LOCAL_C_INCLUDES += $(LOCAL_PATH)
+LOCAL_C_INCLUDES += $(GOOGLE_BENCHMARK_INCLUDES)
+LOCAL_STATIC_LIBRARIES += android-emu-base
+LOCAL_STATIC_LIBRARIES += $(GOOGLE_BENCHMARK_STATIC_LIBRARIES)
+LOCAL_LDLIBS += $(GOOGLE_BENCHMARK_LDLIBS)
+
+LOCAL_SRC_FILES := \
+    SpscBufferQueue_benchmark.cpp \
+
+$(call emugl-end-module)
+endif
+
+### emugl_render_replay ##################################################
+# Replays the streams dumped with RENDERER_DUMP_DIR to a render server,
+# see RemoteRenderReplay.cpp.
+$(call emugl-begin-executable,emugl$(BUILD_TARGET_SUFFIX)_render_replay)
+
+$(call emugl-import,libGLESv1_dec libGLESv2_dec lib_renderControl_dec libOpenglCodecCommon)
+
+LOCAL_LDLIBS += $(host_common_LDLIBS)
+
+LOCAL_SRC_FILES := \
+    $(host_common_SRC_FILES) \
+    RemoteRenderReplay.cpp \
+    RemoteRenderStandInServer.cpp \
+
+# use Translator's egl/gles headers
+LOCAL_C_INCLUDES += $(EMUGL_PATH)/host/include
+LOCAL_C_INCLUDES += $(EMUGL_PATH)/host/libs/Translator/include
+LOCAL_C_INCLUDES += $(EMUGL_PATH)/host/libs/libOpenGLESDispatch
+
+LOCAL_STATIC_LIBRARIES += libemugl_common
+LOCAL_STATIC_LIBRARIES += libOpenGLESDispatch
+LOCAL_STATIC_LIBRARIES += android-emu-base
+
+$(call emugl-end-module)
@@ -87,6 +87,18 @@ const unsigned char* ChannelStream::readRaw(void* buf, size_t* inout_len) {
     return (const unsigned char*)buf;
 }
 
+bool ChannelStream::readBuffer(RenderChannel::Buffer* buffer) {
+    if (mReadBufferLeft > 0) {
+        // What read() left of the current buffer comes first.
+        const char* const left =
+                mReadBuffer.data() + (mReadBuffer.size() - mReadBufferLeft);
+        *buffer = RenderChannel::Buffer(left, left + mReadBufferLeft);
+        mReadBufferLeft = 0;
+        return true;
+    }
+    return mChannel->readFromGuest(buffer, true) == IoResult::Ok;
+}
+
 void* ChannelStream::getDmaForReading(uint64_t guest_paddr) {
     return g_emugl_dma_get_host_addr(guest_paddr);
 }
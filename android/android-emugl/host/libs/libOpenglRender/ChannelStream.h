@@ -28,6 +28,10 @@ public:
 
     void forceStop();
 
+    // Take the next buffer written by the guest as it is, instead of
+    // copying it with read(). Return false once the channel is stopped.
+    bool readBuffer(RenderChannel::Buffer* buffer);
+
 protected:
     virtual void* allocBuffer(size_t minSize) override final;
     virtual int commitBuffer(size_t size) override final;
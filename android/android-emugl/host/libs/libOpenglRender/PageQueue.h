@@ -0,0 +1,324 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include "OpenglRender/RenderChannel.h"
+
+#include "android/base/Compiler.h"
+#include "android/base/synchronization/ConditionVariable.h"
+#include "android/base/synchronization/Lock.h"
+#include "android/base/threads/Thread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace emugl {
+
+// A BufferPage is one slot of a PageQueue. It either holds data copied into
+// its own buffer, or refers to caller-owned data (a 'borrowed' page). A
+// borrowed page can also own the buffer its data is in (an 'adopted' one),
+// until the slot is reused.
+class BufferPage {
+public:
+    BufferPage() = default;
+
+    ~BufferPage() {
+        free(mOwnBuf);
+    }
+
+    char* data() const {
+        return mData;
+    }
+
+    size_t size() const {
+        return mSize;
+    }
+
+    bool isBorrowed() const {
+        return mData != mOwnBuf;
+    }
+
+private:
+    friend class PageQueue;
+
+    char* mOwnBuf = nullptr;
+    char* mData = nullptr;
+    size_t mSize = 0;
+    RenderChannel::Buffer mAdopted;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(BufferPage);
+};
+
+// PageQueue is a bounded single-producer / single-consumer ring of pages,
+// all allocated by init(). The producer (a render thread) fills pages with
+// pushQueue(), pushBorrowed() or pushAdopted(), and the consumer (a reactor
+// thread) takes them with popQueue(), then gives them back with
+// returnToQueue(), in the same order, once they have been sent or copied.
+//
+// None of these operations allocate or lock. When the ring is full, the
+// push methods return early, and the producer can block in waitForSpace()
+// until the consumer returns a page. This is what bounds the memory used by
+// a channel whose server does not keep up.
+class PageQueue {
+    using ConditionVariable = android::base::ConditionVariable;
+    using Lock = android::base::Lock;
+    using AutoLock = android::base::AutoLock;
+
+public:
+    explicit PageQueue(size_t pageSize) : mPageSize(pageSize) {}
+
+    size_t pageSize() const {
+        return mPageSize;
+    }
+
+    size_t pageCount() const {
+        return mPageCount;
+    }
+
+    // Allocate |pageCount| pages, rounded up to a power of 2. Must be
+    // called once, before any other method.
+    void init(size_t pageCount) {
+        assert(!mPages);
+        mPageCount = 1;
+        while (mPageCount < pageCount) {
+            mPageCount <<= 1;
+        }
+        mPages.reset(new BufferPage[mPageCount]);
+        for (size_t i = 0; i < mPageCount; i++) {
+            mPages[i].mOwnBuf = (char*)malloc(mPageSize);
+            mPages[i].mData = mPages[i].mOwnBuf;
+        }
+    }
+
+    // Producer methods.
+
+    // Copy as much of |data| as possible into the ring, and return the
+    // number of bytes copied. Full pages are made visible to the consumer,
+    // the last partial one only after flushQueue().
+    size_t pushQueue(const char* data, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            if (mFillSize == 0 && !hasSpace()) {
+                break;
+            }
+            BufferPage& page = pageAt(mTail.load(std::memory_order_relaxed));
+            if (mFillSize == 0) {
+                releaseAdopted(&page);
+            }
+            const size_t len = std::min(mPageSize - mFillSize, size - done);
+            memcpy(page.mOwnBuf + mFillSize, data + done, len);
+            mFillSize += len;
+            done += len;
+            if (mFillSize == mPageSize) {
+                flushQueue();
+            }
+        }
+        return done;
+    }
+
+    // Make the partially filled page, if any, visible to the consumer.
+    void flushQueue() {
+        if (mFillSize > 0) {
+            const size_t tail = mTail.load(std::memory_order_relaxed);
+            BufferPage& page = pageAt(tail);
+            page.mData = page.mOwnBuf;
+            page.mSize = mFillSize;
+            mFillSize = 0;
+            mTail.store(tail + 1, std::memory_order_release);
+        }
+    }
+
+    // Queue a page that refers to |size| bytes of |data|, after flushing
+    // the current one. |data| must stay valid until waitForEmpty() returns.
+    // Return false if the ring is full.
+    bool pushBorrowed(char* data, size_t size) {
+        flushQueue();
+        if (!hasSpace()) {
+            return false;
+        }
+        const size_t tail = mTail.load(std::memory_order_relaxed);
+        BufferPage& page = pageAt(tail);
+        releaseAdopted(&page);
+        page.mData = data;
+        page.mSize = size;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Like pushBorrowed(), for the whole of |*buffer|, which the page takes
+    // over. There is no need to wait for the consumer then: the buffer is
+    // released when the page is reused, once the consumer is done with it.
+    // The pages borrowed from |*buffer| before, for instance to cut it in
+    // smaller pieces, must be pushed first, and the last piece adopted.
+    bool pushAdopted(RenderChannel::Buffer* buffer, size_t offset) {
+        // Moving a buffer in its small inline storage would move its data.
+        assert(buffer->isAllocated());
+        flushQueue();
+        if (!hasSpace()) {
+            return false;
+        }
+        const size_t tail = mTail.load(std::memory_order_relaxed);
+        BufferPage& page = pageAt(tail);
+        page.mAdopted = std::move(*buffer);
+        page.mData = page.mAdopted.data() + offset;
+        page.mSize = page.mAdopted.size() - offset;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Return true if the next push can make progress.
+    bool hasSpace() const {
+        return mTail.load(std::memory_order_relaxed) -
+                       mHead.load(std::memory_order_seq_cst) <
+               mPageCount;
+    }
+
+    // Number of pages queued and not given back yet. It is only a hint for
+    // other threads than the producer.
+    size_t queuedPageCount() const {
+        const size_t head = mHead.load(std::memory_order_seq_cst);
+        return mTail.load(std::memory_order_acquire) - head;
+    }
+
+    // Block until a page is free. Return false if the queue was closed.
+    bool waitForSpace() {
+        return waitUntil([this] { return hasSpace(); });
+    }
+
+    // Block until all queued pages were returned by the consumer. Return
+    // false if the queue was closed.
+    bool waitForEmpty() {
+        return waitUntil([this] {
+            return mHead.load(std::memory_order_seq_cst) ==
+                   mTail.load(std::memory_order_relaxed);
+        });
+    }
+
+    // Consumer methods.
+
+    // Take the next queued page, or return nullptr.
+    BufferPage* popQueue() {
+        const size_t popped = mPopped.load(std::memory_order_relaxed);
+        if (popped == mTail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        mPopped.store(popped + 1, std::memory_order_release);
+        return &pageAt(popped);
+    }
+
+    // Return true if some queued pages were not popped yet. This can be
+    // called by the producer too, to know whether the consumer still has
+    // to be told about the pages it just queued.
+    bool hasPendingPages() const {
+        return mPopped.load(std::memory_order_acquire) !=
+               mTail.load(std::memory_order_acquire);
+    }
+
+    // Give back |page|, and all the pages popped before it that were not
+    // given back yet.
+    void returnToQueue(BufferPage* page) {
+        for (size_t head = mHead.load(std::memory_order_relaxed);
+             head != mPopped.load(std::memory_order_relaxed); head++) {
+            if (&pageAt(head) == page) {
+                mHead.store(head + 1, std::memory_order_seq_cst);
+                if (mWaiting.load(std::memory_order_seq_cst)) {
+                    AutoLock lock(mLock);
+                    mCanPush.broadcast();
+                }
+                return;
+            }
+        }
+        assert(!"page was not popped");
+    }
+
+    // Make the producer's waits fail, now and later. Can be called from
+    // any thread.
+    void close() {
+        mClosed.store(true);
+        AutoLock lock(mLock);
+        mCanPush.broadcast();
+    }
+
+    bool isClosed() const {
+        return mClosed.load();
+    }
+
+private:
+    // Number of times to yield before sleeping on |mCanPush|. The consumer
+    // usually returns pages within a few microseconds.
+    static constexpr int kSpinCount = 16;
+
+    BufferPage& pageAt(size_t index) const {
+        return mPages[index & (mPageCount - 1)];
+    }
+
+    // Free the buffer adopted by |page|, once it was returned.
+    static void releaseAdopted(BufferPage* page) {
+        if (page->mAdopted.isAllocated()) {
+            RenderChannel::Buffer released(std::move(page->mAdopted));
+        }
+    }
+
+    template <class Predicate>
+    bool waitUntil(Predicate ready) {
+        for (int spin = 0; !ready(); spin++) {
+            if (mClosed.load()) {
+                return false;
+            }
+            if (spin < kSpinCount) {
+                android::base::Thread::yield();
+                continue;
+            }
+            // |mWaiting| is set before checking the condition again, and
+            // the consumer checks it after updating |mHead|, so either we
+            // see the update or it sees us waiting.
+            AutoLock lock(mLock);
+            mWaiting.store(true, std::memory_order_seq_cst);
+            while (!ready() && !mClosed.load()) {
+                mCanPush.wait(&lock);
+            }
+            mWaiting.store(false);
+        }
+        return !mClosed.load();
+    }
+
+    const size_t mPageSize;
+    size_t mPageCount = 0;
+    std::unique_ptr<BufferPage[]> mPages;
+
+    // Pages [mHead, mTail) are queued, [mHead, mPopped) are being sent by
+    // the consumer. |mTail| is only written by the producer, |mHead| and
+    // |mPopped| by the consumer, and all are read by both.
+    std::atomic<size_t> mHead {0};
+    std::atomic<size_t> mTail {0};
+    std::atomic<size_t> mPopped {0};
+
+    // Bytes written by the producer into the page at |mTail|.
+    size_t mFillSize = 0;
+
+    std::atomic_bool mClosed {false};
+    std::atomic_bool mWaiting {false};
+    Lock mLock;
+    ConditionVariable mCanPush;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(PageQueue);
+};
+
+}  // namespace emugl
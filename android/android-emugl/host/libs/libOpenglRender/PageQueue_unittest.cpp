@@ -0,0 +1,223 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "PageQueue.h"
+
+#include "android/base/threads/FunctorThread.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace emugl {
+
+using android::base::FunctorThread;
+
+static std::string pageString(const BufferPage* page) {
+    return std::string(page->data(), page->size());
+}
+
+TEST(PageQueue, init) {
+    PageQueue queue(16);
+    queue.init(5);
+    EXPECT_EQ(16U, queue.pageSize());
+    EXPECT_EQ(8U, queue.pageCount());
+    EXPECT_FALSE(queue.hasPendingPages());
+    EXPECT_EQ(nullptr, queue.popQueue());
+}
+
+TEST(PageQueue, pushAndPop) {
+    PageQueue queue(8);
+    queue.init(4);
+
+    EXPECT_EQ(11U, queue.pushQueue("Hello World", 11));
+    // Only the full page is visible before flushing.
+    BufferPage* page = queue.popQueue();
+    ASSERT_TRUE(page);
+    EXPECT_EQ("Hello Wo", pageString(page));
+    EXPECT_FALSE(page->isBorrowed());
+    EXPECT_EQ(nullptr, queue.popQueue());
+
+    queue.flushQueue();
+    BufferPage* page2 = queue.popQueue();
+    ASSERT_TRUE(page2);
+    EXPECT_EQ("rld", pageString(page2));
+
+    queue.returnToQueue(page);
+    queue.returnToQueue(page2);
+    EXPECT_TRUE(queue.waitForEmpty());
+}
+
+TEST(PageQueue, pushWhenFull) {
+    PageQueue queue(4);
+    queue.init(2);
+
+    EXPECT_EQ(8U, queue.pushQueue("0123456789", 10));
+    EXPECT_FALSE(queue.hasSpace());
+    EXPECT_EQ(0U, queue.pushQueue("89", 2));
+    EXPECT_FALSE(queue.pushBorrowed((char*)"89", 2));
+
+    BufferPage* page = queue.popQueue();
+    ASSERT_TRUE(page);
+    queue.returnToQueue(page);
+    EXPECT_TRUE(queue.hasSpace());
+    EXPECT_EQ(2U, queue.pushQueue("89", 2));
+}
+
+TEST(PageQueue, pushBorrowed) {
+    PageQueue queue(4);
+    queue.init(4);
+
+    char data[] = "borrowed";
+    EXPECT_EQ(2U, queue.pushQueue("ab", 2));
+    EXPECT_TRUE(queue.pushBorrowed(data, 8));
+
+    // The partial page is flushed first to keep the order.
+    BufferPage* page = queue.popQueue();
+    ASSERT_TRUE(page);
+    EXPECT_EQ("ab", pageString(page));
+    BufferPage* borrowed = queue.popQueue();
+    ASSERT_TRUE(borrowed);
+    EXPECT_TRUE(borrowed->isBorrowed());
+    EXPECT_EQ(data, borrowed->data());
+    EXPECT_EQ(8U, borrowed->size());
+
+    queue.returnToQueue(page);
+    queue.returnToQueue(borrowed);
+
+    // The slot of a borrowed page gets its own buffer back once reused.
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(4U, queue.pushQueue("abcd", 4));
+        page = queue.popQueue();
+        ASSERT_TRUE(page);
+        EXPECT_FALSE(page->isBorrowed());
+        EXPECT_EQ("abcd", pageString(page));
+        queue.returnToQueue(page);
+    }
+}
+
+TEST(PageQueue, pushAdopted) {
+    PageQueue queue(4);
+    queue.init(2);
+
+    RenderChannel::Buffer buffer;
+    buffer.resize_noinit(1024);
+    memset(buffer.data(), 'x', buffer.size());
+    const char* const data = buffer.data();
+    EXPECT_TRUE(queue.pushBorrowed(buffer.data(), 16));
+    EXPECT_TRUE(queue.pushAdopted(&buffer, 16));
+    // The queue owns the data now.
+    EXPECT_TRUE(buffer.empty());
+
+    BufferPage* borrowed = queue.popQueue();
+    BufferPage* adopted = queue.popQueue();
+    ASSERT_TRUE(borrowed && adopted);
+    EXPECT_EQ(data, borrowed->data());
+    EXPECT_EQ(data + 16, adopted->data());
+    EXPECT_EQ(1024U - 16U, adopted->size());
+    EXPECT_EQ(std::string(1024 - 16, 'x'), pageString(adopted));
+    queue.returnToQueue(adopted);
+
+    // The slots are usable again once the adopted buffer is released.
+    EXPECT_EQ(8U, queue.pushQueue("abcdefgh", 8));
+    for (const char* expected : {"abcd", "efgh"}) {
+        BufferPage* page = queue.popQueue();
+        ASSERT_TRUE(page);
+        EXPECT_FALSE(page->isBorrowed());
+        EXPECT_EQ(expected, pageString(page));
+        queue.returnToQueue(page);
+    }
+}
+
+TEST(PageQueue, returnSeveralPages) {
+    PageQueue queue(4);
+    queue.init(4);
+
+    EXPECT_EQ(12U, queue.pushQueue("abcdefghijkl", 12));
+    BufferPage* first = queue.popQueue();
+    BufferPage* second = queue.popQueue();
+    BufferPage* third = queue.popQueue();
+    ASSERT_TRUE(first && second && third);
+
+    // Returning a page also returns the ones popped before it.
+    queue.returnToQueue(second);
+    EXPECT_EQ(12U, queue.pushQueue("mnopqrstuvwx", 12));
+    EXPECT_FALSE(queue.hasSpace());
+    queue.returnToQueue(third);
+    EXPECT_TRUE(queue.hasSpace());
+}
+
+TEST(PageQueue, closeWakesProducer) {
+    PageQueue queue(4);
+    queue.init(1);
+    EXPECT_EQ(4U, queue.pushQueue("abcd", 4));
+
+    FunctorThread thread([&queue]() { queue.close(); });
+    thread.start();
+    EXPECT_FALSE(queue.waitForSpace());
+    EXPECT_FALSE(queue.waitForEmpty());
+    EXPECT_TRUE(queue.isClosed());
+    thread.wait();
+}
+
+TEST(PageQueue, producerConsumer) {
+    static const size_t kCount = 100000;
+    PageQueue queue(64);
+    queue.init(4);
+
+    std::string received;
+    FunctorThread consumer([&queue, &received]() {
+        while (received.size() < kCount * sizeof(uint32_t)) {
+            BufferPage* page = queue.popQueue();
+            if (!page) {
+                android::base::Thread::yield();
+                continue;
+            }
+            received.append(page->data(), page->size());
+            queue.returnToQueue(page);
+        }
+    });
+    consumer.start();
+
+    std::vector<uint32_t> sent(kCount);
+    for (size_t i = 0; i < kCount; i++) {
+        sent[i] = (uint32_t)i;
+    }
+    const char* data = (const char*)sent.data();
+    const size_t size = sent.size() * sizeof(uint32_t);
+    // Push in uneven chunks to straddle page boundaries.
+    size_t done = 0;
+    while (done < size) {
+        const size_t chunk = std::min<size_t>(size - done, 7 + done % 93);
+        size_t pushed = 0;
+        while (pushed < chunk) {
+            pushed += queue.pushQueue(data + done + pushed, chunk - pushed);
+            if (pushed < chunk) {
+                ASSERT_TRUE(queue.waitForSpace());
+            }
+        }
+        done += chunk;
+        if (done % 5 == 0) {
+            queue.flushQueue();
+        }
+    }
+    queue.flushQueue();
+    EXPECT_TRUE(queue.waitForEmpty());
+    consumer.wait();
+
+    ASSERT_EQ(size, received.size());
+    EXPECT_EQ(0, memcmp(data, received.data(), size));
+}
+
+}  // namespace emugl
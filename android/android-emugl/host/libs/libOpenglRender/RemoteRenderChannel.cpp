@@ -1,511 +1,311 @@
 #include "RemoteRenderChannel.h"
 
+#include "android/base/sockets/SocketUtils.h"
+#include "android/base/system/System.h"
+
+#include <algorithm>
+
 namespace emugl {
 
 #define EMUGL_DEBUG_LEVEL 0
 #include "emugl/common/debug.h"
 
-intptr_t RemoteRenderChannel::main() {
-    PagePacketHead head;
-    size_t rwLen = 0;
-    std::shared_ptr<BufferPage> curPage;
-    bool isHeadSending = true;
-    unsigned char * readBuf = NULL;
-    size_t readBufSize = 0;
-    bool unKnownSizeDataReady = false;
-
-    struct epoll_event events[1];
+static std::atomic_int sChannelCount;
 
-    while (mIsWorking.load()) {
-
-        int ret = ::epoll_wait(mEpollFD, events, 1, 20);
-
-        if (ret == 0) {
-            continue;
-        }
+// Writes of at least this size are sent from the caller's buffer instead of
+// being copied into pages.
+static constexpr size_t kBorrowMinSize = 64 * 1024;
 
-        if (ret == -1) {
-            if (errno == EINTR)
-                continue;
-            else {
-                exitChannel();
-                assert(0);
-                break;
-            }
-        }
+// Buffers of at least this size are adopted by the page queue instead of
+// being copied into pages, in pieces of at most |kMaxAdoptedPageSize|.
+static constexpr size_t kAdoptMinSize = 4 * 1024;
+static constexpr size_t kMaxAdoptedPageSize = 64 * 1024;
 
-        if ((events[0].events & EPOLLERR) ||
-              (events[0].events & EPOLLHUP) ||
-              (events[0].events & EPOLLRDHUP)) {
-              //printf("found a connection exited\n");
-              exitChannel();
-        } else if (events[0].events & EPOLLIN) {
-            if (!mUpStream) {
-                exitChannel();
-                assert(0);
-                continue;
-            }
-
-            //if ((int)mWantReadSize == 0) {
-            //    printf("wait readChannel, hang up occur !!!!!!!!!!!!!\n");
-            //    //assert(0);
-            //    continue;
-            //}
-
-            while (1) {
-                if (readBuf == NULL) {
-                    rwLen = 0;
-
-                    if (mWantReadSize <= 0) {
-                        // in this case, data from peer arrived before decoding
-                        // thus, we cannot know the recving data size
-                        // make a assumtion first, use a default buffer to receive the data
-                        // then update the received data size later.
-                        D("unknow size data ready, possible hang up occur !!!!!!!!!!!!!\n");
-                        unKnownSizeDataReady = true;
-                        readBufSize = 512; //because channel buffer default size is 512
-                    } else {
-                        readBufSize = (size_t)mWantReadSize;
-                    }
-
-                    readBuf = mUpStream->alloc(readBufSize);
-                }
-
-                if (onNetworkRecvDataReady((char*)readBuf, &rwLen, readBufSize - rwLen)) {
-                    if (!unKnownSizeDataReady) {
-                        if (rwLen == readBufSize) {
-                            readBuf = NULL;
-                            mWantReadSize -= readBufSize;
-                            mUpStream->flush();
-                        }
-
-                        break;
-                    } else {
-                        if (rwLen == readBufSize) {
-                            readBuf = NULL;
-                            mWantReadSize -= rwLen;
-                            mUpStream->flush(rwLen);
-                            continue;
-                        } else {
-                            unKnownSizeDataReady = false;
-                            readBuf = NULL;
-                            mWantReadSize -= rwLen;
-                            mUpStream->flush(rwLen);
-                            break;
-                        }
-                    }
-                } else {
-                    exitChannel();
-                    assert(0);
-                    break;
-                }
-            }
-
-
-        } else if (events[0].events & EPOLLOUT) {
-            while (1) {//loop due to set EPOLLET
-                if (!curPage) {
-                    AutoLock lock(mPendingLock);
-                    if (mPendingPages.size() == 0) {
-                        modConnection(false);
-                        break;
-                    }
-
-                    curPage = mPendingPages.front();
-                    mPendingPages.pop_front();
-                    lock.unlock();
-                    isHeadSending = true;
-
-                    // build a packethead
-                    head.packet_type = 0;
-                    //head.session_id = mRemoteChannelId;
-                    head.packet_body_size = curPage->writePos() - curPage->beginPos();
-
-                    rwLen = 0;
-                }
-
-                if (isHeadSending) {
-                    if (onNetworkSndDataHeadReady(head, &rwLen)) {
-                        if (rwLen == PAGE_PACKET_HEAD_LEN) {
-                            isHeadSending = false;
-                            rwLen = 0;
-                        } else
-                            break;
-                    } else {
-                        exitChannel();
-                        break;
-                    }
-                }
-
-                if (onNetworkSndDataPageReady(curPage, &rwLen)) {
-                    if (rwLen == (size_t)(curPage->writePos() - curPage->beginPos())) {
-                        mBufQueue.returnToQueue(curPage);
-                        curPage.reset();
-                    } else
-                        break;
- 
-                } else {
-                    exitChannel();
-                    assert(0);
-                }
-            }
-        }
+static uint64_t nowUs() {
+    return android::base::System::get()->getHighResTimeUs();
+}
 
-    }
+RemoteRenderChannel::RemoteRenderChannel() :
+     mBufQueue(4 * 1024),
+     mIsWorking(true),
+     mUpStream(NULL), mWantReadSize(0),
+     mStats(nowUs()) {
+     mRemoteChannelId = sChannelCount++;
+}
 
-    // if need, enable the following code to send a packet close message to remote render
-    // currently, remote can close the renderthread by detecting the socket disconnection
-    //notifyCloseToPeer();
-    DD("exit remote render channel thread\n");
-    return 0;
+RemoteRenderChannel::~RemoteRenderChannel() {
+    closeChannel();
 }
 
-bool RemoteRenderChannel::initChannel(size_t queueSize) {
+void RemoteRenderChannel::initChannel(size_t queueSize) {
     mBufQueue.init(queueSize);
+}
 
-    // Add Tcp Channel for comunication
-    const char* render_server_hostname = getenv("render_server_hostname");
-    if (!render_server_hostname) {
-        D("Cannot find render server hostname\n");
-        render_server_hostname = "127.0.0.1";
-    }
-    const char* render_server_port = getenv("render_server_port");
-    if (!render_server_port) {
-        D("Cannot find render server port\n");
-        render_server_port = "23432";
+bool RemoteRenderChannel::startChannel() {
+    mConnection = RemoteRenderConnection::acquire();
+    if (!mConnection) {
+        D("%s: cannot connect to rendering server.\n", __func__);
+        mIsWorking.store(false);
+        return false;
     }
-    DD("new connection %s : %s\n", render_server_hostname, render_server_port);
-
-    int socket = android::base::socketTcp4Client(render_server_hostname, atoi(render_server_port));
-    if (socket == -1) {
-        D("%s: cannot connect to rendering server.(%s)\n", __func__, errno_str);
+    if (!mConnection->attachSession(this)) {
+        mIsWorking.store(false);
         return false;
     }
-
     mIsWorking.store(true);
-
-    android::base::socketSetNonBlocking(socket);
-    // socketSetNoDelay() reduces the latency of sending data, at the cost
-    // of creating more TCP packets on the connection. It's useful when
-    // doing lots of small send() calls, like the ADB protocol requires.
-    // And since this is on localhost, the packet increase should not be
-    // noticeable.
-    android::base::socketSetNoDelay(socket);
-
-    mSocket = socket;
-
-    struct epoll_event ev;
-    ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-    ev.data.fd = socket;
-    ::epoll_ctl(mEpollFD, EPOLL_CTL_ADD, socket, &ev);
-
-    //startChannel();
-
+    mStarted = true;
     return true;
 }
 
-void RemoteRenderChannel::startChannel() {
-    start();
-}
+bool RemoteRenderChannel::writeChannel(char * data, size_t size) {
+    if (!mIsWorking.load())
+        return false;
 
-void RemoteRenderChannel::modConnection(bool askWrite)
-{
-    if (mSocket <= 0)
-        return;
+    mStats.addBytesIn(size);
 
-    struct epoll_event ev;
+    if (size >= kBorrowMinSize) {
+        return writeBorrowed(data, size);
+    }
 
-    ev.data.fd = mSocket;
-    if (askWrite)
-        ev.events = EPOLLOUT | EPOLLET | EPOLLRDHUP;
-    else
-        ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+    if (!writeCopied(data, size))
+        return false;
+    flushChannel();
 
-    ::epoll_ctl(mEpollFD, EPOLL_CTL_MOD, mSocket, &ev);
+    return true;
 }
 
-bool RemoteRenderChannel::writeChannel(char * data, size_t size) {
+bool RemoteRenderChannel::writeBuffer(RenderChannel::Buffer* buffer) {
     if (!mIsWorking.load())
         return false;
 
-    mBufQueue.pushQueue(data, size);
-    flushOneWrite();
+    const size_t size = buffer->size();
+    mStats.addBytesIn(size);
+    if (size < kAdoptMinSize || !buffer->isAllocated()) {
+        if (!writeCopied(buffer->data(), size))
+            return false;
+        flushChannel();
+        return true;
+    }
 
+    // Borrow all the pieces but the last one, which adopts the buffer.
+    char* const data = buffer->data();
+    size_t pos = 0;
+    while (true) {
+        const bool last = size - pos <= kMaxAdoptedPageSize;
+        const bool pushed =
+                last ? mBufQueue.pushAdopted(buffer, pos)
+                     : mBufQueue.pushBorrowed(data + pos, kMaxAdoptedPageSize);
+        if (pushed) {
+            if (last)
+                break;
+            pos += kMaxAdoptedPageSize;
+            continue;
+        }
+        requestWrite();
+        if (!mBufQueue.waitForSpace())
+            return false;
+    }
+    requestWrite();
     return true;
 }
 
-void RemoteRenderChannel::flushChannel() {
-    if (!mIsWorking.load())
-        return;
-
-    mBufQueue.flushQueue();
+bool RemoteRenderChannel::writeCopied(char * data, size_t size) {
+    size_t done = 0;
+    while (true) {
+        done += mBufQueue.pushQueue(data + done, size - done);
+        if (done == size)
+            return true;
 
-    while (1) {
-        std::shared_ptr<BufferPage> page = mBufQueue.popQueue();
-        if (!page)
-            break;
+        // The queue is full, have the connection drain it and wait.
+        requestWrite();
+        if (!mBufQueue.waitForSpace())
+            return false;
+    }
+}
 
-        AutoLock lock(mPendingLock);
-        mPendingPages.push_back(page);
+bool RemoteRenderChannel::writeBorrowed(char * data, size_t size) {
+    // Cut the data in page-sized frames, like copied data would be. Whatever
+    // was copied before is flushed first, to keep the stream in order.
+    const size_t pageSize = mBufQueue.pageSize();
+    size_t pos = 0;
+    while (pos < size) {
+        const size_t len = std::min(pageSize, size - pos);
+        if (mBufQueue.pushBorrowed(data + pos, len)) {
+            pos += len;
+            continue;
+        }
+        requestWrite();
+        if (!mBufQueue.waitForSpace())
+            return false;
     }
+    requestWrite();
 
-    modConnection(true);
+    // |data| belongs to the caller, it must not be touched once we return.
+    return mBufQueue.waitForEmpty();
 }
 
-void RemoteRenderChannel::flushOnePage() {
+void RemoteRenderChannel::flushChannel() {
     if (!mIsWorking.load())
         return;
 
-    std::shared_ptr<BufferPage> page = mBufQueue.popQueue();
-    if (!page)
-        return;
-
-    AutoLock lock(mPendingLock);
-    mPendingPages.push_back(page);
-
-    mDataReady.signal();
-}
-
-void RemoteRenderChannel::flushOneWrite() {
-    flushChannel();
-}
-
-void RemoteRenderChannel::flushOneFrame() {
-    flushChannel();
-}
-
-void RemoteRenderChannel::exitChannel() {
-    mIsWorking.store(false);
-
-    ::epoll_ctl(mEpollFD, EPOLL_CTL_DEL, mSocket, NULL);
-}
-
-void RemoteRenderChannel::closeChannel() {
-    exitChannel();
-
-    wait();
-
-    if (mEpollFD > 0)
-        ::close(mEpollFD);
-
-    mEpollFD = -1;
-
-    android::base::socketShutdownWrites(mSocket);
-    android::base::socketShutdownReads(mSocket);
-    android::base::socketClose(mSocket);
-    mSocket = -1;
-
-}
-
-void RemoteRenderChannel::onHostSocketEvent(unsigned events) {
-    //if ((events & FdWatch::kEventWrite) != 0) {
-    //    mSocket->dontWantWrite();
-    //    mDataReady.signal();
-    //}
-}
-
-void RemoteRenderChannel::notifyCloseToPeer()
-{
-    if (mSocket < 0) {
-        assert(0);
-        return;
+    mBufQueue.flushQueue();
+    if (mBufQueue.hasPendingPages()) {
+        requestWrite();
     }
-
-    PagePacketHead head;
-    head.packet_type = 1;
-    head.packet_body_size = 0;
-
-    android::base::socketSendAll(mSocket,
-          &head, PAGE_PACKET_HEAD_LEN);
 }
 
-bool RemoteRenderChannel::onNetworkRecvDataReady(char * buf, size_t * pOffset, size_t wantReadLen) {
-
-    ssize_t readLen = 0;
-    while (1) {
-        ssize_t retRead = android::base::socketRecv(mSocket,
-                            buf + *pOffset + readLen, wantReadLen - readLen);
-
-        if (retRead < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                break;
-            } else {
-                //android::base::socketClose(mSocket);
-                assert(0);
-                return false;
-            }
+void RemoteRenderChannel::closeChannel() {
+    if (mConnection) {
+        // Let the connection send what is queued, the pages belong to us.
+        // This returns early if the connection is lost meanwhile.
+        if (mStarted && mIsWorking.load()) {
+            mBufQueue.flushQueue();
+            requestWrite();
+            mBufQueue.waitForEmpty();
         }
+        mIsWorking.store(false);
+        mBufQueue.close();
 
-        readLen += retRead;
-
-        if (wantReadLen == (size_t)readLen)
-            break;
+        mConnection->detachSession(this);
+        mConnection.reset();
     }
-
-    *pOffset += readLen;
-
-    //printf("0x%lx %s : recv %d\n", android::base::getCurrentThreadId(), __func__, (int)readLen);
-
-    return true;
+    mIsWorking.store(false);
+    mStarted = false;
 }
 
 bool RemoteRenderChannel::readChannel(size_t wantReadLen) {
-    if (mSocket < 0) {
+    if (!mConnection) {
         assert(0);
         return false;
     }
 
     mWantReadSize += wantReadLen;
-    //modConnection(false);
+    mStats.onReplyExpected(wantReadLen, nowUs());
 
     return true;
 }
 
-bool RemoteRenderChannel::onNetworkSndDataHeadReady(PagePacketHead& head, size_t * pOffset) {
-    if (mSocket < 0) {
-        assert(0);
-        return false;
-    }
-
-    ssize_t retHead = android::base::socketSend(mSocket,
-                            (char *)&head + *pOffset, PAGE_PACKET_HEAD_LEN - *pOffset);
+void RemoteRenderChannel::getTransportStats(Renderer::TransportStats* out) {
+    mStats.snapshot(nowUs(), out);
+    out->session = mRemoteChannelId;
+    out->queuedPages = mBufQueue.queuedPageCount();
+    out->queueSize = mBufQueue.pageCount();
+}
 
-    if (retHead < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return true;
-            }
-        else {
-            //android::base::socketClose(mSocket);
-            assert(0);
-            return false;
-        }
-    }
+void RemoteRenderChannel::requestWrite() {
+    mStats.onQueuedPages(mBufQueue.queuedPageCount());
+    mConnection->requestWrite(this);
+}
 
-    *pOffset += retHead;
+void RemoteRenderChannel::onConnectionLost() {
+    mIsWorking.store(false);
 
-    return true;
+    // Wake up the render thread if it waits for the queue.
+    mBufQueue.close();
 }
 
-bool RemoteRenderChannel::onNetworkSndDataPageReady(std::shared_ptr<BufferPage> page, size_t * pOffset) {
-
-    if (mSocket < 0) {
+bool RemoteRenderChannel::onSocketReadable(int socket) {
+    if (!mUpStream) {
         assert(0);
         return false;
     }
 
-    ssize_t ret = android::base::socketSend(mSocket,
-                            page->beginPos() + *pOffset, page->writePos() - page->beginPos() - *pOffset);
-
-    if (ret < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return true;
+    while (1) {
+        if (mReplyBuf == NULL) {
+            mReplyLen = 0;
+
+            if (mWantReadSize <= 0) {
+                // in this case, data from peer arrived before decoding
+                // thus, we cannot know the recving data size
+                // make a assumtion first, use a default buffer to receive the data
+                // then update the received data size later.
+                D("unknow size data ready, possible hang up occur !!!!!!!!!!!!!\n");
+                mReplySizeUnknown = true;
+                mReplyBufSize = 512; //because channel buffer default size is 512
+            } else {
+                mReplyBufSize = (size_t)mWantReadSize;
             }
-        else {
-            //android::base::socketClose(mSocket);
-            assert(0);
+
+            mReplyBuf = mUpStream->alloc(mReplyBufSize);
+        }
+
+        if (!onNetworkRecvDataReady(socket, (char*)mReplyBuf, &mReplyLen,
+                                    mReplyBufSize - mReplyLen)) {
             return false;
         }
-    }
 
-    *pOffset += ret;
+        if (!mReplySizeUnknown) {
+            if (mReplyLen == mReplyBufSize) {
+                mReplyBuf = NULL;
+                mWantReadSize -= mReplyBufSize;
+                mUpStream->flush();
+                mStats.onReplyReceived(mReplyBufSize, nowUs());
+            }
 
-    //printf("0x%lx %s : send %d\n", android::base::getCurrentThreadId(), __func__, (int)ret);
+            break;
+        } else {
+            if (mReplyLen == mReplyBufSize) {
+                mReplyBuf = NULL;
+                mWantReadSize -= mReplyLen;
+                mUpStream->flush(mReplyLen);
+                mStats.onReplyReceived(mReplyLen, nowUs());
+                continue;
+            } else {
+                mReplySizeUnknown = false;
+                mReplyBuf = NULL;
+                mWantReadSize -= mReplyLen;
+                mUpStream->flush(mReplyLen);
+                mStats.onReplyReceived(mReplyLen, nowUs());
+                break;
+            }
+        }
+    }
 
     return true;
 }
 
-/*
-bool RemoteRenderChannel::onNetworkDataPageReady(std::shared_ptr<BufferPage> page) {
-    //printf("0x%lx %s : page size = %d, opcode = %d session = %d\n", android::base::getCurrentThreadId(), __func__, (int)(page->writePos() - page->beginPos()), *(int*)page->beginPos(), (int)mRemoteChannelId);
-    if (mSocket < 0 || !page) {
-        assert(0);
-        return false;
+unsigned char* RemoteRenderChannel::allocReply(size_t size) {
+    if (!mUpStream) {
+        return nullptr;
     }
+    return mUpStream->alloc(size);
+}
 
-    PagePacketHead head;
-    head.packet_type = 0;
-    //head.session_id = mRemoteChannelId;
-    head.packet_body_size = page->writePos() - page->beginPos();
-
-    ssize_t sentLen = 0;
-    while (mIsWorking) {
-        mSocketWaiter->update(mSocket, android::base::SocketWaiter::kEventWrite);
-        int ret = mSocketWaiter->wait(50);
-        if (ret == 0 && errno == ETIMEDOUT)
-            continue;
-
-        if (ret < 0)
-            return false;
-
-        unsigned events = 0;
-        int fd = mSocketWaiter->nextPendingFd(&events);
-        if (fd < 0) {
-            return false;
-        }
+void RemoteRenderChannel::commitReply(size_t size) {
+    mWantReadSize -= size;
+    mUpStream->flush();
+    mStats.onReplyReceived(size, nowUs());
+}
 
-        if ((events & SocketWaiter::kEventWrite) == SocketWaiter::kEventWrite) {
-            ssize_t retHead = android::base::socketSend(mSocket,
-                            &head + sentLen, PAGE_PACKET_HEAD_LEN - sentLen);
-
-            if (retHead < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    continue;
-                    }
-                else {
-                    android::base::socketClose(mSocket);
-                    assert(0);
-                    return false;
-                }
-            }
+bool RemoteRenderChannel::onNetworkRecvDataReady(int socket, char * buf, size_t * pOffset, size_t wantReadLen) {
 
-            sentLen += retHead;
+    ssize_t readLen = 0;
+    while (1) {
+        ssize_t retRead = android::base::socketRecv(socket,
+                            buf + *pOffset + readLen, wantReadLen - readLen);
 
-            if (sentLen == (ssize_t)PAGE_PACKET_HEAD_LEN)
+        if (retRead < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 break;
+            } else {
+                return false;
+            }
         }
-    }
-
-    sentLen = 0;
-
-    while (mIsWorking) {
-        mSocketWaiter->update(mSocket, android::base::SocketWaiter::kEventWrite);
-        int ret = mSocketWaiter->wait(50);
-        if (ret == 0 && errno == ETIMEDOUT)
-            continue;
-
-        if (ret < 0)
-            return false;
 
-        unsigned events = 0;
-        int fd = mSocketWaiter->nextPendingFd(&events);
-        if (fd < 0) {
+        if (retRead == 0) {
+            // The server closed the connection.
             return false;
         }
 
-        if ((events & SocketWaiter::kEventWrite) == SocketWaiter::kEventWrite) {
-            ssize_t retBody = android::base::socketSend(mSocket,
-                          page->beginPos() + sentLen, page->writePos() - page->beginPos() - sentLen);
-
-            if (retBody < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    continue;
-                    }
-                else {
-                    android::base::socketClose(mSocket);
-                    assert(0);
-                    return false;
-                }
-            }
-
-            sentLen += retBody;
+        readLen += retRead;
 
-            if (sentLen == (ssize_t)(page->writePos() - page->beginPos()))
-                break;
-        }
+        if (wantReadLen == (size_t)readLen)
+            break;
     }
 
-    printf("0x%lx %s : send %d + %d\n", android::base::getCurrentThreadId(), __func__, (int)PAGE_PACKET_HEAD_LEN, (int)(page->writePos() - page->beginPos()));
+    *pOffset += readLen;
+
     return true;
 }
-*/
+
 }
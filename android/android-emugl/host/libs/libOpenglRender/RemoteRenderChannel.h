@@ -1,332 +1,152 @@
-// Copyright (C) 2016 The Android Open Source Project
-//
-// Licensed under the Apache License, Version 2.0 (the "License");
-// you may not use this file except in compliance with the License.
-// You may obtain a copy of the License at
-//
-// http://www.apache.org/licenses/LICENSE-2.0
-//
-// Unless required by applicable law or agreed to in writing, software
-// distributed under the License is distributed on an "AS IS" BASIS,
-// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-// See the License for the specific language governing permissions and
-// limitations under the License.
-#pragma once
-
-#include "android/base/Log.h"
-
-#include "android/base/synchronization/Lock.h"
-#include "android/base/synchronization/ConditionVariable.h"
-
-#include "emugl/common/thread.h"
-#include "android/emulation/VmLock.h"
-#include "OpenglRender/IOStream.h"
-
-#include "android/utils/sockets.h"
-
-#include "android/base/sockets/SocketUtils.h"
-#include "android/utils/debug.h"
-
-#include <sys/epoll.h>
-#include <unistd.h>
-
-#include <memory>
-#include <list>
-#include <errno.h>
-#include <atomic>
-
-namespace emugl {
-
-class ChannelStream;
-
-using Lock = android::base::Lock;
-using AutoLock = android::base::AutoLock;
-
-using ConditionVariable = android::base::ConditionVariable;
-
-typedef struct _PagePacketHead {
-    int packet_type : 8;
-    //int session_id : 8;
-    int packet_body_size : 24;
-} __attribute__ ((packed)) PagePacketHead;
-
-#define PAGE_PACKET_HEAD_LEN       (sizeof(PagePacketHead))
-
-class BufferPage {
-public:
-    BufferPage(int pageId, size_t pageSize) :
-        mPageId(pageId),
-        mPos(0),
-        mSize(pageSize),
-        mIsTailPage(false) {
-        mBuf = (char*)malloc(pageSize);
-    }
-
-    ~BufferPage() {
-        if (mBuf) {
-            free(mBuf);
-        }
-    }
-
-    inline int pageID() {
-        return mPageId;
-    }
-
-    inline char * beginPos() {
-        return mBuf;
-    }
-
-    inline char * writePos() {
-        return mBuf + mPos;
-    }
-
-    inline void updateWritePos(size_t pos) {
-        mPos = pos;
-        assert(mPos <= mSize);
-    }
-
-    inline size_t capacity() {
-        return mSize - mPos;
-    }
-
-    inline bool isFull() {
-        return (mPos == mSize);
-    }
-
-    inline bool isEmpty() {
-        return (mPos == 0);
-    }
-
-    inline size_t appendData(char * data, size_t size) {
-        assert(data);
-        assert(size > 0);
-        size_t ret = 0;
-        size_t avail = capacity();
-        if (size <= avail) {
-            ret = size;
-        } else {
-            ret = avail;
-        }
-
-        memcpy(mBuf + mPos, data, ret);
-        updateWritePos(mPos + ret);
-        //printf("cur write pos (%d) in page(%d)\n", (int)(mPos), mPageId);
-        return ret;
-    }
-
-    inline void setFlagTail() {
-        mIsTailPage = true;
-    }
-
-    inline void resetFlagTail() {
-        mIsTailPage = false;
-    }
-
-    inline bool isTailPage() {
-        return mIsTailPage;
-    }
-
-    inline void reset() {
-        mPos = 0;
-    }
-
-private:
-    int mPageId;
-    size_t mPos;
-    size_t mSize;
-    char * mBuf;
-    bool mIsTailPage;
-};
-
-class PageQueue {
-public:
-    PageQueue(size_t pageSize) : mPageSize(pageSize) {};
-
-    void init(size_t pageCount) {
-        if (mPageSize <= 0 || pageCount <= 0)
-            return;
-
-        mPageCount = pageCount;
-
-        for (size_t i = 0; i < pageCount; i ++) {
-            std::shared_ptr<BufferPage> page = std::make_shared<BufferPage>(i, mPageSize);
-            mFreePages.push_back(page);
-        }
-    }
-
-    bool pushQueue(char * data, size_t size) {
-        size_t left = size;
-
-        while (left > 0) {
-            if (!mCurPage)
-                mCurPage = popFreePage();
-
-            if (!mCurPage)
-                return true;
-
-            char * cur = data + size - left;
-            size_t ret = pushPage(mCurPage, cur, left);
-            left -= ret;
-
-            if (left > 0) {
-                pushToCache(mCurPage);
-                mCurPage.reset();
-            }
-        }
-
-        return true;
-    }
-
-    void flushQueue() {
-        if (mCurPage && !mCurPage->isEmpty()) {
-            pushToCache(mCurPage);
-            mCurPage.reset();
-        }
-    }
-
-    std::shared_ptr<BufferPage> popQueue() {
-        AutoLock lock(mCachedLock);
-        if (mCachedPages.size() > 0) {
-            std::shared_ptr<BufferPage> page = mCachedPages.front();
-            mCachedPages.pop_front();
-            return page;
-        } else {
-            return std::shared_ptr<BufferPage>();
-        }
-    }
-
-    void returnToQueue(std::shared_ptr<BufferPage> page) {
-        page->reset();
-        AutoLock lock(mFreeLock);
-        mFreePages.push_back(page);
-    }
-
-private:
-    size_t pushPage(std::shared_ptr<BufferPage> page, char * data, size_t size) {
-        return page->appendData(data,size);
-    }
-
-    void pushToCache(std::shared_ptr<BufferPage> page) {
-        AutoLock lock(mCachedLock);
-        mCachedPages.push_back(page);
-    }
-
-    std::shared_ptr<BufferPage> popFreePage() {
-        AutoLock lock(mFreeLock);
-        if (mFreePages.size() > 0) {
-            std::shared_ptr<BufferPage> page = mFreePages.front();
-            mFreePages.pop_front();
-            return page;
-        } else {
-            std::shared_ptr<BufferPage> page = std::make_shared<BufferPage>(mPageCount, mPageSize);
-            mPageCount ++ ;
-
-            if (mPageCount > (8 * 1024 / 4)) {
-                printf("page queue is full\n");
-                assert(0);
-            }
-            return page;
-        }
-    }
-
-private:
-    size_t mPageCount;
-    size_t mPageSize;
-    std::shared_ptr<BufferPage> mCurPage;
-    mutable android::base::Lock mFreeLock;
-    std::list<std::shared_ptr<BufferPage> > mFreePages;
-    mutable android::base::Lock mCachedLock;
-    std::list<std::shared_ptr<BufferPage> > mCachedPages;
-
-};
-
-static std::atomic_int gChannelCount;
-
-class RemoteRenderChannel : public android::base::Thread {
-public:
-    RemoteRenderChannel () :
-         mEpollFD(-1),
-         mBufQueue(4 * 1024),
-         mSocket(-1), mIsWorking(true),
-         mUpStream(NULL), mWantReadSize(0) {
-         mRemoteChannelId = gChannelCount.load();
-         gChannelCount++;
-
-         //mSocketWaiter =
-         //   std::shared_ptr<android::base::SocketWaiter>(
-         //   android::base::SocketWaiter::create());
-
-         mEpollFD = ::epoll_create(1);
-    }
-
-    ~RemoteRenderChannel() {
-        if (mEpollFD > 0)
-            ::close(mEpollFD);
-
-        mEpollFD = -1;
-    }
-
-    virtual intptr_t main() override;
-
-    inline int sessionId() {
-        return mRemoteChannelId;
-    }
-
-    void setUpStream(IOStream * stream) {
-        mUpStream = stream;
-    }
-
-    void startChannel();
-
-    bool initChannel(size_t queueSize);
-    
-    bool writeChannel(char * data, size_t size);
-
-    bool readChannel(size_t wantReadLen);
-
-    void flushChannel();
-    
-    void closeChannel();
-private:
-    
-    void modConnection(bool askWrite);
-    
-    void exitChannel();
-
-    void flushOneFrame();
-
-    void flushOnePage();
-
-    void flushOneWrite();
-    
-    void onHostSocketEvent(unsigned events);
-
-    bool onNetworkSndDataHeadReady(PagePacketHead& head, size_t * pOffset);
-    bool onNetworkSndDataPageReady(std::shared_ptr<BufferPage> page, size_t * pOffset);
-    bool onNetworkRecvDataReady(char * buf, size_t * pOffset, size_t wantReadLen);
-
-    void notifyCloseToPeer();
-private:
-    int mEpollFD;
-    PageQueue mBufQueue;
-    //android::base::ScopedSocketWatch mSocketFD;
-    int mSocket;
-    //std::shared_ptr<android::base::SocketWaiter> mSocketWaiter;
-
-    std::atomic_bool mIsWorking;
-
-    Lock mPendingLock;
-    ConditionVariable mDataReady;
-    std::list<std::shared_ptr<BufferPage> > mPendingPages;
-
-    int mRemoteChannelId;
-
-    IOStream * mUpStream;
-
-    std::atomic_int mWantReadSize;
-};
-
-// Shared pointer to RenderChannel instance.
-using RemoteRenderChannelPtr = std::shared_ptr<RemoteRenderChannel>;
-
-}  // namespace emugl
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include "android/base/Log.h"
+
+#include "android/base/synchronization/ConditionVariable.h"
+#include "android/base/synchronization/Lock.h"
+
+#include "OpenglRender/IOStream.h"
+#include "OpenglRender/RenderChannel.h"
+#include "PageQueue.h"
+#include "RemoteRenderConnection.h"
+#include "RemoteRenderProtocol.h"
+#include "RemoteRenderStats.h"
+
+#include <memory>
+#include <list>
+#include <errno.h>
+#include <atomic>
+#include <string.h>
+
+namespace emugl {
+
+using Lock = android::base::Lock;
+using AutoLock = android::base::AutoLock;
+using ConditionVariable = android::base::ConditionVariable;
+
+// A RemoteRenderChannel forwards the GLES command stream of one render
+// session to the remote render server, and the server replies back to the
+// guest through the up stream.
+//
+// The render thread copies the stream into pages with writeChannel(), and
+// declares how many reply bytes it expects with readChannel(). Large writes,
+// such as texture uploads, are not copied: the connection sends straight
+// from the caller's buffer, and writeChannel() waits until it is done.
+// writeBuffer() does not even wait, for buffers the channel can keep until
+// they are sent, such as the ones written by the guest. The
+// page queue is bounded, so writes also block while the server is
+// behind by more than the whole queue. The actual
+// socket I/O happens on the reactor thread of the session's
+// RemoteRenderConnection, which calls the methods of the second group below.
+class RemoteRenderChannel {
+public:
+    RemoteRenderChannel();
+    ~RemoteRenderChannel();
+
+    inline int sessionId() {
+        return mRemoteChannelId;
+    }
+
+    void setUpStream(IOStream * stream) {
+        mUpStream = stream;
+    }
+
+    // Size the page queue. This does not touch the network, so that the
+    // guest can start writing right away.
+    void initChannel(size_t queueSize);
+
+    // Connect to the render server, from the render thread. Return false
+    // if it cannot be reached.
+    bool startChannel();
+
+    bool writeChannel(char * data, size_t size);
+
+    // Forward the content of |*buffer|, which the channel may take over.
+    bool writeBuffer(RenderChannel::Buffer* buffer);
+
+    bool readChannel(size_t wantReadLen);
+
+    void flushChannel();
+    
+    void closeChannel();
+
+    // Fill |*out| with the statistics of the channel, from any thread.
+    void getTransportStats(Renderer::TransportStats* out);
+
+    // The following methods are called by the RemoteRenderConnection from
+    // its reactor thread.
+
+    // Pop the next page to send, or return nullptr.
+    BufferPage* popPendingPage() {
+        return mBufQueue.popQueue();
+    }
+
+    bool hasPendingPages() const {
+        return mBufQueue.hasPendingPages();
+    }
+
+    // Give back a page once it has been sent, together with the pages
+    // popped before it.
+    void returnPage(BufferPage* page) {
+        mBufQueue.returnToQueue(page);
+    }
+
+    // Receive raw reply bytes from the |socket| of a dedicated connection
+    // whose server does not frame replies. Return false on error.
+    bool onSocketReadable(int socket);
+
+    // Reserve |size| bytes in the up stream for a framed reply, then send
+    // them to the guest with commitReply().
+    unsigned char* allocReply(size_t size);
+    void commitReply(size_t size);
+
+    void onConnectionLost();
+
+private:
+    // Have the connection send the queued pages.
+    void requestWrite();
+
+    bool writeCopied(char * data, size_t size);
+    bool writeBorrowed(char * data, size_t size);
+
+    bool onNetworkRecvDataReady(int socket, char * buf, size_t * pOffset, size_t wantReadLen);
+
+private:
+    PageQueue mBufQueue;
+    RemoteRenderConnectionPtr mConnection;
+    bool mStarted = false;
+
+    std::atomic_bool mIsWorking;
+
+    int mRemoteChannelId;
+
+    IOStream * mUpStream;
+
+    std::atomic_int mWantReadSize;
+
+    // Reply being received on a dedicated connection.
+    unsigned char * mReplyBuf = nullptr;
+    size_t mReplyBufSize = 0;
+    size_t mReplyLen = 0;
+    bool mReplySizeUnknown = false;
+
+    RemoteRenderStats mStats;
+};
+
+// Shared pointer to RenderChannel instance.
+using RemoteRenderChannelPtr = std::shared_ptr<RemoteRenderChannel>;
+
+}  // namespace emugl
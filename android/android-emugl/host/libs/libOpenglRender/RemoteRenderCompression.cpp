@@ -0,0 +1,213 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "RemoteRenderCompression.h"
+
+#include <stdint.h>
+#include <string.h>
+
+namespace emugl {
+
+// Constants of the LZ4 block format.
+static constexpr size_t kMinMatch = 4;
+// The last 5 bytes of a block are always literals.
+static constexpr size_t kLastLiterals = 5;
+// The last match must start at least 12 bytes before the end of the block.
+static constexpr size_t kMatchFindLimit = 12;
+static constexpr size_t kMaxOffset = 65535;
+static constexpr size_t kRunMask = 15;
+
+static constexpr int kHashLog = 12;
+
+// After this many positions without a match, the search starts skipping
+// bytes, faster and faster, so that incompressible data is cheap to scan.
+static constexpr int kSkipTrigger = 6;
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761U) >> (32 - kHashLog);
+}
+
+// Write the extra bytes of a literal or match length that did not fit in
+// the 4 bits of the token.
+static inline uint8_t* writeLength(uint8_t* op, size_t len) {
+    len -= kRunMask;
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static inline bool readLength(const uint8_t** ip, const uint8_t* end,
+                              size_t* len) {
+    uint8_t b;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+static inline uint8_t* writeLiterals(uint8_t* op, uint8_t* token,
+                                     const uint8_t* literals, size_t len) {
+    if (len >= kRunMask) {
+        *token = kRunMask << 4;
+        op = writeLength(op, len);
+    } else {
+        *token = (uint8_t)(len << 4);
+    }
+    memcpy(op, literals, len);
+    return op + len;
+}
+
+size_t lz4CompressBound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+size_t lz4Compress(const char* srcData, size_t srcSize, char* dstData) {
+    const uint8_t* const src = (const uint8_t*)srcData;
+    const uint8_t* const end = src + srcSize;
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    uint8_t* op = (uint8_t*)dstData;
+
+    if (srcSize > kMatchFindLimit) {
+        const uint8_t* const matchLimit = end - kLastLiterals;
+        const uint8_t* const searchLimit = end - kMatchFindLimit;
+        uint32_t table[1 << kHashLog] = {};
+        int misses = 1 << kSkipTrigger;
+
+        while (ip < searchLimit) {
+            const uint32_t seq = read32(ip);
+            const uint32_t h = hash32(seq);
+            const uint8_t* ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || (size_t)(ip - ref) > kMaxOffset ||
+                read32(ref) != seq) {
+                ip += misses++ >> kSkipTrigger;
+                continue;
+            }
+            misses = 1 << kSkipTrigger;
+
+            // Extend the match backwards over the pending literals, then
+            // forwards.
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t* matchEnd = ip + kMinMatch;
+            const uint8_t* refEnd = ref + kMinMatch;
+            while (matchEnd < matchLimit && *matchEnd == *refEnd) {
+                matchEnd++;
+                refEnd++;
+            }
+
+            uint8_t* token = op++;
+            op = writeLiterals(op, token, anchor, ip - anchor);
+
+            const size_t offset = ip - ref;
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+
+            const size_t matchLen = matchEnd - ip - kMinMatch;
+            if (matchLen >= kRunMask) {
+                *token |= kRunMask;
+                op = writeLength(op, matchLen);
+            } else {
+                *token |= (uint8_t)matchLen;
+            }
+
+            ip = anchor = matchEnd;
+            if (ip < searchLimit) {
+                // Remember a position inside the match, this helps with
+                // repeated short commands.
+                table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+            }
+        }
+    }
+
+    uint8_t* token = op++;
+    op = writeLiterals(op, token, anchor, end - anchor);
+    return op - (uint8_t*)dstData;
+}
+
+bool lz4Decompress(const char* srcData, size_t srcSize, char* dstData,
+                   size_t dstSize) {
+    const uint8_t* ip = (const uint8_t*)srcData;
+    const uint8_t* const ipEnd = ip + srcSize;
+    uint8_t* const dst = (uint8_t*)dstData;
+    uint8_t* op = dst;
+    uint8_t* const opEnd = dst + dstSize;
+
+    while (ip < ipEnd) {
+        const uint8_t token = *ip++;
+
+        size_t litLen = token >> 4;
+        if (litLen == kRunMask && !readLength(&ip, ipEnd, &litLen)) {
+            return false;
+        }
+        if (litLen > (size_t)(ipEnd - ip) || litLen > (size_t)(opEnd - op)) {
+            return false;
+        }
+        memcpy(op, ip, litLen);
+        op += litLen;
+        ip += litLen;
+        if (ip == ipEnd) {
+            // The last sequence has no match.
+            break;
+        }
+
+        if (ipEnd - ip < 2) {
+            return false;
+        }
+        const size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return false;
+        }
+
+        size_t matchLen = token & kRunMask;
+        if (matchLen == kRunMask && !readLength(&ip, ipEnd, &matchLen)) {
+            return false;
+        }
+        matchLen += kMinMatch;
+        if (matchLen > (size_t)(opEnd - op)) {
+            return false;
+        }
+
+        const uint8_t* ref = op - offset;
+        if (offset >= matchLen) {
+            memcpy(op, ref, matchLen);
+            op += matchLen;
+        } else {
+            // Overlapping copy, repeats the last |offset| bytes.
+            for (size_t i = 0; i < matchLen; i++) {
+                *op++ = *ref++;
+            }
+        }
+    }
+
+    return op == opEnd;
+}
+
+}  // namespace emugl
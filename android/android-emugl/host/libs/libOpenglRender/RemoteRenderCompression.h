@@ -0,0 +1,40 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <stddef.h>
+
+namespace emugl {
+
+// A small compressor for the remote render link, producing the LZ4 block
+// format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md) so
+// that the render server can use any LZ4 implementation to decompress.
+//
+// It is a greedy single-pass matcher with a 4 KiB hash table, tuned for
+// speed rather than ratio: GLES command streams compress well already with
+// it, and it skips quickly over incompressible data.
+
+// Return the largest possible compressed size for |size| input bytes.
+size_t lz4CompressBound(size_t size);
+
+// Compress |srcSize| bytes from |src| into |dst|, which must have room for
+// at least lz4CompressBound(srcSize) bytes. Return the compressed size.
+size_t lz4Compress(const char* src, size_t srcSize, char* dst);
+
+// Decompress the LZ4 block |src| into exactly |dstSize| bytes at |dst|.
+// Return false if the block is malformed or does not decompress to
+// |dstSize| bytes.
+bool lz4Decompress(const char* src, size_t srcSize, char* dst, size_t dstSize);
+
+}  // namespace emugl
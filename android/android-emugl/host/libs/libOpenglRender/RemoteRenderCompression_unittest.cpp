@@ -0,0 +1,98 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "RemoteRenderCompression.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace emugl {
+
+static std::vector<char> compress(const std::string& input) {
+    std::vector<char> out(lz4CompressBound(input.size()));
+    out.resize(lz4Compress(input.data(), input.size(), out.data()));
+    return out;
+}
+
+static void checkRoundTrip(const std::string& input) {
+    std::vector<char> packed = compress(input);
+    EXPECT_LE(packed.size(), lz4CompressBound(input.size()));
+
+    std::string output(input.size(), '\0');
+    ASSERT_TRUE(lz4Decompress(packed.data(), packed.size(), &output[0],
+                              output.size()));
+    EXPECT_TRUE(input == output);
+}
+
+// A simple deterministic generator, good enough for incompressible data.
+static std::string randomString(size_t size, uint32_t seed) {
+    std::string s(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        s[i] = (char)(seed >> 16);
+    }
+    return s;
+}
+
+TEST(RemoteRenderCompression, smallInputs) {
+    for (size_t size = 0; size < 40; size++) {
+        checkRoundTrip(std::string(size, 'a'));
+        checkRoundTrip(randomString(size, size));
+    }
+}
+
+TEST(RemoteRenderCompression, repetitiveData) {
+    // Looks like a stream of small GLES commands.
+    std::string input;
+    for (int i = 0; i < 2000; i++) {
+        uint32_t cmd[4] = {2048 + (uint32_t)(i % 7), 16, (uint32_t)i, 0};
+        input.append((const char*)cmd, sizeof(cmd));
+    }
+    checkRoundTrip(input);
+    EXPECT_LT(compress(input).size(), input.size() / 2);
+}
+
+TEST(RemoteRenderCompression, longRuns) {
+    // Exercises the extra length bytes of literals and matches.
+    std::string input = randomString(1000, 1) + std::string(70000, 'x') +
+                        randomString(300, 2) + std::string(5, 'y');
+    checkRoundTrip(input);
+}
+
+TEST(RemoteRenderCompression, incompressibleData) {
+    std::string input = randomString(64 * 1024, 42);
+    checkRoundTrip(input);
+    EXPECT_GE(compress(input).size(), input.size());
+}
+
+TEST(RemoteRenderCompression, decompressRejectsBadInput) {
+    std::string input(1000, 'z');
+    std::vector<char> packed = compress(input);
+    std::string output(input.size(), '\0');
+
+    // Wrong output size.
+    EXPECT_FALSE(lz4Decompress(packed.data(), packed.size(), &output[0],
+                               output.size() - 1));
+    // Truncated block.
+    EXPECT_FALSE(lz4Decompress(packed.data(), packed.size() - 1, &output[0],
+                               output.size()));
+    // Offset pointing before the start of the output.
+    const char bad[] = {0x10, 'a', 0x10, 0x00};
+    EXPECT_FALSE(lz4Decompress(bad, sizeof(bad), &output[0], 8));
+}
+
+}  // namespace emugl
@@ -0,0 +1,1185 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "RemoteRenderConnection.h"
+
+#include "RemoteRenderChannel.h"
+#include "RemoteRenderCompression.h"
+
+#include "android/base/sockets/SocketUtils.h"
+#include "android/base/synchronization/ConditionVariable.h"
+#include "android/base/system/System.h"
+#include "android/base/threads/FunctorThread.h"
+#include "emugl/common/lazy_instance.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+// Older system headers do not know about MSG_ZEROCOPY (Linux 4.14).
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#define EMUGL_DEBUG_LEVEL 0
+#include "emugl/common/debug.h"
+
+namespace emugl {
+
+using AutoLock = android::base::AutoLock;
+
+// How long to wait for the server's answer to a hello packet. A server that
+// does not answer in time is treated as not supporting the features.
+static constexpr int kHelloTimeoutMs = 2000;
+
+// Maximum number of frames gathered in one sendmsg() call.
+static constexpr size_t kMaxOutFrames = 32;
+
+// Smallest send that uses MSG_ZEROCOPY, below this copying is cheaper.
+static constexpr size_t kZeroCopyMinBytes = 32 * 1024;
+
+// How long to wait for the kernel to be done with the pages of MSG_ZEROCOPY
+// sends before giving them back. The connection is reset past that.
+static constexpr int kZeroCopyDrainTimeoutMs = 1000;
+
+// Size of the staging buffer framed replies are received into. Reply
+// bodies that do not fit are received in place.
+static constexpr size_t kRecvBufferSize = 64 * 1024;
+
+// Compression batches are made of up to |kMaxPackPages| pages of a session,
+// and stop growing once they reach |kMaxPackBytes|. Smaller batches than
+// |kMinPackBytes| are not worth compressing.
+static constexpr size_t kMaxPackPages = 16;
+static constexpr size_t kMaxPackBytes = 64 * 1024;
+static constexpr size_t kMinPackBytes = 256;
+
+// Number of pages sent uncompressed after a batch did not compress, doubled
+// after each failure in a row.
+static constexpr uint32_t kMinPackBackoff = 16;
+static constexpr uint32_t kMaxPackBackoff = 1024;
+
+// Number of idle dedicated connections kept ready when
+// 'render_server_pool_size' is not set.
+static constexpr int kDefaultPoolSize = 2;
+static constexpr int kMaxPoolSize = 16;
+
+// Delay before the pool tries to connect again after a failure, doubled
+// after each failure in a row.
+static constexpr unsigned kMinPoolRetryMs = 100;
+static constexpr unsigned kMaxPoolRetryMs = 5000;
+
+namespace {
+
+// The shared multiplexed connections of the process. New ones are
+// connected without holding |lock|, |connecting| counts them meanwhile.
+struct MuxConnections {
+    android::base::Lock lock;
+    android::base::ConditionVariable connected;
+    std::vector<RemoteRenderConnectionPtr> connections;
+    int connecting = 0;
+    // Set once the server rejected multiplexing, to stop asking.
+    bool unsupported = false;
+};
+
+// Set once the server did not answer the hello packet of a dedicated
+// connection, to stop sending it.
+static std::atomic_bool sHelloUnsupported {false};
+
+static LazyInstance<MuxConnections> sMux = LAZY_INSTANCE_INIT;
+
+// Idle dedicated connections, refilled by a background thread once
+// started.
+class WarmPool {
+public:
+    // Connect to the server, see RemoteRenderConnection::connect().
+    using Connector = std::function<RemoteRenderConnectionPtr(bool* rejected)>;
+
+    // Start keeping |size| connections made with |connector| ready. Only
+    // the first call does something.
+    void start(int size, Connector connector) {
+        AutoLock lock(mLock);
+        if (mThread || size <= 0) {
+            return;
+        }
+        mSize = size;
+        mConnector = std::move(connector);
+        mThread.reset(new android::base::FunctorThread([this] { refill(); }));
+        mThread->start();
+    }
+
+    // Return an idle connection, or nullptr if there is none.
+    RemoteRenderConnectionPtr take() {
+        AutoLock lock(mLock);
+        while (!mIdle.empty()) {
+            RemoteRenderConnectionPtr conn = std::move(mIdle.front());
+            mIdle.pop_front();
+            mCanRefill.signal();
+            // The server may have closed it meanwhile.
+            if (conn->isOpen()) {
+                return conn;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    void refill() {
+        unsigned retryMs = kMinPoolRetryMs;
+        AutoLock lock(mLock);
+        while (true) {
+            while ((int)mIdle.size() >= mSize) {
+                mCanRefill.wait(&lock);
+            }
+            lock.unlock();
+
+            bool rejected = false;
+            RemoteRenderConnectionPtr conn = mConnector(&rejected);
+            if (!conn) {
+                if (rejected) {
+                    // The server does not know about the hello packet, the
+                    // sessions connect by themselves from now on.
+                    return;
+                }
+                android::base::System::get()->sleepMs(retryMs);
+                retryMs = std::min(retryMs * 2, kMaxPoolRetryMs);
+                lock.lock();
+                continue;
+            }
+            retryMs = kMinPoolRetryMs;
+
+            lock.lock();
+            mIdle.push_back(std::move(conn));
+        }
+    }
+
+    android::base::Lock mLock;
+    android::base::ConditionVariable mCanRefill;
+    std::deque<RemoteRenderConnectionPtr> mIdle;
+    int mSize = 0;
+    Connector mConnector;
+    std::unique_ptr<android::base::FunctorThread> mThread;
+};
+
+static LazyInstance<WarmPool> sWarmPool = LAZY_INSTANCE_INIT;
+
+// The address of the render server, from the 'render_server_hostname' and
+// 'render_server_port' environment variables.
+struct ServerAddress {
+    std::string host;
+    int port;
+};
+
+static const ServerAddress& serverAddress() {
+    static const ServerAddress address = [] {
+        const char* host = getenv("render_server_hostname");
+        if (!host) {
+            D("Cannot find render server hostname\n");
+            host = "127.0.0.1";
+        }
+        const char* port = getenv("render_server_port");
+        if (!port) {
+            D("Cannot find render server port\n");
+            port = "23432";
+        }
+        return ServerAddress{host, atoi(port)};
+    }();
+    return address;
+}
+
+static int poolSize() {
+    static const int size = [] {
+        const char* env = getenv("render_server_pool_size");
+        return env ? std::min(std::max(atoi(env), 0), kMaxPoolSize)
+                   : kDefaultPoolSize;
+    }();
+    return size;
+}
+
+static int muxConnectionCount() {
+    static const int count = [] {
+        const char* env = getenv("render_server_mux_connections");
+        return env ? std::max(atoi(env), 0) : 0;
+    }();
+    return count;
+}
+
+static bool compressionRequested() {
+    static const bool requested = [] {
+        const char* env = getenv("render_server_compression");
+        return env && atoi(env) == 1;
+    }();
+    return requested;
+}
+
+static bool framedRepliesRequested() {
+    static const bool requested = [] {
+        const char* env = getenv("render_server_framed_replies");
+        return env && atoi(env) == 1;
+    }();
+    return requested;
+}
+
+static bool zeroCopyRequested() {
+    static const bool requested = [] {
+        const char* env = getenv("render_server_zerocopy");
+        return env && atoi(env) == 1;
+    }();
+    return requested;
+}
+
+// The features asked for on dedicated connections, 0 to send no hello at
+// all, as legacy servers never answer it.
+static uint32_t dedicatedFeatures() {
+    uint32_t features = 0;
+    if (framedRepliesRequested()) {
+        features |= kRemoteFeatureFramedReplies;
+    }
+    if (compressionRequested()) {
+        features |= kRemoteFeatureCompression;
+    }
+    return features;
+}
+
+static void setReceiveTimeout(int socket, int timeoutMs) {
+    struct timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    ::setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+}  // namespace
+
+// static
+RemoteRenderConnectionPtr RemoteRenderConnection::acquire() {
+    const int muxCount = muxConnectionCount();
+    if (muxCount > 0) {
+        AutoLock lock(sMux->lock);
+        auto& connections = sMux->connections;
+        connections.erase(
+                std::remove_if(connections.begin(), connections.end(),
+                               [](const RemoteRenderConnectionPtr& conn) {
+                                   return !conn->isOpen();
+                               }),
+                connections.end());
+
+        if (!sMux->unsupported &&
+            (int)connections.size() + sMux->connecting < muxCount) {
+            uint32_t features = kRemoteFeatureMultiplex;
+            if (compressionRequested()) {
+                features |= kRemoteFeatureCompression;
+            }
+            bool rejected = false;
+            sMux->connecting++;
+            lock.unlock();
+            RemoteRenderConnectionPtr conn =
+                    connect(features, kRemoteFeatureMultiplex, &rejected);
+            lock.lock();
+            sMux->connecting--;
+            sMux->connected.broadcast();
+            if (conn) {
+                connections.push_back(conn);
+                return conn;
+            }
+            if (rejected) {
+                D("render server does not support multiplexing\n");
+                sMux->unsupported = true;
+            }
+        }
+
+        // Share the connections being made rather than falling back to a
+        // dedicated one.
+        while (connections.empty() && sMux->connecting > 0) {
+            sMux->connected.wait(&lock);
+        }
+
+        if (!connections.empty()) {
+            // Pick the connection with the fewest sessions.
+            RemoteRenderConnectionPtr best;
+            size_t bestCount = 0;
+            for (const auto& conn : connections) {
+                AutoLock connLock(conn->mLock);
+                if (!best || conn->mSessions.size() < bestCount) {
+                    best = conn;
+                    bestCount = conn->mSessions.size();
+                }
+            }
+            return best;
+        }
+    }
+
+    if (dedicatedFeatures() != 0 && !sHelloUnsupported) {
+        warmUp();
+        if (RemoteRenderConnectionPtr conn = sWarmPool->take()) {
+            return conn;
+        }
+
+        bool rejected = false;
+        RemoteRenderConnectionPtr conn =
+                connect(dedicatedFeatures(), 0, &rejected);
+        if (conn || !rejected) {
+            return conn;
+        }
+        D("render server does not support the hello exchange\n");
+        sHelloUnsupported = true;
+    }
+
+    return connect(0, 0, nullptr);
+}
+
+// static
+void RemoteRenderConnection::warmUp() {
+    // Multiplexed connections are already shared and kept open.
+    if (muxConnectionCount() > 0 || dedicatedFeatures() == 0 ||
+        sHelloUnsupported) {
+        return;
+    }
+    sWarmPool->start(poolSize(), [](bool* rejected) {
+        RemoteRenderConnectionPtr conn =
+                connect(dedicatedFeatures(), 0, rejected);
+        if (!conn && *rejected) {
+            D("render server does not support the hello exchange\n");
+            sHelloUnsupported = true;
+        }
+        return conn;
+    });
+}
+
+// static
+RemoteRenderConnectionPtr RemoteRenderConnection::connect(uint32_t features,
+                                                          uint32_t required,
+                                                          bool* rejected) {
+    // Add Tcp Channel for comunication
+    const ServerAddress& address = serverAddress();
+    DD("new connection %s : %d\n", address.host.c_str(), address.port);
+
+    int socket = android::base::socketTcp4Client(address.host.c_str(),
+                                                 address.port);
+    if (socket == -1) {
+        D("%s: cannot connect to rendering server.(%s)\n", __func__,
+          strerror(errno));
+        return nullptr;
+    }
+
+    uint32_t accepted = 0;
+    if (features != 0) {
+        PagePacketHead head;
+        head.packet_type = kPacketTypeHello;
+        head.packet_body_size = sizeof(features);
+
+        setReceiveTimeout(socket, kHelloTimeoutMs);
+        bool ok = android::base::socketSendAll(socket, &head,
+                                               PAGE_PACKET_HEAD_LEN) &&
+                  android::base::socketSendAll(socket, &features,
+                                               sizeof(features)) &&
+                  android::base::socketRecvAll(socket, &head,
+                                               PAGE_PACKET_HEAD_LEN) &&
+                  head.packet_type == kPacketTypeHello &&
+                  head.packet_body_size == (int)sizeof(accepted) &&
+                  android::base::socketRecvAll(socket, &accepted,
+                                               sizeof(accepted));
+        setReceiveTimeout(socket, 0);
+        if (!ok || (accepted & required) != required) {
+            D("%s: features 0x%x rejected (0x%x)\n", __func__, features,
+              accepted);
+            android::base::socketClose(socket);
+            if (rejected) {
+                *rejected = true;
+            }
+            return nullptr;
+        }
+    }
+
+    android::base::socketSetNonBlocking(socket);
+    // socketSetNoDelay() reduces the latency of sending data, at the cost
+    // of creating more TCP packets on the connection. It's useful when
+    // doing lots of small send() calls, like the ADB protocol requires.
+    // And since this is on localhost, the packet increase should not be
+    // noticeable.
+    android::base::socketSetNoDelay(socket);
+
+    accepted &= features;
+    const bool multiplexed = (accepted & kRemoteFeatureMultiplex) != 0;
+    RemoteRenderConnectionPtr conn(new RemoteRenderConnection(
+            socket, multiplexed,
+            multiplexed || (accepted & kRemoteFeatureFramedReplies) != 0));
+    conn->mCompression = (accepted & kRemoteFeatureCompression) != 0;
+    if (zeroCopyRequested()) {
+        int one = 1;
+        conn->mZeroCopy = ::setsockopt(socket, SOL_SOCKET, SO_ZEROCOPY, &one,
+                                       sizeof(one)) == 0;
+    }
+    if (!conn->mReactor->addSocket(socket, conn)) {
+        return nullptr;
+    }
+    return conn;
+}
+
+RemoteRenderConnection::RemoteRenderConnection(int socket,
+                                               bool multiplexed,
+                                               bool framedReplies)
+    : mMultiplexed(multiplexed),
+      mFramedReplies(framedReplies),
+      mHeadLen(multiplexed ? SESSION_PACKET_HEAD_LEN : PAGE_PACKET_HEAD_LEN),
+      mReactor(RemoteRenderReactor::get()),
+      mSocket(socket),
+      mRecvBuf(framedReplies ? kRecvBufferSize : 0) {}
+
+RemoteRenderConnection::~RemoteRenderConnection() {
+    if (mSocket >= 0) {
+        android::base::socketClose(mSocket);
+    }
+}
+
+bool RemoteRenderConnection::isOpen() {
+    AutoLock lock(mLock);
+    return mSocket >= 0;
+}
+
+bool RemoteRenderConnection::attachSession(RemoteRenderChannel* channel) {
+    AutoLock lock(mLock);
+    if (mSocket < 0) {
+        return false;
+    }
+    mSessions[channel->sessionId()] = channel;
+    if (mMultiplexed) {
+        AutoLock pendingLock(mPendingLock);
+        queueControlLocked(kPacketTypeOpen, channel->sessionId());
+    }
+    return true;
+}
+
+void RemoteRenderConnection::detachSession(RemoteRenderChannel* channel) {
+    AutoLock lock(mLock);
+    const int sessionId = channel->sessionId();
+    mSessions.erase(sessionId);
+    mPackStates.erase(sessionId);
+    if (mRecvChannel == channel) {
+        // The rest of the reply being received will be discarded.
+        mRecvChannel = nullptr;
+        mRecvBody = nullptr;
+    }
+
+    // The pages of the session are freed once this returns, the kernel must
+    // be done with those it sends without copying.
+    if (hasZeroCopyFramesLocked(sessionId) && !waitForZeroCopyLocked()) {
+        closeLocked();
+        return;
+    }
+
+    {
+        AutoLock pendingLock(mPendingLock);
+        mWriteQueue.erase(
+                std::remove(mWriteQueue.begin(), mWriteQueue.end(), channel),
+                mWriteQueue.end());
+        dropSessionFramesLocked(sessionId);
+        if (mMultiplexed) {
+            queueControlLocked(kPacketTypeClose, sessionId);
+        }
+    }
+
+    if (!mMultiplexed) {
+        closeLocked();
+    }
+}
+
+void RemoteRenderConnection::requestWrite(RemoteRenderChannel* channel) {
+    AutoLock lock(mPendingLock);
+    if (mSocket < 0) {
+        return;
+    }
+    if (std::find(mWriteQueue.begin(), mWriteQueue.end(), channel) ==
+        mWriteQueue.end()) {
+        mWriteQueue.push_back(channel);
+    }
+    if (!mWantWrite) {
+        mWantWrite = true;
+        mReactor->watchWrite(mSocket, true);
+    }
+}
+
+void RemoteRenderConnection::queueControlLocked(int packetType,
+                                                int sessionId) {
+    if (mSocket < 0) {
+        return;
+    }
+    SessionPacketHead frame;
+    frame.head.packet_type = packetType;
+    frame.head.packet_body_size = 0;
+    frame.session_id = sessionId;
+    mControlFrames.push_back(frame);
+    if (!mWantWrite) {
+        mWantWrite = true;
+        mReactor->watchWrite(mSocket, true);
+    }
+}
+
+void RemoteRenderConnection::onEvents(uint32_t events) {
+    AutoLock lock(mLock);
+    if (mSocket < 0) {
+        return;
+    }
+
+    if ((events & EPOLLIN) && !onReadableLocked()) {
+        closeLocked();
+        return;
+    }
+
+    // With MSG_ZEROCOPY, send completions are reported through the error
+    // queue, which raises EPOLLERR without the socket being broken.
+    if ((events & EPOLLERR) && !(mZeroCopy && onErrorQueueLocked())) {
+        D("render server connection error\n");
+        closeLocked();
+        return;
+    }
+
+    if (events & (EPOLLHUP | EPOLLRDHUP)) {
+        D("render server connection closed\n");
+        closeLocked();
+        return;
+    }
+
+    if (events & EPOLLOUT) {
+        onWritableLocked();
+    }
+}
+
+void RemoteRenderConnection::onWritableLocked() {
+    while (mSocket >= 0) {
+        if (!fillOutFramesLocked()) {
+            return;
+        }
+        bool blocked = false;
+        if (!sendOutFramesLocked(&blocked)) {
+            closeLocked();
+            return;
+        }
+        if (blocked) {
+            // Wait for the next EPOLLOUT event.
+            return;
+        }
+    }
+}
+
+bool RemoteRenderConnection::fillOutFramesLocked() {
+    AutoLock lock(mPendingLock);
+
+    while (mOutFrames.size() < kMaxOutFrames) {
+        OutFrame frame = {};
+        if (!mControlFrames.empty()) {
+            frame.head = mControlFrames.front();
+            frame.session = frame.head.session_id;
+            mControlFrames.pop_front();
+            mOutFrames.push_back(std::move(frame));
+            continue;
+        }
+
+        if (mWriteQueue.empty()) {
+            break;
+        }
+        RemoteRenderChannel* channel = mWriteQueue.front();
+        mWriteQueue.pop_front();
+
+        if (!mCompression || !packPagesLocked(channel)) {
+            BufferPage* page = channel->popPendingPage();
+            if (!page) {
+                continue;
+            }
+            queuePageLocked(channel->sessionId(), page);
+        }
+        // Round-robin between sessions, one page or batch at a time.
+        if (channel->hasPendingPages()) {
+            mWriteQueue.push_back(channel);
+        }
+    }
+
+    if (mOutFrames.empty()) {
+        // Nothing left to send. This is done with |mPendingLock| held so
+        // that a concurrent requestWrite() re-arms the event after us.
+        mWantWrite = false;
+        mReactor->watchWrite(mSocket, false);
+        return false;
+    }
+    return true;
+}
+
+void RemoteRenderConnection::queuePageLocked(int sessionId,
+                                             BufferPage* page) {
+    OutFrame frame = {};
+    frame.page = page;
+    frame.body = page->data();
+    frame.bodySize = page->size();
+    frame.head.head.packet_type = kPacketTypeData;
+    frame.head.head.packet_body_size = frame.bodySize;
+    frame.head.session_id = sessionId;
+    frame.session = sessionId;
+    mOutFrames.push_back(std::move(frame));
+}
+
+bool RemoteRenderConnection::packPagesLocked(RemoteRenderChannel* channel) {
+    const int sessionId = channel->sessionId();
+    PackState& state = mPackStates[sessionId];
+    if (state.skip > 0) {
+        state.skip--;
+        return false;
+    }
+
+    // Leave room in |mOutFrames| to send the pages as they are.
+    const size_t maxPages =
+            std::min(kMaxPackPages, kMaxOutFrames - mOutFrames.size());
+    BufferPage* pages[kMaxPackPages];
+    size_t count = 0;
+    size_t rawSize = 0;
+    while (count < maxPages && rawSize < kMaxPackBytes) {
+        BufferPage* page = channel->popPendingPage();
+        if (!page) {
+            break;
+        }
+        pages[count++] = page;
+        rawSize += page->size();
+    }
+    if (count == 0) {
+        return false;
+    }
+
+    if (rawSize >= kMinPackBytes) {
+        const char* input = pages[0]->data();
+        if (count > 1) {
+            mPackInput.resize(rawSize);
+            size_t pos = 0;
+            for (size_t i = 0; i < count; i++) {
+                memcpy(&mPackInput[pos], pages[i]->data(), pages[i]->size());
+                pos += pages[i]->size();
+            }
+            input = mPackInput.data();
+        }
+
+        std::vector<char> packed;
+        if (!mPackBuffers.empty()) {
+            packed = std::move(mPackBuffers.back());
+            mPackBuffers.pop_back();
+        }
+        packed.resize(COMPRESSED_PACKET_HEAD_LEN + lz4CompressBound(rawSize));
+        const size_t bodySize =
+                COMPRESSED_PACKET_HEAD_LEN +
+                lz4Compress(input, rawSize,
+                            &packed[COMPRESSED_PACKET_HEAD_LEN]);
+
+        // Require a 1/8 gain, anything less is not worth the server's time.
+        if (bodySize < rawSize - rawSize / 8) {
+            CompressedPacketHead packedHead;
+            packedHead.raw_size = (uint32_t)rawSize;
+            memcpy(&packed[0], &packedHead, COMPRESSED_PACKET_HEAD_LEN);
+            state.backoff = 0;
+
+            OutFrame frame = {};
+            frame.page = pages[count - 1];
+            frame.packed = std::move(packed);
+            frame.body = frame.packed.data();
+            frame.bodySize = bodySize;
+            frame.head.head.packet_type = kPacketTypeCompressed;
+            frame.head.head.packet_body_size = bodySize;
+            frame.head.session_id = sessionId;
+            frame.session = sessionId;
+            mOutFrames.push_back(std::move(frame));
+            return true;
+        }
+
+        mPackBuffers.push_back(std::move(packed));
+        state.backoff = std::min(std::max(state.backoff * 2, kMinPackBackoff),
+                                 kMaxPackBackoff);
+        state.skip = state.backoff;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        queuePageLocked(sessionId, pages[i]);
+    }
+    return true;
+}
+
+bool RemoteRenderConnection::sendOutFramesLocked(bool* blocked) {
+    struct iovec iov[2 * kMaxOutFrames];
+    int iovCount = 0;
+    size_t skip = mOutOffset;
+    size_t total = 0;
+    bool hasBorrowed = false;
+
+    auto addIov = [&](char* data, size_t size) {
+        if (skip >= size) {
+            skip -= size;
+            return false;
+        }
+        iov[iovCount].iov_base = data + skip;
+        iov[iovCount].iov_len = size - skip;
+        total += size - skip;
+        skip = 0;
+        iovCount++;
+        return true;
+    };
+
+    int headIovs[kMaxOutFrames];
+    int headCount = 0;
+    size_t headBytes = 0;
+    for (auto& frame : mOutFrames) {
+        if (addIov((char*)&frame.head, mHeadLen)) {
+            headIovs[headCount++] = iovCount - 1;
+            headBytes += iov[iovCount - 1].iov_len;
+        }
+        if (frame.bodySize > 0) {
+            addIov(frame.body, frame.bodySize);
+        }
+        if (frame.page && frame.packed.empty()) {
+            hasBorrowed |= frame.page->isBorrowed();
+        }
+    }
+
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovCount;
+
+    // Zero-copy has a fixed cost per call (page pinning and completion
+    // notification), it is only worth it for large payloads, which are
+    // sent from borrowed pages.
+    bool zeroCopy = mZeroCopy && hasBorrowed && total >= kZeroCopyMinBytes;
+    std::vector<char> heads;
+    if (zeroCopy) {
+        // The kernel reads the data of a MSG_ZEROCOPY call when it actually
+        // transmits it, possibly after the frames left |mOutFrames|.
+        heads.resize(headBytes);
+        size_t pos = 0;
+        for (int i = 0; i < headCount; i++) {
+            struct iovec& headIov = iov[headIovs[i]];
+            memcpy(&heads[pos], headIov.iov_base, headIov.iov_len);
+            headIov.iov_base = &heads[pos];
+            pos += headIov.iov_len;
+        }
+    }
+    ssize_t ret = ::sendmsg(mSocket, &msg,
+                            MSG_NOSIGNAL | (zeroCopy ? MSG_ZEROCOPY : 0));
+    if (ret < 0 && zeroCopy && errno == ENOBUFS) {
+        // Out of socket option memory to track the pinned pages.
+        zeroCopy = false;
+        ret = ::sendmsg(mSocket, &msg, MSG_NOSIGNAL);
+    }
+    if (ret < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            *blocked = true;
+            return true;
+        }
+        return false;
+    }
+
+    const uint32_t seq = zeroCopy ? mZeroCopySeq++ : 0;
+    if (zeroCopy) {
+        mZeroCopyHeads.push_back({seq, std::move(heads)});
+    }
+    size_t sent = ret;
+    while (!mOutFrames.empty()) {
+        OutFrame& frame = mOutFrames.front();
+        if (zeroCopy && sent > 0) {
+            frame.zeroCopy = true;
+            frame.zeroCopySeq = seq;
+        }
+        const size_t frameSize = mHeadLen + frame.bodySize;
+        const size_t left = frameSize - mOutOffset;
+        if (sent < left) {
+            mOutOffset += sent;
+            break;
+        }
+        sent -= left;
+        mOutOffset = 0;
+        completeFrameLocked(&frame);
+        mOutFrames.pop_front();
+    }
+    return true;
+}
+
+void RemoteRenderConnection::completeFrameLocked(OutFrame* frame) {
+    if (!frame->page && frame->packed.empty()) {
+        return;
+    }
+    mSentFrames.push_back(std::move(*frame));
+    returnFramesLocked();
+}
+
+void RemoteRenderConnection::returnFramesLocked() {
+    while (!mSentFrames.empty()) {
+        OutFrame& frame = mSentFrames.front();
+        if (frame.zeroCopy &&
+            (int32_t)(frame.zeroCopySeq - mZeroCopyAcked) >= 0) {
+            // The kernel may still read the page.
+            break;
+        }
+        if (frame.page) {
+            auto it = mSessions.find(frame.session);
+            if (it != mSessions.end()) {
+                it->second->returnPage(frame.page);
+            }
+        }
+        if (!frame.packed.empty()) {
+            mPackBuffers.push_back(std::move(frame.packed));
+        }
+        mSentFrames.pop_front();
+    }
+    while (!mZeroCopyHeads.empty() &&
+           (int32_t)(mZeroCopyHeads.front().seq - mZeroCopyAcked) < 0) {
+        mZeroCopyHeads.pop_front();
+    }
+}
+
+bool RemoteRenderConnection::hasZeroCopyFramesLocked(int sessionId) const {
+    auto pending = [this, sessionId](const OutFrame& frame) {
+        return frame.session == sessionId && frame.zeroCopy &&
+               (int32_t)(frame.zeroCopySeq - mZeroCopyAcked) >= 0;
+    };
+    return (!mOutFrames.empty() && mOutOffset > 0 &&
+            pending(mOutFrames.front())) ||
+           std::any_of(mSentFrames.begin(), mSentFrames.end(), pending);
+}
+
+bool RemoteRenderConnection::waitForZeroCopyLocked() {
+    if (mZeroCopyStuck) {
+        return false;
+    }
+    const uint64_t deadlineUs =
+            android::base::System::get()->getHighResTimeUs() +
+            kZeroCopyDrainTimeoutMs * 1000;
+    while ((int32_t)(mZeroCopySeq - mZeroCopyAcked) > 0) {
+        const uint64_t nowUs = android::base::System::get()->getHighResTimeUs();
+        if (nowUs >= deadlineUs) {
+            D("MSG_ZEROCOPY sends did not complete in time\n");
+            mZeroCopyStuck = true;
+            return false;
+        }
+        // Completions raise POLLERR, which is always polled for.
+        struct pollfd pfd = {mSocket, 0, 0};
+        const int ret = ::poll(&pfd, 1, (deadlineUs - nowUs + 999) / 1000);
+        if (ret < 0 && errno != EINTR) {
+            mZeroCopyStuck = true;
+            return false;
+        }
+        onErrorQueueLocked();
+        if (pfd.revents & POLLHUP) {
+            // The connection is gone, and its send queue with it: the
+            // completions of all the sends are reported by now.
+            onErrorQueueLocked();
+            return (int32_t)(mZeroCopySeq - mZeroCopyAcked) <= 0;
+        }
+    }
+    return true;
+}
+
+void RemoteRenderConnection::dropSessionFramesLocked(int sessionId) {
+    // Called when the pages of |sessionId| are about to be freed, once
+    // the kernel is done with those sent with MSG_ZEROCOPY. Frames that did
+    // not start yet are simply dropped. A partly sent frame must be
+    // completed to keep the stream in sync, so copy the rest of its body.
+    auto it = mOutFrames.begin();
+    if (it != mOutFrames.end() && mOutOffset > 0) {
+        if (it->page && it->session == sessionId) {
+            if (it->packed.empty()) {
+                mOrphanBody.assign(it->body, it->body + it->bodySize);
+                it->body = mOrphanBody.data();
+            }
+            it->page = nullptr;
+        }
+        ++it;
+    }
+    while (it != mOutFrames.end()) {
+        if (it->page && it->session == sessionId) {
+            it = mOutFrames.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // The sent frames still there are held back by the MSG_ZEROCOPY sends of
+    // other sessions, the kernel copied their own data: forget their pages.
+    for (auto& frame : mSentFrames) {
+        if (frame.session == sessionId) {
+            frame.page = nullptr;
+        }
+    }
+}
+
+bool RemoteRenderConnection::onErrorQueueLocked() {
+    while (true) {
+        char control[128];
+        struct msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(mSocket, &msg, MSG_ERRQUEUE) < 0) {
+            break;
+        }
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm;
+             cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 &&
+                   cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            const auto err = (const struct sock_extended_err*)CMSG_DATA(cm);
+            if (err->ee_errno != 0 ||
+                err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // Send calls [ee_info, ee_data] are done with their buffers.
+            if ((int32_t)(err->ee_data + 1 - mZeroCopyAcked) > 0) {
+                mZeroCopyAcked = err->ee_data + 1;
+            }
+        }
+    }
+
+    returnFramesLocked();
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    ::getsockopt(mSocket, SOL_SOCKET, SO_ERROR, &error, &len);
+    return error == 0;
+}
+
+bool RemoteRenderConnection::onReadableLocked() {
+    if (!mFramedReplies) {
+        if (mSessions.empty()) {
+            return true;
+        }
+        return mSessions.begin()->second->onSocketReadable(mSocket);
+    }
+
+    while (true) {
+        char* dst = &mRecvBuf[mRecvLen];
+        size_t wanted = mRecvBuf.size() - mRecvLen;
+        const size_t bodyLeft = mRecvBodySize - mRecvBodyOffset;
+        const bool inPlace = mRecvBody && mRecvLen == 0 &&
+                             bodyLeft >= kRecvBufferSize;
+        if (inPlace) {
+            dst = (char*)mRecvBody + mRecvBodyOffset;
+            wanted = bodyLeft;
+        }
+
+        ssize_t ret = android::base::socketRecv(mSocket, dst, wanted);
+        if (ret < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (ret == 0) {
+            return false;
+        }
+
+        if (inPlace) {
+            mRecvBodyOffset += ret;
+            if (mRecvBodyOffset == mRecvBodySize) {
+                finishRecvFrameLocked();
+            }
+            continue;
+        }
+        mRecvLen += ret;
+        if (!dispatchRecvBufLocked()) {
+            D("invalid reply frame from render server\n");
+            return false;
+        }
+    }
+}
+
+bool RemoteRenderConnection::dispatchRecvBufLocked() {
+    const char* const buf = mRecvBuf.data();
+    size_t pos = 0;
+    while (pos < mRecvLen) {
+        if (mRecvBodyOffset < mRecvBodySize) {
+            const size_t len =
+                    std::min(mRecvBodySize - mRecvBodyOffset, mRecvLen - pos);
+            if (mRecvBody) {
+                memcpy(mRecvBody + mRecvBodyOffset, buf + pos, len);
+            }
+            mRecvBodyOffset += len;
+            pos += len;
+            if (mRecvBodyOffset < mRecvBodySize) {
+                break;
+            }
+            finishRecvFrameLocked();
+            continue;
+        }
+
+        const size_t delivered = deliverRepliesLocked(buf + pos,
+                                                      mRecvLen - pos);
+        if (delivered > 0) {
+            pos += delivered;
+            continue;
+        }
+
+        if (mRecvLen - pos < mHeadLen) {
+            break;
+        }
+        SessionPacketHead head = {};
+        memcpy(&head, buf + pos, mHeadLen);
+        pos += mHeadLen;
+        if (!startRecvFrameLocked(head)) {
+            return false;
+        }
+    }
+
+    // Keep the start of the next frame for later.
+    mRecvLen -= pos;
+    if (mRecvLen > 0 && pos > 0) {
+        memmove(&mRecvBuf[0], buf + pos, mRecvLen);
+    }
+    return true;
+}
+
+size_t RemoteRenderConnection::deliverRepliesLocked(const char* data,
+                                                    size_t len) {
+    // Find the run of complete replies to the same session at |data|.
+    SessionPacketHead head = {};
+    RemoteRenderChannel* channel = nullptr;
+    size_t end = 0;
+    size_t total = 0;
+    while (len - end >= mHeadLen) {
+        memcpy(&head, data + end, mHeadLen);
+        if (head.head.packet_type != kPacketTypeData ||
+            head.head.packet_body_size <= 0 ||
+            (size_t)head.head.packet_body_size > len - end - mHeadLen) {
+            break;
+        }
+        RemoteRenderChannel* const session = recvSessionLocked(head);
+        if (end > 0 && session != channel) {
+            break;
+        }
+        channel = session;
+        total += head.head.packet_body_size;
+        end += mHeadLen + head.head.packet_body_size;
+    }
+    if (end == 0) {
+        return 0;
+    }
+
+    unsigned char* dst = channel ? channel->allocReply(total) : nullptr;
+    if (!dst) {
+        // The session is gone, drop its replies.
+        return end;
+    }
+    for (size_t pos = 0; pos < end;) {
+        memcpy(&head, data + pos, mHeadLen);
+        pos += mHeadLen;
+        memcpy(dst, data + pos, head.head.packet_body_size);
+        dst += head.head.packet_body_size;
+        pos += head.head.packet_body_size;
+    }
+    channel->commitReply(total);
+    return end;
+}
+
+bool RemoteRenderConnection::startRecvFrameLocked(
+        const SessionPacketHead& head) {
+    if (head.head.packet_body_size < 0) {
+        return false;
+    }
+
+    // Find where the body goes.
+    mRecvBodySize = head.head.packet_body_size;
+    mRecvBodyOffset = 0;
+    mRecvBody = nullptr;
+    mRecvChannel = nullptr;
+    RemoteRenderChannel* const channel = recvSessionLocked(head);
+    if (channel) {
+        if (head.head.packet_type == kPacketTypeData && mRecvBodySize > 0) {
+            mRecvBody = channel->allocReply(mRecvBodySize);
+            if (mRecvBody) {
+                mRecvChannel = channel;
+            }
+        } else if (head.head.packet_type == kPacketTypeClose) {
+            channel->onConnectionLost();
+        }
+    }
+    return true;
+}
+
+void RemoteRenderConnection::finishRecvFrameLocked() {
+    if (mRecvChannel) {
+        mRecvChannel->commitReply(mRecvBodySize);
+    }
+    mRecvChannel = nullptr;
+    mRecvBody = nullptr;
+    mRecvBodySize = 0;
+    mRecvBodyOffset = 0;
+}
+
+RemoteRenderChannel* RemoteRenderConnection::recvSessionLocked(
+        const SessionPacketHead& head) {
+    if (!mMultiplexed) {
+        return mSessions.empty() ? nullptr : mSessions.begin()->second;
+    }
+    auto it = mSessions.find(head.session_id);
+    return it == mSessions.end() ? nullptr : it->second;
+}
+
+void RemoteRenderConnection::closeLocked() {
+    if (mSocket < 0) {
+        return;
+    }
+
+    mReactor->removeSocket(mSocket);
+
+    // The pages given back below may still be read by the kernel for
+    // MSG_ZEROCOPY sends. If they do not complete, reset the connection,
+    // which makes the kernel drop what it did not send when closing it.
+    const bool reset = !waitForZeroCopyLocked();
+    if (reset) {
+        struct linger linger = {1, 0};
+        ::setsockopt(mSocket, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    }
+
+    {
+        AutoLock pendingLock(mPendingLock);
+        mControlFrames.clear();
+        mWriteQueue.clear();
+        if (!reset) {
+            android::base::socketShutdownWrites(mSocket);
+        }
+        android::base::socketShutdownReads(mSocket);
+        android::base::socketClose(mSocket);
+        mSocket = -1;
+    }
+
+    for (const auto& session : mSessions) {
+        session.second->onConnectionLost();
+    }
+    mSessions.clear();
+    mOutFrames.clear();
+    mOutOffset = 0;
+    mSentFrames.clear();
+    mZeroCopyHeads.clear();
+    mRecvChannel = nullptr;
+    mRecvBody = nullptr;
+}
+
+}  // namespace emugl
@@ -0,0 +1,249 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include "RemoteRenderProtocol.h"
+#include "RemoteRenderReactor.h"
+
+#include "android/base/Compiler.h"
+#include "android/base/synchronization/Lock.h"
+
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace emugl {
+
+class BufferPage;
+class RemoteRenderChannel;
+
+class RemoteRenderConnection;
+using RemoteRenderConnectionPtr = std::shared_ptr<RemoteRenderConnection>;
+
+// A RemoteRenderConnection is a TCP connection to the remote render server,
+// driven by one of the shared RemoteRenderReactor threads. It carries the
+// traffic of one or more RemoteRenderChannel sessions:
+//
+// - A dedicated connection carries a single session, with the original
+//   PagePacketHead framing. If 'render_server_framed_replies' is set to 1
+//   and the server accepts kRemoteFeatureFramedReplies during the hello
+//   exchange, replies come in frames too. Otherwise they are raw bytes
+//   sized by the session. A dedicated connection only sends a hello when
+//   a feature is asked for, as servers that do not know about the hello
+//   packet never answer it.
+//
+// - A multiplexed connection is shared by several sessions. It is only used
+//   when the 'render_server_mux_connections' environment variable gives
+//   the number of such connections to keep open, and the server accepted
+//   kRemoteFeatureMultiplex during the hello exchange. Frames in both
+//   directions use SessionPacketHead, and the sessions are opened and
+//   closed with kPacketTypeOpen / kPacketTypeClose.
+//
+// Framed replies are received in batches into a staging buffer, and the
+// consecutive replies to a session found there are handed to it at once.
+// Large reply bodies are received in place instead.
+//
+// Sessions queue pages on their own RemoteRenderChannel, then call
+// requestWrite(). The reactor thread picks the queued pages of all ready
+// sessions in turn, one page at a time, so that a large upload on one
+// session does not starve the others, and gathers many of them with their
+// heads into a single sendmsg() call.
+//
+// If 'render_server_zerocopy' is set to 1 and the kernel supports it,
+// large sends of pages borrowed from the render thread use MSG_ZEROCOPY.
+// Such pages are only given back, and their session detached or the
+// connection closed, once the kernel reports that it is done with them.
+//
+// Dedicated connections are opened ahead of time by a background thread,
+// so that a new session does not wait for the connection and the hello
+// exchange. 'render_server_pool_size' sets how many idle connections are
+// kept ready, 0 disables it. They are only used when a feature is asked
+// for and the server answered the hello packet, as older servers take each
+// connection for a session.
+//
+// If 'render_server_compression' is set to 1 and the server accepts
+// kRemoteFeatureCompression, the pages queued by a session are compressed
+// in batches into kPacketTypeCompressed frames. Sessions whose data does
+// not compress, such as already compressed textures, send plain frames for
+// a while before trying again. Compressed pages are not sent with
+// MSG_ZEROCOPY.
+class RemoteRenderConnection final
+        : public RemoteRenderEventHandler,
+          public std::enable_shared_from_this<RemoteRenderConnection> {
+public:
+    // Return a connection for a new session. This is a shared multiplexed
+    // connection if possible, or a new dedicated one otherwise. Return
+    // nullptr if the render server cannot be reached.
+    static RemoteRenderConnectionPtr acquire();
+
+    // Start filling the pool of idle dedicated connections, if it is used.
+    // acquire() also does it, calling this earlier only saves the first
+    // sessions from connecting by themselves.
+    static void warmUp();
+
+    ~RemoteRenderConnection();
+
+    // Return false once the connection is broken or closed.
+    bool isOpen();
+
+    bool isMultiplexed() const { return mMultiplexed; }
+    bool hasFramedReplies() const { return mFramedReplies; }
+
+    // Register |channel| as a session of this connection, and start
+    // receiving its replies. Return false if the connection is broken.
+    bool attachSession(RemoteRenderChannel* channel);
+
+    // Unregister |channel|. Its unsent pages are dropped, and no method of
+    // |channel| will be called, nor its pages read, once this returns. For a
+    // dedicated connection, this also closes the socket.
+    void detachSession(RemoteRenderChannel* channel);
+
+    // Tell the reactor that |channel| has pages ready to be sent.
+    // Can be called from any thread.
+    void requestWrite(RemoteRenderChannel* channel);
+
+    // RemoteRenderEventHandler overrides.
+    virtual void onEvents(uint32_t events) override final;
+
+private:
+    RemoteRenderConnection(int socket, bool multiplexed, bool framedReplies);
+
+    // Connect to the render server. If |features| is not 0, run the hello
+    // exchange, and return nullptr unless the server answers it and
+    // accepts all the |required| ones, setting |*rejected| to true if it
+    // could be reached.
+    static RemoteRenderConnectionPtr connect(uint32_t features,
+                                             uint32_t required,
+                                             bool* rejected);
+
+    void queueControlLocked(int packetType, int sessionId);
+
+    // A frame picked for sending. |page| is null for control frames, and
+    // for frames whose session was detached while they were partly sent,
+    // in which case the rest of their body is in |mOrphanBody|. The body of
+    // compressed frames is in |packed|, and |page| is the last page of the
+    // batch.
+    struct OutFrame {
+        SessionPacketHead head;
+        BufferPage* page;
+        char* body;
+        size_t bodySize;
+        std::vector<char> packed;
+        int session;
+        // Set if part of the frame went out with MSG_ZEROCOPY, in which
+        // case |page| must stay untouched until the kernel is done with
+        // the send call numbered |zeroCopySeq|.
+        bool zeroCopy;
+        uint32_t zeroCopySeq;
+    };
+
+    // These are called from the reactor thread with |mLock| held.
+    void onWritableLocked();
+    bool onReadableLocked();
+    bool dispatchRecvBufLocked();
+    size_t deliverRepliesLocked(const char* data, size_t len);
+    bool startRecvFrameLocked(const SessionPacketHead& head);
+    void finishRecvFrameLocked();
+    RemoteRenderChannel* recvSessionLocked(const SessionPacketHead& head);
+    bool onErrorQueueLocked();
+    bool fillOutFramesLocked();
+    void queuePageLocked(int sessionId, BufferPage* page);
+    bool packPagesLocked(RemoteRenderChannel* channel);
+    bool sendOutFramesLocked(bool* blocked);
+    void completeFrameLocked(OutFrame* frame);
+    void returnFramesLocked();
+    bool hasZeroCopyFramesLocked(int sessionId) const;
+    // Wait until the kernel is done with the pages of all the MSG_ZEROCOPY
+    // send calls made so far. Return false if that takes too long.
+    bool waitForZeroCopyLocked();
+    void dropSessionFramesLocked(int sessionId);
+    void closeLocked();
+
+    const bool mMultiplexed;
+    const bool mFramedReplies;
+    const size_t mHeadLen;
+    RemoteRenderReactor* const mReactor;
+
+    // Held by the reactor thread while handling events, and by sessions
+    // while attaching or detaching, so that a detached session is never
+    // used by the reactor afterwards.
+    android::base::Lock mLock;
+    int mSocket = -1;
+    std::unordered_map<int, RemoteRenderChannel*> mSessions;
+
+    // Sending state, only used by the reactor thread. |mOutFrames| are
+    // sent together with a single sendmsg() call, the first
+    // |mOutOffset| bytes of the first one are already on the wire.
+    std::deque<OutFrame> mOutFrames;
+    size_t mOutOffset = 0;
+
+    std::vector<char> mOrphanBody;
+
+    // Fully sent frames whose pages are not returned yet. Pages must be
+    // returned to their channel in order, so a frame waiting for the
+    // completion of its MSG_ZEROCOPY send call also holds back the frames
+    // sent after it.
+    std::deque<OutFrame> mSentFrames;
+
+    // Compression state, see packPagesLocked(). |mPackStates| tracks the
+    // sessions that send incompressible data.
+    struct PackState {
+        // Number of pages to send without compression.
+        uint32_t skip = 0;
+        // Value of |skip| after the last failure, doubled on each new one.
+        uint32_t backoff = 0;
+    };
+    bool mCompression = false;
+    std::unordered_map<int, PackState> mPackStates;
+    std::vector<char> mPackInput;
+    std::vector<std::vector<char>> mPackBuffers;
+
+    // MSG_ZEROCOPY state.
+    bool mZeroCopy = false;
+    uint32_t mZeroCopySeq = 0;
+    uint32_t mZeroCopyAcked = 0;
+    // Set once waitForZeroCopyLocked() timed out, so as not to wait again.
+    bool mZeroCopyStuck = false;
+    // Frame heads live in |mOutFrames|, which is not kept until the kernel
+    // is done with a MSG_ZEROCOPY call, so such calls send copies of them.
+    struct ZeroCopyHeads {
+        uint32_t seq;
+        std::vector<char> data;
+    };
+    std::deque<ZeroCopyHeads> mZeroCopyHeads;
+
+    // Receiving state of connections with framed replies, only used by
+    // the reactor thread. The first |mRecvLen| bytes of |mRecvBuf| are
+    // received but not dispatched yet. The frame being received has a
+    // body of |mRecvBodySize| bytes, of which |mRecvBodyOffset| were
+    // received, into |mRecvBody| if its session still wants them.
+    std::vector<char> mRecvBuf;
+    size_t mRecvLen = 0;
+    unsigned char* mRecvBody = nullptr;
+    size_t mRecvBodySize = 0;
+    size_t mRecvBodyOffset = 0;
+    RemoteRenderChannel* mRecvChannel = nullptr;
+
+    // Protects the queues below, which are fed by the render threads.
+    // Always acquired after |mLock| when both are needed.
+    android::base::Lock mPendingLock;
+    std::deque<SessionPacketHead> mControlFrames;
+    std::deque<RemoteRenderChannel*> mWriteQueue;
+    bool mWantWrite = false;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(RemoteRenderConnection);
+};
+
+}  // namespace emugl
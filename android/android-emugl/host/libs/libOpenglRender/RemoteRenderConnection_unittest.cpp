@@ -0,0 +1,64 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "RemoteRenderConnection.h"
+
+#include "android/base/sockets/ScopedSocket.h"
+#include "android/base/sockets/SocketUtils.h"
+#include "android/base/system/System.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <errno.h>
+
+namespace emugl {
+
+using android::base::ScopedSocket;
+using android::base::System;
+
+// A server that accepts connections but never sends anything, like a
+// render server that does not know about the hello packet. Without any
+// feature asked for, a dedicated connection must not wait for it.
+TEST(RemoteRenderConnection, LegacyServerConnectsWithoutHello) {
+    ScopedSocket server(android::base::socketTcp4LoopbackServer(0));
+    ASSERT_TRUE(server.valid());
+
+    // RemoteRenderConnection reads these once, no other test sets them.
+    System* const system = System::get();
+    system->envSet("render_server_hostname", "127.0.0.1");
+    system->envSet(
+            "render_server_port",
+            std::to_string(android::base::socketGetPort(server.get())));
+
+    const uint64_t startUs = system->getHighResTimeUs();
+    RemoteRenderConnectionPtr conn = RemoteRenderConnection::acquire();
+    const uint64_t elapsedUs = system->getHighResTimeUs() - startUs;
+    ASSERT_TRUE(conn);
+    EXPECT_TRUE(conn->isOpen());
+    EXPECT_FALSE(conn->isMultiplexed());
+    EXPECT_FALSE(conn->hasFramedReplies());
+    // Far from the 2 seconds a hello would wait for.
+    EXPECT_GT(500000U, elapsedUs);
+
+    // Nothing was sent on the connection.
+    ScopedSocket accepted(android::base::socketAcceptAny(server.get()));
+    ASSERT_TRUE(accepted.valid());
+    android::base::socketSetNonBlocking(accepted.get());
+    char byte;
+    EXPECT_EQ(-1, android::base::socketRecv(accepted.get(), &byte, 1));
+    EXPECT_TRUE(errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+}  // namespace emugl
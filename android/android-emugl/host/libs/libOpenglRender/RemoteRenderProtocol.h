@@ -0,0 +1,86 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace emugl {
+
+// Wire format of the link between the emulator and the remote render server.
+//
+// Every frame starts with a PagePacketHead. On a dedicated connection (one
+// TCP socket per render session) this is all there is, and the connection
+// itself identifies the session. Replies on a dedicated connection are raw
+// bytes, unless kRemoteFeatureFramedReplies was accepted.
+//
+// On a multiplexed connection, several sessions share a single socket, and
+// the head is extended with the id of the session the frame belongs to,
+// see SessionPacketHead. Both directions use the same framing.
+typedef struct _PagePacketHead {
+    int packet_type : 8;
+    int packet_body_size : 24;
+} __attribute__ ((packed)) PagePacketHead;
+
+#define PAGE_PACKET_HEAD_LEN       (sizeof(PagePacketHead))
+
+typedef struct _SessionPacketHead {
+    PagePacketHead head;
+    int session_id;
+} __attribute__ ((packed)) SessionPacketHead;
+
+#define SESSION_PACKET_HEAD_LEN    (sizeof(SessionPacketHead))
+
+// Values of PagePacketHead::packet_type.
+enum RemotePacketType {
+    // Body is a chunk of the GLES command stream (or of a reply).
+    kPacketTypeData = 0,
+    // The session is closed, no body.
+    kPacketTypeClose = 1,
+    // Feature negotiation, body is a uint32_t mask of RemoteFeature bits.
+    // Sent by the emulator right after connecting, and echoed back by the
+    // server with the subset of features it accepts. A server that does not
+    // know about this packet is never sent one, see RemoteRenderConnection.
+    kPacketTypeHello = 2,
+    // A new session starts on a multiplexed connection, no body.
+    kPacketTypeOpen = 3,
+    // Like kPacketTypeData, but the body is a CompressedPacketHead followed
+    // by an LZ4 block, see RemoteRenderCompression.h. Only sent once
+    // kRemoteFeatureCompression was accepted.
+    kPacketTypeCompressed = 4,
+};
+
+// Feature bits exchanged in kPacketTypeHello.
+enum RemoteFeature : uint32_t {
+    // Frames carry a SessionPacketHead and the connection is shared.
+    kRemoteFeatureMultiplex = 1U << 0,
+    // The emulator may send kPacketTypeCompressed frames.
+    kRemoteFeatureCompression = 1U << 1,
+    // The server sends replies in kPacketTypeData frames on a dedicated
+    // connection too, so that the emulator never has to guess their size.
+    // Implied by kRemoteFeatureMultiplex.
+    kRemoteFeatureFramedReplies = 1U << 2,
+};
+
+typedef struct _CompressedPacketHead {
+    // Size of the data once decompressed.
+    uint32_t raw_size;
+} __attribute__ ((packed)) CompressedPacketHead;
+
+#define COMPRESSED_PACKET_HEAD_LEN (sizeof(CompressedPacketHead))
+
+// Largest body that fits in PagePacketHead::packet_body_size.
+static constexpr size_t kMaxPacketBodySize = (1U << 23) - 1;
+
+}  // namespace emugl
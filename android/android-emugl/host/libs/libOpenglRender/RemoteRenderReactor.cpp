@@ -0,0 +1,176 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "RemoteRenderReactor.h"
+
+#include "emugl/common/lazy_instance.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define EMUGL_DEBUG_LEVEL 0
+#include "emugl/common/debug.h"
+
+namespace emugl {
+
+using AutoLock = android::base::AutoLock;
+
+// Number of reactor threads when 'render_server_reactors' is not set. Each
+// reactor only moves bytes between page queues and sockets, so a couple of
+// them are enough for all the GL pipes of an emulator instance.
+static constexpr int kDefaultReactorCount = 2;
+static constexpr int kMaxReactorCount = 16;
+
+// Maximum number of events processed per epoll_wait() call.
+static constexpr int kMaxEvents = 64;
+
+namespace {
+
+class ReactorPool {
+public:
+    ReactorPool() {
+        int count = kDefaultReactorCount;
+        const char* env = getenv("render_server_reactors");
+        if (env && atoi(env) > 0) {
+            count = std::min(atoi(env), kMaxReactorCount);
+        }
+        for (int i = 0; i < count; i++) {
+            mReactors.emplace_back(new RemoteRenderReactor());
+            mReactors.back()->start();
+        }
+        D("started %d remote render reactors", count);
+    }
+
+    RemoteRenderReactor* next() {
+        return mReactors[mNext++ % mReactors.size()].get();
+    }
+
+private:
+    std::vector<std::unique_ptr<RemoteRenderReactor>> mReactors;
+    std::atomic<size_t> mNext {0};
+};
+
+static LazyInstance<ReactorPool> sReactorPool = LAZY_INSTANCE_INIT;
+
+}  // namespace
+
+RemoteRenderReactor::RemoteRenderReactor()
+    : emugl::Thread(android::base::ThreadFlags::MaskSignals, 256 * 1024),
+      mEpollFD(::epoll_create1(EPOLL_CLOEXEC)) {}
+
+RemoteRenderReactor::~RemoteRenderReactor() {
+    if (mEpollFD >= 0) {
+        ::close(mEpollFD);
+    }
+}
+
+// static
+RemoteRenderReactor* RemoteRenderReactor::get() {
+    return sReactorPool->next();
+}
+
+bool RemoteRenderReactor::addSocket(int socket,
+                                    RemoteRenderEventHandlerPtr handler) {
+    AutoLock lock(mLock);
+    const uint64_t token = mNextToken++;
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+    ev.data.u64 = token;
+    if (::epoll_ctl(mEpollFD, EPOLL_CTL_ADD, socket, &ev) < 0) {
+        D("cannot watch socket %d: %s", socket, strerror(errno));
+        return false;
+    }
+    mRegistrations[token] = {socket, std::move(handler)};
+    mTokens[socket] = token;
+    return true;
+}
+
+void RemoteRenderReactor::watchWrite(int socket, bool wantWrite) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+    if (wantWrite) {
+        ev.events |= EPOLLOUT;
+    }
+
+    AutoLock lock(mLock);
+    auto it = mTokens.find(socket);
+    if (it == mTokens.end()) {
+        return;
+    }
+    ev.data.u64 = it->second;
+    ::epoll_ctl(mEpollFD, EPOLL_CTL_MOD, socket, &ev);
+}
+
+void RemoteRenderReactor::removeSocket(int socket) {
+    RemoteRenderEventHandlerPtr handler;
+    {
+        AutoLock lock(mLock);
+        auto it = mTokens.find(socket);
+        if (it == mTokens.end()) {
+            return;
+        }
+        ::epoll_ctl(mEpollFD, EPOLL_CTL_DEL, socket, NULL);
+        auto reg = mRegistrations.find(it->second);
+        handler = std::move(reg->second.handler);
+        mRegistrations.erase(reg);
+        mTokens.erase(it);
+    }
+    // |handler| may hold the last reference, release it outside of the lock.
+}
+
+intptr_t RemoteRenderReactor::main() {
+    struct epoll_event events[kMaxEvents];
+    std::vector<std::pair<RemoteRenderEventHandlerPtr, uint32_t>> ready;
+    ready.reserve(kMaxEvents);
+
+    while (true) {
+        int count = ::epoll_wait(mEpollFD, events, kMaxEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            D("epoll_wait() failed: %s", strerror(errno));
+            break;
+        }
+
+        // Grab a reference to each handler, so that a concurrent
+        // removeSocket() cannot destroy it while it runs.
+        {
+            AutoLock lock(mLock);
+            for (int i = 0; i < count; i++) {
+                auto it = mRegistrations.find(events[i].data.u64);
+                if (it != mRegistrations.end()) {
+                    ready.emplace_back(it->second.handler,
+                                       (uint32_t)events[i].events);
+                }
+            }
+        }
+
+        for (auto& item : ready) {
+            item.first->onEvents(item.second);
+        }
+        ready.clear();
+    }
+
+    return 0;
+}
+
+}  // namespace emugl
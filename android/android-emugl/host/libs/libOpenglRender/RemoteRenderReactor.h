@@ -0,0 +1,95 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include "android/base/Compiler.h"
+#include "android/base/synchronization/Lock.h"
+
+#include "emugl/common/thread.h"
+
+#include <memory>
+#include <unordered_map>
+
+#include <stdint.h>
+
+namespace emugl {
+
+// Interface of objects that want to be notified of socket events by
+// a RemoteRenderReactor. onEvents() is always called from the reactor
+// thread, with the epoll event mask that triggered it.
+class RemoteRenderEventHandler {
+public:
+    virtual ~RemoteRenderEventHandler() = default;
+    virtual void onEvents(uint32_t events) = 0;
+};
+
+using RemoteRenderEventHandlerPtr = std::shared_ptr<RemoteRenderEventHandler>;
+
+// A RemoteRenderReactor is a thread that waits for events on many render
+// server sockets at once, and dispatches them to their handlers.
+//
+// All remote render connections of the process are spread over a small,
+// fixed pool of reactors (see get()), instead of having one polling thread
+// per GL pipe. Sockets are watched in edge-triggered mode, read readiness is
+// always reported while write readiness is only reported after a call to
+// watchWrite(fd, true).
+class RemoteRenderReactor final : public emugl::Thread {
+public:
+    RemoteRenderReactor();
+    ~RemoteRenderReactor();
+
+    // Return one of the process-wide reactors, starting it if needed.
+    // Successive calls return the reactors of the pool in turn. The pool
+    // size can be set with the 'render_server_reactors' environment
+    // variable.
+    static RemoteRenderReactor* get();
+
+    // Start watching |socket| and send its events to |handler|, which is
+    // kept alive until removeSocket() is called. Return true on success.
+    bool addSocket(int socket, RemoteRenderEventHandlerPtr handler);
+
+    // Enable or disable the reporting of write readiness for |socket|.
+    // Enabling it always triggers an event if the socket is writable.
+    // Can be called from any thread.
+    void watchWrite(int socket, bool wantWrite);
+
+    // Stop watching |socket|. After this returns, the handler will not be
+    // called for new events, though a call already in progress on the
+    // reactor thread may still be completing. Can be called from any
+    // thread, including from a handler.
+    void removeSocket(int socket);
+
+private:
+    virtual intptr_t main() override final;
+
+    // Each registration gets a unique token, stored in the epoll event data,
+    // so that an event still pending for a removed socket can never reach
+    // the handler of a new socket that reused the same descriptor.
+    struct Registration {
+        int socket;
+        RemoteRenderEventHandlerPtr handler;
+    };
+
+    int mEpollFD = -1;
+
+    // Protects the fields below, never held while calling a handler.
+    android::base::Lock mLock;
+    uint64_t mNextToken = 1;
+    std::unordered_map<uint64_t, Registration> mRegistrations;
+    std::unordered_map<int, uint64_t> mTokens;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(RemoteRenderReactor);
+};
+
+}  // namespace emugl
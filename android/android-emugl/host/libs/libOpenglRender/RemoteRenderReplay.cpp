@@ -0,0 +1,444 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// emugl_render_replay replays GLES command streams recorded with
+// RENDERER_DUMP_DIR (the stream_of_session_<N> files) through the same
+// path as a guest render session: RenderChannelImpl, then a RenderThread
+// that sizes the replies with a ReplySizeScanner and forwards the guest
+// buffers as they are through RemoteRenderChannel and
+// RemoteRenderConnection to a render server. Unless -s is given, the
+// server is a RemoteRenderStandInServer on a loopback port, so neither a
+// guest nor a GPU is needed.
+//
+// Each stream is replayed by its own guest thread, which waits for the
+// replies of the commands that have some, like the guest encoder does. The
+// tool then reports the throughput and the round trip latencies, which
+// makes it a benchmark for changes to the transport.
+
+#include "ReplySizeScanner.h"
+#include "RemoteRenderChannel.h"
+#include "RemoteRenderConnection.h"
+#include "RemoteRenderStandInServer.h"
+#include "RenderChannelImpl.h"
+#include "RenderThread.h"
+
+#include "android/base/synchronization/ConditionVariable.h"
+#include "android/base/synchronization/Lock.h"
+#include "android/base/system/System.h"
+#include "android/base/threads/FunctorThread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace emugl {
+
+using android::base::AutoLock;
+using android::base::ConditionVariable;
+using android::base::FunctorThread;
+using android::base::Lock;
+using android::base::System;
+using State = RenderChannel::State;
+using IoResult = RenderChannel::IoResult;
+
+// Same as RendererImpl.
+static const size_t kRemotePageCount = 64;
+
+// Commands without a reply are sent in batches of up to this size, like
+// the guest encoder buffers them before writing to its pipe.
+static const size_t kMaxBatchSize = 16 * 1024;
+
+struct ReplayStats {
+    uint64_t bytes = 0;
+    uint64_t commands = 0;
+    // One entry per command that waited for a reply, in microseconds.
+    std::vector<uint64_t> roundTripsUs;
+};
+
+// Stands in for the guest end of a render channel, i.e. the opengles pipe
+// of the emulator, with a render thread at the other end.
+class ReplayGuest {
+public:
+    ReplayGuest()
+        : mChannel(std::make_shared<RenderChannelImpl>()),
+          mRemoteChannel(std::make_shared<RemoteRenderChannel>()),
+          mWatcher([this]() {
+              mRenderThread->wait();
+              AutoLock lock(mLock);
+              mHostDone = true;
+              mCondition.broadcast();
+          }) {}
+
+    ~ReplayGuest() {
+        stop();
+    }
+
+    bool start() {
+        mRemoteChannel->initChannel(kRemotePageCount);
+        // This runs on the render thread, with the channel lock held.
+        mChannel->setEventCallback([this](State state) {
+            AutoLock lock(mLock);
+            mEvents |= state;
+            mCondition.broadcast();
+        });
+        mRenderThread = RenderThread::create(std::weak_ptr<RendererImpl>(),
+                                             mChannel, mRemoteChannel);
+        if (!mRenderThread->start()) {
+            return false;
+        }
+        mWatcher.start();
+        mStarted = true;
+        return true;
+    }
+
+    bool write(const char* data, size_t size) {
+        RenderChannel::Buffer buffer(data, data + size);
+        while (true) {
+            const IoResult result = mChannel->tryWrite(std::move(buffer));
+            if (result == IoResult::Ok) {
+                return true;
+            }
+            if (result == IoResult::Error || !waitFor(State::CanWrite)) {
+                return false;
+            }
+        }
+    }
+
+    // Read and drop |size| bytes of replies.
+    bool read(size_t size) {
+        RenderChannel::Buffer buffer;
+        while (size > 0) {
+            const IoResult result = mChannel->tryRead(&buffer);
+            if (result == IoResult::Ok) {
+                if (buffer.size() > size) {
+                    fprintf(stderr, "Unexpected reply of %d bytes\n",
+                            (int)(buffer.size() - size));
+                    return false;
+                }
+                size -= buffer.size();
+                continue;
+            }
+            if (result == IoResult::Error || !waitFor(State::CanRead)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Close the channel, and wait until the render thread is done.
+    void stop() {
+        if (mStarted) {
+            mStarted = false;
+            mChannel->stop();
+            mWatcher.wait();
+        }
+    }
+
+private:
+    // Return false if the render thread exited instead.
+    bool waitFor(State state) {
+        {
+            AutoLock lock(mLock);
+            mEvents &= ~state;
+        }
+        // Not under |mLock|, this can call the event callback right away.
+        mChannel->setWantedEvents(state);
+        AutoLock lock(mLock);
+        while ((mEvents & state) == 0 && !mHostDone) {
+            mCondition.wait(&lock);
+        }
+        return (mEvents & state) != 0;
+    }
+
+    std::shared_ptr<RenderChannelImpl> mChannel;
+    std::shared_ptr<RemoteRenderChannel> mRemoteChannel;
+    std::unique_ptr<RenderThread> mRenderThread;
+    FunctorThread mWatcher;
+    bool mStarted = false;
+
+    Lock mLock;
+    ConditionVariable mCondition;
+    State mEvents = State::Empty;
+    bool mHostDone = false;
+};
+
+// Replay |stream| in a new render session, and add to |stats|.
+static bool replayStream(const std::string& name,
+                         const std::vector<char>& stream,
+                         ReplayStats* stats) {
+    // The guest side needs the reply sizes too, and tracks the checksum
+    // version selected by the stream in the same way as the render thread.
+    ReplySizeScanner scanner;
+
+    ReplayGuest guest;
+    if (!guest.start()) {
+        fprintf(stderr, "%s: could not start a render thread\n",
+                name.c_str());
+        return false;
+    }
+
+    // The dumps do not include the flags word that starts the stream.
+    const uint32_t flags = 0;
+    if (!guest.write((const char*)&flags, sizeof(flags))) {
+        fprintf(stderr, "%s: render thread exited\n", name.c_str());
+        return false;
+    }
+
+    const char* const data = stream.data();
+    size_t pos = 0;
+    size_t batchStart = 0;
+    while (pos + 8 <= stream.size()) {
+        int32_t packetLen;
+        memcpy(&packetLen, data + pos + 4, sizeof(packetLen));
+        if (packetLen < 8 || (size_t)packetLen > stream.size() - pos) {
+            fprintf(stderr, "%s: truncated command at offset %d\n",
+                    name.c_str(), (int)pos);
+            break;
+        }
+
+        size_t replySize = 0;
+        if (!scanner.scan(data + pos, packetLen, &replySize)) {
+            uint32_t opcode;
+            memcpy(&opcode, data + pos, sizeof(opcode));
+            fprintf(stderr, "%s: unknown command %u at offset %d\n",
+                    name.c_str(), opcode, (int)pos);
+            return false;
+        }
+        pos += packetLen;
+        stats->commands++;
+
+        if (replySize == 0 && pos - batchStart < kMaxBatchSize) {
+            continue;
+        }
+        const uint64_t startUs = System::get()->getHighResTimeUs();
+        if (!guest.write(data + batchStart, pos - batchStart) ||
+            !guest.read(replySize)) {
+            fprintf(stderr, "%s: render thread exited at offset %d\n",
+                    name.c_str(), (int)pos);
+            return false;
+        }
+        if (replySize > 0) {
+            stats->roundTripsUs.push_back(System::get()->getHighResTimeUs() -
+                                          startUs);
+        }
+        stats->bytes += pos - batchStart;
+        batchStart = pos;
+    }
+    if (pos > batchStart && !guest.write(data + batchStart, pos - batchStart)) {
+        return false;
+    }
+    stats->bytes += pos - batchStart;
+
+    guest.stop();
+    return true;
+}
+
+static bool readFile(const char* path, std::vector<char>* data) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    char buf[64 * 1024];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data->insert(data->end(), buf, buf + len);
+    }
+    const bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, int pct) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, sorted.size() * pct / 100)];
+}
+
+}  // namespace emugl
+
+using namespace emugl;
+
+static void usage(const char* filename) {
+    fprintf(stderr, "Usage: %s [options] <stream_of_session_N>...\n",
+            filename);
+    fprintf(stderr, "\t-h: This message\n");
+    fprintf(stderr, "\t-l <count>: replay each stream <count> times\n");
+    fprintf(stderr, "\t-s <host:port>: use this render server instead of "
+                    "a local stand-in\n");
+    fprintf(stderr, "\t-m <count>: multiplex sessions on <count> "
+                    "connections\n");
+    fprintf(stderr, "\t-c: compress the stream\n");
+    fprintf(stderr, "\t-f: ask for framed replies on dedicated "
+                    "connections\n");
+    fprintf(stderr, "\t-z: send large writes with MSG_ZEROCOPY\n");
+}
+
+int main(int argc, char* argv[]) {
+    int loops = 1;
+    std::string server;
+    std::string muxConnections;
+    bool compress = false;
+    bool framedReplies = false;
+    bool zeroCopy = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "l:s:m:cfzh")) != -1) {
+        switch (c) {
+            case 'l':
+                loops = std::max(atoi(optarg), 1);
+                break;
+            case 's':
+                server = optarg;
+                break;
+            case 'm':
+                muxConnections = optarg;
+                break;
+            case 'c':
+                compress = true;
+                break;
+            case 'f':
+                framedReplies = true;
+                break;
+            case 'z':
+                zeroCopy = true;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> names(argv + optind, argv + argc);
+    std::vector<std::vector<char>> streams(names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+        if (!readFile(names[i].c_str(), &streams[i])) {
+            perror(names[i].c_str());
+            return 1;
+        }
+    }
+
+    RemoteRenderStandInServer standIn;
+    std::string host = "127.0.0.1";
+    std::string port;
+    if (server.empty()) {
+        if (!standIn.start(0)) {
+            return 1;
+        }
+        port = std::to_string(standIn.port());
+    } else {
+        const size_t colon = server.rfind(':');
+        if (colon == std::string::npos) {
+            usage(argv[0]);
+            return 1;
+        }
+        host = server.substr(0, colon);
+        port = server.substr(colon + 1);
+    }
+
+    // RemoteRenderConnection reads these once, so they must be set before
+    // the first session starts.
+    System* const system = System::get();
+    system->envSet("render_server_hostname", host);
+    system->envSet("render_server_port", port);
+    if (!muxConnections.empty()) {
+        system->envSet("render_server_mux_connections", muxConnections);
+    }
+    if (compress) {
+        system->envSet("render_server_compression", "1");
+    }
+    if (framedReplies) {
+        system->envSet("render_server_framed_replies", "1");
+    }
+    if (zeroCopy) {
+        system->envSet("render_server_zerocopy", "1");
+    }
+    RemoteRenderConnection::warmUp();
+
+    std::vector<ReplayStats> stats(streams.size());
+    std::vector<std::unique_ptr<FunctorThread>> threads;
+    std::atomic_bool ok {true};
+    const uint64_t startUs = system->getHighResTimeUs();
+    for (size_t i = 0; i < streams.size(); i++) {
+        threads.emplace_back(new FunctorThread([&, i]() -> intptr_t {
+            for (int loop = 0; loop < loops; loop++) {
+                if (!replayStream(names[i], streams[i], &stats[i])) {
+                    ok = false;
+                    break;
+                }
+            }
+            return 0;
+        }));
+        threads.back()->start();
+    }
+    for (const auto& thread : threads) {
+        thread->wait();
+    }
+    const uint64_t elapsedUs =
+            std::max<uint64_t>(system->getHighResTimeUs() - startUs, 1);
+
+    ReplayStats total;
+    for (const auto& s : stats) {
+        total.bytes += s.bytes;
+        total.commands += s.commands;
+        total.roundTripsUs.insert(total.roundTripsUs.end(),
+                                  s.roundTripsUs.begin(),
+                                  s.roundTripsUs.end());
+    }
+    std::sort(total.roundTripsUs.begin(), total.roundTripsUs.end());
+
+    const double seconds = elapsedUs / 1000000.0;
+    printf("replayed %d stream(s) x %d: %llu bytes, %llu commands, "
+           "%d round trips in %.3f s\n",
+           (int)streams.size(), loops, (unsigned long long)total.bytes,
+           (unsigned long long)total.commands,
+           (int)total.roundTripsUs.size(), seconds);
+    printf("throughput: %.2f MB/s, %.0f commands/s\n",
+           total.bytes / seconds / (1024.0 * 1024.0),
+           total.commands / seconds);
+    printf("round trip (us): p50 %llu, p90 %llu, p99 %llu, max %llu\n",
+           (unsigned long long)percentile(total.roundTripsUs, 50),
+           (unsigned long long)percentile(total.roundTripsUs, 90),
+           (unsigned long long)percentile(total.roundTripsUs, 99),
+           (unsigned long long)(total.roundTripsUs.empty()
+                                        ? 0
+                                        : total.roundTripsUs.back()));
+
+    if (server.empty()) {
+        standIn.stop();
+        const RemoteRenderStandInServer::Stats serverStats = standIn.stats();
+        printf("stand-in server: %llu session(s), %llu stream bytes, "
+               "%llu on the wire, %llu reply bytes\n",
+               (unsigned long long)serverStats.sessions,
+               (unsigned long long)serverStats.streamBytes,
+               (unsigned long long)serverStats.wireBytes,
+               (unsigned long long)serverStats.replyBytes);
+    }
+
+    return ok ? 0 : 1;
+}
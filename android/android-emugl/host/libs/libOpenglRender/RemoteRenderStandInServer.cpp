@@ -0,0 +1,308 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "RemoteRenderStandInServer.h"
+
+#include "RemoteRenderCompression.h"
+#include "RemoteRenderProtocol.h"
+#include "ReplySizeScanner.h"
+
+#include "android/base/sockets/SocketUtils.h"
+
+#define EMUGL_DEBUG_LEVEL 0
+#include "emugl/common/debug.h"
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+
+#include <stdio.h>
+#include <string.h>
+
+namespace emugl {
+
+using android::base::AutoLock;
+using android::base::FunctorThread;
+
+// Size of the zero-filled buffer replies are sent from.
+static constexpr size_t kReplyChunkSize = 64 * 1024;
+
+// Serves a single emulator connection, on its own thread.
+class RemoteRenderStandInServer::Connection {
+public:
+    Connection(RemoteRenderStandInServer* server, int socket)
+        : mServer(server),
+          mSocket(socket),
+          mThread([this]() { serve(); }) {}
+
+    ~Connection() {
+        mThread.wait();
+        android::base::socketClose(mSocket);
+    }
+
+    void start() {
+        mThread.start();
+    }
+
+    // Make serve() return soon, from any thread.
+    void shutdown() {
+        android::base::socketShutdownReads(mSocket);
+        android::base::socketShutdownWrites(mSocket);
+    }
+
+private:
+    struct Session {
+        // The stream starts with the flags word sent by RenderThread::main(),
+        // which is not a command.
+        size_t flagsLeft = sizeof(uint32_t);
+        // Tracks the checksum version the session selects, and the commands
+        // split across frames.
+        std::unique_ptr<ReplySizeScanner> scanner {new ReplySizeScanner()};
+    };
+
+    void serve();
+    bool onHello(const std::vector<char>& body);
+    bool onData(int sessionId, Session* session, const char* data,
+                size_t size);
+    bool sendReply(int sessionId, size_t size);
+
+    RemoteRenderStandInServer* const mServer;
+    const int mSocket;
+    FunctorThread mThread;
+
+    bool mMultiplexed = false;
+    bool mFramedReplies = false;
+    std::vector<char> mZeros;
+};
+
+void RemoteRenderStandInServer::Connection::serve() {
+    mZeros.assign(kReplyChunkSize, 0);
+
+    std::unordered_map<int, Session> sessions;
+    std::vector<char> body;
+    std::vector<char> raw;
+    while (true) {
+        SessionPacketHead head = {};
+        const size_t headLen =
+                mMultiplexed ? SESSION_PACKET_HEAD_LEN : PAGE_PACKET_HEAD_LEN;
+        if (!android::base::socketRecvAll(mSocket, &head, headLen)) {
+            break;
+        }
+        if (head.head.packet_body_size < 0) {
+            fprintf(stderr, "%s: invalid frame head (type %d, size %d)\n",
+                    __func__, (int)head.head.packet_type,
+                    (int)head.head.packet_body_size);
+            return;
+        }
+        body.resize(head.head.packet_body_size);
+        if (!body.empty() &&
+            !android::base::socketRecvAll(mSocket, body.data(), body.size())) {
+            break;
+        }
+        mServer->mWireBytes += body.size();
+
+        // A dedicated connection carries a single session.
+        const int sessionId = mMultiplexed ? head.session_id : 0;
+        const char* data = body.data();
+        size_t size = body.size();
+        switch (head.head.packet_type) {
+            case kPacketTypeHello:
+                if (!onHello(body)) {
+                    return;
+                }
+                continue;
+            case kPacketTypeOpen:
+                sessions[sessionId] = Session();
+                mServer->mSessions++;
+                continue;
+            case kPacketTypeClose:
+                sessions.erase(sessionId);
+                continue;
+            case kPacketTypeCompressed: {
+                CompressedPacketHead packed;
+                if (size < COMPRESSED_PACKET_HEAD_LEN) {
+                    fprintf(stderr, "%s: truncated compressed frame\n",
+                            __func__);
+                    return;
+                }
+                memcpy(&packed, data, COMPRESSED_PACKET_HEAD_LEN);
+                raw.resize(packed.raw_size);
+                if (!lz4Decompress(data + COMPRESSED_PACKET_HEAD_LEN,
+                                   size - COMPRESSED_PACKET_HEAD_LEN,
+                                   raw.data(), raw.size())) {
+                    fprintf(stderr, "%s: invalid compressed frame\n",
+                            __func__);
+                    return;
+                }
+                data = raw.data();
+                size = raw.size();
+                break;
+            }
+            case kPacketTypeData:
+                break;
+            default:
+                fprintf(stderr, "%s: unknown packet type %d\n", __func__,
+                        (int)head.head.packet_type);
+                return;
+        }
+
+        auto it = sessions.find(sessionId);
+        if (it == sessions.end()) {
+            if (mMultiplexed) {
+                D("data for unknown session %d", sessionId);
+                continue;
+            }
+            it = sessions.emplace(sessionId, Session()).first;
+            mServer->mSessions++;
+        }
+        if (!onData(sessionId, &it->second, data, size)) {
+            return;
+        }
+    }
+}
+
+bool RemoteRenderStandInServer::Connection::onHello(
+        const std::vector<char>& body) {
+    uint32_t features = 0;
+    memcpy(&features, body.data(), std::min(body.size(), sizeof(features)));
+    features &= kRemoteFeatureMultiplex | kRemoteFeatureCompression |
+                kRemoteFeatureFramedReplies;
+
+    PagePacketHead head = {};
+    head.packet_type = kPacketTypeHello;
+    head.packet_body_size = sizeof(features);
+    if (!android::base::socketSendAll(mSocket, &head, PAGE_PACKET_HEAD_LEN) ||
+        !android::base::socketSendAll(mSocket, &features, sizeof(features))) {
+        return false;
+    }
+    mMultiplexed = (features & kRemoteFeatureMultiplex) != 0;
+    mFramedReplies =
+            mMultiplexed || (features & kRemoteFeatureFramedReplies) != 0;
+    return true;
+}
+
+bool RemoteRenderStandInServer::Connection::onData(int sessionId,
+                                                   Session* session,
+                                                   const char* data,
+                                                   size_t size) {
+    mServer->mStreamBytes += size;
+
+    const size_t skip = std::min(session->flagsLeft, size);
+    session->flagsLeft -= skip;
+
+    // The emulator would wait forever for the reply of a command the
+    // scanner does not know.
+    size_t replySize = 0;
+    if (!session->scanner->scan(data + skip, size - skip, &replySize)) {
+        fprintf(stderr, "%s: session %d: unknown command\n", __func__,
+                sessionId);
+        return false;
+    }
+
+    return sendReply(sessionId, replySize);
+}
+
+bool RemoteRenderStandInServer::Connection::sendReply(int sessionId,
+                                                      size_t size) {
+    mServer->mReplyBytes += size;
+    while (size > 0) {
+        const size_t chunk = std::min(size, mZeros.size());
+        if (mFramedReplies) {
+            SessionPacketHead head = {};
+            head.head.packet_type = kPacketTypeData;
+            head.head.packet_body_size = chunk;
+            head.session_id = sessionId;
+            if (!android::base::socketSendAll(
+                        mSocket, &head,
+                        mMultiplexed ? SESSION_PACKET_HEAD_LEN
+                                     : PAGE_PACKET_HEAD_LEN)) {
+                return false;
+            }
+        }
+        if (!android::base::socketSendAll(mSocket, mZeros.data(), chunk)) {
+            return false;
+        }
+        size -= chunk;
+    }
+    return true;
+}
+
+RemoteRenderStandInServer::RemoteRenderStandInServer() = default;
+
+RemoteRenderStandInServer::~RemoteRenderStandInServer() {
+    stop();
+}
+
+bool RemoteRenderStandInServer::start(int port) {
+    mSocket = android::base::socketTcp4LoopbackServer(port);
+    if (mSocket < 0) {
+        fprintf(stderr, "%s: could not listen on port %d\n", __func__, port);
+        return false;
+    }
+    mPort = android::base::socketGetPort(mSocket);
+    mAcceptThread.reset(new FunctorThread([this]() { acceptConnections(); }));
+    mAcceptThread->start();
+    return true;
+}
+
+void RemoteRenderStandInServer::stop() {
+    if (!mAcceptThread) {
+        return;
+    }
+
+    {
+        AutoLock lock(mLock);
+        mStopping = true;
+        for (const auto& connection : mConnections) {
+            connection->shutdown();
+        }
+    }
+    // This makes the pending accept() fail.
+    android::base::socketShutdownReads(mSocket);
+    mAcceptThread->wait();
+    mAcceptThread.reset();
+    android::base::socketClose(mSocket);
+    mSocket = -1;
+
+    // Waits for the connection threads.
+    mConnections.clear();
+}
+
+RemoteRenderStandInServer::Stats RemoteRenderStandInServer::stats() const {
+    Stats stats;
+    stats.streamBytes = mStreamBytes.load();
+    stats.wireBytes = mWireBytes.load();
+    stats.replyBytes = mReplyBytes.load();
+    stats.sessions = mSessions.load();
+    return stats;
+}
+
+void RemoteRenderStandInServer::acceptConnections() {
+    while (true) {
+        const int socket = android::base::socketAcceptAny(mSocket);
+        if (socket < 0) {
+            break;
+        }
+        android::base::socketSetNoDelay(socket);
+
+        AutoLock lock(mLock);
+        if (mStopping) {
+            android::base::socketClose(socket);
+            break;
+        }
+        mConnections.emplace_back(new Connection(this, socket));
+        mConnections.back()->start();
+    }
+}
+
+}  // namespace emugl
@@ -0,0 +1,88 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include "android/base/Compiler.h"
+#include "android/base/synchronization/Lock.h"
+#include "android/base/threads/FunctorThread.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <stdint.h>
+
+namespace emugl {
+
+// RemoteRenderStandInServer speaks the server side of the remote render
+// protocol (see RemoteRenderProtocol.h) on a loopback socket, without
+// rendering anything. It scans the command stream of each session with a
+// ReplySizeScanner, and answers every command that expects a reply with as
+// many zero bytes as the real server would send.
+//
+// This is enough to drive RemoteRenderChannel and RemoteRenderConnection
+// exactly like in production, to measure the transport without a GPU, see
+// RemoteRenderReplay.cpp. All the features of the hello exchange are always
+// accepted.
+class RemoteRenderStandInServer {
+public:
+    struct Stats {
+        // Bytes of command stream received, once decompressed.
+        uint64_t streamBytes;
+        // Bytes of frame bodies received, as sent on the wire.
+        uint64_t wireBytes;
+        uint64_t replyBytes;
+        uint64_t sessions;
+    };
+
+    RemoteRenderStandInServer();
+    ~RemoteRenderStandInServer();
+
+    // Listen on the loopback |port|, or on any free one if |port| is 0.
+    // Return false on failure.
+    bool start(int port);
+
+    // The port the server listens on, valid after start() succeeded.
+    int port() const {
+        return mPort;
+    }
+
+    // Close the listening socket and all connections, and wait for their
+    // threads.
+    void stop();
+
+    Stats stats() const;
+
+private:
+    class Connection;
+
+    void acceptConnections();
+
+    int mSocket = -1;
+    int mPort = 0;
+    std::unique_ptr<android::base::FunctorThread> mAcceptThread;
+
+    android::base::Lock mLock;
+    bool mStopping = false;
+    std::vector<std::unique_ptr<Connection>> mConnections;
+
+    std::atomic<uint64_t> mStreamBytes {0};
+    std::atomic<uint64_t> mWireBytes {0};
+    std::atomic<uint64_t> mReplyBytes {0};
+    std::atomic<uint64_t> mSessions {0};
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(RemoteRenderStandInServer);
+};
+
+}  // namespace emugl
@@ -0,0 +1,92 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "RemoteRenderStats.h"
+
+#include <string.h>
+
+namespace emugl {
+
+using android::base::AutoLock;
+
+// Shortest period the rates are averaged over.
+static constexpr uint64_t kRatePeriodUs = 1000000;
+
+// Upper bound of the first latency bucket, each next one doubles it.
+static constexpr uint64_t kFirstLatencyLimitUs = 250;
+
+static int latencyBucket(uint64_t latencyUs) {
+    int bucket = 0;
+    while (bucket < RemoteRenderStats::Snapshot::kLatencyBucketCount - 1 &&
+           latencyUs >= kFirstLatencyLimitUs << bucket) {
+        bucket++;
+    }
+    return bucket;
+}
+
+RemoteRenderStats::RemoteRenderStats(uint64_t nowUs) : mRateStartUs(nowUs) {}
+
+void RemoteRenderStats::onReplyExpected(size_t size, uint64_t nowUs) {
+    if (size == 0) {
+        return;
+    }
+    AutoLock lock(mLock);
+    mExpectedReplyBytes += size;
+    mPendingReplies.emplace_back(mExpectedReplyBytes, nowUs);
+    // Replies of unknown size may be received before they are expected.
+    completeRepliesLocked(nowUs);
+}
+
+void RemoteRenderStats::onReplyReceived(size_t size, uint64_t nowUs) {
+    mBytesOut.fetch_add(size, std::memory_order_relaxed);
+
+    AutoLock lock(mLock);
+    mReceivedReplyBytes += size;
+    completeRepliesLocked(nowUs);
+}
+
+void RemoteRenderStats::completeRepliesLocked(uint64_t nowUs) {
+    while (!mPendingReplies.empty() &&
+           mPendingReplies.front().first <= mReceivedReplyBytes) {
+        const uint64_t startUs = mPendingReplies.front().second;
+        mPendingReplies.pop_front();
+        mRoundTrips++;
+        mLatencyHistogram[latencyBucket(nowUs > startUs ? nowUs - startUs
+                                                        : 0)]++;
+    }
+}
+
+void RemoteRenderStats::snapshot(uint64_t nowUs, Snapshot* out) {
+    out->bytesIn = mBytesIn.load(std::memory_order_relaxed);
+    out->bytesOut = mBytesOut.load(std::memory_order_relaxed);
+    out->maxQueuedPages = mMaxQueuedPages.load(std::memory_order_relaxed);
+
+    AutoLock lock(mLock);
+    if (nowUs >= mRateStartUs + kRatePeriodUs) {
+        const uint64_t period = nowUs - mRateStartUs;
+        mBytesInPerSec =
+                (out->bytesIn - mRateStartBytesIn) * kRatePeriodUs / period;
+        mBytesOutPerSec =
+                (out->bytesOut - mRateStartBytesOut) * kRatePeriodUs / period;
+        mRateStartUs = nowUs;
+        mRateStartBytesIn = out->bytesIn;
+        mRateStartBytesOut = out->bytesOut;
+    }
+    out->bytesInPerSec = mBytesInPerSec;
+    out->bytesOutPerSec = mBytesOutPerSec;
+    out->roundTrips = mRoundTrips;
+    memcpy(out->latencyHistogram, mLatencyHistogram,
+           sizeof(mLatencyHistogram));
+}
+
+}  // namespace emugl
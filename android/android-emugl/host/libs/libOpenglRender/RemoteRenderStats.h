@@ -0,0 +1,92 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include "OpenglRender/Renderer.h"
+
+#include "android/base/Compiler.h"
+#include "android/base/synchronization/Lock.h"
+
+#include <atomic>
+#include <deque>
+#include <utility>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace emugl {
+
+// RemoteRenderStats counts the traffic of one RemoteRenderChannel, for
+// Renderer::getTransportStats(). The render thread reports the stream it
+// forwards and the replies it expects, the reactor thread the replies it
+// receives; the round trip of a command is measured by matching the two.
+//
+// All times are in microseconds, and passed by the caller.
+class RemoteRenderStats {
+public:
+    using Snapshot = Renderer::TransportStats;
+
+    explicit RemoteRenderStats(uint64_t nowUs);
+
+    // Render thread methods.
+
+    void addBytesIn(size_t size) {
+        mBytesIn.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    // Called after queueing pages, with the count of pages now queued.
+    void onQueuedPages(size_t count) {
+        if (count > mMaxQueuedPages.load(std::memory_order_relaxed)) {
+            mMaxQueuedPages.store(count, std::memory_order_relaxed);
+        }
+    }
+
+    // The command just read expects a reply of |size| bytes.
+    void onReplyExpected(size_t size, uint64_t nowUs);
+
+    // Reactor thread method: |size| bytes of reply were sent to the guest.
+    void onReplyReceived(size_t size, uint64_t nowUs);
+
+    // Fill the counters of |*out|, from any thread. The session and queue
+    // fields are left to the caller.
+    void snapshot(uint64_t nowUs, Snapshot* out);
+
+private:
+    // Count the round trips of the expected replies that were received.
+    void completeRepliesLocked(uint64_t nowUs);
+
+    std::atomic<uint64_t> mBytesIn {0};
+    std::atomic<uint64_t> mBytesOut {0};
+    std::atomic<size_t> mMaxQueuedPages {0};
+
+    android::base::Lock mLock;
+    // The end offsets, in the reply stream, of the replies still expected,
+    // with the time each was expected at.
+    std::deque<std::pair<uint64_t, uint64_t>> mPendingReplies;
+    uint64_t mExpectedReplyBytes = 0;
+    uint64_t mReceivedReplyBytes = 0;
+    uint64_t mRoundTrips = 0;
+    uint64_t mLatencyHistogram[Snapshot::kLatencyBucketCount] = {};
+
+    // Start of the current rate period, and the counters at that time.
+    uint64_t mRateStartUs;
+    uint64_t mRateStartBytesIn = 0;
+    uint64_t mRateStartBytesOut = 0;
+    uint64_t mBytesInPerSec = 0;
+    uint64_t mBytesOutPerSec = 0;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(RemoteRenderStats);
+};
+
+}  // namespace emugl
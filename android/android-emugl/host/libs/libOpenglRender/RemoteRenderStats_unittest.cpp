@@ -0,0 +1,108 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "RemoteRenderStats.h"
+
+#include <gtest/gtest.h>
+
+namespace emugl {
+
+using Snapshot = RemoteRenderStats::Snapshot;
+
+TEST(RemoteRenderStats, Bytes) {
+    RemoteRenderStats stats(0);
+    stats.addBytesIn(1000);
+    stats.onReplyExpected(20, 0);
+    stats.onReplyReceived(20, 10);
+
+    Snapshot snapshot = {};
+    stats.snapshot(100, &snapshot);
+    EXPECT_EQ(1000U, snapshot.bytesIn);
+    EXPECT_EQ(20U, snapshot.bytesOut);
+    // Rates need a whole second.
+    EXPECT_EQ(0U, snapshot.bytesInPerSec);
+    EXPECT_EQ(0U, snapshot.bytesOutPerSec);
+}
+
+TEST(RemoteRenderStats, Rates) {
+    RemoteRenderStats stats(0);
+    stats.addBytesIn(3000);
+    stats.onReplyReceived(300, 0);
+
+    Snapshot snapshot = {};
+    stats.snapshot(2000000, &snapshot);
+    EXPECT_EQ(1500U, snapshot.bytesInPerSec);
+    EXPECT_EQ(150U, snapshot.bytesOutPerSec);
+
+    // The rates stay until the next period ends.
+    stats.addBytesIn(10000);
+    stats.snapshot(2500000, &snapshot);
+    EXPECT_EQ(1500U, snapshot.bytesInPerSec);
+    stats.snapshot(3000000, &snapshot);
+    EXPECT_EQ(10000U, snapshot.bytesInPerSec);
+    EXPECT_EQ(0U, snapshot.bytesOutPerSec);
+    EXPECT_EQ(13000U, snapshot.bytesIn);
+}
+
+TEST(RemoteRenderStats, MaxQueuedPages) {
+    RemoteRenderStats stats(0);
+    stats.onQueuedPages(3);
+    stats.onQueuedPages(7);
+    stats.onQueuedPages(1);
+
+    Snapshot snapshot = {};
+    stats.snapshot(0, &snapshot);
+    EXPECT_EQ(7U, snapshot.maxQueuedPages);
+}
+
+TEST(RemoteRenderStats, RoundTrips) {
+    RemoteRenderStats stats(0);
+    // Commands without reply are not round trips.
+    stats.onReplyExpected(0, 0);
+
+    stats.onReplyExpected(4, 0);
+    stats.onReplyExpected(8, 1000);
+    // The first reply arrives in two parts.
+    stats.onReplyReceived(2, 100);
+    stats.onReplyReceived(2, 200);
+    stats.onReplyReceived(8, 70000);
+
+    Snapshot snapshot = {};
+    stats.snapshot(0, &snapshot);
+    EXPECT_EQ(2U, snapshot.roundTrips);
+    for (int i = 0; i < Snapshot::kLatencyBucketCount; i++) {
+        // 200 us and 69 ms.
+        EXPECT_EQ(i == 0 || i == 9 ? 1U : 0U, snapshot.latencyHistogram[i])
+                << "bucket " << i;
+    }
+
+    // The last bucket has no upper bound.
+    stats.onReplyExpected(1, 0);
+    stats.onReplyReceived(1, 3600000000ULL);
+    stats.snapshot(0, &snapshot);
+    EXPECT_EQ(1U,
+              snapshot.latencyHistogram[Snapshot::kLatencyBucketCount - 1]);
+}
+
+TEST(RemoteRenderStats, ReplyReceivedFirst) {
+    RemoteRenderStats stats(0);
+    stats.onReplyReceived(16, 0);
+    stats.onReplyExpected(16, 10);
+
+    Snapshot snapshot = {};
+    stats.snapshot(0, &snapshot);
+    EXPECT_EQ(1U, snapshot.roundTrips);
+    EXPECT_EQ(1U, snapshot.latencyHistogram[0]);
+}
+
+}  // namespace emugl
@@ -45,11 +45,8 @@ static constexpr size_t kGuestToHostQueueCapacity = 1024U;
 static constexpr size_t kHostToGuestQueueCapacity = 16U;
 
 RenderChannelImpl::RenderChannelImpl()
-    : mLock(),
-      mFromGuest(kGuestToHostQueueCapacity, mLock),
-      mToGuest(kHostToGuestQueueCapacity, mLock) {
-    updateStateLocked();
-}
+    : mFromGuest(kGuestToHostQueueCapacity),
+      mToGuest(kHostToGuestQueueCapacity) {}
 
 void RenderChannelImpl::setEventCallback(EventCallback&& callback) {
     mEventCallback = std::move(callback);
@@ -58,99 +55,98 @@ void RenderChannelImpl::setEventCallback(EventCallback&& callback) {
 void RenderChannelImpl::setWantedEvents(State state) {
     D("state=%d", (int)state);
     AutoLock lock(mLock);
-    mWantedEvents |= state;
+    mWantedEvents.store(mWantedEvents.load() | state);
     notifyStateChangeLocked();
 }
 
 RenderChannel::State RenderChannelImpl::state() const {
-    AutoLock lock(mLock);
-    return mState;
+    return computeState();
 }
 
 IoResult RenderChannelImpl::tryWrite(Buffer&& buffer) {
     D("buffer size=%d", (int)buffer.size());
-    AutoLock lock(mLock);
-    auto result = mFromGuest.tryPushLocked(std::move(buffer));
-    updateStateLocked();
-    DD("mFromGuest.tryPushLocked() returned %d, state %d", (int)result,
-       (int)mState);
+    auto result = mFromGuest.tryPush(std::move(buffer));
+    DD("mFromGuest.tryPush() returned %d", (int)result);
     return result;
 }
 
 IoResult RenderChannelImpl::tryRead(Buffer* buffer) {
     D("enter");
-    AutoLock lock(mLock);
-    auto result = mToGuest.tryPopLocked(buffer);
-    updateStateLocked();
-    DD("mToGuest.tryPopLocked() returned %d, buffer size %d, state %d",
-       (int)result, (int)buffer->size(), (int)mState);
+    auto result = mToGuest.tryPop(buffer);
+    DD("mToGuest.tryPop() returned %d, buffer size %d", (int)result,
+       (int)buffer->size());
     return result;
 }
 
 void RenderChannelImpl::stop() {
     D("enter");
-    AutoLock lock(mLock);
-    mFromGuest.closeLocked();
-    mToGuest.closeLocked();
+    mFromGuest.close();
+    mToGuest.close();
 }
 
 bool RenderChannelImpl::writeToGuest(Buffer&& buffer) {
     D("buffer size=%d", (int)buffer.size());
-    AutoLock lock(mLock);
-    IoResult result = mToGuest.pushLocked(std::move(buffer));
-    updateStateLocked();
-    DD("mToGuest.pushLocked() returned %d, state %d", (int)result, (int)mState);
-    notifyStateChangeLocked();
+    IoResult result = mToGuest.push(std::move(buffer));
+    DD("mToGuest.push() returned %d", (int)result);
+    notifyStateChange();
     return result == IoResult::Ok;
 }
 
 IoResult RenderChannelImpl::readFromGuest(Buffer* buffer, bool blocking) {
     D("enter");
-    AutoLock lock(mLock);
     IoResult result;
     if (blocking) {
-        result = mFromGuest.popLocked(buffer);
+        result = mFromGuest.pop(buffer);
     } else {
-        result = mFromGuest.tryPopLocked(buffer);
+        result = mFromGuest.tryPop(buffer);
     }
-    updateStateLocked();
-    DD("mFromGuest.%s() return %d, buffer size %d, state %d",
-       blocking ? "popLocked" : "tryPopLocked", (int)result,
-       (int)buffer->size(), (int)mState);
-    notifyStateChangeLocked();
+    DD("mFromGuest.%s() return %d, buffer size %d",
+       blocking ? "pop" : "tryPop", (int)result, (int)buffer->size());
+    notifyStateChange();
     return result;
 }
 
 void RenderChannelImpl::stopFromHost() {
     D("enter");
-
-    AutoLock lock(mLock);
-    mFromGuest.closeLocked();
-    mToGuest.closeLocked();
-    mState |= State::Stopped;
-    notifyStateChangeLocked();
+    mFromGuest.close();
+    mToGuest.close();
+    notifyStateChange();
 }
 
-void RenderChannelImpl::updateStateLocked() {
+RenderChannel::State RenderChannelImpl::computeState() const {
     State state = RenderChannel::State::Empty;
 
-    if (mToGuest.canPopLocked()) {
+    if (mToGuest.canPop()) {
         state |= State::CanRead;
     }
-    if (mFromGuest.canPushLocked()) {
+    if (mFromGuest.canPush()) {
         state |= State::CanWrite;
     }
-    if (mToGuest.isClosedLocked()) {
+    if (mToGuest.isClosed()) {
         state |= State::Stopped;
     }
-    mState = state;
+    return state;
+}
+
+void RenderChannelImpl::notifyStateChange() {
+    // The render thread updates the queues before checking |mWantedEvents|,
+    // and the guest updates it before checking the queues again in
+    // setWantedEvents(), so one of them always sees the other. Most of the
+    // time, the guest doesn't wait for anything and the lock is not needed.
+    if (mWantedEvents.load() == State::Empty) {
+        return;
+    }
+    AutoLock lock(mLock);
+    notifyStateChangeLocked();
 }
 
 void RenderChannelImpl::notifyStateChangeLocked() {
-    State available = mState & mWantedEvents;
+    State state = computeState();
+    State wanted = mWantedEvents.load();
+    State available = state & wanted;
     if (available != 0) {
         D("callback with %d", (int)available);
-        mWantedEvents &= ~mState;
+        mWantedEvents.store(wanted & ~state);
         mEventCallback(available);
     }
 }
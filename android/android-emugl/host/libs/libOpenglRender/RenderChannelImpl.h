@@ -14,8 +14,12 @@
 #pragma once
 
 #include "OpenglRender/RenderChannel.h"
-#include "BufferQueue.h"
 #include "RendererImpl.h"
+#include "SpscBufferQueue.h"
+
+#include "android/base/synchronization/Lock.h"
+
+#include <atomic>
 
 namespace emugl {
 
@@ -72,18 +76,20 @@ public:
     void stopFromHost();
 
 private:
-    void updateStateLocked();
+    State computeState() const;
+    void notifyStateChange();
     void notifyStateChangeLocked();
 
     EventCallback mEventCallback;
 
-    // A single lock to protect the state and the two buffer queues at the
-    // same time. NOTE: This needs to appear before the BufferQueue instances.
-    mutable android::base::Lock mLock;
-    State mState = State::Empty;
-    State mWantedEvents = State::Empty;
-    BufferQueue mFromGuest;
-    BufferQueue mToGuest;
+    // The guest thread is the only producer of |mFromGuest| and consumer of
+    // |mToGuest|, and the render thread the other way around, so neither
+    // queue needs a lock. |mLock| only serializes the changes to
+    // |mWantedEvents| and the calls to |mEventCallback|.
+    android::base::Lock mLock;
+    std::atomic<State> mWantedEvents {State::Empty};
+    SpscBufferQueue mFromGuest;
+    SpscBufferQueue mToGuest;
 };
 
 }  // namespace emugl
@@ -18,20 +18,11 @@
 #include "ChannelStream.h"
 #include "ErrorLog.h"
 #include "FrameBuffer.h"
-#include "ReadBuffer.h"
 #include "RenderControl.h"
 #include "RendererImpl.h"
 #include "RenderChannelImpl.h"
 #include "RenderThreadInfo.h"
-
-#include "OpenGLESDispatch/EGLDispatch.h"
-#include "OpenGLESDispatch/GLESv2Dispatch.h"
-#include "OpenGLESDispatch/GLESv1Dispatch.h"
-#include "../../../shared/OpenglCodecCommon/ChecksumCalculatorThreadInfo.h"
-
-#include "android/base/system/System.h"
-
-
+#include "ReplySizeScanner.h"
 
 #define EMUGL_DEBUG_LEVEL 0
 #include "emugl/common/debug.h"
@@ -42,9 +33,6 @@
 
 namespace emugl {
 
-// Start with a smaller buffer to not waste memory on a low-used render threads.
-static constexpr int kStreamBufferSize = 128 * 1024;
-
 RenderThread::RenderThread(std::weak_ptr<RendererImpl> renderer,
                            std::shared_ptr<RenderChannelImpl> channel,
                            std::shared_ptr<RemoteRenderChannel> remote_channel)
@@ -66,8 +54,13 @@ intptr_t RenderThread::main() {
     ChannelStream stream(mChannel, RenderChannel::Buffer::kSmallSize);
 
     mRemoteChannel->setUpStream(&stream);
-    mRemoteChannel->startChannel();
-    //mRemoteChannel->modConnection(false);
+    if (!mRemoteChannel->startChannel()) {
+        // The guest opened its pipe before the server was reached, close
+        // it from here.
+        D("Warning: render thread could not connect to remote");
+        mChannel->stopFromHost();
+        return 0;
+    }
 
     uint32_t flags = 0;
     if (stream.read(&flags, sizeof(flags)) != sizeof(flags)) {
@@ -83,20 +76,12 @@ intptr_t RenderThread::main() {
     }
 
     RenderThreadInfo tInfo;
-    ChecksumCalculatorThreadInfo tChecksumInfo;
-    ChecksumCalculator& checksumCalc = tChecksumInfo.get();
-
-    //
-    // initialize decoders
-    //
-    tInfo.m_glDec.initGL(gles1_dispatch_get_proc_func, NULL);
-    tInfo.m_gl2Dec.initGL(gles2_dispatch_get_proc_func, NULL);
-    initRenderControlContext(&tInfo.m_rcDec);
 
-    ReadBuffer readBuf(kStreamBufferSize);
-
-    int stats_totalBytes = 0;
-    long long stats_t0 = android::base::System::get()->getHighResTimeUs() / 1000;
+    // The commands are executed by the remote render server, only the size
+    // of their replies is computed here. The buffers written by the guest
+    // are forwarded as they are, without being copied again.
+    ReplySizeScanner replySizeScanner;
+    RenderChannel::Buffer buffer;
 
     //
     // open dump file if RENDER_DUMP_DIR is defined
@@ -115,119 +100,38 @@ intptr_t RenderThread::main() {
         delete[] fname;
     }
 
-    while (1) {
-        // Let's make sure we read enough data for at least some processing.
-        int packetSize;
-        if (readBuf.validData() >= 8) {
-            // We know that packet size is the second int32_t from the start.
-            packetSize = *(const int32_t*)(readBuf.buf() + 4);
-        } else {
-            // Read enough data to at least be able to get the packet size next
-            // time.
-            packetSize = 8;
-        }
-
-        // We should've processed the packet on the previous iteration if it
-        // was already in the buffer.
-        assert(packetSize > (int)readBuf.validData());
-
-        const int stat = readBuf.getData(&stream, packetSize);
-        if (stat <= 0) {
-            D("Warning: render thread could not read data from stream");
-            break;
-        }
-        DD("render thread read %d bytes, op %d, packet size %d",
-           (int)readBuf.validData(), *(int32_t*)readBuf.buf(),
-           *(int32_t*)(readBuf.buf() + 4));
-
-        int hasSent = readBuf.validData() - stat;
-    	//tcpChannel.sndBufUntil((unsigned char*)readBuf.buf() + hasSent, stat);
-    	if (!mRemoteChannel->writeChannel((char*)(readBuf.buf() + hasSent), stat)) {
-            D("Warning: render thread could not write data to remote");
-            break;
-        }
-
-        //
-        // log received bandwidth statistics
-        //
-        stats_totalBytes += readBuf.validData();
-        long long dt = android::base::System::get()->getHighResTimeUs() / 1000 - stats_t0;
-        if (dt > 1000) {
-            // float dts = (float)dt / 1000.0f;
-            // printf("Used Bandwidth %5.3f MB/s\n", ((float)stats_totalBytes /
-            // dts) / (1024.0f*1024.0f));
-            stats_totalBytes = 0;
-            stats_t0 = android::base::System::get()->getHighResTimeUs() / 1000;
-        }
+    while (stream.readBuffer(&buffer)) {
+        const size_t size = buffer.size();
+        DD("render thread read %d bytes", (int)size);
 
         //
         // dump stream to file if needed
         //
         if (dumpFP) {
-            int skip = readBuf.validData() - stat;
-            fwrite(readBuf.buf() + skip, 1, readBuf.validData() - skip, dumpFP);
+            fwrite(buffer.data(), 1, size, dumpFP);
             fflush(dumpFP);
         }
 
-        bool progress;
         size_t retSize = 0;
-        do {
-            progress = false;
-
-            // try to process some of the command buffer using the GLESv1
-            // decoder
-            //
-            // DRIVER WORKAROUND:
-            // On Linux with NVIDIA GPU's at least, we need to avoid performing
-            // GLES ops while someone else holds the FrameBuffer write lock.
-            //
-            // To be more specific, on Linux with NVIDIA Quadro K2200 v361.xx,
-            // we get a segfault in the NVIDIA driver when glTexSubImage2D
-            // is called at the same time as glXMake(Context)Current.
-            //
-            // To fix, this driver workaround avoids calling
-            // any sort of GLES call when we are creating/destroying EGL
-            // contexts.
-            FrameBuffer::getFB()->lockContextStructureRead();
-            size_t last = tInfo.m_glDec.decode(
-                    readBuf.buf(), readBuf.validData(), &stream, &checksumCalc, &retSize);
-            
-            if (last > 0) {
-                //printf("gles1 dec consume %d bytes\n", (int)last);
-                progress = true;
-                readBuf.consume(last);
-            }
+        const uint64_t frameCount = replySizeScanner.frameCount();
+        if (!replySizeScanner.scan(buffer.data(), size, &retSize)) {
+            D("Warning: render thread forwards unknown commands");
+        }
 
-            //
-            // try to process some of the command buffer using the GLESv2
-            // decoder
-            //
-            last = tInfo.m_gl2Dec.decode(readBuf.buf(), readBuf.validData(),
-                                         &stream, &checksumCalc, &retSize);
-            FrameBuffer::getFB()->unlockContextStructureRead();
+        // The reply is expected before the commands are sent, so that it
+        // is never received first.
+        mRemoteChannel->readChannel(retSize);
 
-            if (last > 0) {
-                //printf("gles2 dec consume %d bytes\n", (int)last);
-                progress = true;
-                readBuf.consume(last);
-            }
+        if (!mRemoteChannel->writeBuffer(&buffer)) {
+            D("Warning: render thread could not write data to remote");
+            break;
+        }
 
-            //
-            // try to process some of the command buffer using the
-            // renderControl decoder
-            //
-            last = tInfo.m_rcDec.decode(readBuf.buf(), readBuf.validData(),
-                                        &stream, &checksumCalc, &retSize);
-            if (last > 0) {
-                //printf("egl dec consume %d bytes\n", (int)last);
-                readBuf.consume(last);
-                progress = true;
+        if (replySizeScanner.frameCount() != frameCount) {
+            if (auto renderer = mRenderer.lock()) {
+                renderer->onFrameSent();
             }
-        } while (progress);
-
-        mRemoteChannel->readChannel(retSize);
-
-        //printf("after dec %d bytes left\n", (int)readBuf.validData());
+        }
     }
 
     if (dumpFP) {
@@ -239,16 +143,22 @@ intptr_t RenderThread::main() {
     SyncThread::destroySyncThread();
 
     //
-    // Release references to the current thread's context/surfaces if any
+    // Release references to the current thread's context/surfaces if any.
+    // There is no FrameBuffer when replaying a stream with
+    // emugl_render_replay.
     //
-    FrameBuffer::getFB()->bindContext(0, 0, 0);
+    FrameBuffer* fb = FrameBuffer::getFB();
+    if (!fb) {
+        return 0;
+    }
+    fb->bindContext(0, 0, 0);
     if (tInfo.currContext || tInfo.currDrawSurf || tInfo.currReadSurf) {
         fprintf(stderr,
                 "ERROR: RenderThread exiting with current context/surfaces\n");
     }
 
-    FrameBuffer::getFB()->drainWindowSurface();
-    FrameBuffer::getFB()->drainRenderContext();
+    fb->drainWindowSurface();
+    fb->drainRenderContext();
 
     DD("Exited a RenderThread @%p\n", this);
 
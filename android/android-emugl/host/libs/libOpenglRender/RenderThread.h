@@ -42,6 +42,11 @@ public:
     // Note that this also means that the thread's stack has been
     bool isFinished() { return tryWait(NULL); }
 
+    // The channel the thread forwards its stream to.
+    const std::shared_ptr<RemoteRenderChannel>& remoteChannel() const {
+        return mRemoteChannel;
+    }
+
 private:
     RenderThread(std::weak_ptr<RendererImpl> renderer,
                  std::shared_ptr<RenderChannelImpl> channel,
@@ -15,6 +15,7 @@
 
 #include "RenderChannelImpl.h"
 #include "RemoteRenderChannel.h"
+#include "RemoteRenderConnection.h"
 
 #include "emugl/common/logging.h"
 #include "ErrorLog.h"
@@ -49,6 +50,10 @@ namespace emugl {
 //   thread, which may in turn be blocked on something else.
 static const bool kUseSubwindowThread = false;
 
+// Number of 4 KiB pages each remote render channel can queue before its
+// render thread blocks, waiting for the render server to catch up.
+static const size_t kRemotePageCount = 64;
+
 RendererImpl::RendererImpl()
     : mCleanupThread([this]() {
           while (const auto id = mCleanupProcessIds.receive()) {
@@ -81,6 +86,7 @@ bool RendererImpl::initialize(int width, int height, bool useSubWindow) {
     }
 
     mRenderWindow = std::move(renderWindow);
+    RemoteRenderConnection::warmUp();
     GL_LOG("OpenGL renderer initialized successfully");
     return true;
 }
@@ -113,8 +119,9 @@ RenderChannelPtr RendererImpl::createRenderChannel() {
     const auto channel = std::make_shared<RenderChannelImpl>();
     const auto remote_channel = std::make_shared<RemoteRenderChannel>();
 
-    if (!remote_channel->initChannel(4))
-        return nullptr;
+    // The render thread connects to the server, the guest does not wait
+    // for it.
+    remote_channel->initChannel(kRemotePageCount);
 
     std::unique_ptr<RenderThread> rt(RenderThread::create(
             shared_from_this(), channel, remote_channel));
@@ -210,4 +217,31 @@ void RendererImpl::cleanupProcGLObjects(uint64_t puid) {
     mCleanupProcessIds.send(puid);
 }
 
+std::vector<RendererImpl::TransportStats> RendererImpl::getTransportStats() {
+    std::vector<TransportStats> res;
+    android::base::AutoLock lock(mThreadVectorLock);
+    for (const auto& t : mThreads) {
+        if (t.second.expired() || t.first->isFinished()) {
+            continue;
+        }
+        res.emplace_back();
+        t.first->remoteChannel()->getTransportStats(&res.back());
+    }
+    return res;
+}
+
+void RendererImpl::setFrameSentCallback(OnFrameSentCallback onFrameSent,
+                                        void* context) {
+    android::base::AutoLock lock(mFrameSentLock);
+    mOnFrameSent = onFrameSent;
+    mOnFrameSentContext = context;
+}
+
+void RendererImpl::onFrameSent() {
+    android::base::AutoLock lock(mFrameSentLock);
+    if (mOnFrameSent) {
+        mOnFrameSent(mOnFrameSentContext);
+    }
+}
+
 }  // namespace emugl
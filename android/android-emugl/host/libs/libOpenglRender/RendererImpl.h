@@ -59,6 +59,12 @@ public:
     void setOpenGLDisplayTranslation(float px, float py) final;
     void repaintOpenGLDisplay() final;
     void cleanupProcGLObjects(uint64_t puid) final;
+    std::vector<TransportStats> getTransportStats() final;
+    void setFrameSentCallback(OnFrameSentCallback onFrameSent,
+                              void* context) final;
+
+    // Called from a render thread after sending the end of a frame.
+    void onFrameSent();
 private:
     DISALLOW_COPY_ASSIGN_AND_MOVE(RendererImpl);
 
@@ -73,6 +79,10 @@ private:
     std::vector<ThreadWithChannel> mThreads;
     bool mStopped = false;
 
+    android::base::Lock mFrameSentLock;
+    OnFrameSentCallback mOnFrameSent = nullptr;
+    void* mOnFrameSentContext = nullptr;
+
     // A message channel and a cleanup thread for GL resources of finished
     // guest processes. Cleanup takes time, so we should offload it into a
     // worker thread.
@@ -0,0 +1,155 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "ReplySizeScanner.h"
+
+#include "gles1_reply_size.h"
+#include "gles2_reply_size.h"
+#include "renderControl_opcodes.h"
+#include "renderControl_reply_size.h"
+
+#include <algorithm>
+
+#include <stdint.h>
+#include <string.h>
+
+namespace emugl {
+
+// Size of the head of every command: opcode and packet length.
+static constexpr size_t kCommandHeadSize = 8;
+
+static int32_t packetLenAt(const char* command) {
+    int32_t packetLen;
+    memcpy(&packetLen, command + 4, sizeof(packetLen));
+    return packetLen;
+}
+
+bool ReplySizeScanner::scan(const void* buf, size_t len, size_t* replySize) {
+    const char* data = (const char*)buf;
+    bool ok = true;
+    while (len > 0) {
+        if (mSkip > 0) {
+            const size_t skip = std::min(mSkip, len);
+            mSkip -= skip;
+            data += skip;
+            len -= skip;
+            continue;
+        }
+
+        const char* command = data;
+        size_t avail = len;
+        if (!mCarry.empty()) {
+            // Complete the head of the carried command, then the command
+            // itself, but do not take anything past it.
+            size_t wanted = kCommandHeadSize - std::min(mCarry.size(),
+                                                        kCommandHeadSize);
+            if (wanted == 0) {
+                const int32_t packetLen = packetLenAt(mCarry.data());
+                wanted = packetLen > (int32_t)mCarry.size()
+                                 ? packetLen - mCarry.size()
+                                 : 0;
+            }
+            wanted = std::min(wanted, len);
+            mCarry.insert(mCarry.end(), data, data + wanted);
+            data += wanted;
+            len -= wanted;
+            command = mCarry.data();
+            avail = mCarry.size();
+        }
+
+        size_t done = scanCommands(command, avail, replySize);
+        if (done == 0 && avail >= kCommandHeadSize) {
+            const int32_t packetLen = packetLenAt(command);
+            if (packetLen < (int32_t)kCommandHeadSize) {
+                // The stream is corrupted, there is no way to find the
+                // next command.
+                mCarry.clear();
+                return false;
+            }
+            if ((size_t)packetLen <= avail) {
+                // Not part of any API.
+                ok = false;
+                done = packetLen;
+            }
+        }
+
+        if (command == mCarry.data()) {
+            if (done > 0) {
+                mSkip = done - mCarry.size();
+                mCarry.clear();
+            }
+            continue;
+        }
+        if (done == 0) {
+            mCarry.assign(data, data + len);
+            break;
+        }
+        if (done > len) {
+            mSkip = done - len;
+            done = len;
+        }
+        data += done;
+        len -= done;
+    }
+    return ok;
+}
+
+size_t ReplySizeScanner::scanCommands(const char* buf, size_t len,
+                                      size_t* replySize) {
+    size_t pos = 0;
+    bool progress;
+    do {
+        progress = false;
+
+        size_t last = gles1_reply_size_scan(buf + pos, len - pos,
+                                            &mChecksumCalc, replySize);
+        if (last > 0) {
+            progress = true;
+            pos += last;
+        }
+        if (pos >= len) {
+            break;
+        }
+
+        last = gles2_reply_size_scan(buf + pos, len - pos, &mChecksumCalc,
+                                     replySize);
+        if (last > 0) {
+            progress = true;
+            pos += last;
+        }
+        if (pos >= len) {
+            break;
+        }
+
+        last = renderControl_reply_size_scan(buf + pos, len - pos,
+                                             &mChecksumCalc, replySize);
+        if (last > 0) {
+            progress = true;
+            // The head of each command scanned is in |buf|.
+            for (size_t command = pos; command < pos + last && command < len;
+                 command += packetLenAt(buf + command)) {
+                uint32_t opcode;
+                memcpy(&opcode, buf + command, sizeof(opcode));
+                if (opcode == OP_rcFlushWindowColorBuffer ||
+                    opcode == OP_rcFlushWindowColorBufferAsync) {
+                    ++mFrameCount;
+                }
+            }
+            pos += last;
+        }
+    } while (progress && pos < len);
+
+    return pos;
+}
+
+}  // namespace emugl
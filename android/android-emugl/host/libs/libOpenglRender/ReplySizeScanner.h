@@ -0,0 +1,73 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include "ChecksumCalculator.h"
+
+#include "android/base/Compiler.h"
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace emugl {
+
+// ReplySizeScanner walks a GLES command stream without executing it, and
+// computes the size of the replies that a renderer will send back for it.
+// This is what the emulator needs to know about the stream it forwards to
+// the remote render server, and what the tools that stand in for that
+// server need to answer it.
+//
+// It relies on the reply size scanners generated by emugen for each API,
+// and never touches the GL dispatch tables nor the FrameBuffer. The only
+// command with a side effect is rcSelectChecksumHelper, which changes the
+// checksum size, and therefore the size of later replies, of the stream.
+// One scanner must be used per stream.
+//
+// The stream can be fed in pieces of any size, such as the buffers the
+// guest writes. Only the start of a command that spans several pieces is
+// copied, until the part its reply size depends on is complete, which is
+// the first 8 bytes for most commands.
+//
+// It also counts the commands that post a window surface, which the guest
+// sends for each eglSwapBuffers(), to tell where its frames end.
+class ReplySizeScanner {
+public:
+    ReplySizeScanner() = default;
+
+    // Scan the next |len| bytes of the stream at |buf|, and add to
+    // |*replySize| the size of the replies to the commands that could be
+    // scanned. Return false if the stream holds a command that is not part
+    // of any of the APIs, which is skipped and has no reply.
+    bool scan(const void* buf, size_t len, size_t* replySize);
+
+    // The number of rcFlushWindowColorBuffer and
+    // rcFlushWindowColorBufferAsync commands scanned so far.
+    uint64_t frameCount() const { return mFrameCount; }
+
+private:
+    size_t scanCommands(const char* buf, size_t len, size_t* replySize);
+
+    ChecksumCalculator mChecksumCalc;
+    // Bytes of the stream to skip, the rest of the last command scanned.
+    size_t mSkip = 0;
+    // Start of a command that could not be scanned yet.
+    std::vector<char> mCarry;
+    uint64_t mFrameCount = 0;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(ReplySizeScanner);
+};
+
+}  // namespace emugl
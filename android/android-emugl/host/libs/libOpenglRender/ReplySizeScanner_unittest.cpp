@@ -0,0 +1,145 @@
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "ReplySizeScanner.h"
+
+#include "renderControl_opcodes.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+namespace emugl {
+
+// Append a command with the given 32-bit parameters to |stream|.
+static void addCommand(std::vector<char>* stream,
+                       uint32_t opcode,
+                       std::vector<uint32_t> params) {
+    const uint32_t packetLen = 8 + 4 * params.size();
+    params.insert(params.begin(), {opcode, packetLen});
+    const size_t pos = stream->size();
+    stream->resize(pos + packetLen);
+    memcpy(&(*stream)[pos], params.data(), packetLen);
+}
+
+TEST(ReplySizeScanner, NoReply) {
+    std::vector<char> stream;
+    addCommand(&stream, OP_rcSelectChecksumHelper, {0, 0});
+
+    ReplySizeScanner scanner;
+    size_t replySize = 0;
+    EXPECT_TRUE(scanner.scan(stream.data(), stream.size(), &replySize));
+    EXPECT_EQ(0U, replySize);
+}
+
+TEST(ReplySizeScanner, ReturnValueAndOutPointers) {
+    std::vector<char> stream;
+    addCommand(&stream, OP_rcGetRendererVersion, {});
+    // Both out pointers only carry their size.
+    addCommand(&stream, OP_rcGetEGLVersion, {4, 4});
+
+    ReplySizeScanner scanner;
+    size_t replySize = 0;
+    EXPECT_TRUE(scanner.scan(stream.data(), stream.size(), &replySize));
+    EXPECT_EQ(4U + (4U + 4U + 4U), replySize);
+}
+
+TEST(ReplySizeScanner, SelectChecksum) {
+    std::vector<char> stream;
+    addCommand(&stream, OP_rcGetFBParam, {0});
+    addCommand(&stream, OP_rcSelectChecksumHelper, {1, 0});
+    addCommand(&stream, OP_rcGetFBParam, {0});
+
+    ReplySizeScanner scanner;
+    size_t replySize = 0;
+    EXPECT_TRUE(scanner.scan(stream.data(), stream.size(), &replySize));
+    // Version 1 checksums are 8 bytes long.
+    EXPECT_EQ(4U + (4U + 8U), replySize);
+
+    // The version sticks to the scanner.
+    replySize = 0;
+    EXPECT_TRUE(scanner.scan(stream.data(), 12, &replySize));
+    EXPECT_EQ(12U, replySize);
+}
+
+TEST(ReplySizeScanner, SplitStream) {
+    std::vector<char> stream;
+    addCommand(&stream, OP_rcSelectChecksumHelper, {1, 0});
+    addCommand(&stream, OP_rcGetRendererVersion, {});
+    addCommand(&stream, OP_rcGetEGLVersion, {4, 4});
+    // A large command without reply.
+    addCommand(&stream, OP_rcSetWindowColorBuffer,
+               std::vector<uint32_t>(1000, 0));
+    addCommand(&stream, OP_rcGetFBParam, {0});
+    const size_t expected = (4U + 8U) + (4U + 4U + 4U + 8U) + (4U + 8U);
+
+    for (size_t pieceSize : {1, 3, 7, 8, 13, 100, 4096}) {
+        ReplySizeScanner scanner;
+        size_t replySize = 0;
+        for (size_t pos = 0; pos < stream.size(); pos += pieceSize) {
+            EXPECT_TRUE(scanner.scan(
+                    &stream[pos], std::min(pieceSize, stream.size() - pos),
+                    &replySize));
+        }
+        EXPECT_EQ(expected, replySize) << "pieces of " << pieceSize;
+    }
+}
+
+TEST(ReplySizeScanner, ScannedBeforeComplete) {
+    std::vector<char> stream;
+    addCommand(&stream, OP_rcGetEGLVersion, {4, 4});
+
+    ReplySizeScanner scanner;
+    size_t replySize = 0;
+    // The size of the second out pointer is needed.
+    EXPECT_TRUE(scanner.scan(stream.data(), 15, &replySize));
+    EXPECT_EQ(0U, replySize);
+    EXPECT_TRUE(scanner.scan(&stream[15], 1, &replySize));
+    EXPECT_EQ(4U + 4U + 4U, replySize);
+}
+
+TEST(ReplySizeScanner, UnknownCommand) {
+    std::vector<char> stream;
+    addCommand(&stream, OP_rcGetFBParam, {0});
+    addCommand(&stream, OP_last, {1, 2, 3});
+    addCommand(&stream, OP_rcGetFBParam, {0});
+
+    ReplySizeScanner scanner;
+    size_t replySize = 0;
+    EXPECT_FALSE(scanner.scan(stream.data(), stream.size(), &replySize));
+    EXPECT_EQ(8U, replySize);
+}
+
+TEST(ReplySizeScanner, FrameCount) {
+    std::vector<char> stream;
+    addCommand(&stream, OP_rcFlushWindowColorBuffer, {1});
+    addCommand(&stream, OP_rcGetFBParam, {0});
+    addCommand(&stream, OP_rcFlushWindowColorBufferAsync, {1});
+
+    for (size_t pieceSize = 1; pieceSize <= stream.size(); ++pieceSize) {
+        ReplySizeScanner scanner;
+        size_t replySize = 0;
+        for (size_t pos = 0; pos < stream.size(); pos += pieceSize) {
+            EXPECT_TRUE(scanner.scan(
+                    &stream[pos], std::min(pieceSize, stream.size() - pos),
+                    &replySize));
+        }
+        EXPECT_EQ(2U, scanner.frameCount()) << "pieces of " << pieceSize;
+    }
+}
+
+}  // namespace emugl
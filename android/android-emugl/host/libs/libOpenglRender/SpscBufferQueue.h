@@ -0,0 +1,223 @@
+// Copyright (C) 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include "OpenglRender/RenderChannel.h"
+#include "android/base/Compiler.h"
+#include "android/base/synchronization/ConditionVariable.h"
+#include "android/base/synchronization/Lock.h"
+
+#include <atomic>
+#include <memory>
+
+#include <stddef.h>
+
+namespace emugl {
+
+// SpscBufferQueue is a FIFO queue of RenderChannel::Buffer instances with
+// the same semantics as BufferQueue, for exactly one producer thread and
+// one consumer thread, and without any lock on the way.
+//
+// tryPush() and tryPop() only touch the ring and its two indices, which are
+// kept on different cache lines. A thread sleeps in push() or pop() only
+// when the queue is full or empty, and the other side takes the lock to
+// wake it only when it may be sleeping, i.e. when it just made the queue
+// non-empty or non-full. close() can be called from any thread.
+class SpscBufferQueue {
+    using ConditionVariable = android::base::ConditionVariable;
+    using Lock = android::base::Lock;
+    using AutoLock = android::base::AutoLock;
+
+public:
+    using IoResult = RenderChannel::IoResult;
+    using Buffer = RenderChannel::Buffer;
+
+    // Constructor. |capacity| is the maximum number of Buffer instances in
+    // the queue, rounded up to a power of 2.
+    explicit SpscBufferQueue(size_t capacity) {
+        while (mCapacity < capacity) {
+            mCapacity <<= 1;
+        }
+        mBuffers.reset(new Buffer[mCapacity]);
+    }
+
+    // Return true iff one can send a buffer to the queue, i.e. if it
+    // is not full. The result is only a hint for other threads than the
+    // producer.
+    bool canPush() const {
+        return !isClosed() &&
+               mTail.load(std::memory_order_seq_cst) -
+                               mHead.load(std::memory_order_seq_cst) <
+                       mCapacity;
+    }
+
+    // Return true iff one can receive a buffer from the queue, i.e. if
+    // it is not empty. The result is only a hint for other threads than the
+    // consumer.
+    bool canPop() const {
+        return mTail.load(std::memory_order_seq_cst) !=
+               mHead.load(std::memory_order_seq_cst);
+    }
+
+    // Return true iff the queue is closed.
+    bool isClosed() const { return mClosed.load(std::memory_order_seq_cst); }
+
+    // Producer methods.
+
+    // Try to send a buffer to the queue. On success, return IoResult::Ok
+    // and moves |buffer| to the queue. On failure, return
+    // IoResult::TryAgain if the queue was full, or IoResult::Error
+    // if it was closed.
+    IoResult tryPush(Buffer&& buffer) {
+        if (isClosed()) {
+            return IoResult::Error;
+        }
+        const size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mProducerHead >= mCapacity) {
+            mProducerHead = mHead.load(std::memory_order_acquire);
+            if (tail - mProducerHead >= mCapacity) {
+                return IoResult::TryAgain;
+            }
+        }
+        mBuffers[tail & (mCapacity - 1)] = std::move(buffer);
+        mTail.store(tail + 1, std::memory_order_seq_cst);
+        // The consumer can only be waiting if it had taken everything.
+        if (mHead.load(std::memory_order_seq_cst) == tail) {
+            wakeWaiter();
+        }
+        return IoResult::Ok;
+    }
+
+    // Push a buffer to the queue. This is a blocking call. On success,
+    // move |buffer| into the queue and return IoResult::Ok. On failure,
+    // return IoResult::Error meaning the queue was closed.
+    IoResult push(Buffer&& buffer) {
+        for (;;) {
+            IoResult result = tryPush(std::move(buffer));
+            if (result != IoResult::TryAgain) {
+                return result;
+            }
+            waitUntil([this] {
+                return mTail.load(std::memory_order_relaxed) -
+                               mHead.load(std::memory_order_seq_cst) <
+                       mCapacity;
+            });
+        }
+    }
+
+    // Consumer methods.
+
+    // Try to read a buffer from the queue. On success, moves item into
+    // |*buffer| and return IoResult::Ok. On failure, return IoResult::Error
+    // if the queue is empty and closed, and IoResult::TryAgain if it is
+    // empty but not closed.
+    IoResult tryPop(Buffer* buffer) {
+        const size_t head = mHead.load(std::memory_order_relaxed);
+        if (head == mConsumerTail) {
+            mConsumerTail = mTail.load(std::memory_order_acquire);
+            if (head == mConsumerTail) {
+                if (!isClosed()) {
+                    return IoResult::TryAgain;
+                }
+                // Buffers pushed before the queue was closed are visible
+                // now.
+                mConsumerTail = mTail.load(std::memory_order_acquire);
+                if (head == mConsumerTail) {
+                    return IoResult::Error;
+                }
+            }
+        }
+        *buffer = std::move(mBuffers[head & (mCapacity - 1)]);
+        mHead.store(head + 1, std::memory_order_seq_cst);
+        // The producer can only be waiting if the queue was full.
+        if (mTail.load(std::memory_order_seq_cst) - head == mCapacity) {
+            wakeWaiter();
+        }
+        return IoResult::Ok;
+    }
+
+    // Pop a buffer from the queue. This is a blocking call. On success,
+    // move item into |*buffer| and return IoResult::Ok. On failure,
+    // return IoResult::Error to indicate the queue was closed.
+    IoResult pop(Buffer* buffer) {
+        for (;;) {
+            IoResult result = tryPop(buffer);
+            if (result != IoResult::TryAgain) {
+                return result;
+            }
+            waitUntil([this] {
+                return mTail.load(std::memory_order_seq_cst) !=
+                       mHead.load(std::memory_order_relaxed);
+            });
+        }
+    }
+
+    // Close the queue, it is no longer possible to push new items
+    // to it (i.e. push() will always return IoResult::Error), or to
+    // read from an empty queue (i.e. pop() will always return
+    // IoResult::Error once the queue becomes empty).
+    void close() {
+        mClosed.store(true, std::memory_order_seq_cst);
+        AutoLock lock(mLock);
+        mCanProceed.broadcast();
+    }
+
+private:
+    // Sleep until |ready| returns true or the queue is closed.
+    template <class Predicate>
+    void waitUntil(Predicate ready) {
+        // |mWaiters| is incremented before checking the condition again,
+        // and the other side checks it after updating its index and seeing
+        // the queue was empty or full, so either we see the update or it
+        // sees us waiting.
+        AutoLock lock(mLock);
+        mWaiters.fetch_add(1, std::memory_order_seq_cst);
+        while (!ready() && !isClosed()) {
+            mCanProceed.wait(&lock);
+        }
+        mWaiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Both threads can briefly be in waitUntil() together: one woken up but
+    // not out yet, and the other going to sleep, hence the broadcast.
+    void wakeWaiter() {
+        if (mWaiters.load(std::memory_order_seq_cst) > 0) {
+            AutoLock lock(mLock);
+            mCanProceed.broadcast();
+        }
+    }
+
+    static constexpr size_t kCacheLineSize = 64;
+
+    size_t mCapacity = 1;
+    std::unique_ptr<Buffer[]> mBuffers;
+
+    // Buffers [mHead, mTail) are queued. |mTail| is only written by the
+    // producer, |mHead| by the consumer, and each of them keeps the last
+    // value it read of the other index, to only read it again when the
+    // queue looks full or empty.
+    alignas(kCacheLineSize) std::atomic<size_t> mTail {0};
+    size_t mProducerHead = 0;
+    alignas(kCacheLineSize) std::atomic<size_t> mHead {0};
+    size_t mConsumerTail = 0;
+
+    alignas(kCacheLineSize) std::atomic_bool mClosed {false};
+    std::atomic<int> mWaiters {0};
+    Lock mLock;
+    ConditionVariable mCanProceed;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(SpscBufferQueue);
+};
+
+}  // namespace emugl
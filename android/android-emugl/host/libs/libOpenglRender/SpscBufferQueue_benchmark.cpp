@@ -0,0 +1,124 @@
+// Copyright (C) 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A small benchmark used to compare SpscBufferQueue with the BufferQueue
+// protected by a lock that RenderChannelImpl used before.
+
+#include "BufferQueue.h"
+#include "SpscBufferQueue.h"
+
+#include "android/base/synchronization/Lock.h"
+#include "android/base/threads/FunctorThread.h"
+
+#include <string>
+
+#include "benchmark/benchmark_api.h"
+
+using android::base::AutoLock;
+using android::base::FunctorThread;
+using android::base::Lock;
+using emugl::BufferQueue;
+using emugl::SpscBufferQueue;
+using Buffer = emugl::RenderChannel::Buffer;
+using IoResult = emugl::RenderChannel::IoResult;
+
+// The capacity of the guest -> host queue of a RenderChannelImpl.
+static constexpr size_t kCapacity = 1024U;
+
+#define BUFFER_SIZE_BENCHMARK(x) \
+    BENCHMARK(x)->Arg(8)->Arg(512)->Arg(8192)
+
+// Push and pop from a single thread, to measure the cost of the
+// synchronization alone.
+void BM_BufferQueue_PushPop(benchmark::State& state) {
+    Lock lock;
+    BufferQueue queue(kCapacity, lock);
+    Buffer buffer;
+    while (state.KeepRunning()) {
+        {
+            AutoLock al(lock);
+            queue.tryPushLocked(Buffer("Hello"));
+        }
+        AutoLock al(lock);
+        queue.tryPopLocked(&buffer);
+    }
+}
+
+BENCHMARK(BM_BufferQueue_PushPop);
+
+void BM_SpscBufferQueue_PushPop(benchmark::State& state) {
+    SpscBufferQueue queue(kCapacity);
+    Buffer buffer;
+    while (state.KeepRunning()) {
+        queue.tryPush(Buffer("Hello"));
+        queue.tryPop(&buffer);
+    }
+}
+
+BENCHMARK(BM_SpscBufferQueue_PushPop);
+
+// Send buffers of state.range_x() bytes to a consumer thread, the way the
+// guest sends its commands to a render thread.
+void BM_BufferQueue_Transfer(benchmark::State& state) {
+    Lock lock;
+    BufferQueue queue(kCapacity, lock);
+    FunctorThread consumer([&lock, &queue]() {
+        Buffer buffer;
+        for (;;) {
+            AutoLock al(lock);
+            if (queue.popLocked(&buffer) != IoResult::Ok) {
+                break;
+            }
+        }
+    });
+    consumer.start();
+
+    const std::string data(state.range_x(), 'x');
+    while (state.KeepRunning()) {
+        Buffer buffer(data);
+        AutoLock al(lock);
+        queue.pushLocked(std::move(buffer));
+    }
+
+    lock.lock();
+    queue.closeLocked();
+    lock.unlock();
+    consumer.wait();
+    state.SetBytesProcessed(state.iterations() * state.range_x());
+}
+
+BUFFER_SIZE_BENCHMARK(BM_BufferQueue_Transfer);
+
+void BM_SpscBufferQueue_Transfer(benchmark::State& state) {
+    SpscBufferQueue queue(kCapacity);
+    FunctorThread consumer([&queue]() {
+        Buffer buffer;
+        while (queue.pop(&buffer) == IoResult::Ok) {
+        }
+    });
+    consumer.start();
+
+    const std::string data(state.range_x(), 'x');
+    while (state.KeepRunning()) {
+        queue.push(Buffer(data));
+    }
+
+    queue.close();
+    consumer.wait();
+    state.SetBytesProcessed(state.iterations() * state.range_x());
+}
+
+BUFFER_SIZE_BENCHMARK(BM_SpscBufferQueue_Transfer);
+
+BENCHMARK_MAIN()
@@ -0,0 +1,140 @@
+// Copyright (C) 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "SpscBufferQueue.h"
+
+#include "android/base/threads/FunctorThread.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace emugl {
+
+using android::base::FunctorThread;
+using Buffer = SpscBufferQueue::Buffer;
+using IoResult = SpscBufferQueue::IoResult;
+
+TEST(SpscBufferQueue, tryPush) {
+    SpscBufferQueue queue(2);
+
+    EXPECT_TRUE(queue.canPush());
+    EXPECT_EQ(IoResult::Ok, queue.tryPush(Buffer("Hello")));
+    EXPECT_EQ(IoResult::Ok, queue.tryPush(Buffer("World")));
+    EXPECT_FALSE(queue.canPush());
+
+    Buffer buff0("You Shall Not Move");
+    EXPECT_EQ(IoResult::TryAgain, queue.tryPush(std::move(buff0)));
+    EXPECT_FALSE(buff0.empty()) << "Buffer should not be moved on failure!";
+}
+
+TEST(SpscBufferQueue, capacityIsRoundedUp) {
+    SpscBufferQueue queue(3);
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(IoResult::Ok, queue.tryPush(Buffer("Hello")));
+    }
+    EXPECT_EQ(IoResult::TryAgain, queue.tryPush(Buffer("World")));
+}
+
+TEST(SpscBufferQueue, tryPop) {
+    SpscBufferQueue queue(2);
+
+    Buffer buffer;
+    EXPECT_FALSE(queue.canPop());
+    EXPECT_EQ(IoResult::TryAgain, queue.tryPop(&buffer));
+
+    // Go around the ring a few times.
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(IoResult::Ok, queue.tryPush(Buffer("Hello")));
+        EXPECT_EQ(IoResult::Ok, queue.tryPush(Buffer("World")));
+        EXPECT_TRUE(queue.canPop());
+
+        EXPECT_EQ(IoResult::Ok, queue.tryPop(&buffer));
+        EXPECT_STREQ("Hello", buffer.data());
+        EXPECT_EQ(IoResult::Ok, queue.tryPop(&buffer));
+        EXPECT_STREQ("World", buffer.data());
+    }
+
+    EXPECT_EQ(IoResult::TryAgain, queue.tryPop(&buffer));
+    EXPECT_STREQ("World", buffer.data());
+}
+
+TEST(SpscBufferQueue, closedQueue) {
+    SpscBufferQueue queue(2);
+
+    EXPECT_EQ(IoResult::Ok, queue.tryPush(Buffer("Hello")));
+
+    // Closing the queue prevents pushing new items, but not popping the
+    // existing ones, after which IoResult::Error is returned.
+    queue.close();
+    EXPECT_TRUE(queue.isClosed());
+    EXPECT_FALSE(queue.canPush());
+    EXPECT_EQ(IoResult::Error, queue.tryPush(Buffer("World")));
+    EXPECT_EQ(IoResult::Error, queue.push(Buffer("World")));
+
+    Buffer buffer;
+    EXPECT_EQ(IoResult::Ok, queue.pop(&buffer));
+    EXPECT_STREQ("Hello", buffer.data());
+    EXPECT_EQ(IoResult::Error, queue.tryPop(&buffer));
+    EXPECT_EQ(IoResult::Error, queue.pop(&buffer));
+}
+
+TEST(SpscBufferQueue, closeWakesConsumer) {
+    SpscBufferQueue queue(2);
+
+    FunctorThread thread([&queue]() { queue.close(); });
+    thread.start();
+    Buffer buffer;
+    EXPECT_EQ(IoResult::Error, queue.pop(&buffer));
+    thread.wait();
+}
+
+TEST(SpscBufferQueue, closeWakesProducer) {
+    SpscBufferQueue queue(1);
+    EXPECT_EQ(IoResult::Ok, queue.tryPush(Buffer("Hello")));
+
+    FunctorThread thread([&queue]() { queue.close(); });
+    thread.start();
+    EXPECT_EQ(IoResult::Error, queue.push(Buffer("World")));
+    thread.wait();
+}
+
+TEST(SpscBufferQueue, producerConsumer) {
+    static const int kCount = 100000;
+    SpscBufferQueue queue(4);
+
+    // The consumer blocks in pop() whenever the queue is empty, and the
+    // producer in push() whenever it is full.
+    std::string received;
+    FunctorThread consumer([&queue, &received]() {
+        Buffer buffer;
+        while (queue.pop(&buffer) == IoResult::Ok) {
+            received.append(buffer.data(), buffer.size());
+        }
+    });
+    consumer.start();
+
+    std::string sent;
+    for (int i = 0; i < kCount; i++) {
+        std::string item = std::to_string(i) + ",";
+        sent += item;
+        ASSERT_EQ(IoResult::Ok, queue.push(Buffer(item)));
+    }
+    queue.close();
+    consumer.wait();
+
+    EXPECT_EQ(sent, received);
+}
+
+}  // namespace emugl
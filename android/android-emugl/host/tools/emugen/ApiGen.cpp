@@ -864,7 +864,7 @@ int ApiGen::genDecoderHeader(const std::string &filename)
 
     fprintf(fp, "struct %s : public %s_%s_context_t {\n\n",
             classname.c_str(), m_basename.c_str(), sideString(SERVER_SIDE));
-    fprintf(fp, "\tsize_t decode(void *buf, size_t bufsize, IOStream *stream, ChecksumCalculator* checksumCalc, size_t * pRetSize);\n");
+    fprintf(fp, "\tsize_t decode(void *buf, size_t bufsize, IOStream *stream, ChecksumCalculator* checksumCalc);\n");
     fprintf(fp, "\n};\n\n");
     fprintf(fp, "#endif  // GUARD_%s\n", classname.c_str());
 
@@ -926,7 +926,6 @@ int ApiGen::genDecoderImpl(const std::string &filename)
     }
 
     fprintf(fp, "\n\n#include <string.h>\n");
-    fprintf(fp, "\n\n#include <assert.h>\n");
     fprintf(fp, "#include \"%s_opcodes.h\"\n\n", m_basename.c_str());
     fprintf(fp, "#include \"%s_dec.h\"\n\n\n", m_basename.c_str());
     fprintf(fp, "#include \"ProtocolUtils.h\"\n\n");
@@ -952,28 +951,18 @@ int ApiGen::genDecoderImpl(const std::string &filename)
             "#  define SET_LASTCALL(name)\n"
             "#endif\n");
 
-    EntryPoint *e = &(*this)[0];
-    fprintf(fp,
-            "static inline bool isValidRcCode(int opCode){\n"
-            "    return ((opCode >= OP_%s) && (opCode < OP_last));\n"
-            "}\n",
-            e->name().c_str());
-
     // helper templates
     fprintf(fp, "using namespace emugl;\n\n");
 
     // decoder switch;
-    fprintf(fp, "size_t %s::decode(void *buf, size_t len, IOStream *stream, ChecksumCalculator* checksumCalc, size_t * pRetSize) {\n", classname.c_str());
+    fprintf(fp, "size_t %s::decode(void *buf, size_t len, IOStream *stream, ChecksumCalculator* checksumCalc) {\n", classname.c_str());
     fprintf(fp,
 "\tif (len < 8) return 0; \n\
 #ifdef CHECK_GL_ERRORS\n\
 \tchar lastCall[256] = {0};\n\
 #endif\n\
 \tunsigned char *ptr = (unsigned char *)buf;\n\
-\tconst unsigned char* const end = (const unsigned char*)buf + len;\n\
-\tif (pRetSize != nullptr) {\n\
-\t\t*pRetSize = 0;\n\
-\t}\n");
+\tconst unsigned char* const end = (const unsigned char*)buf + len;\n");
     if (!changesChecksum) {
         fprintf(fp,
 R"(    const size_t checksumSize = checksumCalc->checksumByteSize();
@@ -994,13 +983,6 @@ R"(        // Do this on every iteration, as some commands may change the checks
 )");
     }
 
-    fprintf(fp,
-            "\t\tif (pRetSize != nullptr) {\n"
-            "\t\t\tif (isValidRcCode(opcode)) {\n"
-            "\t\t\t\t//printf(\"opcode = %%d\\n\", opcode);\n"
-            "\t\t\t}\n"
-            "\t\t}\n");
-
     fprintf(fp, "\t\tswitch(opcode) {\n");
 
     for (size_t f = 0; f < n; f++) {
@@ -1042,27 +1024,6 @@ R"(        // Do this on every iteration, as some commands may change the checks
         }
 
         for (int pass = PASS_FIRST; pass < PASS_LAST; pass++) {
-            if (pass == PASS_FIRST) {
-                if (e->retval().isVoid()) {
-                    
-                    bool hasOutPtr = false;
-                    VarsArray & evars = e->vars();
-                    for (size_t j = 0; j < evars.size(); j++) {
-                        Var *v = & evars[j];
-
-                        if (v->pointerDir() != Var::POINTER_IN) {
-                            hasOutPtr = true;
-                            break;
-                        }
-                    }
-
-                    if (!hasOutPtr) {
-                        fprintf(fp, "\t\t\tif (pRetSize != nullptr && opcode != 10028)\n");
-                        fprintf(fp, "\t\t\t\tbreak;\n");
-                    }
-                }
-
-            }
 #if INSTRUMENT_TIMING_HOST
             if (pass == PASS_FunctionCall) {
                 fprintf(fp, "\t\t\tclock_gettime(CLOCK_REALTIME, &ts2);\n");
@@ -1089,7 +1050,7 @@ R"(        // Do this on every iteration, as some commands may change the checks
                     fprintf(fp, "\t\t\t#endif\n");
                 }
                 fprintf(fp,
-                        "\t\t\t\tDEBUG(\"%s(%%p): %s(%s)\\n\", stream",
+                        "\t\t\tDEBUG(\"%s(%%p): %s(%s)\\n\", stream",
                         m_basename.c_str(),
                         e->name().c_str(),
                         printString.c_str());
@@ -1306,7 +1267,7 @@ R"(        // Do this on every iteration, as some commands may change the checks
 
             if (pass == PASS_Protocol) {
                 fprintf(fp,
-                        "\t\t\tif (useChecksum && pRetSize == NULL) {\n"
+                        "\t\t\tif (useChecksum) {\n"
                         "\t\t\t\tChecksumCalculatorThreadInfo::validOrDie(checksumCalc, ptr, %s, "
                         "ptr + %s, checksumSize, "
                         "\n\t\t\t\t\t\"%s::decode,"
@@ -1358,11 +1319,7 @@ R"(        // Do this on every iteration, as some commands may change the checks
                 if (totalTmpBuffExist) {
                     fprintf(fp,
                             "\t\t\ttotalTmpSize += checksumSize;\n"
-                            "\t\t\tif (pRetSize != nullptr) {\n"
-                            "\t\t\t\t*pRetSize += totalTmpSize;\n"
-                            "\t\t\t} else {\n"
-                            "\t\t\t\tunsigned char *tmpBuf = stream->alloc(totalTmpSize);\n"
-                            "\n");
+                            "\t\t\tunsigned char *tmpBuf = stream->alloc(totalTmpSize);\n");
                 }
             }
 
@@ -1370,13 +1327,12 @@ R"(        // Do this on every iteration, as some commands may change the checks
                 // send back out pointers data as well as retval
                 if (totalTmpBuffExist) {
                     fprintf(fp,
-                            "\t\t\t\tif (useChecksum) {\n"
-                            "\t\t\t\t\tChecksumCalculatorThreadInfo::writeChecksum(checksumCalc, "
+                            "\t\t\tif (useChecksum) {\n"
+                            "\t\t\t\tChecksumCalculatorThreadInfo::writeChecksum(checksumCalc, "
                             "&tmpBuf[0], totalTmpSize - checksumSize, "
                             "&tmpBuf[totalTmpSize - checksumSize], checksumSize);\n"
-                            "\t\t\t\t}\n"
-                            "\t\t\t\tstream->flush();\n"
-                            "\t\t\t}\n");
+                            "\t\t\t}\n"
+                            "\t\t\tstream->flush();\n");
                 }
             }
         } // pass;
@@ -1413,6 +1369,210 @@ R"(        // Do this on every iteration, as some commands may change the checks
     return 0;
 }
 
+int ApiGen::genReplySizeHeader(const std::string &filename)
+{
+    FILE *fp = fopen(filename.c_str(), "wt");
+    if (fp == NULL) {
+        perror(filename.c_str());
+        return -1;
+    }
+
+    printHeader(fp);
+    std::string funcname = m_basename + "_reply_size_scan";
+
+    fprintf(fp, "\n#ifndef GUARD_%s\n", funcname.c_str());
+    fprintf(fp, "#define GUARD_%s\n\n", funcname.c_str());
+
+    fprintf(fp, "#include \"ChecksumCalculator.h\"\n\n");
+    fprintf(fp, "#include <stddef.h>\n\n");
+
+    fprintf(fp,
+"// Walk the %s commands at the start of |buf| without decoding them, and\n\
+// add the size of the replies they expect to |*pRetSize|. A command is\n\
+// scanned as soon as the part of it its reply size depends on is in |buf|.\n\
+// Commands that select a checksum version update |checksumCalc|.\n\
+// Return the offset of the first command that was not scanned, because it\n\
+// is not part of this API or more of it is needed. This is past |len| when\n\
+// the last command scanned does not end in |buf|.\n",
+            m_basename.c_str());
+    fprintf(fp, "size_t %s(const void *buf, size_t len, ChecksumCalculator* checksumCalc, size_t* pRetSize);\n\n",
+            funcname.c_str());
+    fprintf(fp, "#endif  // GUARD_%s\n", funcname.c_str());
+
+    fclose(fp);
+    return 0;
+}
+
+int ApiGen::genReplySizeImpl(const std::string &filename)
+{
+    FILE *fp = fopen(filename.c_str(), "wt");
+    if (fp == NULL) {
+        perror(filename.c_str());
+        return -1;
+    }
+
+    printHeader(fp);
+
+    size_t n = size();
+    if (n == 0) {
+        fprintf(stderr, "%s: no entry points\n", m_basename.c_str());
+        fclose(fp);
+        return -1;
+    }
+
+    EntryPoint *selectChecksum = NULL;
+    for (size_t i = 0; i < n; ++i) {
+        EntryPoint& ep = at(i);
+        if (ep.name().find("SelectChecksum") != std::string::npos) {
+            selectChecksum = &ep;
+            break;
+        }
+    }
+
+    fprintf(fp, "\n\n#include \"%s_opcodes.h\"\n", m_basename.c_str());
+    fprintf(fp, "#include \"%s_reply_size.h\"\n\n", m_basename.c_str());
+    fprintf(fp, "#include \"ProtocolUtils.h\"\n\n");
+    fprintf(fp, "#include <stdint.h>\n\n");
+    fprintf(fp, "using namespace emugl;\n\n");
+
+    fprintf(fp,
+"namespace {\n\n\
+// What a command needs to compute the size of its reply.\n\
+struct ReplyLayout {\n\
+\t// Size of the return value, or 0.\n\
+\tuint8_t retSize;\n\
+\t// Whether anything is sent back, at least a checksum.\n\
+\tbool hasReply;\n\
+\t// One character per parameter, up to the last out pointer: the size\n\
+\t// of a scalar as a digit, 'i' for an in or inout pointer, 'o' for an\n\
+\t// out pointer and 'd' for a DMA pointer.\n\
+\tconst char* params;\n\
+};\n\n");
+
+    fprintf(fp, "const ReplyLayout kReplyLayouts[] = {\n");
+    for (size_t f = 0; f < n; f++) {
+        EntryPoint *e = &at(f);
+
+        size_t retSize = 0;
+        if (!e->retval().isVoid() && !e->retval().isPointer()) {
+            retSize = e->retval().type()->bytes();
+        }
+        bool hasReply = retSize > 0;
+
+        std::string params;
+        size_t used = 0;
+        VarsArray & evars = e->vars();
+        for (size_t j = 0; j < evars.size(); j++) {
+            Var *v = & evars[j];
+            if (v->isVoid()) {
+                continue;
+            }
+            if (!v->isPointer()) {
+                size_t bytes = v->type()->bytes();
+                if (bytes > 9) {
+                    fprintf(stderr, "%s: parameter '%s' is too large (%zu bytes)\n",
+                            e->name().c_str(), v->name().c_str(), bytes);
+                    fclose(fp);
+                    return -1;
+                }
+                params += (char)('0' + bytes);
+            } else if (v->isDMA()) {
+                params += 'd';
+            } else if (v->pointerDir() == Var::POINTER_OUT) {
+                params += 'o';
+                used = params.size();
+                hasReply = true;
+            } else {
+                params += 'i';
+            }
+        }
+        // Nothing after the last out pointer matters.
+        params.resize(used);
+
+        fprintf(fp, "\t{ %zu, %s, \"%s\" }, // %s\n",
+                retSize,
+                hasReply ? "true" : "false",
+                params.c_str(),
+                e->name().c_str());
+    }
+    fprintf(fp, "};\n\n");
+    fprintf(fp, "}  // namespace\n\n");
+
+    std::string selectChecksumCheck;
+    if (selectChecksum) {
+        VarsArray & svars = selectChecksum->vars();
+        if (svars.empty() || svars[0].isPointer() ||
+            svars[0].type()->bytes() != 4) {
+            fprintf(stderr, "%s: expected a 32-bit version as first parameter\n",
+                    selectChecksum->name().c_str());
+            fclose(fp);
+            return -1;
+        }
+        selectChecksumCheck =
+                "\t\tif (opcode == OP_" + selectChecksum->name() +
+                " && avail < 12) break;\n";
+    }
+
+    fprintf(fp, "size_t %s_reply_size_scan(const void *buf, size_t len, ChecksumCalculator* checksumCalc, size_t* pRetSize) {\n",
+            m_basename.c_str());
+    fprintf(fp,
+"\tconst unsigned char* const start = (const unsigned char*)buf;\n\
+\tconst unsigned char* const end = start + len;\n\
+\tconst unsigned char* ptr = start;\n\
+\twhile (end - ptr >= 8) {\n\
+\t\tuint32_t opcode = Unpack<uint32_t,uint32_t>(ptr);\n\
+\t\tint32_t packetLen = Unpack<int32_t,uint32_t>(ptr + 4);\n\
+\t\tif (packetLen < 8) break;\n\
+\t\tif (opcode - OP_%s >= OP_last - OP_%s) break;\n\
+\t\tconst ReplyLayout& layout = kReplyLayouts[opcode - OP_%s];\n\
+\t\t// Only this part of the command can be read.\n\
+\t\tconst size_t avail = end - ptr < packetLen ? end - ptr : packetLen;\n\
+%s\
+\t\tif (layout.hasReply) {\n\
+\t\t\tsize_t size = layout.retSize + checksumCalc->checksumByteSize();\n\
+\t\t\tsize_t offset = 8;\n\
+\t\t\tfor (const char* param = layout.params; *param; ++param) {\n\
+\t\t\t\tif (*param >= '0' && *param <= '9') {\n\
+\t\t\t\t\toffset += *param - '0';\n\
+\t\t\t\t\tcontinue;\n\
+\t\t\t\t}\n\
+\t\t\t\tif (*param == 'd') {\n\
+\t\t\t\t\toffset += 8;\n\
+\t\t\t\t\tcontinue;\n\
+\t\t\t\t}\n\
+\t\t\t\tif (offset + 4 > avail) return ptr - start;\n\
+\t\t\t\tuint32_t paramSize = Unpack<uint32_t,uint32_t>(ptr + offset);\n\
+\t\t\t\toffset += 4;\n\
+\t\t\t\tif (*param == 'o') {\n\
+\t\t\t\t\tsize += paramSize;\n\
+\t\t\t\t} else {\n\
+\t\t\t\t\toffset += paramSize;\n\
+\t\t\t\t}\n\
+\t\t\t}\n\
+\t\t\t*pRetSize += size;\n\
+\t\t}\n",
+            at(0).name().c_str(),
+            at(0).name().c_str(),
+            at(0).name().c_str(),
+            selectChecksumCheck.c_str());
+    if (selectChecksum) {
+        fprintf(fp,
+"\t\t// The checksum size of the next commands depends on this one.\n\
+\t\tif (opcode == OP_%s) {\n\
+\t\t\tchecksumCalc->setVersion(Unpack<uint32_t,uint32_t>(ptr + 8));\n\
+\t\t}\n",
+                selectChecksum->name().c_str());
+    }
+    fprintf(fp,
+"\t\tptr += packetLen;\n\
+\t}\n\
+\treturn ptr - start;\n\
+}\n");
+
+    fclose(fp);
+    return 0;
+}
+
 int ApiGen::readSpec(const std::string & filename)
 {
     FILE *specfp = fopen(filename.c_str(), "rt");
@@ -82,6 +82,9 @@ public:
     int genDecoderHeader(const std::string &filename);
     int genDecoderImpl(const std::string &filename);
 
+    int genReplySizeHeader(const std::string &filename);
+    int genReplySizeImpl(const std::string &filename);
+
 protected:
     virtual void printHeader(FILE *fp) const;
     std::string m_basename;
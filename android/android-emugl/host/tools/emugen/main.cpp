@@ -140,6 +140,8 @@ int main(int argc, char *argv[])
         apiEntries.genContextImpl(decoderDir + "/" + baseName + "_server_context.cpp", ApiGen::SERVER_SIDE);
         apiEntries.genDecoderHeader(decoderDir + "/" + baseName + "_dec.h");
         apiEntries.genDecoderImpl(decoderDir + "/" + baseName + "_dec.cpp");
+        apiEntries.genReplySizeHeader(decoderDir + "/" + baseName + "_reply_size.h");
+        apiEntries.genReplySizeImpl(decoderDir + "/" + baseName + "_reply_size.cpp");
     }
 
     if (wrapperDir.size() != 0) {
@@ -0,0 +1,76 @@
+// Generated Code - DO NOT EDIT !!
+// generated by 'emugen'
+
+
+#include "foo_opcodes.h"
+#include "foo_reply_size.h"
+
+#include "ProtocolUtils.h"
+
+#include <stdint.h>
+
+using namespace emugl;
+
+namespace {
+
+// What a command needs to compute the size of its reply.
+struct ReplyLayout {
+	// Size of the return value, or 0.
+	uint8_t retSize;
+	// Whether anything is sent back, at least a checksum.
+	bool hasReply;
+	// One character per parameter, up to the last out pointer: the size
+	// of a scalar as a digit, 'i' for an in or inout pointer, 'o' for an
+	// out pointer and 'd' for a DMA pointer.
+	const char* params;
+};
+
+const ReplyLayout kReplyLayouts[] = {
+	{ 0, false, "" }, // fooAlphaFunc
+	{ 1, true, "" }, // fooIsBuffer
+	{ 0, false, "" }, // fooUnsupported
+	{ 0, false, "" }, // fooDoEncoderFlush
+	{ 0, false, "" }, // fooTakeConstVoidPtrConstPtr
+};
+
+}  // namespace
+
+size_t foo_reply_size_scan(const void *buf, size_t len, ChecksumCalculator* checksumCalc, size_t* pRetSize) {
+	const unsigned char* const start = (const unsigned char*)buf;
+	const unsigned char* const end = start + len;
+	const unsigned char* ptr = start;
+	while (end - ptr >= 8) {
+		uint32_t opcode = Unpack<uint32_t,uint32_t>(ptr);
+		int32_t packetLen = Unpack<int32_t,uint32_t>(ptr + 4);
+		if (packetLen < 8) break;
+		if (opcode - OP_fooAlphaFunc >= OP_last - OP_fooAlphaFunc) break;
+		const ReplyLayout& layout = kReplyLayouts[opcode - OP_fooAlphaFunc];
+		// Only this part of the command can be read.
+		const size_t avail = end - ptr < packetLen ? end - ptr : packetLen;
+		if (layout.hasReply) {
+			size_t size = layout.retSize + checksumCalc->checksumByteSize();
+			size_t offset = 8;
+			for (const char* param = layout.params; *param; ++param) {
+				if (*param >= '0' && *param <= '9') {
+					offset += *param - '0';
+					continue;
+				}
+				if (*param == 'd') {
+					offset += 8;
+					continue;
+				}
+				if (offset + 4 > avail) return ptr - start;
+				uint32_t paramSize = Unpack<uint32_t,uint32_t>(ptr + offset);
+				offset += 4;
+				if (*param == 'o') {
+					size += paramSize;
+				} else {
+					offset += paramSize;
+				}
+			}
+			*pRetSize += size;
+		}
+		ptr += packetLen;
+	}
+	return ptr - start;
+}
@@ -0,0 +1,20 @@
+// Generated Code - DO NOT EDIT !!
+// generated by 'emugen'
+
+#ifndef GUARD_foo_reply_size_scan
+#define GUARD_foo_reply_size_scan
+
+#include "ChecksumCalculator.h"
+
+#include <stddef.h>
+
+// Walk the foo commands at the start of |buf| without decoding them, and
+// add the size of the replies they expect to |*pRetSize|. A command is
+// scanned as soon as the part of it its reply size depends on is in |buf|.
+// Commands that select a checksum version update |checksumCalc|.
+// Return the offset of the first command that was not scanned, because it
+// is not part of this API or more of it is needed. This is past |len| when
+// the last command scanned does not end in |buf|.
+size_t foo_reply_size_scan(const void *buf, size_t len, ChecksumCalculator* checksumCalc, size_t* pRetSize);
+
+#endif  // GUARD_foo_reply_size_scan
@@ -1782,6 +1782,41 @@ void qemu_ram_free(RAMBlock *block)
 }
 
 #ifndef _WIN32
+int qemu_ram_map_file(RAMBlock *block, int fd, off_t offset)
+{
+    void *area;
+
+    if ((block->flags & (RAM_PREALLOC | RAM_SHARED)) || block->fd >= 0 ||
+        xen_enabled() || phys_mem_alloc != qemu_anon_ram_alloc) {
+        return -ENOTSUP;
+    }
+    /* HAX pins the pages it populated, it would not see the new ones. */
+    if (hax_enabled()) {
+        return -ENOTSUP;
+    }
+
+    area = mmap(block->host, block->used_length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_FIXED, fd, offset);
+    if (area != block->host) {
+        int ret = -errno;
+
+        /* The old mapping may be gone already, put back an empty one. */
+        area = mmap(block->host, block->used_length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        if (area != block->host) {
+            fprintf(stderr, "Could not remap RAM block '%s'\n",
+                    block->idstr);
+            exit(1);
+        }
+        memory_try_enable_merging(block->host, block->used_length);
+        return ret;
+    }
+    memory_try_enable_merging(block->host, block->used_length);
+    qemu_ram_setup_dump(block->host, block->used_length);
+    qemu_madvise(block->host, block->used_length, QEMU_MADV_DONTFORK);
+    return 0;
+}
+
 void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
 {
     RAMBlock *block;
@@ -1828,6 +1863,11 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
         }
     }
 }
+#else
+int qemu_ram_map_file(RAMBlock *block, int fd, off_t offset)
+{
+    return -ENOTSUP;
+}
 #endif /* !_WIN32 */
 
 /* Return a host pointer to ram allocated with qemu_ram_alloc.
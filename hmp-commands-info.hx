@@ -814,6 +814,21 @@ STEXI
 @item info hotpluggable-cpus
 @findex hotpluggable-cpus
 Show information about hotpluggable CPUs
+ETEXI
+
+    {
+        .name       = "render",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the remote render transport statistics",
+        .mhandler.cmd = hmp_info_render,
+    },
+
+STEXI
+@item info render
+@findex render
+Show the statistics of the render sessions forwarded to the remote render
+server.
 ETEXI
 
 STEXI
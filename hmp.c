@@ -2446,3 +2446,47 @@ void hmp_hotpluggable_cpus(Monitor *mon, const QDict *qdict)
 
     qapi_free_HotpluggableCPUList(saved);
 }
+
+void hmp_info_render(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+    RenderSessionStatsList *list = qmp_query_render_stats(&err);
+    RenderSessionStatsList *l;
+    RenderLatencyBucketList *b;
+
+    if (err != NULL) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+
+    if (!list) {
+        monitor_printf(mon,
+                       "No render session is forwarded to a render server\n");
+        return;
+    }
+
+    for (l = list; l; l = l->next) {
+        RenderSessionStats *s = l->value;
+
+        monitor_printf(mon, "Session %" PRId64 ":\n", s->session);
+        monitor_printf(mon, "  in: %" PRId64 " B/s (%" PRId64 " B)\n",
+                       s->bytes_in_per_sec, s->bytes_in);
+        monitor_printf(mon, "  out: %" PRId64 " B/s (%" PRId64 " B)\n",
+                       s->bytes_out_per_sec, s->bytes_out);
+        monitor_printf(mon, "  queue: %" PRId64 "/%" PRId64
+                       " pages (max %" PRId64 ")\n",
+                       s->queued_pages, s->queue_size, s->max_queued_pages);
+        monitor_printf(mon, "  round trips: %" PRId64 "\n", s->round_trips);
+        for (b = s->latency; b; b = b->next) {
+            if (b->value->has_max_us) {
+                monitor_printf(mon, "    < %" PRId64 " us: %" PRId64 "\n",
+                               b->value->max_us, b->value->count);
+            } else {
+                monitor_printf(mon, "    longer: %" PRId64 "\n",
+                               b->value->count);
+            }
+        }
+    }
+
+    qapi_free_RenderSessionStatsList(list);
+}
@@ -13,12 +13,17 @@
 #include "hw/hw.h"
 #include "audio/audio.h"
 #include "hw/sysbus.h"
+#include "hw/audio/goldfish_audio.h"
+#include "qemu/timer.h"
 #include "qemu/error-report.h"
 #include "trace.h"
 
 #define TYPE_GOLDFISH_AUDIO "goldfish_audio"
 #define GOLDFISH_AUDIO(obj) OBJECT_CHECK(struct goldfish_audio_state, (obj), TYPE_GOLDFISH_AUDIO)
 
+/* bytes of output played per second */
+#define GOLDFISH_AUDIO_BYTE_RATE  (GOLDFISH_AUDIO_FREQ * GOLDFISH_AUDIO_CHANNELS * 2)
+
 enum {
 	/* audio status register */
 	AUDIO_INT_STATUS	= 0x00,
@@ -92,8 +97,25 @@ struct goldfish_audio_state {
     QEMUSoundCard card;
     SWVoiceOut *voice;
     SWVoiceIn*  voicein;
+
+    // with a tap, the AUDIO_INT_WRITE_BUFFER_x_EMPTY bits of the buffers
+    // being played, the virtual time at which each of them ends, and the
+    // end of the last one
+    QEMUTimer *tap_timer;
+    uint32_t tap_pending;
+    int64_t tap_done_ns[2];
+    int64_t tap_end_ns;
 };
 
+static GoldfishAudioTapFunc audio_tap;
+static void *audio_tap_opaque;
+
+void goldfish_audio_set_tap(GoldfishAudioTapFunc tap, void *opaque)
+{
+    audio_tap = tap;
+    audio_tap_opaque = opaque;
+}
+
 static void
 goldfish_audio_buff_init( struct goldfish_audio_buff*  b )
 {
@@ -204,6 +226,44 @@ static const VMStateDescription goldfish_audio_buff_vmsd = {
     }
 };
 
+static void goldfish_audio_tap_arm(struct goldfish_audio_state *s);
+
+static bool goldfish_audio_tap_needed(void *opaque)
+{
+    struct goldfish_audio_state *s = opaque;
+    return s->tap_pending != 0;
+}
+
+static int goldfish_audio_tap_post_load(void *opaque, int version_id)
+{
+    struct goldfish_audio_state *s = opaque;
+
+    if (s->tap_timer) {
+        goldfish_audio_tap_arm(s);
+    } else {
+        /* No output here, give the buffers back right away. */
+        s->int_status |= s->tap_pending;
+        s->tap_pending = 0;
+        qemu_set_irq(s->irq, s->int_status & s->int_enable);
+    }
+    return 0;
+}
+
+/* The buffers the tap holds until they would have been played. */
+static const VMStateDescription goldfish_audio_tap_vmsd = {
+    .name = "goldfish_audio/tap",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = goldfish_audio_tap_needed,
+    .post_load = goldfish_audio_tap_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(tap_pending, struct goldfish_audio_state),
+        VMSTATE_INT64_ARRAY(tap_done_ns, struct goldfish_audio_state, 2),
+        VMSTATE_INT64(tap_end_ns, struct goldfish_audio_state),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription goldfish_audio_vmsd = {
     .name = "goldfish_audio",
     .version_id = AUDIO_STATE_SAVE_VERSION,
@@ -219,6 +279,10 @@ static const VMStateDescription goldfish_audio_vmsd = {
         VMSTATE_STRUCT(in_buff, struct goldfish_audio_state, 0,
                 goldfish_audio_buff_vmsd, struct goldfish_audio_buff),
         VMSTATE_END_OF_LIST()
+    },
+    .subsections = (const VMStateDescription*[]) {
+        &goldfish_audio_tap_vmsd,
+        NULL
     }
 };
 
@@ -234,6 +298,12 @@ static void enable_audio(struct goldfish_audio_state *s, int enable)
         goldfish_audio_buff_reset( &s->in_buff );
     }
     s->current_buffer = -1;
+
+    if (s->tap_timer) {
+        timer_del(s->tap_timer);
+        s->tap_pending = 0;
+        s->tap_end_ns = 0;
+    }
 }
 
 static void start_read(struct goldfish_audio_state *s, uint32_t count)
@@ -274,9 +344,85 @@ static uint64_t goldfish_audio_read(void *opaque, hwaddr offset, unsigned size)
     }
 }
 
+static void goldfish_audio_tap_arm(struct goldfish_audio_state *s)
+{
+    int64_t deadline = INT64_MAX;
+
+    if (s->tap_pending & AUDIO_INT_WRITE_BUFFER_1_EMPTY)
+        deadline = s->tap_done_ns[0];
+    if (s->tap_pending & AUDIO_INT_WRITE_BUFFER_2_EMPTY)
+        deadline = MIN(deadline, s->tap_done_ns[1]);
+
+    if (deadline != INT64_MAX)
+        timer_mod(s->tap_timer, deadline);
+    else
+        timer_del(s->tap_timer);
+}
+
+/* Give back the buffers whose samples have all been played. */
+static void goldfish_audio_tap_timer(void *opaque)
+{
+    struct goldfish_audio_state *s = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    uint32_t new_status = 0;
+
+    if ((s->tap_pending & AUDIO_INT_WRITE_BUFFER_1_EMPTY) &&
+            s->tap_done_ns[0] <= now)
+        new_status |= AUDIO_INT_WRITE_BUFFER_1_EMPTY;
+    if ((s->tap_pending & AUDIO_INT_WRITE_BUFFER_2_EMPTY) &&
+            s->tap_done_ns[1] <= now)
+        new_status |= AUDIO_INT_WRITE_BUFFER_2_EMPTY;
+
+    s->tap_pending &= ~new_status;
+    goldfish_audio_tap_arm(s);
+
+    if (new_status) {
+        s->int_status |= new_status;
+        qemu_set_irq(s->irq, s->int_status & s->int_enable);
+    }
+}
+
+/* Pass the buffer to the tap straight from guest memory, and keep it until
+ * it would have been played, right after the previous one or now. */
+static void goldfish_audio_tap_buffer(struct goldfish_audio_state *s,
+        unsigned int buf, uint32_t length)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int64_t start = MAX(now, s->tap_end_ns);
+    int64_t timestamp = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + start - now;
+    hwaddr addr = s->out_buffs[buf].address;
+    hwaddr left = length;
+
+    while (left > 0) {
+        hwaddr len = left;
+        void *data = cpu_physical_memory_map(addr, &len, 0);
+
+        if (!data)
+            break;
+        audio_tap(audio_tap_opaque, data, len, timestamp);
+        cpu_physical_memory_unmap(data, len, 0, len);
+        timestamp += muldiv64(len, NANOSECONDS_PER_SECOND,
+                              GOLDFISH_AUDIO_BYTE_RATE);
+        addr += len;
+        left -= len;
+    }
+
+    s->tap_end_ns = start + muldiv64(length, NANOSECONDS_PER_SECOND,
+                                     GOLDFISH_AUDIO_BYTE_RATE);
+    s->tap_done_ns[buf] = s->tap_end_ns;
+    s->tap_pending |= buf ? AUDIO_INT_WRITE_BUFFER_2_EMPTY :
+            AUDIO_INT_WRITE_BUFFER_1_EMPTY;
+    goldfish_audio_tap_arm(s);
+}
+
 static void goldfish_audio_write_buffer(struct goldfish_audio_state *s,
         unsigned int buf, uint32_t length)
 {
+    if (audio_tap && s->tap_timer) {
+        goldfish_audio_tap_buffer(s, buf, length);
+        return;
+    }
+
     if (s->current_buffer == -1)
         s->current_buffer = buf;
     goldfish_audio_buff_set_length(&s->out_buffs[buf], length);
@@ -476,8 +622,11 @@ static void goldfish_audio_realize(DeviceState *dev, Error **errp)
     AUD_register_card( "goldfish_audio", &s->card);
 
     if (s->output) {
-        as.freq = 44100;
-        as.nchannels = 2;
+        s->tap_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                    goldfish_audio_tap_timer, s);
+
+        as.freq = GOLDFISH_AUDIO_FREQ;
+        as.nchannels = GOLDFISH_AUDIO_CHANNELS;
         as.fmt = AUD_FMT_S16;
         as.endianness = AUDIO_HOST_ENDIANNESS;
         s->voice = AUD_open_out (
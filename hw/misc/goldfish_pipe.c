@@ -35,7 +35,14 @@
 #include "hw/sysbus.h"
 
 #include "qemu-common.h"
+#include "exec/address-spaces.h"
+#include "exec/ram_addr.h"
+#include "qemu/atomic.h"
 #include "qemu/log.h"
+#include "qemu/main-loop.h"
+#include "qemu/queue.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
 #include "qemu/timer.h"
 #include "qemu/error-report.h"
 
@@ -266,6 +273,17 @@ typedef struct PipeCommand {
     };
 } PipeCommand;
 
+/* The guest RAM range the last buffer of a pipe was found in, so the next
+ * buffers usually don't need a lookup in the memory map. Valid as long as
+ * PipeDevice::ram_map_generation is |generation|. */
+typedef struct PipeRamCache {
+    unsigned generation;
+    hwaddr start;
+    hwaddr end;
+    MemoryRegion* mr;
+    hwaddr offset;  // of |start| within |mr|
+} PipeRamCache;
+
 struct GoldfishHwPipe {
     struct GoldfishHwPipe *wanted_next;
     struct GoldfishHwPipe *wanted_prev;
@@ -278,6 +296,23 @@ struct GoldfishHwPipe {
     PipeCommand* command_buffer;
     uint32_t rw_params_max_count;
 
+    // Serializes the commands on the pipe, taken after the BQL if both are.
+    QemuMutex lock;
+    // Whether the commands that allow it can run without the BQL, see
+    // pipeDevice_tryUnlockedCommand_v2().
+    bool thread_safe;
+    PipeRamCache ram_cache;
+
+    // Wakes queued by goldfish_pipe_queue_wake() and not applied yet. The
+    // pipe is in PipeDevice::queued_wakes while they are not 0.
+    unsigned char queued_wakes;
+    QSLIST_ENTRY(GoldfishHwPipe) queued_next;
+    // One reference for the device until hwpipe_free(), and one while the
+    // pipe is in PipeDevice::queued_wakes. |released| is set once the
+    // device has dropped its own, the queued wakes are then ignored.
+    int refcount;
+    bool released;
+
     // v1-specific fields
     struct GoldfishHwPipe* next;
     uint64_t channel; /* opaque kernel handle */
@@ -330,6 +365,21 @@ typedef struct PipeDevice {
     // Cache of the pipes by channel for a faster lookup.
     GHashTable* pipes_by_channel;
 
+    // Protects |pipes| and |pipes_capacity| from the lookups done without
+    // the BQL. Changing them takes both. A pipe's lock may be taken while
+    // holding it, never the other way around.
+    QemuMutex pipes_lock;
+
+    // Incremented when the guest memory map changes, to invalidate the
+    // PipeRamCache of all pipes.
+    MemoryListener ram_listener;
+    unsigned ram_map_generation;
+
+    // Pipes with wakes queued from other threads, pushed without a lock.
+    // |wake_bh| applies them from the main loop.
+    QSLIST_HEAD(, GoldfishHwPipe) queued_wakes;
+    QEMUBH* wake_bh;
+
     // i/o registers
     uint64_t address;
     uint32_t size;
@@ -406,20 +456,28 @@ static void hash_channel_destroy(gpointer a) {
 }
 #endif
 
+// |wanted| is also changed by the commands running without the BQL.
 static unsigned char hwpipe_get_and_clear_wanted(HwPipe* pipe) {
-    unsigned char val = pipe->wanted;
-    pipe->wanted = 0;
-    return val;
+    return atomic_xchg(&pipe->wanted, 0);
 }
 
 static void hwpipe_set_wanted(HwPipe* pipe, unsigned char val) {
-    pipe->wanted |= val;
+    atomic_or(&pipe->wanted, val);
+}
+
+static void hwpipe_set_host_pipe(HwPipe* pipe, HostPipe* host_pipe) {
+    pipe->host_pipe = host_pipe;
+    atomic_set(&pipe->thread_safe,
+               host_pipe && service_ops->guest_is_thread_safe &&
+                       service_ops->guest_is_thread_safe(host_pipe));
 }
 
 static HwPipe* hwpipe_new0(PipeDevice* dev) {
     HwPipe* pipe;
     pipe = g_malloc0(sizeof(HwPipe));
     pipe->dev = dev;
+    pipe->refcount = 1;
+    qemu_mutex_init(&pipe->lock);
     return pipe;
 }
 
@@ -427,15 +485,81 @@ static HwPipe* hwpipe_new(uint32_t id, uint64_t channel, PipeDevice* dev) {
     HwPipe* pipe = hwpipe_new0(dev);
     pipe->id = id;
     pipe->channel = channel;
-    pipe->host_pipe = service_ops->guest_open(pipe);
+    hwpipe_set_host_pipe(pipe, service_ops->guest_open(pipe));
     return pipe;
 }
 
+// Set the wake |flags| of |pipe| and add it to the wanted list, or mark it
+// as closed by the host if |flags| has GOLDFISH_PIPE_WAKE_CLOSED. Return
+// false if there was nothing to do. The caller raises the IRQ.
+static bool hwpipe_wake(HwPipe* pipe, unsigned char flags) {
+    if (flags & GOLDFISH_PIPE_WAKE_CLOSED) {
+        if (pipe->closed) {
+            return false;
+        }
+        atomic_set(&pipe->closed, 1);
+        flags = GOLDFISH_PIPE_WAKE_CLOSED;
+    }
+    hwpipe_set_wanted(pipe, flags);
+    pipe->dev->ops->wanted_list_add(pipe->dev, pipe);
+    return true;
+}
+
+static void hwpipe_unref(HwPipe* pipe) {
+    if (atomic_fetch_dec(&pipe->refcount) == 1) {
+        qemu_mutex_destroy(&pipe->lock);
+        g_free(pipe);
+    }
+}
+
+// Apply the wakes queued by goldfish_pipe_queue_wake(), except those of the
+// pipes released since, and raise the IRQ once for all of them.
+static void pipe_apply_queued_wakes(PipeDevice* dev) {
+    QSLIST_HEAD(, GoldfishHwPipe) queued;
+    HwPipe* pipe;
+    HwPipe* next;
+    bool raise_irq = false;
+
+    QSLIST_MOVE_ATOMIC(&queued, &dev->queued_wakes);
+    for (pipe = QSLIST_FIRST(&queued); pipe; pipe = next) {
+        // Once its wakes are cleared, |pipe| may be queued again, changing
+        // its next pointer.
+        next = QSLIST_NEXT(pipe, queued_next);
+        const unsigned char flags = atomic_xchg(&pipe->queued_wakes, 0);
+        if (flags && !atomic_read(&pipe->released)) {
+            raise_irq |= hwpipe_wake(pipe, flags);
+        }
+        hwpipe_unref(pipe);
+    }
+    if (raise_irq) {
+        qemu_set_irq(dev->ps->irq, 1);
+        DD("%s: raising IRQ", __func__);
+    }
+}
+
+static void pipe_wake_bh(void* opaque) {
+    pipe_apply_queued_wakes(opaque);
+}
+
 static void hwpipe_free(HwPipe* pipe) {
     if (pipe->host_pipe)
         service_ops->guest_close(pipe->host_pipe);
 
-    g_free(pipe);
+    // A wake may still be on its way into the queue, which keeps |pipe|
+    // alive until pipe_apply_queued_wakes() drops it.
+    atomic_set(&pipe->released, true);
+    hwpipe_unref(pipe);
+}
+
+// Remove |pipe| from the pipes of |dev|, and wait for the command that may
+// still run on it without the BQL.
+static void hwpipe_remove_v2(PipeDevice* dev, HwPipe* pipe) {
+    qemu_mutex_lock(&dev->pipes_lock);
+    dev->pipes[pipe->id] = NULL;
+    qemu_mutex_unlock(&dev->pipes_lock);
+
+    qemu_mutex_lock(&pipe->lock);
+    qemu_mutex_unlock(&pipe->lock);
 }
 
 // Wanted pipe linked list operations
@@ -572,9 +696,9 @@ static void close_all_pipes_v2(PipeDevice* dev) {
     for (; i < dev->pipes_capacity; ++i) {
         HwPipe* pipe = dev->pipes[i];
         if (pipe) {
+            hwpipe_remove_v2(dev, pipe);
             unmap_command_buffer(pipe->command_buffer);
             hwpipe_free(pipe);
-            dev->pipes[i] = NULL;
         }
     }
 }
@@ -754,8 +878,11 @@ static void pipeDevice_doOpenClose_v2(PipeDevice* dev, uint32_t id) {
             return;
         }
         memcpy(pipes, dev->pipes, sizeof(HwPipe*) * dev->pipes_capacity);
+        qemu_mutex_lock(&dev->pipes_lock);
+        free(dev->pipes);
         dev->pipes = pipes;
         dev->pipes_capacity = newCapacity;
+        qemu_mutex_unlock(&dev->pipes_lock);
     }
 
     HwPipe* pipe = hwpipe_new(id, 0, dev);
@@ -769,35 +896,93 @@ static void pipeDevice_doOpenClose_v2(PipeDevice* dev, uint32_t id) {
     pipe->command_buffer_addr = dev->open_command->command_buffer_ptr;
     pipe->command_buffer = commandBuffer;
     pipe->rw_params_max_count = dev->open_command->rw_params_max_count;
+    qemu_mutex_lock(&dev->pipes_lock);
     dev->pipes[id] = pipe;
+    qemu_mutex_unlock(&dev->pipes_lock);
     commandBuffer->status = 0;
 }
 
-static void pipeDevice_doCommand_v2(HwPipe* pipe) {
-    assert(pipe);
-    assert(pipe->command_buffer->cmd != PIPE_CMD_OPEN);
+// Return the host address of the |size| bytes of guest RAM at |phys|, or
+// NULL if they are not all in RAM. The pipe's RAM cache is used and updated
+// instead of mapping the buffer, so this must be called, and the result
+// used, within an RCU critical section. Not used with TCG, see
+// pipeDevice_doCommand_v2().
+static void* hwpipe_lookup_ram(HwPipe* pipe,
+                               hwaddr phys,
+                               uint32_t size,
+                               MemoryRegion** mr,
+                               ram_addr_t* ram_addr) {
+    PipeRamCache* cache = &pipe->ram_cache;
+    const unsigned generation = atomic_read(&pipe->dev->ram_map_generation);
+
+    if (cache->generation != generation || !cache->mr ||
+        phys < cache->start || phys >= cache->end ||
+        size > cache->end - phys) {
+        // Look up the whole RAM range |phys| is in, for the next buffers.
+        hwaddr offset;
+        hwaddr len = ~(hwaddr)0 - phys;
+        MemoryRegion* found = address_space_translate(
+                &address_space_memory, phys, &offset, &len, true);
+        if (!memory_region_is_ram(found) || found->readonly || len < size) {
+            return NULL;
+        }
+        cache->generation = generation;
+        cache->start = phys;
+        cache->end = phys + len;
+        cache->mr = found;
+        cache->offset = offset;
+    }
+
+    const hwaddr offset = cache->offset + (phys - cache->start);
+    *mr = cache->mr;
+    *ram_addr = memory_region_get_ram_addr(cache->mr) + offset;
+    return (uint8_t*)memory_region_get_ram_ptr(cache->mr) + offset;
+}
 
+static void pipe_ram_map_commit(MemoryListener* listener) {
+    PipeDevice* dev = container_of(listener, PipeDevice, ram_listener);
+    atomic_inc(&dev->ram_map_generation);
+}
+
+static bool pipe_cmd_can_run_unlocked(PipeCmd command) {
+    switch (command) {
+        case PIPE_CMD_POLL:
+        case PIPE_CMD_READ:
+        case PIPE_CMD_WRITE:
+        case PIPE_CMD_WAKE_ON_READ:
+        case PIPE_CMD_WAKE_ON_WRITE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void pipeDevice_doClose_v2(HwPipe* pipe) {
     PipeDevice* dev = pipe->dev;
-    PipeCmd command = pipe->command_buffer->cmd;
+
+    DD("%s: CMD_CLOSE id=%d", __func__, (int)pipe->id);
+    // Remove from device's lists.
+    hwpipe_remove_v2(dev, pipe);
+    wanted_pipes_remove_v2(dev, pipe);
+    pipe->command_buffer->status = 0;
+    unmap_command_buffer(pipe->command_buffer);
+    hwpipe_free(pipe);
+}
+
+// Run |command| on |pipe|, with its lock held. |command| is read from the
+// guest's command buffer by the caller, only once as the guest may change
+// it meanwhile.
+static void pipeDevice_doCommand_v2(HwPipe* pipe, PipeCmd command) {
+    assert(pipe);
+    assert(command != PIPE_CMD_OPEN && command != PIPE_CMD_CLOSE);
 
     /* If the pipe is closed by the host, return an error */
-    if (pipe->closed && command != PIPE_CMD_CLOSE) {
+    if (atomic_read(&pipe->closed)) {
         pipe->command_buffer->status = GOLDFISH_PIPE_ERROR_IO;
         return;
     }
 
     switch (command) {
-        case PIPE_CMD_CLOSE: {
-            DD("%s: CMD_CLOSE id=%d", __func__, (int)pipe->id);
-            // Remove from device's lists.
-            dev->pipes[pipe->id] = NULL;
-            wanted_pipes_remove_v2(dev, pipe);
-            pipe->command_buffer->status = 0;
-            unmap_command_buffer(pipe->command_buffer);
-            hwpipe_free(pipe);
-            break;
-        }
-
         case PIPE_CMD_POLL:
             pipe->command_buffer->status =
                     service_ops->guest_poll(pipe->host_pipe);
@@ -823,49 +1008,98 @@ static void pipeDevice_doCommand_v2(HwPipe* pipe) {
             // we're free to estimate the maximum size this way.
             uint64_t* const rwPtrs = hwpipe_get_command_rw_ptrs(pipe);
             uint32_t* const rwSizes = hwpipe_get_command_rw_sizes(pipe);
-            assert(buffers_count <=
-                   COMMAND_BUFFER_SIZE / (sizeof(*rwPtrs) + sizeof(*rwSizes)));
-            GoldfishPipeBuffer buffers[
-                    COMMAND_BUFFER_SIZE / (sizeof(*rwPtrs) + sizeof(*rwSizes))];
-
-            buffers[0].size = rwSizes[0];
-            buffers[0].data = map_guest_buffer(
-                                  rwPtrs[0], rwSizes[0], willModifyData);
-            if (!buffers[0].data) {
-                pipe->command_buffer->status = GOLDFISH_PIPE_ERROR_INVAL;
-                break;
-            }
-            // All passed buffers are allocated in the same guest process, so
-            // know they all have the same offset from the host address.
-            const ptrdiff_t diffFromGuest =
-                    (intptr_t)buffers[0].data - (intptr_t)rwPtrs[0];
+            enum {
+                kMaxBuffers = COMMAND_BUFFER_SIZE /
+                              (sizeof(*rwPtrs) + sizeof(*rwSizes))
+            };
+            assert(buffers_count <= kMaxBuffers);
+            GoldfishPipeBuffer buffers[kMaxBuffers];
             unsigned i;
-            for (i = 1; i < buffers_count; ++i) {
-                buffers[i].data = (void*)(intptr_t)(rwPtrs[i] + diffFromGuest);
-                buffers[i].size = rwSizes[i];
-                assert(buffers[i].data != NULL);
-                assert(buffers[i].size != 0);
-            }
+
+            if (tcg_enabled()) {
+                // Writing to guest memory may invalidate translated code,
+                // which only cpu_physical_memory_unmap() knows how to do.
+                buffers[0].size = rwSizes[0];
+                buffers[0].data = map_guest_buffer(
+                                      rwPtrs[0], rwSizes[0], willModifyData);
+                if (!buffers[0].data) {
+                    pipe->command_buffer->status = GOLDFISH_PIPE_ERROR_INVAL;
+                    break;
+                }
+                // All passed buffers are allocated in the same guest
+                // process, so know they all have the same offset from the
+                // host address.
+                const ptrdiff_t diffFromGuest =
+                        (intptr_t)buffers[0].data - (intptr_t)rwPtrs[0];
+                for (i = 1; i < buffers_count; ++i) {
+                    buffers[i].data =
+                            (void*)(intptr_t)(rwPtrs[i] + diffFromGuest);
+                    buffers[i].size = rwSizes[i];
+                    assert(buffers[i].data != NULL);
+                    assert(buffers[i].size != 0);
+                }
 
 #ifndef NDEBUG
-            // Verify that our interpolated mappings are actually correct
-            for (i = 1; i < buffers_count; ++i) {
-                void* const mapping = map_guest_buffer(rwPtrs[i], rwSizes[i],
-                                                       willModifyData);
-                assert(mapping == buffers[i].data);
-                cpu_physical_memory_unmap(mapping, rwSizes[i],
-                                          willModifyData, rwSizes[i]);
-            }
+                // Verify that our interpolated mappings are actually correct
+                for (i = 1; i < buffers_count; ++i) {
+                    void* const mapping = map_guest_buffer(
+                            rwPtrs[i], rwSizes[i], willModifyData);
+                    assert(mapping == buffers[i].data);
+                    cpu_physical_memory_unmap(mapping, rwSizes[i],
+                                              willModifyData, rwSizes[i]);
+                }
 #endif
 
-            pipe->command_buffer->status =
-                    willModifyData
-                            ? service_ops->guest_recv(pipe->host_pipe,
-                                                        buffers,
-                                                        buffers_count)
-                            : service_ops->guest_send(pipe->host_pipe,
-                                                        buffers,
-                                                        buffers_count);
+                pipe->command_buffer->status =
+                        willModifyData
+                                ? service_ops->guest_recv(pipe->host_pipe,
+                                                          buffers,
+                                                          buffers_count)
+                                : service_ops->guest_send(pipe->host_pipe,
+                                                          buffers,
+                                                          buffers_count);
+                cpu_physical_memory_unmap(buffers[0].data, buffers[0].size,
+                                          willModifyData, buffers[0].size);
+            } else {
+                // Look every buffer up in the RAM cache of the pipe: no
+                // mapping, and guest RAM is written directly, so only the
+                // dirty bitmap needs an update after a read.
+                MemoryRegion* mrs[kMaxBuffers];
+                ram_addr_t ramAddrs[kMaxBuffers];
+
+                rcu_read_lock();
+                for (i = 0; i < buffers_count; ++i) {
+                    buffers[i].size = rwSizes[i];
+                    buffers[i].data = hwpipe_lookup_ram(
+                            pipe, rwPtrs[i], rwSizes[i], &mrs[i],
+                            &ramAddrs[i]);
+                    if (!buffers[i].data) {
+                        break;
+                    }
+                }
+                if (i < buffers_count) {
+                    rcu_read_unlock();
+                    pipe->command_buffer->status = GOLDFISH_PIPE_ERROR_INVAL;
+                    break;
+                }
+                pipe->command_buffer->status =
+                        willModifyData
+                                ? service_ops->guest_recv(pipe->host_pipe,
+                                                          buffers,
+                                                          buffers_count)
+                                : service_ops->guest_send(pipe->host_pipe,
+                                                          buffers,
+                                                          buffers_count);
+                if (willModifyData && pipe->command_buffer->status > 0) {
+                    for (i = 0; i < buffers_count; ++i) {
+                        cpu_physical_memory_set_dirty_range(
+                                ramAddrs[i], buffers[i].size,
+                                memory_region_get_dirty_log_mask(mrs[i]));
+                    }
+                }
+                rcu_read_unlock();
+            }
+
             // TODO(zyy): create an extended version of send()/recv() functions
             // to return both transferred size and resulting status in single
             // call.
@@ -876,9 +1110,6 @@ static void pipeDevice_doCommand_v2(HwPipe* pipe) {
             DD("%s: CMD_%s id=%d buffers=%d > status=%d", __func__,
                (willModifyData ? "READ" : "WRITE"), (int)pipe->id,
                (int)buffers_count, pipe->command_buffer->status);
-
-            cpu_physical_memory_unmap(buffers[0].data, buffers[0].size,
-                                      willModifyData, buffers[0].size);
             break;
         }
 
@@ -889,9 +1120,11 @@ static void pipeDevice_doCommand_v2(HwPipe* pipe) {
                     ? GOLDFISH_PIPE_WAKE_READ : GOLDFISH_PIPE_WAKE_WRITE;
             DD("%s: CMD_WAKE_ON_%s id=%d", __func__, (read ? "READ" : "WRITE"),
                (int)pipe->id);
-            if ((pipe->wanted & wake_flags) == 0) {
-                pipe->wanted |= wake_flags;
-                service_ops->guest_wake_on(pipe->host_pipe, pipe->wanted);
+            const unsigned char wanted =
+                    atomic_fetch_or(&pipe->wanted, wake_flags);
+            if ((wanted & wake_flags) == 0) {
+                service_ops->guest_wake_on(pipe->host_pipe,
+                                           wanted | wake_flags);
             }
             pipe->command_buffer->status = 0;
             break;
@@ -911,6 +1144,48 @@ static void pipeDevice_doCommand_v2(HwPipe* pipe) {
     }
 }
 
+// Run the command the guest issued on pipe |id| without taking the BQL, if
+// the pipe and the command allow it. Return false if they don't, for the
+// caller to take the BQL and run it with pipeDevice_doCommand_v2().
+//
+// This lets the vCPUs of a guest with many GL threads run their commands
+// in parallel, instead of all waiting for the BQL. The pipe is looked up
+// and locked with |pipes_lock| held, so it cannot be closed until the
+// command completes (see hwpipe_remove_v2()).
+static bool pipeDevice_tryUnlockedCommand_v2(PipeDevice* dev, uint32_t id) {
+    HwPipe* pipe = NULL;
+
+    qemu_mutex_lock(&dev->pipes_lock);
+    if (id < dev->pipes_capacity) {
+        pipe = dev->pipes[id];
+    }
+    if (!pipe || !atomic_read(&pipe->thread_safe)) {
+        qemu_mutex_unlock(&dev->pipes_lock);
+        return false;
+    }
+    qemu_mutex_lock(&pipe->lock);
+    qemu_mutex_unlock(&dev->pipes_lock);
+
+    const PipeCmd command = atomic_read(&pipe->command_buffer->cmd);
+    const bool unlocked = pipe_cmd_can_run_unlocked(command);
+    if (unlocked) {
+        pipeDevice_doCommand_v2(pipe, command);
+    }
+    qemu_mutex_unlock(&pipe->lock);
+    return unlocked;
+}
+
+// The i/o registers are accessed without the BQL (see
+// goldfish_pipe_realize()): everything but the pipe commands that can do
+// without it takes it. Return true if it had to be taken.
+static bool pipe_lock_iothread(void) {
+    if (qemu_mutex_iothread_locked()) {
+        return false;
+    }
+    qemu_mutex_lock_iothread();
+    return true;
+}
+
 static void pipe_dev_write(void* opaque,
                            hwaddr offset,
                            uint64_t value,
@@ -920,16 +1195,27 @@ static void pipe_dev_write(void* opaque,
 
     DR("%s: offset = 0x%" HWADDR_PRIx " value=%" PRIu64 "/0x%" PRIx64, __func__,
        offset, value, value);
+    if (offset == PIPE_REG_CMD && atomic_read(&dev->ops) == &pipe_ops_v2 &&
+        pipeDevice_tryUnlockedCommand_v2(dev, value)) {
+        return;
+    }
+
+    const bool locked = pipe_lock_iothread();
     if (offset == PIPE_REG_VERSION) {
         dev->driver_version = value;
     } else {
         dev->ops->dev_write(dev, offset, value);
     }
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 static uint64_t pipe_dev_read(void* opaque, hwaddr offset, unsigned size) {
     GoldfishPipeState* s = (GoldfishPipeState*)opaque;
     PipeDevice* dev = s->dev;
+    const bool locked = pipe_lock_iothread();
+    uint64_t res;
     if (offset == PIPE_REG_VERSION) {
         // PIPE_REG_VERSION is issued on probe, which means that
         // we should clean up all existing stale pipes.
@@ -939,14 +1225,19 @@ static uint64_t pipe_dev_read(void* opaque, hwaddr offset, unsigned size) {
         if (dev->driver_version < MAX_SUPPORTED_DRIVER_VERSION) {
             // Old driver used to not report its version at all.
             dev->device_version = PIPE_DEVICE_VERSION_v1;
-            dev->ops = &pipe_ops_v1;
+            atomic_set(&dev->ops, &pipe_ops_v1);
         } else {
             dev->device_version = PIPE_DEVICE_VERSION;
-            dev->ops = &pipe_ops_v2;
+            atomic_set(&dev->ops, &pipe_ops_v2);
         }
-        return dev->device_version;
+        res = dev->device_version;
+    } else {
+        res = dev->ops->dev_read(dev, offset);
+    }
+    if (locked) {
+        qemu_mutex_unlock_iothread();
     }
-    return dev->ops->dev_read(dev, offset);
+    return res;
 }
 
 static void pipe_dev_write_v1(PipeDevice* dev,
@@ -1079,7 +1370,15 @@ static void pipe_dev_write_v2(PipeDevice* dev,
         case PIPE_REG_CMD: {
             unsigned id = value;
             if (id < dev->pipes_capacity && dev->pipes[id]) {
-                pipeDevice_doCommand_v2(dev->pipes[id]);
+                HwPipe* pipe = dev->pipes[id];
+                const PipeCmd command = atomic_read(&pipe->command_buffer->cmd);
+                if (command == PIPE_CMD_CLOSE) {
+                    pipeDevice_doClose_v2(pipe);
+                } else {
+                    qemu_mutex_lock(&pipe->lock);
+                    pipeDevice_doCommand_v2(pipe, command);
+                    qemu_mutex_unlock(&pipe->lock);
+                }
             } else {
                 pipeDevice_doOpenClose_v2(dev, id);
             }
@@ -1439,19 +1738,25 @@ static int goldfish_pipe_load_v2(QEMUFile* file, PipeDevice* dev) {
     /* Clean up old pipe objects. */
     dev->wanted_pipes_first = NULL;
     dev->ops->close_all(dev);
-    dev->ops = &pipe_ops_v2;
+    atomic_set(&dev->ops, &pipe_ops_v2);
 
     int pipes_capacity = qemu_get_be32(file);
+    HwPipe** pipes = NULL;
     if (dev->pipes_capacity < pipes_capacity) {
-        void* pipes = calloc(pipes_capacity, sizeof(*dev->pipes));
+        pipes = calloc(pipes_capacity, sizeof(*dev->pipes));
         if (!pipes) {
             goto done;
         }
+    }
+    qemu_mutex_lock(&dev->pipes_lock);
+    if (pipes) {
         // No need to memcpy() the old array - we've already freed
         // all pipes there.
+        free(dev->pipes);
         dev->pipes = pipes;
     }
     dev->pipes_capacity = pipes_capacity;
+    qemu_mutex_unlock(&dev->pipes_lock);
 
     int pipe_count = qemu_get_be32(file);
     force_closed_pipes = malloc(sizeof(*force_closed_pipes) * pipe_count);
@@ -1475,7 +1780,8 @@ static int goldfish_pipe_load_v2(QEMUFile* file, PipeDevice* dev) {
         pipe->wanted = qemu_get_byte(file);
 
         char force_close = 0;
-        pipe->host_pipe = service_ops->guest_load(file, pipe, &force_close);
+        hwpipe_set_host_pipe(
+                pipe, service_ops->guest_load(file, pipe, &force_close));
 
         // |pipe| might be NULL in case it couldn't be saved. However,
         // in that case |force_close| will be set by goldfish_pipe_guest_load,
@@ -1490,12 +1796,14 @@ static int goldfish_pipe_load_v2(QEMUFile* file, PipeDevice* dev) {
             goto done;
         }
 
-        if (dev->pipes[pipe->id]) {
+        if (pipe->id >= dev->pipes_capacity || dev->pipes[pipe->id]) {
             unmap_command_buffer(pipe->command_buffer);
             hwpipe_free(pipe);
             goto done;
         }
+        qemu_mutex_lock(&dev->pipes_lock);
         dev->pipes[pipe->id] = pipe;
+        qemu_mutex_unlock(&dev->pipes_lock);
     }
 
     /* Reconstruct wanted pipes list. */
@@ -1570,8 +1878,16 @@ static void goldfish_pipe_realize(DeviceState* dev, Error** errp) {
         APANIC("%s: failed to initialize pipes hash\n", __func__);
     }
 
+    qemu_mutex_init(&s->dev->pipes_lock);
+    s->dev->wake_bh = qemu_bh_new(pipe_wake_bh, s->dev);
+    s->dev->ram_listener.commit = pipe_ram_map_commit;
+    memory_listener_register(&s->dev->ram_listener, &address_space_memory);
+
     memory_region_init_io(&s->iomem, OBJECT(s), &goldfish_pipe_iomem_ops, s,
                           "goldfish_pipe", 0x2000 /*TODO: ?how big?*/);
+    // The GL traffic of all guest threads goes through the pipe commands,
+    // don't serialize them on the BQL, see pipeDevice_tryUnlockedCommand_v2().
+    memory_region_clear_global_locking(&s->iomem);
     sysbus_init_mmio(sbdev, &s->iomem);
     sysbus_init_irq(sbdev, &s->irq);
 
@@ -1581,7 +1897,8 @@ static void goldfish_pipe_realize(DeviceState* dev, Error** errp) {
 }
 
 void goldfish_pipe_reset(GoldfishHwPipe *pipe, GoldfishHostPipe *host_pipe) {
-    pipe->host_pipe = host_pipe;
+    // Called from a command on the pipe, no other one can run meanwhile.
+    hwpipe_set_host_pipe(pipe, host_pipe);
 }
 
 void goldfish_pipe_signal_wake(GoldfishHwPipe *pipe,
@@ -1605,11 +1922,43 @@ void goldfish_pipe_close_from_host(GoldfishHwPipe *pipe)
         pipe->channel, pipe->closed);
 
     if (!pipe->closed) {
-        pipe->closed = 1;
+        atomic_set(&pipe->closed, 1);
         goldfish_pipe_signal_wake(pipe, GOLDFISH_PIPE_WAKE_CLOSED);
     }
 }
 
+void goldfish_pipe_queue_wake(GoldfishHwPipe *pipe,
+                              GoldfishPipeWakeFlags flags)
+{
+    PipeDevice *dev = pipe->dev;
+
+    if (qemu_mutex_iothread_locked()) {
+        if (flags & GOLDFISH_PIPE_WAKE_CLOSED) {
+            goldfish_pipe_close_from_host(pipe);
+        } else {
+            goldfish_pipe_signal_wake(pipe, flags);
+        }
+        return;
+    }
+
+    // Only the first wake queued since the last time they were applied
+    // pushes the pipe and notifies the main loop (through its event
+    // notifier), the next ones are merged into it.
+    // The reference is taken before the wakes are visible, so that
+    // hwpipe_free() can't free the pipe before it is pushed.
+    DD("%s: id=%d flags=%d", __func__, (int)pipe->id, flags);
+    if (!flags) {
+        return;
+    }
+    atomic_inc(&pipe->refcount);
+    if (atomic_fetch_or(&pipe->queued_wakes, flags) == 0) {
+        QSLIST_INSERT_HEAD_ATOMIC(&dev->queued_wakes, pipe, queued_next);
+        qemu_bh_schedule(dev->wake_bh);
+    } else {
+        hwpipe_unref(pipe);
+    }
+}
+
 static void goldfish_pipe_class_init(ObjectClass* klass, void* data) {
     DeviceClass* dc = DEVICE_CLASS(klass);
     dc->realize = goldfish_pipe_realize;
@@ -109,6 +109,15 @@ void qemu_ram_free(RAMBlock *block);
 
 int qemu_ram_resize(RAMBlock *block, ram_addr_t newsize, Error **errp);
 
+/* Replace the content of @block with a private copy-on-write mapping of
+ * @fd at @offset, so that its pages are only read from the file when they
+ * are first accessed. Returns -ENOTSUP if the block is not plain anonymous
+ * memory, or if the accelerator cannot see its mapping change. Returns
+ * another negative errno if mmap() failed, in which case @block is left
+ * zeroed.
+ */
+int qemu_ram_map_file(RAMBlock *block, int fd, off_t offset);
+
 #define DIRTY_CLIENTS_ALL     ((1 << DIRTY_MEMORY_NUM) - 1)
 #define DIRTY_CLIENTS_NOCODE  (DIRTY_CLIENTS_ALL & ~(1 << DIRTY_MEMORY_CODE))
 
@@ -0,0 +1,33 @@
+/* Copyright (C) 2017 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef _HW_GOLDFISH_AUDIO_H
+#define _HW_GOLDFISH_AUDIO_H
+
+/* The format of the samples played by the guest: signed 16-bit, in host
+ * endianness, interleaved. */
+#define GOLDFISH_AUDIO_FREQ      44100
+#define GOLDFISH_AUDIO_CHANNELS  2
+
+/* Called with |size| bytes of samples written by the guest, mapped directly
+ * from its memory and only valid during the call. |timestamp_ns| is the
+ * time, on QEMU_CLOCK_REALTIME, at which the first sample is played. */
+typedef void (*GoldfishAudioTapFunc)(void *opaque, const void *buf, int size,
+                                     int64_t timestamp_ns);
+
+/* Send the output of the goldfish audio device to |tap| instead of the
+ * audio subsystem, or go back to it with a NULL |tap|. The guest buffers
+ * are then consumed at the pace of QEMU_CLOCK_VIRTUAL, without the mixing
+ * engine, its conversions and its timer. Must be called with the BQL held.
+ */
+void goldfish_audio_set_tap(GoldfishAudioTapFunc tap, void *opaque);
+
+#endif /* _HW_GOLDFISH_AUDIO_H */
@@ -118,6 +118,14 @@ typedef struct {
     // any of these events occur.
     void (*guest_wake_on)(GoldfishHostPipe *host_pipe,
                           GoldfishPipeWakeFlags wake_flags);
+
+    // Return true if guest_poll(), guest_recv(), guest_send() and
+    // guest_wake_on() can be called for |host_pipe| without the BQL, from
+    // the vCPU thread that issued the command. They are still never called
+    // concurrently for the same pipe. The other callbacks always run with
+    // the BQL held.
+    bool (*guest_is_thread_safe)(GoldfishHostPipe *host_pipe);
+
     // called to register a new DMA buffer that can be mapped in guest + host.
     void (*dma_add_buffer)(void* pipe, uint64_t guest_paddr, uint64_t);
     // called when the guest is done with a particular DMA buffer.
@@ -154,4 +162,12 @@ extern void goldfish_pipe_close_from_host(GoldfishHwPipe *hw_pipe);
 extern void goldfish_pipe_signal_wake(GoldfishHwPipe *hw_pipe,
                                       GoldfishPipeWakeFlags flags);
 
+/* Same as goldfish_pipe_signal_wake(), or goldfish_pipe_close_from_host()
+ * if |flags| has GOLDFISH_PIPE_WAKE_CLOSED, but can be called from any
+ * thread. Without the BQL, the flags are accumulated in |hw_pipe| and the
+ * main loop is notified once; it then applies the wakes of all pipes and
+ * raises the IRQ a single time. */
+extern void goldfish_pipe_queue_wake(GoldfishHwPipe *hw_pipe,
+                                     GoldfishPipeWakeFlags flags);
+
 #endif /* _HW_GOLDFISH_PIPE_H */
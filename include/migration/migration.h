@@ -275,6 +275,9 @@ int ram_postcopy_send_discard_bitmap(MigrationState *ms);
 int ram_discard_range(MigrationIncomingState *mis, const char *block_name,
                       uint64_t start, size_t length);
 int ram_postcopy_incoming_init(MigrationIncomingState *mis);
+/* Snapshot files of guest RAM that can be mapped back lazily */
+int ram_save_to_file(const char *path, Error **errp);
+int ram_load_from_file(const char *path, Error **errp);
 
 /**
  * @migrate_add_blocker - prevent migration from proceeding
@@ -50,6 +50,11 @@ void net_slirp_receive_raw(void* opaque, const uint8_t *buf, size_t size);
 /* Return a Slirp instance, or NULL if the network stack is not initialized */
 void* net_slirp_state(void);
 
+/* Move the network stacks to threads of their own, unless the SLIRP_THREAD
+ * environment variable is 0. Call once the stacks and the HTTP proxy are
+ * set up. */
+void net_slirp_start_threads(void);
+
 typedef void (*SlirpShaperSendFunc)(void* opaque, const void* data, int len);
 
 void* net_slirp_set_shapers(void* out_opaque,
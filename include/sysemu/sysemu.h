@@ -80,6 +80,10 @@ void qemu_remove_machine_init_done_notifier(Notifier *notify);
 
 void hmp_savevm(Monitor *mon, const QDict *qdict);
 int load_vmstate(const char *name);
+int save_vmstate_to_dir(const char *dir, const char *name, Error **errp);
+int check_vmstate_in_dir(const char *dir, const char *name, Error **errp);
+int load_vmstate_from_dir(const char *dir, const char *name, Error **errp);
+int delete_vmstate_from_dir(const char *dir, const char *name, Error **errp);
 void hmp_delvm(Monitor *mon, const QDict *qdict);
 void hmp_info_snapshots(Monitor *mon, const QDict *qdict);
 
@@ -2578,6 +2578,228 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
     return ret;
 }
 
+/*
+ * RAM snapshot files
+ *
+ * ram_save_to_file() writes the content of all RAM blocks to a file, after
+ * a header listing them. Each block starts at an offset aligned on
+ * RAM_FILE_ALIGN, and its pages that only hold zeroes are left as holes.
+ * ram_load_from_file() maps the blocks of such a file over guest RAM
+ * where it can, so that a page is only read from the file the first time
+ * the guest touches it.
+ *
+ * Header:
+ *   be32 magic, be32 version, be32 block count
+ *   for each block: be64 file offset, be64 length, u8 id length, id
+ */
+
+#define RAM_FILE_MAGIC      0x5152414d  /* "QRAM" */
+#define RAM_FILE_VERSION    1
+#define RAM_FILE_ALIGN      (64 * 1024)
+#define RAM_FILE_HEAD_LEN   12
+#define RAM_FILE_ENTRY_LEN  17
+
+static int ram_file_write_at(int fd, off_t offset, const void *buf,
+                             size_t len)
+{
+    if (lseek(fd, offset, SEEK_SET) != offset) {
+        return -errno;
+    }
+    if (qemu_write_full(fd, buf, len) != len) {
+        return -errno;
+    }
+    return 0;
+}
+
+static int ram_file_read_at(int fd, off_t offset, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    if (lseek(fd, offset, SEEK_SET) != offset) {
+        return -errno;
+    }
+    while (len > 0) {
+        ssize_t ret = read(fd, p, len);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return ret < 0 ? -errno : -EIO;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/* Write the pages of @block that are not all zeroes, in runs. */
+static int ram_file_write_block(int fd, off_t offset, RAMBlock *block)
+{
+    ram_addr_t start = 0, addr;
+
+    for (addr = 0; addr <= block->used_length; addr += TARGET_PAGE_SIZE) {
+        if (addr < block->used_length &&
+            !buffer_is_zero(block->host + addr, TARGET_PAGE_SIZE)) {
+            continue;
+        }
+        if (addr > start) {
+            int ret = ram_file_write_at(fd, offset + start,
+                                        block->host + start, addr - start);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        start = addr + TARGET_PAGE_SIZE;
+    }
+    return 0;
+}
+
+int ram_save_to_file(const char *path, Error **errp)
+{
+    RAMBlock *block;
+    uint8_t *header, *entry;
+    size_t header_len = RAM_FILE_HEAD_LEN;
+    uint32_t count = 0;
+    off_t offset;
+    int fd, ret = 0;
+
+    fd = qemu_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (fd < 0) {
+        ret = -errno;
+        error_setg_errno(errp, -ret, "Could not create '%s'", path);
+        return ret;
+    }
+
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        header_len += RAM_FILE_ENTRY_LEN + strlen(block->idstr);
+        count++;
+    }
+
+    header = g_malloc0(header_len);
+    stl_be_p(header, RAM_FILE_MAGIC);
+    stl_be_p(header + 4, RAM_FILE_VERSION);
+    stl_be_p(header + 8, count);
+    entry = header + RAM_FILE_HEAD_LEN;
+    offset = ROUND_UP(header_len, RAM_FILE_ALIGN);
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        size_t len = strlen(block->idstr);
+
+        stq_be_p(entry, offset);
+        stq_be_p(entry + 8, block->used_length);
+        entry[16] = len;
+        memcpy(entry + RAM_FILE_ENTRY_LEN, block->idstr, len);
+        entry += RAM_FILE_ENTRY_LEN + len;
+
+        ret = ram_file_write_block(fd, offset, block);
+        if (ret < 0) {
+            break;
+        }
+        offset += ROUND_UP(block->used_length, RAM_FILE_ALIGN);
+    }
+    rcu_read_unlock();
+
+    if (!ret) {
+        ret = ram_file_write_at(fd, 0, header, header_len);
+    }
+    /* Trailing zero pages were not written. */
+    if (!ret && ftruncate(fd, offset) < 0) {
+        ret = -errno;
+    }
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write '%s'", path);
+    }
+    g_free(header);
+    close(fd);
+    return ret;
+}
+
+int ram_load_from_file(const char *path, Error **errp)
+{
+    uint8_t head[RAM_FILE_HEAD_LEN];
+    uint8_t entry[RAM_FILE_ENTRY_LEN];
+    off_t pos = RAM_FILE_HEAD_LEN;
+    uint32_t count, i;
+    int fd, ret;
+
+    fd = qemu_open(path, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        ret = -errno;
+        error_setg_errno(errp, -ret, "Could not open '%s'", path);
+        return ret;
+    }
+
+    ret = ram_file_read_at(fd, 0, head, sizeof(head));
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read '%s'", path);
+        goto out;
+    }
+    if (ldl_be_p(head) != RAM_FILE_MAGIC ||
+        ldl_be_p(head + 4) != RAM_FILE_VERSION) {
+        error_setg(errp, "'%s' is not a RAM snapshot file", path);
+        ret = -EINVAL;
+        goto out;
+    }
+    count = ldl_be_p(head + 8);
+
+    rcu_read_lock();
+    for (i = 0; i < count; i++) {
+        RAMBlock *block;
+        char id[256];
+        uint64_t offset, length;
+        size_t len;
+
+        ret = ram_file_read_at(fd, pos, entry, sizeof(entry));
+        len = entry[16];
+        if (!ret) {
+            ret = ram_file_read_at(fd, pos + sizeof(entry), id, len);
+        }
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not read '%s'", path);
+            break;
+        }
+        id[len] = 0;
+        pos += sizeof(entry) + len;
+        offset = ldq_be_p(entry);
+        length = ldq_be_p(entry + 8);
+
+        block = qemu_ram_block_by_name(id);
+        if (!block) {
+            error_setg(errp, "Unknown RAM block '%s' in '%s'", id, path);
+            ret = -EINVAL;
+            break;
+        }
+        if (offset % RAM_FILE_ALIGN) {
+            error_setg(errp, "Misaligned RAM block '%s' in '%s'", id, path);
+            ret = -EINVAL;
+            break;
+        }
+        if (length != block->used_length) {
+            ret = qemu_ram_resize(block, length, errp);
+            if (ret < 0) {
+                break;
+            }
+        }
+
+        if (qemu_ram_map_file(block, fd, offset) < 0) {
+            ret = ram_file_read_at(fd, offset, block->host, length);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "Could not load RAM block '%s'",
+                                 id);
+                break;
+            }
+        }
+        cpu_physical_memory_set_dirty_range(block->offset, length,
+                                            DIRTY_CLIENTS_ALL);
+    }
+    rcu_read_unlock();
+
+out:
+    /* The mappings keep the file open. */
+    close(fd);
+    return ret;
+}
+
 static SaveVMHandlers savevm_ram_handlers = {
     .save_live_setup = ram_save_setup,
     .save_live_iterate = ram_save_iterate,
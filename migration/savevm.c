@@ -1210,8 +1210,7 @@ static int qemu_save_device_state(QEMUFile *f)
 {
     SaveStateEntry *se;
 
-    qemu_put_be32(f, QEMU_VM_FILE_MAGIC);
-    qemu_put_be32(f, QEMU_VM_FILE_VERSION);
+    qemu_savevm_state_header(f);
 
     cpu_synchronize_all_states();
 
@@ -1235,6 +1234,12 @@ static int qemu_save_device_state(QEMUFile *f)
 
     qemu_put_byte(f, QEMU_VM_EOF);
 
+    /* qemu_loadvm_state() complains if it is missing */
+    if (should_send_vmdesc()) {
+        qemu_put_byte(f, QEMU_VM_VMDESCRIPTION);
+        qemu_put_be32(f, 0);
+    }
+
     return qemu_file_get_error(f);
 }
 
@@ -2212,6 +2217,311 @@ int load_vmstate(const char *name)
     return 0;
 }
 
+/*
+ * Snapshots kept in a directory: the disks still use internal snapshots,
+ * but the RAM is saved in a file that is mapped back lazily on load (see
+ * ram_save_to_file()), and the state of the devices in another one. This
+ * makes loading a snapshot about as fast as loading the device state.
+ *
+ * The files of snapshot @name are in @dir/@name/.
+ */
+#define SNAPSHOT_RAM_FILE       "ram.bin"
+#define SNAPSHOT_DEVICES_FILE   "devices.bin"
+
+/* Flush @path, opened with @flags, to the disk. */
+static int sync_snapshot_file(const char *path, int flags, Error **errp)
+{
+    int fd, ret = 0;
+
+    fd = qemu_open(path, flags | O_BINARY);
+    if (fd < 0) {
+        ret = -errno;
+    } else {
+        if (qemu_fdatasync(fd) < 0) {
+            ret = -errno;
+        }
+        close(fd);
+    }
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not sync '%s'", path);
+    }
+    return ret;
+}
+
+/* A RAM file may be mapped by a running VM, and must not be modified: new
+ * files are written aside, then moved over the old ones. */
+static int replace_snapshot_file(const char *tmp_path, const char *path,
+                                 Error **errp)
+{
+#ifdef _WIN32
+    unlink(path);
+#endif
+    if (rename(tmp_path, path) < 0) {
+        int ret = -errno;
+        error_setg_errno(errp, -ret, "Could not write '%s'", path);
+        return ret;
+    }
+    return 0;
+}
+
+/*
+ * Nothing is deleted before both new files are written and synced, so a
+ * failure up to then leaves the old snapshot as it was. Then the disk
+ * snapshot is replaced, and the files moved in place. devices.bin goes
+ * last: a snapshot without it is not loaded, so a failure there leaves no
+ * snapshot rather than a mismatched one.
+ */
+int save_vmstate_to_dir(const char *dir, const char *name, Error **errp)
+{
+    BlockDriverState *bs, *bs1;
+    QEMUSnapshotInfo sn1, *sn = &sn1;
+    QIOChannelFile *ioc;
+    QEMUFile *f;
+    AioContext *aio_context;
+    qemu_timeval tv;
+    char *snapshot_dir, *ram_path, *ram_tmp_path;
+    char *devices_path, *devices_tmp_path;
+    int saved_vm_running;
+    int ret;
+
+    if (!bdrv_all_can_snapshot(&bs)) {
+        error_setg(errp, "Device '%s' is writable but does not support "
+                   "snapshots", bdrv_get_device_name(bs));
+        return -ENOTSUP;
+    }
+    bs = bdrv_all_find_vmstate_bs();
+    if (bs == NULL) {
+        error_setg(errp, "No block device can accept snapshots");
+        return -ENOTSUP;
+    }
+
+    snapshot_dir = g_build_filename(dir, name, NULL);
+    ram_path = g_build_filename(snapshot_dir, SNAPSHOT_RAM_FILE, NULL);
+    ram_tmp_path = g_strconcat(ram_path, ".tmp", NULL);
+    devices_path = g_build_filename(snapshot_dir, SNAPSHOT_DEVICES_FILE, NULL);
+    devices_tmp_path = g_strconcat(devices_path, ".tmp", NULL);
+
+    if (g_mkdir_with_parents(snapshot_dir, 0755) < 0) {
+        ret = -errno;
+        error_setg_errno(errp, -ret, "Could not create '%s'", snapshot_dir);
+        goto out;
+    }
+
+    saved_vm_running = runstate_is_running();
+
+    ret = global_state_store();
+    if (ret) {
+        error_setg(errp, "Error saving global state");
+        goto out;
+    }
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    aio_context = bdrv_get_aio_context(bs);
+    aio_context_acquire(aio_context);
+
+    ret = ram_save_to_file(ram_tmp_path, errp);
+    if (ret < 0) {
+        goto the_end;
+    }
+
+    ioc = qio_channel_file_new_path(devices_tmp_path,
+                                    O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+                                    0644, errp);
+    if (!ioc) {
+        ret = -EIO;
+        goto the_end;
+    }
+    f = qemu_fopen_channel_output(QIO_CHANNEL(ioc));
+    ret = qemu_save_device_state(f);
+    if (qemu_fclose(f) < 0 && !ret) {
+        ret = -EIO;
+    }
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write '%s'", devices_tmp_path);
+        goto the_end;
+    }
+
+    ret = sync_snapshot_file(ram_tmp_path, O_RDWR, errp);
+    if (!ret) {
+        ret = sync_snapshot_file(devices_tmp_path, O_RDWR, errp);
+    }
+    if (ret < 0) {
+        goto the_end;
+    }
+
+    /* From now on, the old files do not match the disks anymore. */
+    ret = bdrv_all_delete_snapshot(name, &bs1, errp);
+    unlink(devices_path);
+    if (ret < 0) {
+        error_prepend(errp, "Error while deleting snapshot on device '%s': ",
+                      bdrv_get_device_name(bs1));
+        ret = -EIO;
+        goto the_end;
+    }
+
+    memset(sn, 0, sizeof(*sn));
+    pstrcpy(sn->name, sizeof(sn->name), name);
+    qemu_gettimeofday(&tv);
+    sn->date_sec = tv.tv_sec;
+    sn->date_nsec = tv.tv_usec * 1000;
+    sn->vm_clock_nsec = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    /* The VM state is not in the disks, this is a disk-only snapshot for
+     * them. */
+    ret = bdrv_all_create_snapshot(sn, bs, 0, &bs);
+    if (ret < 0) {
+        error_setg(errp, "Error while creating snapshot on '%s'",
+                   bdrv_get_device_name(bs));
+        unlink(ram_path);
+        goto the_end;
+    }
+
+    ret = replace_snapshot_file(ram_tmp_path, ram_path, errp);
+    if (!ret) {
+        ret = replace_snapshot_file(devices_tmp_path, devices_path, errp);
+    }
+#ifndef _WIN32
+    if (!ret) {
+        ret = sync_snapshot_file(snapshot_dir, O_RDONLY, errp);
+    }
+#endif
+
+ the_end:
+    aio_context_release(aio_context);
+    if (saved_vm_running) {
+        vm_start();
+    }
+    if (ret < 0) {
+        unlink(ram_tmp_path);
+        unlink(devices_tmp_path);
+    }
+ out:
+    g_free(devices_tmp_path);
+    g_free(devices_path);
+    g_free(ram_tmp_path);
+    g_free(ram_path);
+    g_free(snapshot_dir);
+    return ret;
+}
+
+/* Check that snapshot @name can be loaded from @dir, without touching the
+ * state of the VM. */
+int check_vmstate_in_dir(const char *dir, const char *name, Error **errp)
+{
+    BlockDriverState *bs;
+    const char *files[] = { SNAPSHOT_RAM_FILE, SNAPSHOT_DEVICES_FILE };
+    int i, ret;
+
+    if (!bdrv_all_can_snapshot(&bs)) {
+        error_setg(errp, "Device '%s' is writable but does not support "
+                   "snapshots", bdrv_get_device_name(bs));
+        return -ENOTSUP;
+    }
+    ret = bdrv_all_find_snapshot(name, &bs);
+    if (ret < 0) {
+        error_setg(errp, "Device '%s' does not have the requested snapshot "
+                   "'%s'", bdrv_get_device_name(bs), name);
+        return ret;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(files); i++) {
+        char *path = g_build_filename(dir, name, files[i], NULL);
+        int fd = qemu_open(path, O_RDONLY | O_BINARY);
+
+        if (fd < 0) {
+            ret = -errno;
+            error_setg_errno(errp, -ret, "Snapshot '%s' has no VM state in "
+                             "'%s'", name, dir);
+        } else {
+            close(fd);
+        }
+        g_free(path);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+int load_vmstate_from_dir(const char *dir, const char *name, Error **errp)
+{
+    BlockDriverState *bs;
+    QIOChannelFile *ioc;
+    QEMUFile *f;
+    char *ram_path, *devices_path;
+    int ret;
+
+    ret = check_vmstate_in_dir(dir, name, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ram_path = g_build_filename(dir, name, SNAPSHOT_RAM_FILE, NULL);
+    devices_path = g_build_filename(dir, name, SNAPSHOT_DEVICES_FILE, NULL);
+
+    /* Flush all IO requests so they don't interfere with the new state.  */
+    bdrv_drain_all();
+
+    ret = bdrv_all_goto_snapshot(name, &bs);
+    if (ret < 0) {
+        error_setg(errp, "Error %d while activating snapshot '%s' on '%s'",
+                   ret, name, bdrv_get_device_name(bs));
+        goto out;
+    }
+
+    qemu_system_reset(VMRESET_SILENT);
+
+    /* The devices may look at guest memory while loading. */
+    ret = ram_load_from_file(ram_path, errp);
+    if (ret < 0) {
+        goto out;
+    }
+
+    ioc = qio_channel_file_new_path(devices_path, O_RDONLY | O_BINARY, 0,
+                                    errp);
+    if (!ioc) {
+        ret = -EIO;
+        goto out;
+    }
+    f = qemu_fopen_channel_input(QIO_CHANNEL(ioc));
+
+    migration_incoming_state_new(f);
+    ret = qemu_loadvm_state(f);
+    qemu_fclose(f);
+    migration_incoming_state_destroy();
+    if (ret < 0) {
+        error_setg(errp, "Error %d while loading VM state", ret);
+    }
+
+ out:
+    g_free(devices_path);
+    g_free(ram_path);
+    return ret;
+}
+
+int delete_vmstate_from_dir(const char *dir, const char *name, Error **errp)
+{
+    BlockDriverState *bs;
+    char *snapshot_dir, *path;
+
+    if (bdrv_all_delete_snapshot(name, &bs, errp) < 0) {
+        error_prepend(errp, "Error while deleting snapshot on device '%s': ",
+                      bdrv_get_device_name(bs));
+        return -EIO;
+    }
+
+    snapshot_dir = g_build_filename(dir, name, NULL);
+    path = g_build_filename(snapshot_dir, SNAPSHOT_RAM_FILE, NULL);
+    unlink(path);
+    g_free(path);
+    path = g_build_filename(snapshot_dir, SNAPSHOT_DEVICES_FILE, NULL);
+    unlink(path);
+    g_free(path);
+    rmdir(snapshot_dir);
+    g_free(snapshot_dir);
+    return 0;
+}
+
 void hmp_delvm(Monitor *mon, const QDict *qdict)
 {
     BlockDriverState *bs;
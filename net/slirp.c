@@ -784,6 +784,9 @@ static int slirp_guestfwd(SlirpState *s, const char *config_str,
             return -1;
         }
     } else {
+        /* The character device is serviced by the main loop */
+        slirp_thread_stop(s->slirp);
+
         fwd = g_new(struct GuestFwd, 1);
         fwd->hd = qemu_chr_new(buf, p, NULL);
         if (!fwd->hd) {
@@ -951,6 +954,19 @@ int net_slirp_parse_legacy(QemuOptsList *opts_list, const char *optarg, int *ret
     return 1;
 }
 
+void net_slirp_start_threads(void)
+{
+    SlirpState *s;
+    const char *env = getenv("SLIRP_THREAD");
+
+    if (env && !strcmp(env, "0")) {
+        return;
+    }
+    QTAILQ_FOREACH(s, &slirp_stacks, entry) {
+        slirp_thread_start(s->slirp);
+    }
+}
+
 void* net_slirp_set_shapers(void* out_opaque,
                             SlirpShaperSendFunc out_send,
                             void* in_opaque,
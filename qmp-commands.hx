@@ -5039,3 +5039,52 @@ Example for pc machine type started with
             "props": {"core-id": 0, "socket-id": 0, "thread-id": 0}
          }
        ]}
+
+EQMP
+
+    {
+        .name       = "query-render-stats",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_query_render_stats,
+    },
+
+SQMP
+query-render-stats
+------------------
+
+Show the statistics of the render sessions forwarded to the remote render
+server, to tell whether a stutter comes from the guest, the transport or the
+server.
+
+Return a json-array of json-objects, one for each live render session:
+
+- "session": session number (json-int)
+- "bytes-in": bytes of command stream received from the guest (json-int)
+- "bytes-out": bytes of replies sent back to the guest (json-int)
+- "bytes-in-per-sec": "bytes-in" per second, averaged since the rates were
+  last updated, which queries do at most once per second (json-int)
+- "bytes-out-per-sec": "bytes-out" per second, averaged the same way
+  (json-int)
+- "queued-pages": pages waiting to be sent to the server (json-int)
+- "max-queued-pages": the most pages that were ever waiting (json-int)
+- "queue-size": pages that can wait before the guest is blocked (json-int)
+- "round-trips": commands that expected a reply and received it (json-int)
+- "latency": histogram of their round trip times, a json-array of
+  json-objects:
+    - "max-us": upper bound of the bucket, in microseconds, omitted for the
+      last bucket (json-int, optional)
+    - "count": round trips in the bucket (json-int)
+
+Example:
+
+-> { "execute": "query-render-stats" }
+<- { "return": [
+      { "session": 0, "bytes-in": 48213520, "bytes-out": 12008,
+        "bytes-in-per-sec": 2104331, "bytes-out-per-sec": 512,
+        "queued-pages": 0, "max-queued-pages": 12, "queue-size": 64,
+        "round-trips": 3002,
+        "latency": [ { "max-us": 250, "count": 2870 },
+                     { "max-us": 500, "count": 120 },
+                     ...
+                     { "count": 0 } ] }
+   ] }
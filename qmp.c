@@ -36,6 +36,10 @@
 #include "hw/mem/pc-dimm.h"
 #include "hw/acpi/acpi_dev_interface.h"
 
+#ifdef CONFIG_ANDROID
+#include "android/opengles.h"
+#endif
+
 NameInfo *qmp_query_name(Error **errp)
 {
     NameInfo *info = g_malloc0(sizeof(*info));
@@ -161,6 +165,59 @@ VncInfo2List *qmp_query_vnc_servers(Error **errp)
 };
 #endif
 
+RenderSessionStatsList *qmp_query_render_stats(Error **errp)
+{
+#ifdef CONFIG_ANDROID
+    RenderSessionStatsList *head = NULL, **tail = &head;
+    AndroidOpenglesTransportStats *stats;
+    int count, i, j;
+
+    count = android_getOpenglesTransportStats(NULL, 0);
+    stats = g_new0(AndroidOpenglesTransportStats, count);
+    /* sessions may have ended meanwhile, never more are reported */
+    count = MIN(count, android_getOpenglesTransportStats(stats, count));
+
+    for (i = 0; i < count; i++) {
+        RenderSessionStats *info = g_new0(RenderSessionStats, 1);
+        RenderLatencyBucketList **bucket_tail = &info->latency;
+
+        info->session = stats[i].session;
+        info->bytes_in = stats[i].bytesIn;
+        info->bytes_out = stats[i].bytesOut;
+        info->bytes_in_per_sec = stats[i].bytesInPerSec;
+        info->bytes_out_per_sec = stats[i].bytesOutPerSec;
+        info->queued_pages = stats[i].queuedPages;
+        info->max_queued_pages = stats[i].maxQueuedPages;
+        info->queue_size = stats[i].queueSize;
+        info->round_trips = stats[i].roundTrips;
+
+        for (j = 0; j < ANDROID_OPENGLES_LATENCY_BUCKETS; j++) {
+            RenderLatencyBucket *bucket = g_new0(RenderLatencyBucket, 1);
+
+            if (j < ANDROID_OPENGLES_LATENCY_BUCKETS - 1) {
+                bucket->has_max_us = true;
+                bucket->max_us = 250 << j;
+            }
+            bucket->count = stats[i].latencyHistogram[j];
+
+            *bucket_tail = g_new0(RenderLatencyBucketList, 1);
+            (*bucket_tail)->value = bucket;
+            bucket_tail = &(*bucket_tail)->next;
+        }
+
+        *tail = g_new0(RenderSessionStatsList, 1);
+        (*tail)->value = info;
+        tail = &(*tail)->next;
+    }
+
+    g_free(stats);
+    return head;
+#else
+    error_setg(errp, QERR_FEATURE_DISABLED, "render");
+    return NULL;
+#endif
+}
+
 #ifndef CONFIG_SPICE
 /*
  * qmp-commands.hx ensures that QMP command query-spice exists only
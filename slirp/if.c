@@ -116,6 +116,7 @@ diddit:
 		/* Update *_queued */
 		so->so_queued++;
 		so->so_nqueued++;
+		slirp_poll_mark(so);
 		/*
 		 * Check if the interactive session should be downgraded to
 		 * the batchq.  A session is downgraded if it has queued 6
@@ -193,6 +194,11 @@ void if_start(Slirp *slirp)
             ifm_next = NULL;
         }
 
+        /* Wait for the main loop to take the packets output so far */
+        if (!slirp_can_output(slirp)) {
+            break;
+        }
+
         /* Try to send packet unless it already expired */
         if (ifm->expiration_date >= now && !if_encap(slirp, ifm)) {
             /* Packet is delayed due to pending ARP or NDP resolution */
@@ -227,9 +233,12 @@ void if_start(Slirp *slirp)
         }
 
         /* Update so_queued */
-        if (ifm->ifq_so && --ifm->ifq_so->so_queued == 0) {
-            /* If there's no more queued, reset nqueued */
-            ifm->ifq_so->so_nqueued = 0;
+        if (ifm->ifq_so) {
+            slirp_poll_mark(ifm->ifq_so);
+            if (--ifm->ifq_so->so_queued == 0) {
+                /* If there's no more queued, reset nqueued */
+                ifm->ifq_so->so_nqueued = 0;
+            }
         }
 
         m_free(ifm);
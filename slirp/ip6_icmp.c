@@ -16,9 +16,11 @@
 static void ra_timer_handler(void *opaque)
 {
     Slirp *slirp = opaque;
+    slirp_lock(slirp);
     timer_mod(slirp->ra_timer,
               qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL) + NDP_Interval);
     ndp_send_ra(slirp);
+    slirp_unlock(slirp);
 }
 
 void icmp6_init(Slirp *slirp)
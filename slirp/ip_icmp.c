@@ -90,12 +90,13 @@ static int icmp_send(struct socket *so, struct mbuf *m, int hlen)
     so->so_iptos = ip->ip_tos;
     so->so_type = IPPROTO_ICMP;
     so->so_state = SS_ISFCONNECTED;
-    so->so_expire = curtime + SO_EXPIRE;
+    so->so_expire = atomic_read(&curtime) + SO_EXPIRE;
 
     addr.sin_family = AF_INET;
     addr.sin_addr = so->so_faddr;
 
     insque(so, &so->slirp->icmp);
+    slirp_poll_mark(so);
 
     if (sendto(so->s, m->m_data + hlen, m->m_len - hlen, 0,
                (struct sockaddr *)&addr, sizeof(addr)) == -1) {
@@ -44,6 +44,17 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout);
 
 void slirp_pollfds_poll(GArray *pollfds, int select_error);
 
+/* Run the stack on a thread of its own instead of the main loop, polling
+ * its sockets with epoll. slirp_input() then queues the packets for that
+ * thread, and slirp_output() is called from a bottom half in the main
+ * loop. Returns 0 on success, or -1 if the stack must stay in the main
+ * loop, e.g. when epoll is not available, or with an HTTP proxy or guest
+ * forwarding to a character device, which are serviced by the main loop. */
+int slirp_thread_start(Slirp *slirp);
+
+/* Bring the stack back to the main loop. */
+void slirp_thread_stop(Slirp *slirp);
+
 void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len);
 
 /* you must provide the following functions: */
@@ -31,6 +31,8 @@ extern int ctty_closed;
 
 extern char *slirp_tty;
 extern char *exec_shell;
+/* Read and written with atomic_read() and atomic_set(), as each stack
+ * thread updates it as well as the main loop */
 extern u_int curtime;
 extern struct in_addr loopback_addr;
 extern unsigned long loopback_mask;
@@ -226,6 +226,8 @@ void slirp_connection_info(Slirp *slirp, Monitor *mon)
     const char *state;
     char buf[20];
 
+    slirp_lock(slirp);
+    slirp_thread_info(slirp, mon);
     monitor_printf(mon, "  Protocol[State]    FD  Source Address  Port   "
                         "Dest. Address  Port RecvQ SendQ\n");
 
@@ -266,7 +268,7 @@ void slirp_connection_info(Slirp *slirp, Monitor *mon)
             dst_port = so->so_lport;
         } else {
             snprintf(buf, sizeof(buf), "  UDP[%d sec]",
-                         (so->so_expire - curtime) / 1000);
+                         (so->so_expire - atomic_read(&curtime)) / 1000);
             src.sin_addr = so->so_laddr;
             src.sin_port = so->so_lport;
             dst_addr = so->so_faddr;
@@ -282,7 +284,7 @@ void slirp_connection_info(Slirp *slirp, Monitor *mon)
 
     for (so = slirp->icmp.so_next; so != &slirp->icmp; so = so->so_next) {
         snprintf(buf, sizeof(buf), "  ICMP[%d sec]",
-                     (so->so_expire - curtime) / 1000);
+                     (so->so_expire - atomic_read(&curtime)) / 1000);
         src.sin_addr = so->so_laddr;
         dst_addr = so->so_faddr;
         monitor_printf(mon, "%-19s %3d %15s  -    ", buf, so->s,
@@ -290,4 +292,5 @@ void slirp_connection_info(Slirp *slirp, Monitor *mon)
         monitor_printf(mon, "%15s  -    %5d %5d\n", inet_ntoa(dst_addr),
                        so->so_rcv.sb_cc, so->so_snd.sb_cc);
     }
+    slirp_unlock(slirp);
 }
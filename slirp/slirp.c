@@ -23,13 +23,23 @@
  */
 #include "qemu/osdep.h"
 #include "qemu-common.h"
+#include "qemu/atomic.h"
+#include "qemu/event_notifier.h"
+#include "qemu/main-loop.h"
+#include "qemu/thread.h"
 #include "qemu/timer.h"
 #include "qemu/error-report.h"
+#include "monitor/monitor.h"
 #include "sysemu/char.h"
 #include "slirp.h"
+#include "proxy.h"
 #include "hw/hw.h"
 #include "qemu/cutils.h"
 
+#ifdef CONFIG_EPOLL_CREATE1
+#include <sys/epoll.h>
+#endif
+
 #ifndef _WIN32
 #include <net/if.h>
 #endif
@@ -73,7 +83,8 @@ static int get_dns_addr(struct in_addr *pdns_addr)
     IP_ADDR_STRING *pIPAddr;
     struct in_addr tmp_addr;
 
-    if (dns_addr.s_addr != 0 && (curtime - dns_addr_time) < TIMEOUT_DEFAULT) {
+    if (dns_addr.s_addr != 0 &&
+        (atomic_read(&curtime) - dns_addr_time) < TIMEOUT_DEFAULT) {
         *pdns_addr = dns_addr;
         return 0;
     }
@@ -102,7 +113,7 @@ static int get_dns_addr(struct in_addr *pdns_addr)
     inet_aton(pIPAddr->IpAddress.String, &tmp_addr);
     *pdns_addr = tmp_addr;
     dns_addr = tmp_addr;
-    dns_addr_time = curtime;
+    dns_addr_time = atomic_read(&curtime);
     if (FixedInfo) {
         GlobalFree(FixedInfo);
         FixedInfo = NULL;
@@ -127,7 +138,7 @@ static int get_dns_addr_cached(void *pdns_addr, void *cached_addr,
                                struct stat *cached_stat, u_int *cached_time)
 {
     struct stat old_stat;
-    if (curtime - *cached_time < TIMEOUT_DEFAULT) {
+    if (atomic_read(&curtime) - *cached_time < TIMEOUT_DEFAULT) {
         memcpy(pdns_addr, cached_addr, addrlen);
         return 0;
     }
@@ -183,7 +194,7 @@ static int get_dns_addr_resolv_conf(int af, void *pdns_addr, void *cached_addr,
                 if (scope_id) {
                     *scope_id = if_index;
                 }
-                *cached_time = curtime;
+                *cached_time = atomic_read(&curtime);
             }
 #ifdef DEBUG
             else
@@ -367,6 +378,7 @@ void slirp_init_custom_dns_servers(Slirp *slirp,
                                    int dns_count)
 {
     int n = 0;
+    slirp_lock(slirp);
     for (; n < dns_count; ++n) {
         char temp[128];
         int port;
@@ -386,6 +398,7 @@ void slirp_init_custom_dns_servers(Slirp *slirp,
             ;
         }
     }
+    slirp_unlock(slirp);
 }
 
 static void slirp_init_once(void)
@@ -473,6 +486,8 @@ Slirp *slirp_init(int restricted, bool in_enabled, struct in_addr vnetwork,
 
 void slirp_cleanup(Slirp *slirp)
 {
+    slirp_thread_stop(slirp);
+
     QTAILQ_REMOVE(&slirp_instances, slirp, entry);
 
     unregister_savevm(NULL, "slirp", slirp);
@@ -492,6 +507,21 @@ void slirp_cleanup(Slirp *slirp)
 #define CONN_CANFSEND(so) (((so)->so_state & (SS_FCANTSENDMORE|SS_ISFCONNECTED)) == SS_ISFCONNECTED)
 #define CONN_CANFRCV(so) (((so)->so_state & (SS_FCANTRCVMORE|SS_ISFCONNECTED)) == SS_ISFCONNECTED)
 
+/* Return the poll timeout of one instance, at most 'timeout' */
+static uint32_t slirp_instance_timeout(Slirp *slirp, uint32_t timeout)
+{
+    /* If we have tcp timeout with slirp, then we will fill @timeout with
+     * more precise value.
+     */
+    if (slirp->time_fasttimo) {
+        return TIMEOUT_FAST;
+    }
+    if (slirp->do_slowtimo) {
+        return MIN(TIMEOUT_SLOW, timeout);
+    }
+    return timeout;
+}
+
 static void slirp_update_timeout(uint32_t *timeout)
 {
     Slirp *slirp;
@@ -503,222 +533,405 @@ static void slirp_update_timeout(uint32_t *timeout)
 
     t = MIN(1000, *timeout);
 
-    /* If we have tcp timeout with slirp, then we will fill @timeout with
-     * more precise value.
-     */
     QTAILQ_FOREACH(slirp, &slirp_instances, entry) {
-        if (slirp->time_fasttimo) {
-            *timeout = TIMEOUT_FAST;
-            return;
+        if (slirp->thread) {
+            continue;
         }
-        if (slirp->do_slowtimo) {
-            t = MIN(TIMEOUT_SLOW, t);
+        t = slirp_instance_timeout(slirp, t);
+        if (t == TIMEOUT_FAST) {
+            break;
         }
     }
     *timeout = t;
 }
 
-void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
+/* Called for each socket by slirp_poll_prepare(), with the G_IO_* events
+ * to poll it for, or 0 if it must not be polled */
+typedef void SlirpPollAddFunc(struct socket *so, int list, int events,
+                              void *opaque);
+
+/* Find what to poll a TCP socket for, see slirp_poll_prepare() */
+static int slirp_poll_tcp_events(Slirp *slirp, struct socket *so)
 {
-    Slirp *slirp;
-    struct socket *so, *so_next;
+    int events = 0;
 
-    if (QTAILQ_EMPTY(&slirp_instances)) {
-        return;
+    /*
+     * See if we need a tcp_fasttimo
+     */
+    if (slirp->time_fasttimo == 0 &&
+        so->so_tcpcb->t_flags & TF_DELACK) {
+        /* Flag when want a fasttimo */
+        slirp->time_fasttimo = atomic_read(&curtime);
     }
 
     /*
-     * First, TCP sockets
+     * NOFDREF can include still connecting to local-host,
+     * newly socreated() sockets etc. Don't want to select these.
      */
+    if (so->so_state & SS_NOFDREF || so->s == -1) {
+        return 0;
+    }
 
-    QTAILQ_FOREACH(slirp, &slirp_instances, entry) {
-        /*
-         * *_slowtimo needs calling if there are IP fragments
-         * in the fragment queue, or there are TCP connections active
-         */
-        slirp->do_slowtimo = ((slirp->tcb.so_next != &slirp->tcb) ||
-                (&slirp->ipq.ip_link != slirp->ipq.ip_link.next));
+    /*
+     * Set for reading sockets which are accepting
+     */
+    if (so->so_state & SS_FACCEPTCONN) {
+        return G_IO_IN | G_IO_HUP | G_IO_ERR;
+    }
 
-        for (so = slirp->tcb.so_next; so != &slirp->tcb;
-                so = so_next) {
-            int events = 0;
+    /*
+     * Set for writing sockets which are connecting
+     */
+    if (so->so_state & SS_ISFCONNECTING) {
+        return G_IO_OUT | G_IO_ERR;
+    }
 
-            so_next = so->so_next;
+    /*
+     * Set for writing if we are connected, can send more, and
+     * we have something to send
+     */
+    if (CONN_CANFSEND(so) && so->so_rcv.sb_cc) {
+        events |= G_IO_OUT | G_IO_ERR;
+    }
 
-            so->pollfds_idx = -1;
+    /*
+     * Set for reading (and urgent data) if we are connected, can
+     * receive more, and we have room for it XXX /2 ?
+     */
+    if (CONN_CANFRCV(so) &&
+        (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2))) {
+        events |= G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_PRI;
+    }
+    return events;
+}
 
-            /*
-             * See if we need a tcp_fasttimo
-             */
-            if (slirp->time_fasttimo == 0 &&
-                so->so_tcpcb->t_flags & TF_DELACK) {
-                slirp->time_fasttimo = curtime; /* Flag when want a fasttimo */
-            }
+/* Same for a UDP socket, or -1 if it timed out and was freed */
+static int slirp_poll_udp_events(Slirp *slirp, struct socket *so)
+{
+    /*
+     * See if it's timed out
+     */
+    if (so->so_expire) {
+        if (so->so_expire <= atomic_read(&curtime)) {
+            udp_detach(so);
+            return -1;
+        } else {
+            slirp->do_slowtimo = true; /* Let socket expire */
+        }
+    }
 
-            /*
-             * NOFDREF can include still connecting to local-host,
-             * newly socreated() sockets etc. Don't want to select these.
-             */
-            if (so->so_state & SS_NOFDREF || so->s == -1) {
-                continue;
-            }
+    /*
+     * When UDP packets are received from over the
+     * link, they're sendto()'d straight away, so
+     * no need for setting for writing
+     * Limit the number of packets queued by this session
+     * to 4.  Note that even though we try and limit this
+     * to 4 packets, the session could have more queued
+     * if the packets needed to be fragmented
+     * (XXX <= 4 ?)
+     */
+    if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4) {
+        return G_IO_IN | G_IO_HUP | G_IO_ERR;
+    }
+    return 0;
+}
 
-            /*
-             * Set for reading sockets which are accepting
-             */
-            if (so->so_state & SS_FACCEPTCONN) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_IN | G_IO_HUP | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
-                continue;
-            }
+/* Same for an ICMP socket */
+static int slirp_poll_icmp_events(Slirp *slirp, struct socket *so)
+{
+    /*
+     * See if it's timed out
+     */
+    if (so->so_expire) {
+        if (so->so_expire <= atomic_read(&curtime)) {
+            icmp_detach(so);
+            return -1;
+        } else {
+            slirp->do_slowtimo = true; /* Let socket expire */
+        }
+    }
 
-            /*
-             * Set for writing sockets which are connecting
-             */
-            if (so->so_state & SS_ISFCONNECTING) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_OUT | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
-                continue;
-            }
+    if (so->so_state & SS_ISFCONNECTED) {
+        return G_IO_IN | G_IO_HUP | G_IO_ERR;
+    }
+    return 0;
+}
 
-            /*
-             * Set for writing if we are connected, can send more, and
-             * we have something to send
-             */
-            if (CONN_CANFSEND(so) && so->so_rcv.sb_cc) {
-                events |= G_IO_OUT | G_IO_ERR;
-            }
+/* Walk the sockets of an instance, to find what to poll them for */
+static void slirp_poll_prepare(Slirp *slirp, SlirpPollAddFunc *add,
+                               void *opaque)
+{
+    struct socket *so, *so_next;
+    int events;
 
-            /*
-             * Set for reading (and urgent data) if we are connected, can
-             * receive more, and we have room for it XXX /2 ?
-             */
-            if (CONN_CANFRCV(so) &&
-                (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2))) {
-                events |= G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_PRI;
-            }
+    /*
+     * *_slowtimo needs calling if there are IP fragments
+     * in the fragment queue, or there are TCP connections active
+     */
+    slirp->do_slowtimo = ((slirp->tcb.so_next != &slirp->tcb) ||
+            (&slirp->ipq.ip_link != slirp->ipq.ip_link.next));
+
+    for (so = slirp->tcb.so_next; so != &slirp->tcb;
+            so = so_next) {
+        so_next = so->so_next;
+        so->pollfds_idx = -1;
+        add(so, SLIRP_POLL_TCP, slirp_poll_tcp_events(slirp, so), opaque);
+    }
 
-            if (events) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = events,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
-            }
+    for (so = slirp->udb.so_next; so != &slirp->udb;
+            so = so_next) {
+        so_next = so->so_next;
+        so->pollfds_idx = -1;
+        events = slirp_poll_udp_events(slirp, so);
+        if (events >= 0) {
+            add(so, SLIRP_POLL_UDP, events, opaque);
+        }
+    }
+
+    for (so = slirp->icmp.so_next; so != &slirp->icmp;
+            so = so_next) {
+        so_next = so->so_next;
+        so->pollfds_idx = -1;
+        events = slirp_poll_icmp_events(slirp, so);
+        if (events >= 0) {
+            add(so, SLIRP_POLL_ICMP, events, opaque);
+        }
+    }
+}
+
+static void slirp_pollfds_add(struct socket *so, int list, int events,
+                              void *opaque)
+{
+    GArray *pollfds = opaque;
+
+    if (events) {
+        GPollFD pfd = {
+            .fd = so->s,
+            .events = events,
+        };
+        so->pollfds_idx = pollfds->len;
+        g_array_append_val(pollfds, pfd);
+    }
+}
+
+void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
+{
+    Slirp *slirp;
+
+    if (QTAILQ_EMPTY(&slirp_instances)) {
+        return;
+    }
+
+    QTAILQ_FOREACH(slirp, &slirp_instances, entry) {
+        /* Polled by its own thread */
+        if (slirp->thread) {
+            continue;
         }
+        slirp_poll_prepare(slirp, slirp_pollfds_add, pollfds);
+    }
+    slirp_update_timeout(timeout);
+}
 
+/* Run the TCP timers of an instance that are due */
+static void slirp_poll_timers(Slirp *slirp)
+{
+    /*
+     * See if anything has timed out
+     */
+    if (slirp->time_fasttimo &&
+        ((atomic_read(&curtime) - slirp->time_fasttimo) >= TIMEOUT_FAST)) {
+        tcp_fasttimo(slirp);
+        slirp->time_fasttimo = 0;
+    }
+    if (slirp->do_slowtimo &&
+        ((atomic_read(&curtime) - slirp->last_slowtimo) >= TIMEOUT_SLOW)) {
+        ip_slowtimo(slirp);
+        tcp_slowtimo(slirp);
+        slirp->last_slowtimo = atomic_read(&curtime);
+    }
+}
+
+/* Handle the events polled on a TCP socket */
+static void slirp_poll_tcp(struct socket *so, int revents)
+{
+    int ret;
+
+    if (so->so_state & SS_NOFDREF || so->s == -1) {
+        return;
+    }
+
+    /*
+     * Check for URG data
+     * This will soread as well, so no need to
+     * test for G_IO_IN below if this succeeds
+     */
+    if (revents & G_IO_PRI) {
+        ret = sorecvoob(so);
+        if (ret < 0) {
+            /* Socket error might have resulted in the socket being
+             * removed, do not try to do anything more with it. */
+            return;
+        }
+    }
+    /*
+     * Check sockets for reading
+     */
+    else if (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) {
         /*
-         * UDP sockets
+         * Check for incoming connections
          */
-        for (so = slirp->udb.so_next; so != &slirp->udb;
-                so = so_next) {
-            so_next = so->so_next;
+        if (so->so_state & SS_FACCEPTCONN) {
+            tcp_connect(so);
+            return;
+        } /* else */
+        ret = soread(so);
 
-            so->pollfds_idx = -1;
+        /* Output it if we read something */
+        if (ret > 0) {
+            tcp_output(sototcpcb(so));
+        }
+        if (ret < 0) {
+            /* Socket error might have resulted in the socket being
+             * removed, do not try to do anything more with it. */
+            return;
+        }
+    }
 
-            /*
-             * See if it's timed out
-             */
-            if (so->so_expire) {
-                if (so->so_expire <= curtime) {
-                    udp_detach(so);
-                    continue;
-                } else {
-                    slirp->do_slowtimo = true; /* Let socket expire */
+    /*
+     * Check sockets for writing
+     */
+    if (!(so->so_state & SS_NOFDREF) &&
+            (revents & (G_IO_OUT | G_IO_ERR))) {
+        /*
+         * Check for non-blocking, still-connecting sockets
+         */
+        if (so->so_state & SS_ISFCONNECTING) {
+            /* Connected */
+            so->so_state &= ~SS_ISFCONNECTING;
+
+            ret = send(so->s, (const void *) &ret, 0, 0);
+            if (ret < 0) {
+                /* XXXXX Must fix, zero bytes is a NOP */
+                if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINPROGRESS || errno == ENOTCONN) {
+                    return;
                 }
+
+                /* else failed */
+                so->so_state &= SS_PERSISTENT_MASK;
+                so->so_state |= SS_NOFDREF;
             }
+            /* else so->so_state &= ~SS_ISFCONNECTING; */
 
             /*
-             * When UDP packets are received from over the
-             * link, they're sendto()'d straight away, so
-             * no need for setting for writing
-             * Limit the number of packets queued by this session
-             * to 4.  Note that even though we try and limit this
-             * to 4 packets, the session could have more queued
-             * if the packets needed to be fragmented
-             * (XXX <= 4 ?)
+             * Continue tcp_input
              */
-            if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_IN | G_IO_HUP | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
-            }
+            tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
+                      so->so_ffamily);
+            /* continue; */
+        } else {
+            ret = sowrite(so);
         }
-
         /*
-         * ICMP sockets
+         * XXXXX If we wrote something (a lot), there
+         * could be a need for a window update.
+         * In the worst case, the remote will send
+         * a window probe to get things going again
          */
-        for (so = slirp->icmp.so_next; so != &slirp->icmp;
-                so = so_next) {
-            so_next = so->so_next;
+    }
 
-            so->pollfds_idx = -1;
+    /*
+     * Probe a still-connecting, non-blocking socket
+     * to check if it's still alive
+     */
+#ifdef PROBE_CONN
+    if (so->so_state & SS_ISFCONNECTING) {
+        ret = qemu_recv(so->s, &ret, 0, 0);
+
+        if (ret < 0) {
+            /* XXX */
+            if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                errno == EINPROGRESS || errno == ENOTCONN) {
+                return; /* Still connecting, continue */
+            }
 
-            /*
-             * See if it's timed out
-             */
-            if (so->so_expire) {
-                if (so->so_expire <= curtime) {
-                    icmp_detach(so);
-                    continue;
-                } else {
-                    slirp->do_slowtimo = true; /* Let socket expire */
+            /* else failed */
+            so->so_state &= SS_PERSISTENT_MASK;
+            so->so_state |= SS_NOFDREF;
+
+            /* tcp_input will take care of it */
+        } else {
+            ret = send(so->s, &ret, 0, 0);
+            if (ret < 0) {
+                /* XXX */
+                if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINPROGRESS || errno == ENOTCONN) {
+                    return;
                 }
+                /* else failed */
+                so->so_state &= SS_PERSISTENT_MASK;
+                so->so_state |= SS_NOFDREF;
+            } else {
+                so->so_state &= ~SS_ISFCONNECTING;
             }
 
-            if (so->so_state & SS_ISFCONNECTED) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_IN | G_IO_HUP | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
-            }
         }
+        tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
+                  so->so_ffamily);
+    } /* SS_ISFCONNECTING */
+#endif
+}
+
+/*
+ * UDP sockets.
+ * Incoming packets are sent straight away, they're not buffered.
+ * Incoming UDP data isn't buffered either.
+ */
+static void slirp_poll_udp(struct socket *so, int revents)
+{
+    if (so->s != -1 &&
+        (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
+        sorecvfrom(so);
+    }
+}
+
+/*
+ * Check incoming ICMP relies.
+ */
+static void slirp_poll_icmp(struct socket *so, int revents)
+{
+    if (so->s != -1 &&
+        (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
+        icmp_receive(so);
     }
-    slirp_update_timeout(timeout);
+}
+
+static int slirp_pollfds_revents(GArray *pollfds, struct socket *so)
+{
+    if (so->pollfds_idx == -1) {
+        return 0;
+    }
+    return g_array_index(pollfds, GPollFD, so->pollfds_idx).revents;
 }
 
 void slirp_pollfds_poll(GArray *pollfds, int select_error)
 {
     Slirp *slirp;
     struct socket *so, *so_next;
-    int ret;
 
     if (QTAILQ_EMPTY(&slirp_instances)) {
         return;
     }
 
-    curtime = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    atomic_set(&curtime, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
 
     QTAILQ_FOREACH(slirp, &slirp_instances, entry) {
-        /*
-         * See if anything has timed out
-         */
-        if (slirp->time_fasttimo &&
-            ((curtime - slirp->time_fasttimo) >= TIMEOUT_FAST)) {
-            tcp_fasttimo(slirp);
-            slirp->time_fasttimo = 0;
-        }
-        if (slirp->do_slowtimo &&
-            ((curtime - slirp->last_slowtimo) >= TIMEOUT_SLOW)) {
-            ip_slowtimo(slirp);
-            tcp_slowtimo(slirp);
-            slirp->last_slowtimo = curtime;
+        if (slirp->thread) {
+            continue;
         }
 
+        slirp_poll_timers(slirp);
+
         /*
          * Check sockets
          */
@@ -728,163 +941,17 @@ void slirp_pollfds_poll(GArray *pollfds, int select_error)
              */
             for (so = slirp->tcb.so_next; so != &slirp->tcb;
                     so = so_next) {
-                int revents;
-
                 so_next = so->so_next;
-
-                revents = 0;
-                if (so->pollfds_idx != -1) {
-                    revents = g_array_index(pollfds, GPollFD,
-                                            so->pollfds_idx).revents;
-                }
-
-                if (so->so_state & SS_NOFDREF || so->s == -1) {
-                    continue;
-                }
-
-                /*
-                 * Check for URG data
-                 * This will soread as well, so no need to
-                 * test for G_IO_IN below if this succeeds
-                 */
-                if (revents & G_IO_PRI) {
-                    ret = sorecvoob(so);
-                    if (ret < 0) {
-                        /* Socket error might have resulted in the socket being
-                         * removed, do not try to do anything more with it. */
-                        continue;
-                    }
-                }
-                /*
-                 * Check sockets for reading
-                 */
-                else if (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) {
-                    /*
-                     * Check for incoming connections
-                     */
-                    if (so->so_state & SS_FACCEPTCONN) {
-                        tcp_connect(so);
-                        continue;
-                    } /* else */
-                    ret = soread(so);
-
-                    /* Output it if we read something */
-                    if (ret > 0) {
-                        tcp_output(sototcpcb(so));
-                    }
-                    if (ret < 0) {
-                        /* Socket error might have resulted in the socket being
-                         * removed, do not try to do anything more with it. */
-                        continue;
-                    }
-                }
-
-                /*
-                 * Check sockets for writing
-                 */
-                if (!(so->so_state & SS_NOFDREF) &&
-                        (revents & (G_IO_OUT | G_IO_ERR))) {
-                    /*
-                     * Check for non-blocking, still-connecting sockets
-                     */
-                    if (so->so_state & SS_ISFCONNECTING) {
-                        /* Connected */
-                        so->so_state &= ~SS_ISFCONNECTING;
-
-                        ret = send(so->s, (const void *) &ret, 0, 0);
-                        if (ret < 0) {
-                            /* XXXXX Must fix, zero bytes is a NOP */
-                            if (errno == EAGAIN || errno == EWOULDBLOCK ||
-                                errno == EINPROGRESS || errno == ENOTCONN) {
-                                continue;
-                            }
-
-                            /* else failed */
-                            so->so_state &= SS_PERSISTENT_MASK;
-                            so->so_state |= SS_NOFDREF;
-                        }
-                        /* else so->so_state &= ~SS_ISFCONNECTING; */
-
-                        /*
-                         * Continue tcp_input
-                         */
-                        tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
-                                  so->so_ffamily);
-                        /* continue; */
-                    } else {
-                        ret = sowrite(so);
-                    }
-                    /*
-                     * XXXXX If we wrote something (a lot), there
-                     * could be a need for a window update.
-                     * In the worst case, the remote will send
-                     * a window probe to get things going again
-                     */
-                }
-
-                /*
-                 * Probe a still-connecting, non-blocking socket
-                 * to check if it's still alive
-                 */
-#ifdef PROBE_CONN
-                if (so->so_state & SS_ISFCONNECTING) {
-                    ret = qemu_recv(so->s, &ret, 0, 0);
-
-                    if (ret < 0) {
-                        /* XXX */
-                        if (errno == EAGAIN || errno == EWOULDBLOCK ||
-                            errno == EINPROGRESS || errno == ENOTCONN) {
-                            continue; /* Still connecting, continue */
-                        }
-
-                        /* else failed */
-                        so->so_state &= SS_PERSISTENT_MASK;
-                        so->so_state |= SS_NOFDREF;
-
-                        /* tcp_input will take care of it */
-                    } else {
-                        ret = send(so->s, &ret, 0, 0);
-                        if (ret < 0) {
-                            /* XXX */
-                            if (errno == EAGAIN || errno == EWOULDBLOCK ||
-                                errno == EINPROGRESS || errno == ENOTCONN) {
-                                continue;
-                            }
-                            /* else failed */
-                            so->so_state &= SS_PERSISTENT_MASK;
-                            so->so_state |= SS_NOFDREF;
-                        } else {
-                            so->so_state &= ~SS_ISFCONNECTING;
-                        }
-
-                    }
-                    tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
-                              so->so_ffamily);
-                } /* SS_ISFCONNECTING */
-#endif
+                slirp_poll_tcp(so, slirp_pollfds_revents(pollfds, so));
             }
 
             /*
              * Now UDP sockets.
-             * Incoming packets are sent straight away, they're not buffered.
-             * Incoming UDP data isn't buffered either.
              */
             for (so = slirp->udb.so_next; so != &slirp->udb;
                     so = so_next) {
-                int revents;
-
                 so_next = so->so_next;
-
-                revents = 0;
-                if (so->pollfds_idx != -1) {
-                    revents = g_array_index(pollfds, GPollFD,
-                            so->pollfds_idx).revents;
-                }
-
-                if (so->s != -1 &&
-                    (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
-                    sorecvfrom(so);
-                }
+                slirp_poll_udp(so, slirp_pollfds_revents(pollfds, so));
             }
 
             /*
@@ -892,27 +959,563 @@ void slirp_pollfds_poll(GArray *pollfds, int select_error)
              */
             for (so = slirp->icmp.so_next; so != &slirp->icmp;
                     so = so_next) {
-                    int revents;
+                so_next = so->so_next;
+                slirp_poll_icmp(so, slirp_pollfds_revents(pollfds, so));
+            }
+        }
 
-                    so_next = so->so_next;
+        if_start(slirp);
+    }
+}
 
-                    revents = 0;
-                    if (so->pollfds_idx != -1) {
-                        revents = g_array_index(pollfds, GPollFD,
-                                                so->pollfds_idx).revents;
-                    }
+static void slirp_input_packet(Slirp *slirp, const uint8_t *pkt, int pkt_len);
 
-                    if (so->s != -1 &&
-                        (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
-                    icmp_receive(so);
-                }
+/*
+ * Stack thread.
+ *
+ * With many connections, walking all the sockets to poll them with the
+ * main loop, under the global lock, slows down the emulation of every
+ * other device. The stack thread polls them with epoll instead, which
+ * only reports the ready sockets. The set is only updated for the sockets
+ * marked by slirp_poll_mark() when their state or buffers changed, and
+ * for all of them when the slow timers run, as they walk all the sockets
+ * and the UDP ones expire then.
+ *
+ * The main thread talks to the stack through single-producer, single-
+ * consumer queues of packets: it pushes the packets from the guest to
+ * 'in', and gets the packets to the guest from 'out' in a bottom half.
+ * The producer of 'out' is whoever runs the stack, i.e. holds the lock.
+ * The other entry points of the stack, called by the main loop, take the
+ * lock too.
+ */
+
+#ifdef CONFIG_EPOLL_CREATE1
+
+typedef struct SlirpPacket {
+    int len;
+    uint8_t data[];
+} SlirpPacket;
+
+/* Number of packets in a queue, a power of 2 */
+#define SLIRP_QUEUE_SIZE 1024
+
+typedef struct SlirpPacketQueue {
+    SlirpPacket *packets[SLIRP_QUEUE_SIZE];
+    unsigned head;  /* next packet pushed, only written by the producer */
+    unsigned tail;  /* next packet popped, only written by the consumer */
+} SlirpPacketQueue;
+
+static SlirpPacket *slirp_packet_new(const uint8_t *pkt, int pkt_len)
+{
+    SlirpPacket *packet = g_malloc(sizeof(*packet) + pkt_len);
+    packet->len = pkt_len;
+    memcpy(packet->data, pkt, pkt_len);
+    return packet;
+}
+
+static bool slirp_queue_full(SlirpPacketQueue *q)
+{
+    return q->head - atomic_mb_read(&q->tail) == SLIRP_QUEUE_SIZE;
+}
+
+static bool slirp_queue_push(SlirpPacketQueue *q, SlirpPacket *packet)
+{
+    if (slirp_queue_full(q)) {
+        return false;
+    }
+    q->packets[q->head % SLIRP_QUEUE_SIZE] = packet;
+    atomic_mb_set(&q->head, q->head + 1);
+    return true;
+}
+
+static SlirpPacket *slirp_queue_pop(SlirpPacketQueue *q)
+{
+    SlirpPacket *packet;
+
+    if (q->tail == atomic_mb_read(&q->head)) {
+        return NULL;
+    }
+    packet = q->packets[q->tail % SLIRP_QUEUE_SIZE];
+    atomic_mb_set(&q->tail, q->tail + 1);
+    return packet;
+}
+
+#define SLIRP_EPOLL_EVENTS 128
+
+struct SlirpThread {
+    QemuThread thread;
+    QemuMutex lock;             /* held while the stack runs */
+    EventNotifier wake;         /* wakes the thread up */
+    int wake_pending;           /* 'wake' set, and not seen by the thread */
+    bool quit;
+    int epollfd;
+    /* events being handled, a NULL pointer for a freed socket */
+    struct epoll_event events[SLIRP_EPOLL_EVENTS];
+    int nevents;
+    struct socket *dirty;       /* sockets marked by slirp_poll_mark() */
+    bool poll_all;              /* update the set for all the sockets */
+    SlirpPacketQueue in;        /* packets from the guest */
+    SlirpPacketQueue out;       /* packets to the guest */
+    QEMUBH *out_bh;             /* outputs the packets to the guest */
+    int out_blocked;            /* if_start() stopped on a full 'out' */
+    uint64_t in_dropped;        /* packets dropped on a full queue */
+    uint64_t out_dropped;
+};
+
+void slirp_lock(Slirp *slirp)
+{
+    if (slirp->thread) {
+        qemu_mutex_lock(&slirp->thread->lock);
+    }
+}
+
+static void slirp_thread_kick(SlirpThread *t)
+{
+    if (!atomic_xchg(&t->wake_pending, true)) {
+        event_notifier_set(&t->wake);
+    }
+}
+
+void slirp_unlock(Slirp *slirp)
+{
+    SlirpThread *t = slirp->thread;
+    bool kick;
+
+    if (t) {
+        /* Have the thread poll the sockets changed by the caller */
+        kick = t->dirty != NULL;
+        qemu_mutex_unlock(&t->lock);
+        if (kick) {
+            slirp_thread_kick(t);
+        }
+    }
+}
+
+static inline int slirp_epoll_events(int events)
+{
+    return (events & G_IO_IN ? EPOLLIN : 0) |
+           (events & G_IO_OUT ? EPOLLOUT : 0) |
+           (events & G_IO_PRI ? EPOLLPRI : 0) |
+           (events & G_IO_HUP ? EPOLLHUP : 0) |
+           (events & G_IO_ERR ? EPOLLERR : 0);
+}
+
+static inline int slirp_epoll_revents(int revents)
+{
+    return (revents & EPOLLIN ? G_IO_IN : 0) |
+           (revents & EPOLLOUT ? G_IO_OUT : 0) |
+           (revents & EPOLLPRI ? G_IO_PRI : 0) |
+           (revents & EPOLLHUP ? G_IO_HUP : 0) |
+           (revents & EPOLLERR ? G_IO_ERR : 0);
+}
+
+/* Update the registration of a socket in the epoll set, if its events
+ * changed since the last time */
+static void slirp_epoll_update(struct socket *so, int list, int events,
+                               void *opaque)
+{
+    SlirpThread *t = opaque;
+    struct epoll_event event;
+
+    if (so->poll_fd != -1 && so->poll_fd != so->s) {
+        /* The descriptor was closed, which took it out of the set */
+        so->poll_fd = -1;
+        so->poll_events = 0;
+    }
+    if (so->s == -1) {
+        events = 0;
+    }
+    if (so->poll_fd == -1 ? !events : events == so->poll_events) {
+        return;
+    }
+
+    if (!events) {
+        epoll_ctl(t->epollfd, EPOLL_CTL_DEL, so->poll_fd, &event);
+        so->poll_fd = -1;
+        so->poll_events = 0;
+        return;
+    }
+
+    event.events = slirp_epoll_events(events);
+    event.data.ptr = so;
+    if (so->poll_fd == -1) {
+        if (epoll_ctl(t->epollfd, EPOLL_CTL_ADD, so->s, &event) &&
+            (errno != EEXIST ||
+             epoll_ctl(t->epollfd, EPOLL_CTL_MOD, so->s, &event))) {
+            error_report("slirp: cannot poll socket %d: %s", so->s,
+                         strerror(errno));
+            return;
+        }
+        so->poll_fd = so->s;
+    } else {
+        epoll_ctl(t->epollfd, EPOLL_CTL_MOD, so->s, &event);
+    }
+    so->poll_list = list;
+    so->poll_events = events;
+}
+
+void slirp_poll_mark(struct socket *so)
+{
+    SlirpThread *t = so->slirp->thread;
+
+    if (!t || so->poll_dirty_prev) {
+        return;
+    }
+    so->poll_dirty_next = t->dirty;
+    if (t->dirty) {
+        t->dirty->poll_dirty_prev = &so->poll_dirty_next;
+    }
+    so->poll_dirty_prev = &t->dirty;
+    t->dirty = so;
+}
+
+static void slirp_poll_unmark(struct socket *so)
+{
+    if (so->poll_dirty_prev) {
+        *so->poll_dirty_prev = so->poll_dirty_next;
+        if (so->poll_dirty_next) {
+            so->poll_dirty_next->poll_dirty_prev = so->poll_dirty_prev;
+        }
+        so->poll_dirty_next = NULL;
+        so->poll_dirty_prev = NULL;
+    }
+}
+
+/* Update the epoll set for the sockets marked by slirp_poll_mark() */
+static void slirp_poll_prepare_marked(Slirp *slirp, SlirpThread *t)
+{
+    struct socket *so;
+    int events;
+
+    /* Only cleared by slirp_poll_prepare(), once the slow timers ran */
+    slirp->do_slowtimo |= ((slirp->tcb.so_next != &slirp->tcb) ||
+            (&slirp->ipq.ip_link != slirp->ipq.ip_link.next));
+
+    while ((so = t->dirty)) {
+        slirp_poll_unmark(so);
+        if (so->so_tcpcb) {
+            slirp_epoll_update(so, SLIRP_POLL_TCP,
+                               slirp_poll_tcp_events(slirp, so), t);
+        } else if (so->so_type == IPPROTO_ICMP) {
+            events = slirp_poll_icmp_events(slirp, so);
+            if (events >= 0) {
+                slirp_epoll_update(so, SLIRP_POLL_ICMP, events, t);
+            }
+        } else {
+            events = slirp_poll_udp_events(slirp, so);
+            if (events >= 0) {
+                slirp_epoll_update(so, SLIRP_POLL_UDP, events, t);
             }
         }
+    }
+}
+
+void slirp_poll_forget(struct socket *so)
+{
+    SlirpThread *t = so->slirp->thread;
+    struct epoll_event event;
+    int i;
+
+    if (!t) {
+        return;
+    }
+    slirp_poll_unmark(so);
+    if (so->poll_fd != -1 && so->poll_fd == so->s) {
+        epoll_ctl(t->epollfd, EPOLL_CTL_DEL, so->poll_fd, &event);
+    }
+    so->poll_fd = -1;
+    for (i = 0; i < t->nevents; i++) {
+        if (t->events[i].data.ptr == so) {
+            t->events[i].data.ptr = NULL;
+        }
+    }
+}
+
+bool slirp_can_output(Slirp *slirp)
+{
+    SlirpThread *t = slirp->thread;
+
+    if (!t || !slirp_queue_full(&t->out)) {
+        return true;
+    }
+    /* Continue once the main loop has emptied the queue */
+    atomic_mb_set(&t->out_blocked, true);
+    return false;
+}
+
+static void slirp_thread_output(void *opaque)
+{
+    Slirp *slirp = opaque;
+    SlirpThread *t = slirp->thread;
+    SlirpPacket *packet;
+
+    while ((packet = slirp_queue_pop(&t->out))) {
+        slirp_output(slirp->opaque, packet->data, packet->len);
+        g_free(packet);
+    }
+    if (atomic_xchg(&t->out_blocked, false)) {
+        slirp_thread_kick(t);
+    }
+}
+
+static void *slirp_thread_main(void *opaque)
+{
+    Slirp *slirp = opaque;
+    SlirpThread *t = slirp->thread;
+    SlirpPacket *packet;
+    int i, n;
+
+    qemu_mutex_lock(&t->lock);
+    while (!atomic_read(&t->quit)) {
+        uint32_t timeout;
+        u_int last_slowtimo;
+
+        if (t->poll_all) {
+            while (t->dirty) {
+                slirp_poll_unmark(t->dirty);
+            }
+            slirp_poll_prepare(slirp, slirp_epoll_update, t);
+            t->poll_all = false;
+        } else {
+            slirp_poll_prepare_marked(slirp, t);
+        }
+        timeout = slirp_instance_timeout(slirp, 1000);
+
+        qemu_mutex_unlock(&t->lock);
+        n = epoll_wait(t->epollfd, t->events, SLIRP_EPOLL_EVENTS, timeout);
+        qemu_mutex_lock(&t->lock);
+
+        atomic_set(&curtime, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+        last_slowtimo = slirp->last_slowtimo;
+        slirp_poll_timers(slirp);
+        if (slirp->last_slowtimo != last_slowtimo) {
+            t->poll_all = true;
+        }
+
+        t->nevents = MAX(n, 0);
+        for (i = 0; i < t->nevents; i++) {
+            struct socket *so = t->events[i].data.ptr;
+            int revents = slirp_epoll_revents(t->events[i].events);
+
+            if (so == (void *)t) {
+                atomic_mb_set(&t->wake_pending, false);
+                event_notifier_test_and_clear(&t->wake);
+                continue;
+            }
+            if (!so) {
+                continue;
+            }
+            slirp_poll_mark(so);
+            switch (so->poll_list) {
+            case SLIRP_POLL_TCP:
+                slirp_poll_tcp(so, revents);
+                break;
+            case SLIRP_POLL_UDP:
+                slirp_poll_udp(so, revents);
+                break;
+            case SLIRP_POLL_ICMP:
+                slirp_poll_icmp(so, revents);
+                break;
+            }
+        }
+        t->nevents = 0;
+
+        while ((packet = slirp_queue_pop(&t->in))) {
+            slirp_input_packet(slirp, packet->data, packet->len);
+            g_free(packet);
+        }
 
         if_start(slirp);
     }
+    qemu_mutex_unlock(&t->lock);
+
+    return NULL;
 }
 
+int slirp_thread_start(Slirp *slirp)
+{
+    SlirpThread *t;
+    struct ex_list *ex_ptr;
+    struct epoll_event event;
+
+    if (slirp->thread) {
+        return 0;
+    }
+    if (slirp_proxy) {
+        return -1;
+    }
+    for (ex_ptr = slirp->exec_list; ex_ptr; ex_ptr = ex_ptr->ex_next) {
+        if (ex_ptr->ex_pty == 3) {
+            return -1;
+        }
+    }
+
+    t = g_new0(SlirpThread, 1);
+    t->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (t->epollfd < 0) {
+        g_free(t);
+        return -1;
+    }
+    if (event_notifier_init(&t->wake, false) < 0) {
+        close(t->epollfd);
+        g_free(t);
+        return -1;
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = t;
+    if (epoll_ctl(t->epollfd, EPOLL_CTL_ADD,
+                  event_notifier_get_fd(&t->wake), &event)) {
+        event_notifier_cleanup(&t->wake);
+        close(t->epollfd);
+        g_free(t);
+        return -1;
+    }
+    qemu_mutex_init(&t->lock);
+    t->out_bh = qemu_bh_new(slirp_thread_output, slirp);
+    t->poll_all = true;
+
+    slirp->thread = t;
+    qemu_thread_create(&t->thread, "slirp", slirp_thread_main, slirp,
+                       QEMU_THREAD_JOINABLE);
+    return 0;
+}
+
+static void slirp_forget_sockets(struct socket *head)
+{
+    struct socket *so;
+
+    for (so = head->so_next; so != head; so = so->so_next) {
+        so->poll_fd = -1;
+        so->poll_events = 0;
+        so->poll_dirty_next = NULL;
+        so->poll_dirty_prev = NULL;
+    }
+}
+
+void slirp_thread_stop(Slirp *slirp)
+{
+    SlirpThread *t = slirp->thread;
+    SlirpPacket *packet;
+
+    if (!t) {
+        return;
+    }
+    atomic_set(&t->quit, true);
+    event_notifier_set(&t->wake);
+    qemu_thread_join(&t->thread);
+
+    /* Output what the thread left, then run the stack in the main loop */
+    slirp_thread_output(slirp);
+    slirp->thread = NULL;
+    while ((packet = slirp_queue_pop(&t->in))) {
+        slirp_input_packet(slirp, packet->data, packet->len);
+        g_free(packet);
+    }
+
+    slirp_forget_sockets(&slirp->tcb);
+    slirp_forget_sockets(&slirp->udb);
+    slirp_forget_sockets(&slirp->icmp);
+
+    qemu_bh_delete(t->out_bh);
+    qemu_mutex_destroy(&t->lock);
+    event_notifier_cleanup(&t->wake);
+    close(t->epollfd);
+    g_free(t);
+}
+
+/* Queue a packet from the guest for the thread */
+static void slirp_thread_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
+{
+    SlirpThread *t = slirp->thread;
+    SlirpPacket *packet = slirp_packet_new(pkt, pkt_len);
+
+    if (!slirp_queue_push(&t->in, packet)) {
+        g_free(packet);
+        t->in_dropped++;
+    }
+    slirp_thread_kick(t);
+}
+
+/* Send a packet to the guest, through the main loop if running in the
+ * thread. if_start() waits for room in the queue, so it is only full for
+ * the ARP and NDP packets, which are dropped then. */
+static void slirp_send_packet(Slirp *slirp, const uint8_t *pkt, int pkt_len)
+{
+    SlirpThread *t = slirp->thread;
+    SlirpPacket *packet;
+
+    if (!t) {
+        slirp_output(slirp->opaque, pkt, pkt_len);
+        return;
+    }
+
+    packet = slirp_packet_new(pkt, pkt_len);
+    if (!slirp_queue_push(&t->out, packet)) {
+        g_free(packet);
+        t->out_dropped++;
+        return;
+    }
+    qemu_bh_schedule(t->out_bh);
+}
+
+void slirp_thread_info(Slirp *slirp, Monitor *mon)
+{
+    SlirpThread *t = slirp->thread;
+
+    if (t) {
+        monitor_printf(mon, "  Polled by its own thread, packets dropped: "
+                       "%" PRIu64 " from the guest, %" PRIu64 " to it\n",
+                       t->in_dropped, t->out_dropped);
+    }
+}
+
+#else /* !CONFIG_EPOLL_CREATE1 */
+
+void slirp_lock(Slirp *slirp)
+{
+}
+
+void slirp_unlock(Slirp *slirp)
+{
+}
+
+void slirp_poll_mark(struct socket *so)
+{
+}
+
+void slirp_poll_forget(struct socket *so)
+{
+}
+
+bool slirp_can_output(Slirp *slirp)
+{
+    return true;
+}
+
+int slirp_thread_start(Slirp *slirp)
+{
+    return -1;
+}
+
+void slirp_thread_stop(Slirp *slirp)
+{
+}
+
+static void slirp_thread_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
+{
+}
+
+static void slirp_send_packet(Slirp *slirp, const uint8_t *pkt, int pkt_len)
+{
+    slirp_output(slirp->opaque, pkt, pkt_len);
+}
+
+void slirp_thread_info(Slirp *slirp, Monitor *mon)
+{
+}
+
+#endif /* !CONFIG_EPOLL_CREATE1 */
+
 static void arp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
 {
     struct slirp_arphdr *ah = (struct slirp_arphdr *)(pkt + ETH_HLEN);
@@ -965,7 +1568,7 @@ static void arp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
             rah->ar_sip = ah->ar_tip;
             memcpy(rah->ar_tha, ah->ar_sha, ETH_ALEN);
             rah->ar_tip = ah->ar_sip;
-            slirp_output(slirp->opaque, arp_reply, sizeof(arp_reply));
+            slirp_send_packet(slirp, arp_reply, sizeof(arp_reply));
         }
         break;
     case ARPOP_REPLY:
@@ -977,6 +1580,15 @@ static void arp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
 }
 
 void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
+{
+    if (slirp->thread) {
+        slirp_thread_input(slirp, pkt, pkt_len);
+        return;
+    }
+    slirp_input_packet(slirp, pkt, pkt_len);
+}
+
+static void slirp_input_packet(Slirp *slirp, const uint8_t *pkt, int pkt_len)
 {
     struct mbuf *m;
     int proto;
@@ -1061,7 +1673,7 @@ static int if_encap4(Slirp *slirp, struct mbuf *ifm, struct ethhdr *eh,
             /* target IP */
             rah->ar_tip = iph->ip_dst.s_addr;
             slirp->client_ipaddr = iph->ip_dst;
-            slirp_output(slirp->opaque, arp_req, sizeof(arp_req));
+            slirp_send_packet(slirp, arp_req, sizeof(arp_req));
             ifm->resolution_requested = true;
 
             /* Expire request and drop outgoing packet after 1 second */
@@ -1147,7 +1759,7 @@ int if_encap(Slirp *slirp, struct mbuf *ifm)
                 eh->h_dest[0], eh->h_dest[1], eh->h_dest[2],
                 eh->h_dest[3], eh->h_dest[4], eh->h_dest[5]));
     memcpy(buf + sizeof(struct ethhdr), ifm->m_data, ifm->m_len);
-    slirp_output(slirp->opaque, buf, ifm->m_len + ETH_HLEN);
+    slirp_send_packet(slirp, buf, ifm->m_len + ETH_HLEN);
     return 1;
 }
 
@@ -1161,6 +1773,7 @@ int slirp_remove_hostfwd(Slirp *slirp, int is_udp, struct in_addr host_addr,
     int port = htons(host_port);
     socklen_t addr_len;
 
+    slirp_lock(slirp);
     for (so = head->so_next; so != head; so = so->so_next) {
         addr_len = sizeof(addr);
         if ((so->so_state & SS_HOSTFWD) &&
@@ -1169,9 +1782,11 @@ int slirp_remove_hostfwd(Slirp *slirp, int is_udp, struct in_addr host_addr,
             addr.sin_port == port) {
             close(so->s);
             sofree(so);
+            slirp_unlock(slirp);
             return 0;
         }
     }
+    slirp_unlock(slirp);
 
     return -1;
 }
@@ -1179,24 +1794,28 @@ int slirp_remove_hostfwd(Slirp *slirp, int is_udp, struct in_addr host_addr,
 int slirp_add_hostfwd(Slirp *slirp, int is_udp, struct in_addr host_addr,
                       int host_port, struct in_addr guest_addr, int guest_port)
 {
+    struct socket *so;
+
     if (!guest_addr.s_addr) {
         guest_addr = slirp->vdhcp_startaddr;
     }
+    slirp_lock(slirp);
     if (is_udp) {
-        if (!udp_listen(slirp, host_addr.s_addr, htons(host_port),
-                        guest_addr.s_addr, htons(guest_port), SS_HOSTFWD))
-            return -1;
+        so = udp_listen(slirp, host_addr.s_addr, htons(host_port),
+                        guest_addr.s_addr, htons(guest_port), SS_HOSTFWD);
     } else {
-        if (!tcp_listen(slirp, host_addr.s_addr, htons(host_port),
-                        guest_addr.s_addr, htons(guest_port), SS_HOSTFWD))
-            return -1;
+        so = tcp_listen(slirp, host_addr.s_addr, htons(host_port),
+                        guest_addr.s_addr, htons(guest_port), SS_HOSTFWD);
     }
-    return 0;
+    slirp_unlock(slirp);
+    return so ? 0 : -1;
 }
 
 int slirp_add_exec(Slirp *slirp, int do_pty, const void *args,
                    struct in_addr *guest_addr, int guest_port)
 {
+    int ret;
+
     if (!guest_addr->s_addr) {
         guest_addr->s_addr = slirp->vnetwork_addr.s_addr |
             (htonl(0x0204) & ~slirp->vnetwork_mask.s_addr);
@@ -1207,8 +1826,11 @@ int slirp_add_exec(Slirp *slirp, int do_pty, const void *args,
         guest_addr->s_addr == slirp->vnameserver_addr.s_addr) {
         return -1;
     }
-    return add_exec(&slirp->exec_list, do_pty, (char *)args, *guest_addr,
-                    htons(guest_port));
+    slirp_lock(slirp);
+    ret = add_exec(&slirp->exec_list, do_pty, (char *)args, *guest_addr,
+                   htons(guest_port));
+    slirp_unlock(slirp);
+    return ret;
 }
 
 ssize_t slirp_send(struct socket *so, const void *buf, size_t len, int flags)
@@ -1240,33 +1862,35 @@ size_t slirp_socket_can_recv(Slirp *slirp, struct in_addr guest_addr,
 {
     struct iovec iov[2];
     struct socket *so;
+    size_t size = 0;
 
+    slirp_lock(slirp);
     so = slirp_find_ctl_socket(slirp, guest_addr, guest_port);
 
-    if (!so || so->so_state & SS_NOFDREF) {
-        return 0;
+    if (so && !(so->so_state & SS_NOFDREF) && CONN_CANFRCV(so) &&
+        so->so_snd.sb_cc < (so->so_snd.sb_datalen/2)) {
+        size = sopreprbuf(so, iov, NULL);
     }
+    slirp_unlock(slirp);
 
-    if (!CONN_CANFRCV(so) || so->so_snd.sb_cc >= (so->so_snd.sb_datalen/2)) {
-        return 0;
-    }
-
-    return sopreprbuf(so, iov, NULL);
+    return size;
 }
 
 void slirp_socket_recv(Slirp *slirp, struct in_addr guest_addr, int guest_port,
                        const uint8_t *buf, int size)
 {
     int ret;
-    struct socket *so = slirp_find_ctl_socket(slirp, guest_addr, guest_port);
-
-    if (!so)
-        return;
+    struct socket *so;
 
-    ret = soreadbuf(so, (const char *)buf, size);
+    slirp_lock(slirp);
+    so = slirp_find_ctl_socket(slirp, guest_addr, guest_port);
+    if (so) {
+        ret = soreadbuf(so, (const char *)buf, size);
 
-    if (ret > 0)
-        tcp_output(sototcpcb(so));
+        if (ret > 0)
+            tcp_output(sototcpcb(so));
+    }
+    slirp_unlock(slirp);
 }
 
 static void slirp_tcp_save(QEMUFile *f, struct tcpcb *tp)
@@ -1376,6 +2000,7 @@ static void slirp_state_save(QEMUFile *f, void *opaque)
     Slirp *slirp = opaque;
     struct ex_list *ex_ptr;
 
+    slirp_lock(slirp);
     for (ex_ptr = slirp->exec_list; ex_ptr; ex_ptr = ex_ptr->ex_next)
         if (ex_ptr->ex_pty == 3) {
             struct socket *so;
@@ -1392,6 +2017,7 @@ static void slirp_state_save(QEMUFile *f, void *opaque)
     qemu_put_be16(f, slirp->ip_id);
 
     slirp_bootp_save(f, slirp);
+    slirp_unlock(slirp);
 }
 
 static void slirp_tcp_load(QEMUFile *f, struct tcpcb *tp)
@@ -1522,9 +2148,8 @@ static void slirp_bootp_load(QEMUFile *f, Slirp *slirp)
     }
 }
 
-static int slirp_state_load(QEMUFile *f, void *opaque, int version_id)
+static int slirp_state_load_locked(QEMUFile *f, Slirp *slirp, int version_id)
 {
-    Slirp *slirp = opaque;
     struct ex_list *ex_ptr;
 
     while (qemu_get_byte(f)) {
@@ -1566,3 +2191,14 @@ static int slirp_state_load(QEMUFile *f, void *opaque, int version_id)
 
     return 0;
 }
+
+static int slirp_state_load(QEMUFile *f, void *opaque, int version_id)
+{
+    Slirp *slirp = opaque;
+    int ret;
+
+    slirp_lock(slirp);
+    ret = slirp_state_load_locked(f, slirp, version_id);
+    slirp_unlock(slirp);
+    return ret;
+}
@@ -152,6 +152,15 @@ bool ndp_table_search(Slirp *slirp, struct in6_addr ip_addr,
 
 #define SLIRP_MAX_DNS_SERVERS 4
 
+/* Socket lists, for the sockets polled by the stack thread */
+enum {
+    SLIRP_POLL_TCP,
+    SLIRP_POLL_UDP,
+    SLIRP_POLL_ICMP,
+};
+
+typedef struct SlirpThread SlirpThread;
+
 struct Slirp {
     QTAILQ_ENTRY(Slirp) entry;
     u_int time_fasttimo;
@@ -204,12 +213,14 @@ struct Slirp {
     /* tcp states */
     struct socket tcb;
     struct socket *tcp_last_so;
+    GHashTable *tcp_cache;
     tcp_seq tcp_iss;        /* tcp initial send seq # */
     uint32_t tcp_now;       /* for RFC 1323 timestamps */
 
     /* udp states */
     struct socket udb;
     struct socket *udp_last_so;
+    GHashTable *udp_cache;
 
     /* icmp states */
     struct socket icmp;
@@ -225,6 +236,9 @@ struct Slirp {
     GRand *grand;
     QEMUTimer *ra_timer;
 
+    /* stack thread, or NULL when running in the main loop */
+    SlirpThread *thread;
+
     void *opaque;
 };
 
@@ -236,6 +250,23 @@ extern Slirp *slirp_instance;
 
 void if_start(Slirp *);
 
+/* Serialize the callers from other threads with the stack thread, if any */
+void slirp_lock(Slirp *);
+void slirp_unlock(Slirp *);
+
+/* Return whether a packet can be output to the guest now */
+bool slirp_can_output(Slirp *);
+
+/* Have the stack thread update the events a socket is polled for, as
+ * its state or buffers changed */
+void slirp_poll_mark(struct socket *);
+
+/* Stop polling a socket that is being freed */
+void slirp_poll_forget(struct socket *);
+
+/* Print the state of the stack thread, if any */
+void slirp_thread_info(Slirp *, Monitor *);
+
 #ifndef _WIN32
 #include <netdb.h>
 #endif
@@ -17,10 +17,104 @@
 static void sofcantrcvmore(struct socket *so);
 static void sofcantsendmore(struct socket *so);
 
-struct socket *solookup(struct socket **last, struct socket *head,
-        struct sockaddr_storage *lhost, struct sockaddr_storage *fhost)
+static void sokey_set_addr(uint16_t *family, uint16_t *port, uint8_t *addr,
+        struct sockaddr_storage *ss)
+{
+    *family = ss->ss_family;
+    switch (ss->ss_family) {
+    case AF_INET:
+    {
+        struct sockaddr_in *sin = (struct sockaddr_in *) ss;
+        *port = sin->sin_port;
+        memcpy(addr, &sin->sin_addr, sizeof(sin->sin_addr));
+        break;
+    }
+    case AF_INET6:
+    {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ss;
+        *port = sin6->sin6_port;
+        memcpy(addr, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+        break;
+    }
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void sokey_init(struct sokey *key, struct sockaddr_storage *lhost,
+        struct sockaddr_storage *fhost)
+{
+    memset(key, 0, sizeof(*key));
+    sokey_set_addr(&key->lfamily, &key->lport, key->laddr, lhost);
+    if (fhost) {
+        sokey_set_addr(&key->ffamily, &key->fport, key->faddr, fhost);
+    }
+}
+
+static guint sokey_hash(gconstpointer v)
+{
+    const uint8_t *p = v;
+    guint32 h = 2166136261U;
+    size_t i;
+
+    /* FNV-1a */
+    for (i = 0; i < sizeof(struct sokey); i++) {
+        h = (h ^ p[i]) * 16777619U;
+    }
+    return h;
+}
+
+static gboolean sokey_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, sizeof(struct sokey));
+}
+
+/*
+ * Create a lookup cache for a socket list. The keys are the so_key of the
+ * sockets themselves, so it only holds references.
+ */
+GHashTable *socache_new(void)
+{
+    return g_hash_table_new(sokey_hash, sokey_equal);
+}
+
+static void socache_remove(struct socket *so)
+{
+    if (so->so_cache) {
+        g_hash_table_remove(so->so_cache, &so->so_key);
+        so->so_cache = NULL;
+    }
+}
+
+static void socache_insert(GHashTable *cache, struct socket *so,
+        const struct sokey *key)
+{
+    struct socket *old;
+
+    socache_remove(so);
+    old = g_hash_table_lookup(cache, key);
+    if (old) {
+        old->so_cache = NULL;
+    }
+    so->so_key = *key;
+    so->so_cache = cache;
+    g_hash_table_replace(cache, &so->so_key, so);
+}
+
+/*
+ * Find the socket of a list for a packet, by its local and foreign
+ * addresses, or only the local one if fhost is NULL. The cache maps the
+ * addresses to the socket found last time for them, so that looking up
+ * the socket of an established connection doesn't scan the list. As the
+ * addresses of a socket can change after it is cached, a cached socket
+ * is only returned if it still matches, and the list is scanned on a miss.
+ */
+struct socket *solookup(struct socket **last, GHashTable *cache,
+        struct socket *head, struct sockaddr_storage *lhost,
+        struct sockaddr_storage *fhost)
 {
     struct socket *so = *last;
+    struct sokey key;
 
     /* Optimisation */
     if (so != head && sockaddr_equal(&(so->lhost.ss), lhost)
@@ -28,9 +122,18 @@ struct socket *solookup(struct socket **last, struct socket *head,
         return so;
     }
 
+    sokey_init(&key, lhost, fhost);
+    so = g_hash_table_lookup(cache, &key);
+    if (so && sockaddr_equal(&(so->lhost.ss), lhost)
+            && (!fhost || sockaddr_equal(&so->fhost.ss, fhost))) {
+        *last = so;
+        return so;
+    }
+
     for (so = head->so_next; so != head; so = so->so_next) {
         if (sockaddr_equal(&(so->lhost.ss), lhost)
                 && (!fhost || sockaddr_equal(&so->fhost.ss, fhost))) {
+            socache_insert(cache, so, &key);
             *last = so;
             return so;
         }
@@ -56,6 +159,7 @@ socreate(Slirp *slirp)
     so->s = -1;
     so->slirp = slirp;
     so->pollfds_idx = -1;
+    so->poll_fd = -1;
   }
   return(so);
 }
@@ -82,6 +186,8 @@ sofree(struct socket *so)
   } else if (so == slirp->icmp_last_so) {
       slirp->icmp_last_so = &slirp->icmp;
   }
+  socache_remove(so);
+  slirp_poll_forget(so);
   m_free(so->so_m);
 
   if(so->so_next && so->so_prev)
@@ -164,6 +270,8 @@ soread(struct socket *so)
 	DEBUG_CALL("soread");
 	DEBUG_ARG("so = %p", so);
 
+	slirp_poll_mark(so);
+
 	/*
 	 * No need to check if there's enough room to read.
 	 * soread wouldn't have been called if there weren't
@@ -239,6 +347,8 @@ int soreadbuf(struct socket *so, const char *buf, int size)
 	DEBUG_CALL("soreadbuf");
 	DEBUG_ARG("so = %p", so);
 
+	slirp_poll_mark(so);
+
 	/*
 	 * No need to check if there's enough room to read.
 	 * soread wouldn't have been called if there weren't
@@ -323,6 +433,8 @@ sosendoob(struct socket *so)
 	DEBUG_ARG("so = %p", so);
 	DEBUG_ARG("sb->sb_cc = %d", sb->sb_cc);
 
+	slirp_poll_mark(so);
+
 	if (so->so_urgc > 2048)
 	   so->so_urgc = 2048; /* XXXX */
 
@@ -380,6 +492,8 @@ sowrite(struct socket *so)
 	DEBUG_CALL("sowrite");
 	DEBUG_ARG("so = %p", so);
 
+	slirp_poll_mark(so);
+
 	if (so->so_urgc) {
 		sosendoob(so);
 		if (sb->sb_cc == 0)
@@ -471,6 +585,8 @@ sorecvfrom(struct socket *so)
 	DEBUG_CALL("sorecvfrom");
 	DEBUG_ARG("so = %p", so);
 
+	slirp_poll_mark(so);
+
 	if (so->so_type == IPPROTO_ICMP) {   /* This is a "ping" reply */
 	  char buff[256];
 	  int len;
@@ -581,9 +697,9 @@ sorecvfrom(struct socket *so)
 	   */
 	    if (so->so_expire) {
 	      if (so->so_fport == htons(kDnsPort))
-		so->so_expire = curtime + SO_EXPIREFAST;
+		so->so_expire = atomic_read(&curtime) + SO_EXPIREFAST;
 	      else
-		so->so_expire = curtime + SO_EXPIRE;
+		so->so_expire = atomic_read(&curtime) + SO_EXPIRE;
 	    }
 
 	    /*
@@ -625,6 +741,8 @@ sosendto(struct socket *so, struct mbuf *m)
 	DEBUG_ARG("so = %p", so);
 	DEBUG_ARG("m = %p", m);
 
+	slirp_poll_mark(so);
+
 	addr = so->fhost.ss;
 	DEBUG_CALL(" sendto()ing)");
 	sotranslate_out(so, &addr);
@@ -641,7 +759,7 @@ sosendto(struct socket *so, struct mbuf *m)
 	 * but only if it's an expirable socket
 	 */
 	if (so->so_expire)
-		so->so_expire = curtime + SO_EXPIRE;
+		so->so_expire = atomic_read(&curtime) + SO_EXPIRE;
 	so->so_state &= SS_PERSISTENT_MASK;
 	so->so_state |= SS_ISFCONNECTED; /* So that it gets select()ed */
 	return 0;
@@ -678,6 +796,7 @@ tcp_listen(Slirp *slirp, uint32_t haddr, u_int hport, uint32_t laddr,
 		return NULL;
 	}
 	insque(so, &slirp->tcb);
+	slirp_poll_mark(so);
 
 	/*
 	 * SS_FACCEPTONCE sockets must time out.
@@ -737,6 +856,7 @@ soisfconnecting(struct socket *so)
 	so->so_state &= ~(SS_NOFDREF|SS_ISFCONNECTED|SS_FCANTRCVMORE|
 			  SS_FCANTSENDMORE|SS_FWDRAIN);
 	so->so_state |= SS_ISFCONNECTING; /* Clobber other states */
+	slirp_poll_mark(so);
 }
 
 void
@@ -744,6 +864,7 @@ soisfconnected(struct socket *so)
 {
 	so->so_state &= ~(SS_ISFCONNECTING|SS_FWDRAIN|SS_NOFDREF);
 	so->so_state |= SS_ISFCONNECTED; /* Clobber other states */
+	slirp_poll_mark(so);
 }
 
 static void
@@ -759,6 +880,7 @@ sofcantrcvmore(struct socket *so)
 	} else {
 	   so->so_state |= SS_FCANTRCVMORE;
 	}
+	slirp_poll_mark(so);
 }
 
 static void
@@ -774,6 +896,7 @@ sofcantsendmore(struct socket *so)
 	} else {
 	   so->so_state |= SS_FCANTSENDMORE;
 	}
+	slirp_poll_mark(so);
 }
 
 /*
@@ -11,6 +11,16 @@
 #define SO_EXPIRE 240000
 #define SO_EXPIREFAST 10000
 
+/*
+ * Addresses of a socket, as a lookup key: the local (guest) host, and
+ * optionally the foreign one, with unused bytes zeroed.
+ */
+struct sokey {
+  uint16_t lfamily, ffamily;
+  uint16_t lport, fport;
+  uint8_t laddr[16], faddr[16];
+};
+
 /*
  * Our socket structure
  */
@@ -21,6 +31,11 @@ struct socket {
   int s;                           /* The actual socket */
 
   int pollfds_idx;                 /* GPollFD GArray index */
+  int poll_fd;                     /* Descriptor in the epoll set, or -1 */
+  int poll_events;                 /* Its G_IO_* events in the set */
+  int poll_list;                   /* Its SLIRP_POLL_* socket list */
+  struct socket *poll_dirty_next;  /* Next socket marked to update */
+  struct socket **poll_dirty_prev; /* Link to it there, or NULL */
 
   Slirp *slirp;			   /* managing slirp instance */
 
@@ -70,6 +85,9 @@ struct socket {
   struct sbuf so_rcv;		/* Receive buffer */
   struct sbuf so_snd;		/* Send buffer */
   void * extra;			/* Extra pointer */
+
+  struct sokey so_key;		/* Key in so_cache, see solookup() */
+  GHashTable *so_cache;		/* Lookup cache it is in, or NULL */
 };
 
 
@@ -138,7 +156,8 @@ static inline socklen_t sockaddr_size(struct sockaddr_storage *a)
 
 const char* sockaddr_to_string(const struct sockaddr_storage* ss);
 
-struct socket *solookup(struct socket **, struct socket *,
+GHashTable *socache_new(void);
+struct socket *solookup(struct socket **, GHashTable *, struct socket *,
         struct sockaddr_storage *, struct sockaddr_storage *);
 struct socket *socreate(Slirp *);
 void sofree(struct socket *);
@@ -396,7 +396,12 @@ findso:
 	    g_assert_not_reached();
 	}
 
-	so = solookup(&slirp->tcp_last_so, &slirp->tcb, &lhost, &fhost);
+	so = solookup(&slirp->tcp_last_so, slirp->tcp_cache, &slirp->tcb,
+	               &lhost, &fhost);
+	if (so) {
+		/* The segment may change what the socket is polled for */
+		slirp_poll_mark(so);
+	}
 
 	/*
 	 * If the state is CLOSED (i.e., TCB does not exist) then
@@ -55,6 +55,7 @@ tcp_init(Slirp *slirp)
     slirp->tcp_iss = 1;		/* wrong */
     slirp->tcb.so_next = slirp->tcb.so_prev = &slirp->tcb;
     slirp->tcp_last_so = &slirp->tcb;
+    slirp->tcp_cache = socache_new();
 }
 
 void tcp_cleanup(Slirp *slirp)
@@ -62,6 +63,7 @@ void tcp_cleanup(Slirp *slirp)
     while (slirp->tcb.so_next != &slirp->tcb) {
         tcp_close(sototcpcb(slirp->tcb.so_next));
     }
+    g_hash_table_destroy(slirp->tcp_cache);
 }
 
 /*
@@ -547,6 +549,7 @@ tcp_attach(struct socket *so)
 	   return -1;
 
 	insque(so, &so->slirp->tcb);
+	slirp_poll_mark(so);
 
 	return 0;
 }
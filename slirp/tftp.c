@@ -34,7 +34,7 @@ static inline int tftp_session_in_use(struct tftp_session *spt)
 
 static inline void tftp_session_update(struct tftp_session *spt)
 {
-    spt->timestamp = curtime;
+    spt->timestamp = atomic_read(&curtime);
 }
 
 static void tftp_session_terminate(struct tftp_session *spt)
@@ -60,7 +60,7 @@ static int tftp_session_allocate(Slirp *slirp, struct sockaddr_storage *srcsas,
         goto found;
 
     /* sessions time out after 5 inactive seconds */
-    if ((int)(curtime - spt->timestamp) > 5000) {
+    if ((int)(atomic_read(&curtime) - spt->timestamp) > 5000) {
         tftp_session_terminate(spt);
         goto found;
     }
@@ -49,6 +49,7 @@ udp_init(Slirp *slirp)
 {
     slirp->udb.so_next = slirp->udb.so_prev = &slirp->udb;
     slirp->udp_last_so = &slirp->udb;
+    slirp->udp_cache = socache_new();
 }
 
 void udp_cleanup(Slirp *slirp)
@@ -56,6 +57,7 @@ void udp_cleanup(Slirp *slirp)
     while (slirp->udb.so_next != &slirp->udb) {
         udp_detach(slirp->udb.so_next);
     }
+    g_hash_table_destroy(slirp->udp_cache);
 }
 
 /* m->m_data  points at ip packet header
@@ -163,7 +165,8 @@ udp_input(register struct mbuf *m, int iphlen)
 	/*
 	 * Locate pcb for datagram.
 	 */
-	so = solookup(&slirp->udp_last_so, &slirp->udb, &lhost, NULL);
+	so = solookup(&slirp->udp_last_so, slirp->udp_cache, &slirp->udb,
+	              &lhost, NULL);
 
 	if (so == NULL) {
 	  /*
@@ -295,8 +298,9 @@ udp_attach(struct socket *so, unsigned short af)
 {
   so->s = qemu_socket(af, SOCK_DGRAM, 0);
   if (so->s != -1) {
-    so->so_expire = curtime + SO_EXPIRE;
+    so->so_expire = atomic_read(&curtime) + SO_EXPIRE;
     insque(so, &so->slirp->udb);
+    slirp_poll_mark(so);
   }
   return(so->s);
 }
@@ -369,8 +373,9 @@ udp_listen(Slirp *slirp, uint32_t haddr, u_int hport, uint32_t laddr,
 	    return NULL;
 	}
 	so->s = qemu_socket(AF_INET,SOCK_DGRAM,0);
-	so->so_expire = curtime + SO_EXPIRE;
+	so->so_expire = atomic_read(&curtime) + SO_EXPIRE;
 	insque(so, &slirp->udb);
+	slirp_poll_mark(so);
 
 	addr.sin_family = AF_INET;
 	addr.sin_addr.s_addr = haddr;
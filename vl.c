@@ -172,6 +172,7 @@ int main(int argc, char **argv)
 #include "android/camera/camera-service.h"
 #include "android/utils/streaming.h"
 
+#include "hw/audio/goldfish_audio.h"
 #include "hw/input/goldfish_events.h"
 
 
@@ -615,6 +616,11 @@ static void process_cmd_properties(void) {
         }
     }
 }
+
+static int write_snapshot_error(void* opaque, const char* buff, int len) {
+    fprintf(stderr, "%.*s", len, buff);
+    return len;
+}
 #endif  // CONFIG_ANDROID
 
 /**
@@ -3276,17 +3282,40 @@ static void RRndr_destroy(void *opaque)
     struct RRndrStream *st = opaque;
     RRndr_delete(st);
 }
+static void RRndr_tap(void *opaque, const void *buf, int size,
+                      int64_t timestamp_ns)
+{
+    struct RRndrStream *st = opaque;
+    RRndr_write_at(st, buf, size, timestamp_ns / 1000);
+}
 
 static int start_audio_capture(const char *path)
 {
     struct audsettings as;
     struct audio_capture_ops ops;
     CaptureVoiceOut *out;
-    struct RRndrStream *st = RRndr_create_audio(2, 44100, AUD_FMT_S16, path);
+    RRndrAudioConfig config;
+    struct RRndrStream *st;
+
+    const char *capture = getenv("AUDIO_CAPTURE");
+
+    RRndr_audio_config_from_env(&config);
+
+    /* Take the samples of the guest as they are, from the audio device. */
+    if (capture && !strcmp(capture, "direct")) {
+        config.freq     = GOLDFISH_AUDIO_FREQ;
+        config.channels = GOLDFISH_AUDIO_CHANNELS;
+        config.fmt      = AUD_FMT_S16;
+        st = RRndr_create_audio(&config, path);
+        goldfish_audio_set_tap(RRndr_tap, st);
+        return 0;
+    }
 
-    as.freq       = 44100;
-    as.nchannels  = 2;
-    as.fmt        = AUD_FMT_S16;
+    st = RRndr_create_audio(&config, path);
+
+    as.freq       = config.freq;
+    as.nchannels  = config.channels;
+    as.fmt        = config.fmt;
     as.endianness = 0;
 
     ops.notify  = RRndr_notify;
@@ -5334,9 +5363,18 @@ static int main_impl(int argc, char** argv)
     qemu_system_reset(VMRESET_SILENT);
     register_global_state();
     if (loadvm) {
+#ifdef CONFIG_ANDROID
+        // Android snapshots keep the RAM outside of the disks, so that it
+        // can be mapped back instead of read.
+        if (!gQAndroidVmOperations->snapshotLoad(loadvm, NULL,
+                                                 write_snapshot_error)) {
+            autostart = 0;
+        }
+#else
         if (load_vmstate(loadvm) < 0) {
             autostart = 0;
         }
+#endif  // CONFIG_ANDROID
     }
 
     qdev_prop_check_globals();